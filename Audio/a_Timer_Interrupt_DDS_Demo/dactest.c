@@ -22,14 +22,13 @@
 #include "hardware/irq.h"
 #include "hardware/spi.h"
 
-// Low-level alarm infrastructure we'll be using
-#define ALARM_NUM 0
-#define ALARM_IRQ timer_hardware_alarm_get_irq_num(timer_hw, ALARM_NUM)
+// Periodic alarm (deadline += period, so the sample rate doesn't drift)
+#include "alarm_service.h"
+struct periodic_alarm sample_alarm ;
 
 //DDS parameters
 #define two32 4294967296.0 // 2^32 
 #define Fs 50000
-#define DELAY 20 // 1/Fs (in microseconds)
 // the DDS units:
 volatile unsigned int phase_accum_main;
 volatile unsigned int phase_incr_main = (800.0*two32)/Fs ;
@@ -57,18 +56,12 @@ uint16_t DAC_data ; // output value
 #define sine_table_size 256
 volatile int sin_table[sine_table_size] ;
 
-// Alarm ISR
+// Alarm callback (the alarm service clears and re-arms the alarm)
 static void alarm_irq(void) {
 
     // Assert a GPIO when we enter the interrupt
     gpio_put(ISR_GPIO, 1) ;
 
-    // Clear the alarm irq
-    hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM);
-
-    // Reset the alarm register
-    timer_hw->alarm[ALARM_NUM] = timer_hw->timerawl + DELAY ;
-
 	// DDS phase and sine table lookup
 	phase_accum_main += phase_incr_main  ;
     DAC_data = (DAC_config_chan_A | ((sin_table[phase_accum_main>>24] + 2048) & 0xffff))  ;
@@ -109,17 +102,16 @@ int main() {
          sin_table[ii] = (int)(2047*sin((float)ii*6.283/(float)sine_table_size));
     }
 
-    // Enable the interrupt for the alarm (we're using Alarm 0)
-    hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM) ;
-    // Associate an interrupt handler with the ALARM_IRQ
-    irq_set_exclusive_handler(ALARM_IRQ, alarm_irq) ;
-    // Enable the alarm interrupt
-    irq_set_enabled(ALARM_IRQ, true) ;
-    // Write the lower 32 bits of the target time to the alarm register, arming it.
-    timer_hw->alarm[ALARM_NUM] = timer_hw->timerawl + DELAY ;
+    // Call alarm_irq at Fs, on this core, from whichever alarm is free
+    alarm_service_start(&sample_alarm, Fs, alarm_irq) ;
 
-    // Nothing happening here
+    // Once a second, how late the interrupt got in (us)
     while(1){
+        sleep_ms(1000) ;
+        printf("latency min %u max %u mean %.2f  missed %u\n",
+               (unsigned)sample_alarm.latency_min, (unsigned)sample_alarm.latency_max,
+               alarm_service_latency_mean(&sample_alarm), (unsigned)sample_alarm.missed) ;
+        alarm_service_reset_stats(&sample_alarm) ;
     }
     return 0;
 }
\ No newline at end of file
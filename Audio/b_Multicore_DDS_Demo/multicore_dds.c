@@ -16,8 +16,8 @@
 
     Note that globals are visible from both cores. Note also that GPIO
     pin mappings performed on core 0 can be utilized from core 1.
-    Creation of an alarm pool is required to force a timer interrupt to
-    take place on core 1 rather than core 0.
+    Each core starts its own periodic alarm (alarm_service.h), so each
+    timer interrupt takes place on the core that started it.
 
     GPIO 5 (pin 7) Chip select
     GPIO 6 (pin 9) SCK/spi0_sclk
@@ -49,16 +49,14 @@ typedef signed int fix15 ;
 #define char2fix15(a) (fix15)(((fix15)(a)) << 15)
 #define divfix(a,b) (fix15)( (((signed long long)(a)) << 15) / (b))
 
-// Alarm infrastructure that we'll be using
-#define ALARM_NUM_0 0
-#define ALARM_NUM_1 1
-#define ALARM_IRQ_0 timer_hardware_alarm_get_irq_num(timer_hw, ALARM_NUM_0)
-#define ALARM_IRQ_1 timer_hardware_alarm_get_irq_num(timer_hw, ALARM_NUM_1)
+// Periodic alarms, one per core (deadline += period, so no drift)
+#include "alarm_service.h"
+struct periodic_alarm alarm_0 ;
+struct periodic_alarm alarm_1 ;
 
 //DDS parameters
 #define two32 4294967296.0 // 2^32 
 #define Fs 50000
-#define DELAY 20 // 1/Fs (in microseconds)
 
 
 // the DDS units - core 1
@@ -140,12 +138,6 @@ static void alarm_irq_0(void) {
     // Assert GPIO for timing interrupt
     gpio_put(ISR_0, 1) ;
 
-    // Clear the alarm irq
-    hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM_0);
-
-    // Reset the alarm register
-    timer_hw->alarm[ALARM_NUM_0] = timer_hw->timerawl + DELAY ;
-
     if (STATE_0 == 0) {
         // DDS phase and sine table lookup
         phase_accum_main_0 += phase_incr_main_0  ;
@@ -200,12 +192,6 @@ static void alarm_irq_1(void) {
     // Assert GPIO for timing interrupt
     gpio_put(ISR_1, 1) ;
 
-    // Clear the alarm irq
-    hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM_1);
-
-    // Reset the alarm register
-    timer_hw->alarm[ALARM_NUM_1] = timer_hw->timerawl + DELAY ;
-
     if (STATE_1 == 0) {
         // DDS phase and sine table lookup
         phase_accum_main_1 += phase_incr_main_1  ;
@@ -257,14 +243,8 @@ static void alarm_irq_1(void) {
 
 void core1_entry() {
 
-    // Enable the interrupt for the alarm (we're using Alarm 1)
-    hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM_1) ;
-    // Associate an interrupt handler with the ALARM_IRQ
-    irq_set_exclusive_handler(ALARM_IRQ_1, alarm_irq_1) ;
-    // Enable the alarm interrupt
-    irq_set_enabled(ALARM_IRQ_1, true) ;
-    // Write the lower 32 bits of the target time to the alarm register, arming it.
-    timer_hw->alarm[ALARM_NUM_1] = timer_hw->timerawl + DELAY ;
+    // Call alarm_irq_1 at Fs, from an alarm interrupt on this core
+    alarm_service_start(&alarm_1, Fs, alarm_irq_1) ;
 
     while (1) {
 
@@ -274,7 +254,8 @@ void core1_entry() {
         for (int i=0; i<10; i++) {
             global_counter += 1 ;
             sleep_ms(250) ;
-            printf("Core 1: %d, ISR core: %d\n", global_counter, corenum_1) ;
+            printf("Core 1: %d, ISR core: %d, latency max: %u us\n", global_counter,
+                   corenum_1, (unsigned)alarm_1.latency_max) ;
         }
         printf("\n\n") ;
         // Unlock spinlock
@@ -337,14 +318,8 @@ int main() {
     // Desyncrhonize the beeps
     sleep_ms(500) ;
 
-     // Enable the interrupt for the alarm (we're using Alarm 1)
-    hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM_0) ;
-    // Associate an interrupt handler with the ALARM_IRQ
-    irq_set_exclusive_handler(ALARM_IRQ_0, alarm_irq_0) ;
-    // Enable the alarm interrupt
-    irq_set_enabled(ALARM_IRQ_0, true) ;
-    // Write the lower 32 bits of the target time to the alarm register, arming it.
-    timer_hw->alarm[ALARM_NUM_0] = timer_hw->timerawl + DELAY ;
+    // Call alarm_irq_0 at Fs, from an alarm interrupt on this core
+    alarm_service_start(&alarm_0, Fs, alarm_irq_0) ;
 
 
     while(1) {
@@ -355,7 +330,8 @@ int main() {
         for (int i=0; i<10; i++) {
             global_counter += 1 ;
             sleep_ms(250) ;
-            printf("Core 0: %d, ISR core: %d\n", global_counter, corenum_0) ;
+            printf("Core 0: %d, ISR core: %d, latency max: %u us\n", global_counter,
+                   corenum_0, (unsigned)alarm_0.latency_max) ;
         }
         printf("\n\n") ;
         // Unlock spinlock
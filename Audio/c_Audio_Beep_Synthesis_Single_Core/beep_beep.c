@@ -24,9 +24,9 @@
 // Include protothreads
 #include "pt_cornell_rp2040_v1_4.h"
 
-// Low-level alarm infrastructure we'll be using
-#define ALARM_NUM 0
-#define ALARM_IRQ timer_hardware_alarm_get_irq_num(timer_hw, ALARM_NUM)
+// Periodic alarm (deadline += period, so the sample rate doesn't drift)
+#include "alarm_service.h"
+struct periodic_alarm sample_alarm ;
 
 // Macros for fixed-point arithmetic (faster than floating point)
 typedef signed int fix15 ;
@@ -42,7 +42,6 @@ typedef signed int fix15 ;
 //Direct Digital Synthesis (DDS) parameters
 #define two32 4294967296.0  // 2^32 (a constant)
 #define Fs 50000
-#define DELAY 20 // 1/Fs (in microseconds)
 
 // the DDS units - core 0
 // Phase accumulator and phase increment. Increment sets output frequency.
@@ -103,12 +102,6 @@ static void alarm_irq(void) {
     // Assert a GPIO when we enter the interrupt
     gpio_put(ISR_GPIO, 1) ;
 
-    // Clear the alarm irq
-    hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM);
-
-    // Reset the alarm register
-    timer_hw->alarm[ALARM_NUM] = timer_hw->timerawl + DELAY ;
-
     if (STATE_0 == 0) {
         // DDS phase and sine table lookup
         phase_accum_main_0 += phase_incr_main_0  ;
@@ -218,14 +211,8 @@ int main() {
          sin_table[ii] = float2fix15(2047*sin((float)ii*6.283/(float)sine_table_size));
     }
 
-    // Enable the interrupt for the alarm (we're using Alarm 0)
-    hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM) ;
-    // Associate an interrupt handler with the ALARM_IRQ
-    irq_set_exclusive_handler(ALARM_IRQ, alarm_irq) ;
-    // Enable the alarm interrupt
-    irq_set_enabled(ALARM_IRQ, true) ;
-    // Write the lower 32 bits of the target time to the alarm register, arming it.
-    timer_hw->alarm[ALARM_NUM] = timer_hw->timerawl + DELAY ;
+    // Call alarm_irq at Fs, from an alarm interrupt on core 0
+    alarm_service_start(&sample_alarm, Fs, alarm_irq) ;
 
     // Add core 0 threads
     pt_add_thread(protothread_core_0) ;
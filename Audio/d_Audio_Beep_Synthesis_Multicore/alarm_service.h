@@ -0,0 +1,251 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Periodic alarms from the hardware timer, without drift
+ *
+ * The usual way to get a sample-rate interrupt out of the timer is to
+ * re-arm the alarm from its own interrupt:
+ *
+ *   timer_hw->alarm[N] = timer_hw->timerawl + DELAY ;
+ *
+ * Every period is then DELAY plus however long the interrupt took to get
+ * in, which depends on whatever else was running. The rate comes out low,
+ * and it wanders. Here each alarm keeps an absolute deadline and moves it
+ * on by exactly one period every time:
+ *
+ *   deadline += period
+ *
+ * Entry latency still moves single samples around (jitter), but it never
+ * adds up (drift). Periods carry a 16-bit fraction of a microsecond, so a
+ * rate that doesn't divide 1 MHz (44.1 kHz, say) is right on average too.
+ * A callback that comes in more than a period late is run again straight
+ * away to catch up, unless it is more than ALARM_SERVICE_CATCH_UP periods
+ * behind, in which case those deadlines are skipped and counted.
+ *
+ * Alarms are claimed from the SDK, so demos can be put together in one
+ * image without two of them grabbing alarm 0, and they stay clear of the
+ * alarm the SDK uses for sleep_ms() and friends. The interrupt is enabled
+ * on the core that calls alarm_service_start(), and the callback runs
+ * there, so each core can have its own.
+ *
+ * Each alarm keeps entry latency statistics (deadline to the start of the
+ * interrupt, in us): last, smallest, largest and mean. The jitter of the
+ * sample instants is largest - smallest.
+ *
+ * If the CPU doesn't need to be involved in every sample, a DMA channel
+ * paced by a DMA timer has no jitter at all. alarm_service_dma_timer()
+ * sets one up as close to a rate as its X/Y fraction of clk_sys can get.
+ *
+ * RESOURCES USED
+ *  - 1 hardware alarm and its TIMER_IRQ per periodic alarm (claimed)
+ *  - 1 DMA timer per alarm_service_dma_timer() (claimed)
+ */
+
+#include <math.h>
+#include "hardware/timer.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Periods a callback can fall behind before deadlines are skipped
+#ifndef ALARM_SERVICE_CATCH_UP
+#define ALARM_SERVICE_CATCH_UP  4
+#endif
+// Hardware alarms on the RP2040
+#define ALARM_SERVICE_ALARMS    4
+
+// Called once per period, from the alarm interrupt
+typedef void (*alarm_service_fn)(void) ;
+
+struct periodic_alarm {
+    int num ;                               // hardware alarm (-1 when stopped)
+    uint32_t period ;                       // whole microseconds
+    uint32_t period_frac ;                  // and 1/65536ths of one
+    uint32_t frac ;                         // fraction carried so far
+    uint32_t deadline ;                     // next deadline (timerawl)
+    alarm_service_fn fn ;
+    volatile uint32_t count ;               // callbacks
+    volatile uint32_t missed ;              // deadlines skipped
+    volatile uint32_t latency ;             // entry latency, last (us)
+    volatile uint32_t latency_min ;
+    volatile uint32_t latency_max ;
+    volatile uint32_t latency_sum ;
+    volatile uint32_t latency_count ;
+    volatile bool reset_request ;           // clear statistics, next interrupt
+} ;
+
+static struct periodic_alarm * alarm_service_slot[ALARM_SERVICE_ALARMS] ;
+
+// One period on from the last deadline
+static inline void alarm_service_advance(struct periodic_alarm * a) {
+    a->frac += a->period_frac ;
+    a->deadline += a->period + (a->frac >> 16) ;
+    a->frac &= 0xffff ;
+}
+
+static void alarm_service_dispatch(int num) {
+    struct periodic_alarm * a = alarm_service_slot[num] ;
+    uint32_t mask = 1u << num ;
+    uint32_t late = timer_hw->timerawl - a->deadline ;
+    uint32_t behind ;
+
+    // Clear the alarm irq (and the forced one, if we were catching up)
+    hw_clear_bits(&timer_hw->intr, mask) ;
+    hw_clear_bits(&timer_hw->intf, mask) ;
+
+    // Statistics
+    if (a->reset_request) {
+        a->latency_min = 0xffffffff ;
+        a->latency_max = 0 ;
+        a->latency_sum = 0 ;
+        a->latency_count = 0 ;
+        a->missed = 0 ;
+        a->reset_request = false ;
+    }
+    a->latency = late ;
+    if (late < a->latency_min) a->latency_min = late ;
+    if (late > a->latency_max) a->latency_max = late ;
+    a->latency_sum += late ;
+    a->latency_count++ ;
+
+    // Next deadline. The alarm only fires when the timer equals it, so one
+    // already in the past would wait for the timer to wrap (71 minutes).
+    // If the timer passes it before it fires (still armed), go again now,
+    // or skip ahead if we're too far behind. Skipping ahead can itself be
+    // overtaken (a higher priority interrupt in between), so it goes round
+    // the same check again.
+    alarm_service_advance(a) ;
+    timer_hw->alarm[num] = a->deadline ;
+    behind = timer_hw->timerawl - a->deadline ;
+    while ((int32_t)behind >= 0 && (timer_hw->armed & mask)) {
+        if (behind < ALARM_SERVICE_CATCH_UP * a->period) {
+            timer_hw->armed = mask ;
+            hw_set_bits(&timer_hw->intf, mask) ;
+            break ;
+        }
+        while ((int32_t)(timer_hw->timerawl + 2 - a->deadline) >= 0) {
+            alarm_service_advance(a) ;
+            a->missed++ ;
+        }
+        timer_hw->alarm[num] = a->deadline ;
+        behind = timer_hw->timerawl - a->deadline ;
+    }
+
+    a->count++ ;
+    a->fn() ;
+}
+
+static void alarm_service_irq_0(void) { alarm_service_dispatch(0) ; }
+static void alarm_service_irq_1(void) { alarm_service_dispatch(1) ; }
+static void alarm_service_irq_2(void) { alarm_service_dispatch(2) ; }
+static void alarm_service_irq_3(void) { alarm_service_dispatch(3) ; }
+
+static const irq_handler_t alarm_service_handler[ALARM_SERVICE_ALARMS] = {
+    alarm_service_irq_0, alarm_service_irq_1, alarm_service_irq_2, alarm_service_irq_3
+} ;
+
+// Call fn() rate_hz times a second, from an alarm interrupt on the calling
+// core. The first call is one period from now. Returns the hardware alarm.
+int alarm_service_start(struct periodic_alarm * a, uint32_t rate_hz, alarm_service_fn fn) {
+    // Period in 1/65536ths of a microsecond, rounded
+    uint64_t period = (((uint64_t)1000000 << 16) + rate_hz / 2) / rate_hz ;
+    int num = hardware_alarm_claim_unused(true) ;
+    uint irq = timer_hardware_alarm_get_irq_num(timer_hw, num) ;
+
+    a->num = num ;
+    a->period = (uint32_t)(period >> 16) ;
+    a->period_frac = (uint32_t)(period & 0xffff) ;
+    a->frac = 0 ;
+    a->fn = fn ;
+    a->count = 0 ;
+    a->latency = 0 ;
+    a->reset_request = true ;
+    alarm_service_slot[num] = a ;
+
+    // Enable the interrupt for the alarm, on this core
+    hw_set_bits(&timer_hw->inte, 1u << num) ;
+    irq_set_exclusive_handler(irq, alarm_service_handler[num]) ;
+    irq_set_enabled(irq, true) ;
+
+    // Arm it
+    a->deadline = timer_hw->timerawl ;
+    alarm_service_advance(a) ;
+    timer_hw->alarm[num] = a->deadline ;
+    return num ;
+}
+
+// Stop an alarm and give it back. Call it on the core that started it.
+void alarm_service_stop(struct periodic_alarm * a) {
+    uint irq ;
+    if (a->num < 0) return ;
+    irq = timer_hardware_alarm_get_irq_num(timer_hw, a->num) ;
+    irq_set_enabled(irq, false) ;
+    hw_clear_bits(&timer_hw->inte, 1u << a->num) ;
+    timer_hw->armed = 1u << a->num ;
+    hw_clear_bits(&timer_hw->intr, 1u << a->num) ;
+    hw_clear_bits(&timer_hw->intf, 1u << a->num) ;
+    irq_remove_handler(irq, alarm_service_handler[a->num]) ;
+    alarm_service_slot[a->num] = NULL ;
+    hardware_alarm_unclaim(a->num) ;
+    a->num = -1 ;
+}
+
+// Clear the statistics (done in the interrupt, so safe from either core)
+static inline void alarm_service_reset_stats(struct periodic_alarm * a) {
+    a->reset_request = true ;
+}
+
+// Mean entry latency (us) since the statistics were cleared
+static inline float alarm_service_latency_mean(struct periodic_alarm * a) {
+    uint32_t n = a->latency_count ;
+    return n ? (float)a->latency_sum / n : 0 ;
+}
+
+// Claim a DMA timer and set it as close to rate_hz as clk_sys * X / Y
+// (X and Y 16 bits, X <= Y) can get, from the continued fraction of
+// rate_hz / clk_sys. Pace a channel with dma_get_timer_dreq(). The rate it
+// got goes in *actual_hz (if not NULL). The slowest is clk_sys / 65535.
+int alarm_service_dma_timer(float rate_hz, float * actual_hz) {
+    double clk = (double)clock_get_hz(clk_sys) ;
+    double x = rate_hz / clk, a ;
+    uint32_t p0 = 0, q0 = 1, p1 = 1, q1 = 0, p2, q2, k ;
+    int timer = dma_claim_unused_timer(true) ;
+
+    if (x >= 1) {
+        p1 = q1 = 1 ;
+    }
+    else {
+        // Convergents p/q until q outgrows 16 bits, then the best
+        // semiconvergent between the last two
+        while (1) {
+            a = (double)(uint32_t)x ;
+            if (a * q1 + q0 > 0xffff) {
+                k = (0xffff - q0) / q1 ;
+                p2 = k * p1 + p0 ;
+                q2 = k * q1 + q0 ;
+                if (fabs((double)p2 / q2 - rate_hz / clk) < fabs((double)p1 / q1 - rate_hz / clk)) {
+                    p1 = p2 ;
+                    q1 = q2 ;
+                }
+                break ;
+            }
+            p2 = (uint32_t)a * p1 + p0 ;
+            q2 = (uint32_t)a * q1 + q0 ;
+            p0 = p1 ; q0 = q1 ;
+            p1 = p2 ; q1 = q2 ;
+            if (x - a < 1e-12) break ;
+            x = 1.0 / (x - a) ;
+        }
+        if (p1 == 0) {
+            p1 = 1 ;
+            q1 = 0xffff ;
+        }
+    }
+
+    dma_timer_set_fraction(timer, (uint16_t)p1, (uint16_t)q1) ;
+    if (actual_hz) *actual_hz = (float)(clk * p1 / q1) ;
+    return timer ;
+}
@@ -15,8 +15,8 @@
 
     Note that globals are visible from both cores. Note also that GPIO
     pin mappings performed on core 0 can be utilized from core 1.
-    Creation of an alarm pool is required to force a timer interrupt to
-    take place on core 1 rather than core 0.
+    Each core starts its own periodic alarm (alarm_service.h), so each
+    timer interrupt takes place on the core that started it.
 
  */
 
@@ -43,16 +43,14 @@ typedef signed int fix15 ;
 #define char2fix15(a) (fix15)(((fix15)(a)) << 15)
 #define divfix(a,b) (fix15)( (((signed long long)(a)) << 15) / (b))
 
-// Alarm infrastructure that we'll be using
-#define ALARM_NUM_0 0
-#define ALARM_NUM_1 1
-#define ALARM_IRQ_0 timer_hardware_alarm_get_irq_num(timer_hw, ALARM_NUM_0)
-#define ALARM_IRQ_1 timer_hardware_alarm_get_irq_num(timer_hw, ALARM_NUM_1)
+// Periodic alarms, one per core (deadline += period, so no drift)
+#include "alarm_service.h"
+struct periodic_alarm alarm_0 ;
+struct periodic_alarm alarm_1 ;
 
 //DDS parameters
 #define two32 4294967296.0 // 2^32 
 #define Fs 50000
-#define DELAY 20 // 1/Fs (in microseconds)
 
 // the DDS units - core 1
 // Phase accumulator and phase increment. Increment sets output frequency.
@@ -132,12 +130,6 @@ static void alarm_irq_1(void) {
     // Assert GPIO for timing interrupt
     gpio_put(ISR_1, 1) ;
 
-    // Clear the alarm irq
-    hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM_1);
-
-    // Reset the alarm register
-    timer_hw->alarm[ALARM_NUM_1] = timer_hw->timerawl + DELAY ;
-
 
     if (STATE_1 == 0) {
         // DDS phase and sine table lookup
@@ -191,12 +183,6 @@ static void alarm_irq_0(void) {
     // Assert GPIO for timing interrupt
     gpio_put(ISR_0, 1) ;
 
-    // Clear the alarm irq
-    hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM_0);
-
-    // Reset the alarm register
-    timer_hw->alarm[ALARM_NUM_0] = timer_hw->timerawl + DELAY ;
-
     if (STATE_0 == 0) {
         // DDS phase and sine table lookup
         phase_accum_main_0 += phase_incr_main_0  ;
@@ -248,15 +234,18 @@ static PT_THREAD (protothread_core_1(struct pt *pt))
 {
     // Indicate thread beginning
     PT_BEGIN(pt) ;
+    // locals must be static to survive a yield
+    static int i ;
     while(1) {
         // Wait for signal
         PT_SEM_SDK_WAIT(pt, &core_1_go) ;
         // Turn off LED
         gpio_put(LED, 0) ;
         // Increment global counter variable
-        for (int i=0; i<10; i++) {
+        for (i=0; i<10; i++) {
             global_counter += 1 ;
-            sleep_ms(250) ;
+            // yield, rather than stall every thread on this core
+            PT_YIELD_usec(250000) ;
             printf("Core 1: %d, ISR core: %d\n", global_counter, corenum_1) ;
         }
         printf("\n\n") ;
@@ -272,15 +261,18 @@ static PT_THREAD (protothread_core_0(struct pt *pt))
 {
     // Indicate thread beginning
     PT_BEGIN(pt) ;
+    // locals must be static to survive a yield
+    static int i ;
     while(1) {
         // Wait for signal
         PT_SEM_SDK_WAIT(pt, &core_0_go) ;
         // Turn on LED
         gpio_put(LED, 1) ;
         // Increment global counter variable
-        for (int i=0; i<10; i++) {
+        for (i=0; i<10; i++) {
             global_counter += 1 ;
-            sleep_ms(250) ;
+            // yield, rather than stall every thread on this core
+            PT_YIELD_usec(250000) ;
             printf("Core 0: %d, ISR core: %d\n", global_counter, corenum_0) ;
         }
         printf("\n\n") ;
@@ -295,14 +287,8 @@ static PT_THREAD (protothread_core_0(struct pt *pt))
 // This is the core 1 entry point. Essentially main() for core 1
 void core1_entry() {
 
-    // Enable the interrupt for the alarm (we're using Alarm 1)
-    hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM_1) ;
-    // Associate an interrupt handler with the ALARM_IRQ
-    irq_set_exclusive_handler(ALARM_IRQ_1, alarm_irq_1) ;
-    // Enable the alarm interrupt
-    irq_set_enabled(ALARM_IRQ_1, true) ;
-    // Write the lower 32 bits of the target time to the alarm register, arming it.
-    timer_hw->alarm[ALARM_NUM_1] = timer_hw->timerawl + DELAY ;
+    // Call alarm_irq_1 at Fs, from an alarm interrupt on this core
+    alarm_service_start(&alarm_1, Fs, alarm_irq_1) ;
 
     // Add thread to core 1
     pt_add_thread(protothread_core_1) ;
@@ -362,14 +348,8 @@ int main() {
     sleep_ms(500) ;
 
     
-     // Enable the interrupt for the alarm (we're using Alarm 1)
-    hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM_0) ;
-    // Associate an interrupt handler with the ALARM_IRQ
-    irq_set_exclusive_handler(ALARM_IRQ_0, alarm_irq_0) ;
-    // Enable the alarm interrupt
-    irq_set_enabled(ALARM_IRQ_0, true) ;
-    // Write the lower 32 bits of the target time to the alarm register, arming it.
-    timer_hw->alarm[ALARM_NUM_0] = timer_hw->timerawl + DELAY ;
+    // Call alarm_irq_0 at Fs, from an alarm interrupt on this core
+    alarm_service_start(&alarm_0, Fs, alarm_irq_0) ;
 
     // Add core 0 threads
     pt_add_thread(protothread_core_0) ;
@@ -91,12 +91,13 @@ DrawPixel is faster
 // Pixel color array that is DMAed to the PIO machines and
 // a pointer to the ADDRESS of this color array.
 // Note that this array is automatically initialized to all 0's (black)
-unsigned char vga_buffer_0[VGA_BUFFER_COUNT];
+// Word aligned: the FFT waterfall scrolls and writes it a word at a time
+unsigned char vga_buffer_0[VGA_BUFFER_COUNT] __attribute__((aligned(4)));
 char * pointer_vga_buffer_0 = &vga_buffer_0[0] ;
 //
 // only define second buffer if necessary
 #ifndef DOUBLE_BUFFER_NONE
-  unsigned char vga_buffer_1[VGA_BUFFER_COUNT];
+  unsigned char vga_buffer_1[VGA_BUFFER_COUNT] __attribute__((aligned(4)));
   char * pointer_vga_buffer_1 = &vga_buffer_1[0] ;
 #endif
 //
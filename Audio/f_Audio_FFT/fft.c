@@ -4,7 +4,39 @@
  * This demonstration calculates an FFT of audio input, and
  * then displays that FFT on a 640x480 VGA display.
  * 
- * Core 0 computes and displays the FFT. Core 1 blinks the LED.
+ * The work is pipelined across the two cores:
+ *  - Core 1 windows each frame of samples and computes its FFT
+ *    (and blinks the LED).
+ *  - Core 0 computes magnitudes, smooths them, finds the peak and
+ *    draws the spectrum.
+ * Finished spectra pass from core 1 to core 0 through a lock-free
+ * single-producer/single-consumer queue of NUM_FRAMES slots, so each
+ * core works on a different frame at the same time.
+ *
+ * Capture is continuous, through the input stage in audio_input.h: the
+ * ADC runs free at 500 ksps with 12-bit samples, and each DMA block is
+ * decimated to Fs (CIC and FIR filters), DC-blocked and gain-controlled
+ * in an interrupt on core 0, into a ring of samples. Consecutive FFT
+ * frames overlap by 0, 50 or 75% (OVERLAP_LOG2). Frames the pipeline
+ * could not keep up with are counted, not hidden.
+ *
+ * Window functions: Hann, Blackman-Harris or flat-top (WINDOW_TYPE),
+ * scaled to the same coherent gain so the display does not change
+ * height. The peak frequency is interpolated between bins by fitting
+ * a parabola to the log magnitudes of the three bins at the peak.
+ *
+ * Two displays (WATERFALL):
+ *  - Bar graph. Only the part of each bar that changed is redrawn.
+ *  - Scrolling spectrogram. Each frame becomes one row of 512 pixels,
+ *    colored from a 16-entry palette on a dB (or linear) scale, with a
+ *    linear or logarithmic frequency axis. A DMA channel moves the
+ *    waterfall up one row in the framebuffer, and the new row is
+ *    written at the bottom a word (8 pixels) at a time.
+ *
+ * The FFT is the real-input, radix-4, block-floating-point fft_real()
+ * from fft_fix.h. The original radix-2 FFTfix() is kept for comparison:
+ * with FFT_BENCHMARK set, both are timed at startup and the results are
+ * printed on the serial port.
  *
  * HARDWARE CONNECTIONS
  *  - GPIO 16 ---> VGA Hsync
@@ -18,8 +50,8 @@
  *
  * RESOURCES USED
  *  - PIO state machines 0, 1, and 2 on PIO instance 0
- *  - DMA channels 0, 1, 2, and 3
- *  - ADC channel 0
+ *  - DMA channels 0, 1, 2, and 3 (and 4 for the waterfall scroll)
+ *  - ADC channel 0, free running at 500 ksps
  *  - 153.6 kBytes of RAM (for pixel color data)
  *
  */
@@ -39,6 +71,8 @@
 #include "hardware/dma.h"
 #include "hardware/adc.h"
 #include "hardware/irq.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
 // Include protothreads
 #include "pt_cornell_rp2040_v1_4.h"
 
@@ -67,14 +101,57 @@ typedef signed int fix15 ;
 #define SHIFT_AMOUNT 6
 // Log2 number of samples
 #define LOG2_NUM_SAMPLES 10
-// Sample rate (Hz)
-#define Fs 10000.0
-// ADC clock rate (unmutable!)
-#define ADCCLK 48000000.0
-
-// DMA channels for sampling ADC
-int sample_chan ;
-int control_chan ;
+// Sample rate (Hz): 500 ksps decimated by 25 (CIC) and 2 (FIR)
+#define INPUT_CIC_DECIMATE 25
+#define INPUT_FIR_DECIMATE 2
+#define Fs ((float)INPUT_FS)
+
+// Overlap between consecutive FFT frames: 0 (none), 1 (50%), 2 (75%)
+#define OVERLAP_LOG2 1
+#define HOP_SAMPLES (NUM_SAMPLES >> OVERLAP_LOG2)
+
+// Window function
+#define WINDOW_HANN             0
+#define WINDOW_BLACKMAN_HARRIS  1
+#define WINDOW_FLAT_TOP         2
+#define WINDOW_TYPE WINDOW_HANN
+
+// Spectrum smoothing, avg += (new - avg) >> SMOOTH_SHIFT (0 is off)
+#define SMOOTH_SHIFT 2
+
+// Spectra in flight between core 1 and core 0 (power of 2)
+#define NUM_FRAMES 4
+
+// Display: 0 for the bar graph, 1 for the scrolling spectrogram
+#define WATERFALL 0
+// Waterfall frequency axis: 0 linear (one bin per column), 1 logarithmic
+#define WF_LOG_FREQ 1
+// Waterfall intensity: 1 for dB (WF_DB_PER_LEVEL per color), 0 for linear
+#define WF_DB 1
+#define WF_DB_PER_LEVEL 5
+// log2 of the magnitude (fix15) shown in the brightest color
+#define WF_TOP_LOG2 21
+// Waterfall area: 512 pixels (64 words) wide, rows WF_TOP to 479
+#define WF_X0 64
+#define WF_WIDTH 512
+#define WF_TOP 50
+
+// Time FFTfix against fft_real at startup (serial output)
+#ifndef FFT_BENCHMARK
+#define FFT_BENCHMARK 0
+#endif
+
+// Real-input fixed-point FFT, same length as the capture buffers
+#define FFT_LOG2_N LOG2_NUM_SAMPLES
+#include "fft_fix.h"
+
+// Audio input stage (ADC, decimation, DC blocker, AGC). Its ring holds
+// 4 frames of samples.
+#include "audio_input.h"
+
+// First sample of the next FFT frame, and frames skipped (core 1)
+uint32_t frame_start = 0 ;
+volatile uint32_t dropped_count = 0 ;
 
 // Max and min macros
 #define max(a,b) ((a>b)?a:b)
@@ -83,19 +160,49 @@ int control_chan ;
 // 0.4 in fixed point (used for alpha max plus beta min)
 fix15 zero_point_4 = float2fix15(0.4) ;
 
-// Here's where we'll have the DMA channel put ADC samples
-uint8_t sample_array[NUM_SAMPLES] ;
-// And here's where we'll copy those samples for FFT calculation
+// The input stage may have this many samples that the FFT has not used
+// yet before it overwrites them
+#define CAPTURE_SLACK (INPUT_RING - INPUT_BLOCK)
+#if FFT_BENCHMARK
+// Used by the FFTfix benchmark
 fix15 fr[NUM_SAMPLES] ;
 fix15 fi[NUM_SAMPLES] ;
-
-// Sine table for the FFT calculation
-fix15 Sinewave[NUM_SAMPLES]; 
-// Hann window table for FFT calculation
+#endif
+
+// Spectrum queue from core 1 to core 0. Core 1 only writes frame_head,
+// core 0 only writes frame_tail, so no lock is needed.
+fix15 frame_spectrum[NUM_FRAMES][NUM_SAMPLES] ;
+int frame_scale[NUM_FRAMES] ;
+volatile uint32_t frame_head = 0 ;
+volatile uint32_t frame_tail = 0 ;
+
+// Smoothed magnitudes (core 0)
+fix15 magnitude[NUM_SAMPLES>>1] ;
+
+// Bar heights currently on screen
+short bar_height[NUM_SAMPLES>>1] ;
+
+// The VGA framebuffer (2 pixels per byte, even pixel in the low nibble)
+extern char * current_draw_buffer ;
+// DMA channel that scrolls the waterfall
+int scroll_chan ;
+dma_channel_config scroll_config ;
+// First bin of each waterfall column (log or linear axis)
+uint16_t waterfall_bin[WF_WIDTH + 1] ;
+// Waterfall row being built, 8 pixels per word
+uint32_t waterfall_row[WF_WIDTH / 8] ;
+// Waterfall palette, weakest to strongest
+const char waterfall_lut[16] = {
+    BLACK, DARK_BLUE, BLUE, LIGHT_BLUE, CYAN, DARK_GREEN, MED_GREEN, GREEN,
+    YELLOW, ORANGE, DARK_ORANGE, RED, MAGENTA, PINK, LIGHT_PINK, WHITE
+} ;
+
+// Window table for FFT calculation
 fix15 window[NUM_SAMPLES]; 
 
-// Pointer to address of start of sample buffer
-uint8_t * sample_address_pointer = &sample_array[0] ;
+#if FFT_BENCHMARK
+// Sine table for the FFTfix calculation
+fix15 Sinewave[NUM_SAMPLES]; 
 
 // Peforms an in-place FFT. For more information about how this
 // algorithm works, please see https://vanhunteradams.com/FFT/FFT.html
@@ -183,17 +290,119 @@ void FFTfix(fix15 fr[], fix15 fi[]) {
         L = istep ;
     }
 }
+#endif
 
-// Runs on core 0
+// Runs on core 1: window each frame and compute its FFT
 static PT_THREAD (protothread_fft(struct pt *pt))
 {
     // Indicate beginning of thread
     PT_BEGIN(pt) ;
     printf("Starting capture\n") ;
-    // Start the ADC channel
-    dma_start_channel_mask((1u << sample_chan)) ;
-    // Start the ADC
-    adc_run(true) ;
+    // Start the ADC and its DMA
+    input_start() ;
+
+    static fix15 * spectrum ;       // queue slot being filled
+    static uint32_t captured ;      // samples captured so far
+    static int i ;                  // incrementing loop variable
+
+    while(1) {
+        // Wait until the whole frame has been captured
+        PT_YIELD_UNTIL(pt, (input_count - frame_start) >= NUM_SAMPLES) ;
+
+        // Fell so far behind that the input stage is overwriting this
+        // frame: skip to the newest complete one
+        captured = input_count ;
+        if ((captured - frame_start) > CAPTURE_SLACK) {
+            dropped_count += (captured - NUM_SAMPLES - frame_start) / HOP_SAMPLES ;
+            frame_start = captured - NUM_SAMPLES ;
+        }
+
+        // Wait for a free slot in the queue
+        PT_YIELD_UNTIL(pt, (frame_head - frame_tail) < NUM_FRAMES) ;
+        spectrum = frame_spectrum[frame_head & (NUM_FRAMES - 1)] ;
+
+        // Copy/window elements into a fixed-point array. Samples are
+        // +/-1.0, scaled by 128 to the range of the old 8-bit samples
+        // so the display keeps its calibration.
+        for (i=0; i<NUM_SAMPLES; i++) {
+            spectrum[i] = multfix15((fix15)input_samples[(frame_start + i) & INPUT_RING_MASK] << 7, window[i]) ;
+        }
+
+        // The input stage came back around to this frame during the copy
+        captured = input_count ;
+        if ((captured - frame_start) > CAPTURE_SLACK) {
+            dropped_count++ ;
+            frame_start += HOP_SAMPLES ;
+            continue ;
+        }
+        frame_start += HOP_SAMPLES ;
+
+        // Compute the FFT in place, then hand the slot to core 0
+        frame_scale[frame_head & (NUM_FRAMES - 1)] = fft_real(spectrum) ;
+        __dmb() ;
+        frame_head++ ;
+    }
+    PT_END(pt) ;
+}
+
+// Palette index (0-15) for a magnitude
+static inline int waterfall_level(fix15 m) {
+#if WF_DB
+    // log2(m) in 1/16 octaves, from the leading one and the 4 bits after it
+    int lz, log2q, level ;
+    if (m <= 0) return 0 ;
+    lz = __builtin_clz((uint32_t)m) ;
+    log2q = ((31 - lz) << 4) | ((((uint32_t)m << lz) >> 27) & 15) ;
+    // 16 steps of 1/16 octave are 6.02 dB
+    level = 15 - ((WF_TOP_LOG2 << 4) - log2q) * 602 / (WF_DB_PER_LEVEL * 1600) ;
+    return (level < 0) ? 0 : ((level > 15) ? 15 : level) ;
+#else
+    int level = m >> (WF_TOP_LOG2 - 4) ;
+    return (level > 15) ? 15 : level ;
+#endif
+}
+
+// Build the newest waterfall row from the smoothed magnitudes. A column
+// that spans several bins shows the strongest.
+void waterfall_make_row() {
+    int w, j, x, k, end ;
+    fix15 m ;
+    uint32_t word ;
+    for (w = 0; w < (WF_WIDTH / 8); w++) {
+        word = 0 ;
+        for (j = 0; j < 8; j++) {
+            x = (w << 3) + j ;
+            k = waterfall_bin[x] ;
+            end = max(waterfall_bin[x+1], k+1) ;
+            m = 0 ;
+            for (; k < end; k++) {
+                if (magnitude[k] > m) m = magnitude[k] ;
+            }
+            word |= (uint32_t)waterfall_lut[waterfall_level(m)] << (j << 2) ;
+        }
+        waterfall_row[w] = word ;
+    }
+}
+
+// First bin of each waterfall column: one bin per column, or a
+// logarithmic axis from bin 2 to the top bin
+void make_waterfall_axis() {
+    int x ;
+    for (x = 0; x <= WF_WIDTH; x++) {
+#if WF_LOG_FREQ
+        waterfall_bin[x] = (uint16_t)(2.0 * pow((NUM_SAMPLES>>1) / 2.0, (double)x / WF_WIDTH) + 0.5) ;
+#else
+        waterfall_bin[x] = x * (NUM_SAMPLES>>1) / WF_WIDTH ;
+#endif
+    }
+    waterfall_bin[WF_WIDTH] = NUM_SAMPLES>>1 ;
+}
+
+// Runs on core 0: magnitude, smoothing, peak detection and display
+static PT_THREAD (protothread_display(struct pt *pt))
+{
+    // Indicate beginning of thread
+    PT_BEGIN(pt) ;
 
     // Declare some static variables
     static int height ;             // for scaling display
@@ -202,6 +411,8 @@ static PT_THREAD (protothread_fft(struct pt *pt))
 
     static fix15 max_fr ;           // temporary variable for max freq calculation
     static int max_fr_dex ;         // index of max frequency
+    static fix15 * spectrum ;       // queue slot being processed
+    static int fft_scale ;          // block exponent from fft_real
 
     // Write some text to VGA
     setTextColor(WHITE) ;
@@ -217,68 +428,172 @@ static PT_THREAD (protothread_fft(struct pt *pt))
     setCursor(250, 0) ;
     setTextSize(2) ;
     writeString("Max freqency:") ;
+    setCursor(450, 0) ;
+    writeString("Dropped:") ;
 
     // Will be used to write dynamic text to screen
     static char freqtext[40];
 
 
     while(1) {
-        // Wait for NUM_SAMPLES samples to be gathered
-        // Measure wait time with timer. THIS IS BLOCKING
-        dma_channel_wait_for_finish_blocking(sample_chan);
-
-        // Copy/window elements into a fixed-point array
-        for (i=0; i<NUM_SAMPLES; i++) {
-            fr[i] = multfix15(int2fix15((int)sample_array[i]), window[i]) ;
-            fi[i] = (fix15) 0 ;
-        }
+        // Wait for a spectrum from core 1 (other threads run meanwhile)
+        PT_YIELD_UNTIL(pt, frame_head != frame_tail) ;
+        __dmb() ;
+        spectrum = frame_spectrum[frame_tail & (NUM_FRAMES - 1)] ;
+        // Bin k is (spectrum[2k], spectrum[2k+1]) * 2^scale. FFTfix
+        // divides by NUM_SAMPLES, keep its scaling for the display.
+        fft_scale = frame_scale[frame_tail & (NUM_FRAMES - 1)] - LOG2_NUM_SAMPLES ;
 
         // Zero max frequency and max frequency index
         max_fr = 0 ;
         max_fr_dex = 0 ;
 
-        // Restart the sample channel, now that we have our copy of the samples
-        dma_channel_start(control_chan) ;
-
-        // Compute the FFT
-        FFTfix(fr, fi) ;
-
         // Find the magnitudes (alpha max plus beta min)
-        for (int i = 0; i < (NUM_SAMPLES>>1); i++) {  
-            // get the approx magnitude
-            fr[i] = abs(fr[i]); 
-            fi[i] = abs(fi[i]);
-            // reuse fr to hold magnitude
-            fr[i] = max(fr[i], fi[i]) + 
-                    multfix15(min(fr[i], fi[i]), zero_point_4); 
+        for (i = 0; i < (NUM_SAMPLES>>1); i++) {
+            // get the approx magnitude (spectrum[1] is the Nyquist bin)
+            fix15 re = abs(spectrum[i<<1]) ;
+            fix15 im = (i == 0) ? 0 : abs(spectrum[(i<<1) + 1]) ;
+            fix15 mag = max(re, im) + multfix15(min(re, im), zero_point_4) ;
+            mag = (fft_scale >= 0) ? (mag << fft_scale) : (mag >> -fft_scale) ;
 
             // Keep track of maximum
-            if (fr[i] > max_fr && i>4) {
-                max_fr = fr[i] ;
+            if (mag > max_fr && i>4) {
+                max_fr = mag ;
                 max_fr_dex = i ;
             }
+            // Exponential average for the display
+            magnitude[i] += (mag - magnitude[i]) >> SMOOTH_SHIFT ;
         }
-        // Compute max frequency in Hz
-        max_freqency = max_fr_dex * (Fs/NUM_SAMPLES) ;
+
+        // Compute max frequency in Hz, interpolating between bins with
+        // a parabola through the log magnitudes at the peak
+        max_freqency = max_fr_dex ;
+        if (max_fr_dex > 4 && max_fr_dex < ((NUM_SAMPLES>>1) - 1)) {
+            float p[3] ;
+            for (int k = 0; k < 3; k++) {
+                float re = (float)spectrum[(max_fr_dex + k - 1) << 1] ;
+                float im = (float)spectrum[((max_fr_dex + k - 1) << 1) + 1] ;
+                p[k] = logf(re*re + im*im + 1.0f) ;
+            }
+            float denom = p[0] - 2.0f*p[1] + p[2] ;
+            if (denom < 0.0f) {
+                float delta = 0.5f * (p[0] - p[2]) / denom ;
+                if (delta > 0.5f) delta = 0.5f ;
+                if (delta < -0.5f) delta = -0.5f ;
+                max_freqency += delta ;
+            }
+        }
+        max_freqency *= (Fs/NUM_SAMPLES) ;
+
+        // Done with the spectrum, core 1 can refill the slot
+        __dmb() ;
+        frame_tail++ ;
 
         // Display on VGA
         fillRect(250, 20, 176, 30, BLACK); // red box
-        sprintf(freqtext, "%d", (int)max_freqency) ;
+        sprintf(freqtext, "%.1f", max_freqency) ;
         setCursor(250, 20) ;
         setTextSize(2) ;
         writeString(freqtext) ;
+        fillRect(450, 20, 176, 30, BLACK);
+        sprintf(freqtext, "%u", (unsigned)dropped_count) ;
+        setCursor(450, 20) ;
+        writeString(freqtext) ;
+        // Input gain the AGC has settled on
+        sprintf(freqtext, "AGC gain: %.1f", fix2float15(input_gain)) ;
+        setCursor(450, 40) ;
+        setTextSize(1) ;
+        writeString(freqtext) ;
 
-        // Update the FFT display
-        for (int i=5; i<(NUM_SAMPLES>>1); i++) {
-            drawVLine(59+i, 50, 429, BLACK);
-            height = fix2int15(multfix15(fr[i], int2fix15(36))) ;
-            drawVLine(59+i, 479-height, height, WHITE);
+#if WATERFALL
+        // Scroll the waterfall up a row, build the new row meanwhile,
+        // then write it at the bottom once the DMA is done
+        dma_channel_configure(scroll_chan, &scroll_config,
+            current_draw_buffer + 320*WF_TOP,           // write one row up
+            current_draw_buffer + 320*(WF_TOP + 1),     // from the row below
+            (479 - WF_TOP) * 80,                        // words (80 per row)
+            true) ;
+        waterfall_make_row() ;
+        PT_YIELD_UNTIL(pt, !dma_channel_is_busy(scroll_chan)) ;
+        {
+            uint32_t * dst = (uint32_t *)(current_draw_buffer + 320*479 + (WF_X0 >> 1)) ;
+            for (i = 0; i < (WF_WIDTH / 8); i++) dst[i] = waterfall_row[i] ;
+        }
+#else
+        // Update the FFT display, drawing only the change in each bar
+        for (i=5; i<(NUM_SAMPLES>>1); i++) {
+            height = fix2int15(multfix15(magnitude[i], int2fix15(36))) ;
+            if (height > 429) height = 429 ;
+            if (height > bar_height[i]) {
+                drawVLine(59+i, 479-height, height-bar_height[i], WHITE);
+            }
+            else if (height < bar_height[i]) {
+                drawVLine(59+i, 479-bar_height[i], bar_height[i]-height, BLACK);
+            }
+            bar_height[i] = height ;
         }
+#endif
 
     }
     PT_END(pt) ;
 }
 
+// Fill the window table with WINDOW_TYPE (periodic form, so overlapped
+// frames add up evenly), scaled to the Hann window's coherent gain of 0.5
+void make_window() {
+    // cosine-sum coefficients a0 - a1 cos + a2 cos2 - a3 cos3 + a4 cos4
+#if WINDOW_TYPE == WINDOW_BLACKMAN_HARRIS
+    const double a[5] = {0.35875, 0.48829, 0.14128, 0.01168, 0.0} ;
+#elif WINDOW_TYPE == WINDOW_FLAT_TOP
+    const double a[5] = {0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368} ;
+#else
+    const double a[5] = {0.5, 0.5, 0.0, 0.0, 0.0} ;
+#endif
+    int i ;
+    for (i = 0; i < NUM_SAMPLES; i++) {
+        double x = 6.283185307179586 * i / NUM_SAMPLES ;
+        double w = a[0] - a[1]*cos(x) + a[2]*cos(2*x) - a[3]*cos(3*x) + a[4]*cos(4*x) ;
+        // coherent gain is a[0]
+        window[i] = float2fix15(w * 0.5 / a[0]) ;
+    }
+}
+
+#if FFT_BENCHMARK
+// Time both FFTs on the same windowed test tone, print microseconds and
+// clk_sys cycles per transform
+void fft_benchmark() {
+    const int runs = 10 ;
+    uint32_t start, t_fix, t_real ;
+    float mhz = clock_get_hz(clk_sys) / 1000000.0 ;
+    int i, r ;
+
+    t_fix = 0 ;
+    for (r = 0; r < runs; r++) {
+        for (i = 0; i < NUM_SAMPLES; i++) {
+            fr[i] = multfix15(Sinewave[(i * 37) & NUM_SAMPLES_M_1] + int2fix15(1), window[i]) ;
+            fi[i] = 0 ;
+        }
+        start = time_us_32() ;
+        FFTfix(fr, fi) ;
+        t_fix += time_us_32() - start ;
+    }
+
+    t_real = 0 ;
+    for (r = 0; r < runs; r++) {
+        for (i = 0; i < NUM_SAMPLES; i++) {
+            fr[i] = multfix15(Sinewave[(i * 37) & NUM_SAMPLES_M_1] + int2fix15(1), window[i]) ;
+        }
+        start = time_us_32() ;
+        fft_real(fr) ;
+        t_real += time_us_32() - start ;
+    }
+
+    printf("%d-point FFT, %d runs\n", NUM_SAMPLES, runs) ;
+    printf("FFTfix:   %6u us  %8u cycles\n", (unsigned)(t_fix / runs), (unsigned)(mhz * t_fix / runs)) ;
+    printf("fft_real: %6u us  %8u cycles\n", (unsigned)(t_real / runs), (unsigned)(mhz * t_real / runs)) ;
+}
+#endif
+
 static PT_THREAD (protothread_blink(struct pt *pt))
 {
     // Indicate beginning of thread
@@ -294,6 +609,7 @@ static PT_THREAD (protothread_blink(struct pt *pt))
 // Core 1 entry point (main() for core 1)
 void core1_entry() {
     // Add and schedule threads
+    pt_add_thread(protothread_fft) ;
     pt_add_thread(protothread_blink) ;
     pt_schedule_start ;
 }
@@ -311,93 +627,41 @@ int main() {
     gpio_set_dir(LED, GPIO_OUT) ;
     gpio_put(LED, 0) ;
 
-    ///////////////////////////////////////////////////////////////////////////////
-    // ============================== ADC CONFIGURATION ==========================
-    //////////////////////////////////////////////////////////////////////////////
-    // Init GPIO for analogue use: hi-Z, no pulls, disable digital input buffer.
-    adc_gpio_init(ADC_PIN);
-
-    // Initialize the ADC harware
-    // (resets it, enables the clock, spins until the hardware is ready)
-    adc_init() ;
-
-    // Select analog mux input (0...3 are GPIO 26, 27, 28, 29; 4 is temp sensor)
-    adc_select_input(ADC_CHAN) ;
-
-    // Setup the FIFO
-    adc_fifo_setup(
-        true,    // Write each completed conversion to the sample FIFO
-        true,    // Enable DMA data request (DREQ)
-        1,       // DREQ (and IRQ) asserted when at least 1 sample present
-        false,   // We won't see the ERR bit because of 8 bit reads; disable.
-        true     // Shift each sample to 8 bits when pushing to FIFO
-    );
-
-    // Divisor of 0 -> full speed. Free-running capture with the divider is
-    // equivalent to pressing the ADC_CS_START_ONCE button once per `div + 1`
-    // cycles (div not necessarily an integer). Each conversion takes 96
-    // cycles, so in general you want a divider of 0 (hold down the button
-    // continuously) or > 95 (take samples less frequently than 96 cycle
-    // intervals). This is all timed by the 48 MHz ADC clock. This is setup
-    // to grab a sample at 10kHz (48Mhz/10kHz - 1)
-    adc_set_clkdiv(ADCCLK/Fs);
-
-
-    // Populate the sine table and Hann window table
+    // Populate the sine table (FFTfix only) and window table
+#if FFT_BENCHMARK
     int ii;
     for (ii = 0; ii < NUM_SAMPLES; ii++) {
         Sinewave[ii] = float2fix15(sin(6.283 * ((float) ii) / (float)NUM_SAMPLES));
-        window[ii] = float2fix15(0.5 * (1.0 - cos(6.283 * ((float) ii) / ((float)NUM_SAMPLES))));
     }
-
-    /////////////////////////////////////////////////////////////////////////////////
-    // ============================== ADC DMA CONFIGURATION =========================
-    /////////////////////////////////////////////////////////////////////////////////
-
-    sample_chan = dma_claim_unused_channel(true);
-    control_chan = dma_claim_unused_channel(true);
-
-    // Channel configurations
-    dma_channel_config c2 = dma_channel_get_default_config(sample_chan);
-    dma_channel_config c3 = dma_channel_get_default_config(control_chan);
-
-
-    // ADC SAMPLE CHANNEL
-    // Reading from constant address, writing to incrementing byte addresses
-    channel_config_set_transfer_data_size(&c2, DMA_SIZE_8);
-    channel_config_set_read_increment(&c2, false);
-    channel_config_set_write_increment(&c2, true);
-    // Pace transfers based on availability of ADC samples
-    channel_config_set_dreq(&c2, DREQ_ADC);
-    // Configure the channel
-    dma_channel_configure(sample_chan,
-        &c2,            // channel config
-        sample_array,   // dst
-        &adc_hw->fifo,  // src
-        NUM_SAMPLES,    // transfer count
-        false            // don't start immediately
-    );
-
-    // CONTROL CHANNEL
-    channel_config_set_transfer_data_size(&c3, DMA_SIZE_32);      // 32-bit txfers
-    channel_config_set_read_increment(&c3, false);                // no read incrementing
-    channel_config_set_write_increment(&c3, false);               // no write incrementing
-    channel_config_set_chain_to(&c3, sample_chan);                // chain to sample chan
-
-    dma_channel_configure(
-        control_chan,                         // Channel to be configured
-        &c3,                                // The configuration we just created
-        &dma_hw->ch[sample_chan].write_addr,  // Write address (channel 0 read address)
-        &sample_address_pointer,                   // Read address (POINTER TO AN ADDRESS)
-        1,                                  // Number of transfers, in this case each is 4 byte
-        false                               // Don't start immediately.
-    );
+#endif
+    make_window() ;
+    // Twiddles and bit reversal swap list for fft_real
+    fft_init() ;
+#if FFT_BENCHMARK
+    fft_benchmark() ;
+#endif
+
+    // ADC at 500 ksps, the decimation filters and the capture DMA. The
+    // filtering runs in a DMA interrupt on this core.
+    input_init(ADC_PIN, ADC_CHAN, NULL) ;
+
+#if WATERFALL
+    // WATERFALL SCROLL CHANNEL
+    // Word copies from the row below to the row above, as fast as
+    // possible (copying upward, so overlapping rows are read first)
+    scroll_chan = dma_claim_unused_channel(true);
+    scroll_config = dma_channel_get_default_config(scroll_chan);
+    channel_config_set_transfer_data_size(&scroll_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&scroll_config, true);
+    channel_config_set_write_increment(&scroll_config, true);
+    make_waterfall_axis() ;
+#endif
 
     // Launch core 1
     multicore_launch_core1(core1_entry);
 
     // Add and schedule core 0 threads
-    pt_add_thread(protothread_fft) ;
+    pt_add_thread(protothread_display) ;
     pt_schedule_start ;
 
 }
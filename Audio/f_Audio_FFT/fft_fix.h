@@ -0,0 +1,241 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Fixed-point real-input FFT (radix-4, block floating point)
+ *
+ * Compared with FFTfix in fft.c (radix-2 complex FFT, fi[] all zeros):
+ *
+ *  -- REAL INPUT. N real samples are treated as N/2 complex samples
+ *     (even samples real, odd samples imaginary), transformed with an
+ *     N/2-point complex FFT and separated with one post-twiddle pass.
+ *     Half the butterflies, half the memory, and no fi[] array.
+ *  -- RADIX-4. Two radix-2 stages are fused into one pass with 3
+ *     complex multiplies per 4 points instead of 4, and half as many
+ *     trips through memory. A single radix-2 pass (no multiplies) is
+ *     added when log2(N/2) is odd. Twiddle-free butterflies (m = 0)
+ *     skip the multiplies.
+ *  -- PRECOMPUTED BIT REVERSAL. fft_init() builds the list of index
+ *     pairs to swap, so each call is a straight walk down that list.
+ *  -- BLOCK FLOATING POINT. The input is normalized to use the full
+ *     word, and before each pass the block is shifted down only as
+ *     much as that pass can grow. The shift count is returned, so small
+ *     signals keep their precision (FFTfix always divides by N).
+ *  -- 16-bit twiddles, multiplied with two 32x32->32 multiplies rather
+ *     than a 64-bit multiply (the M0+ has no long multiply).
+ *
+ * Size is set at compile time: define FFT_LOG2_N (6..12, 64..4096
+ * points) and typedef fix15 (signed int) before including this file.
+ *
+ * USAGE
+ *   #define FFT_LOG2_N 10
+ *   #include "fft_fix.h"
+ *   fix15 buf[FFT_N] ;             // real samples in, spectrum out
+ *   fft_init() ;                   // once
+ *   int scale = fft_real(buf) ;
+ *   // X[k] = (buf[2k] + i*buf[2k+1]) * 2^scale, for 0 < k < N/2
+ *   // X[0] = buf[0] * 2^scale, X[N/2] = buf[1] * 2^scale
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#ifndef FFT_LOG2_N
+#define FFT_LOG2_N 10
+#endif
+#if (FFT_LOG2_N < 6) || (FFT_LOG2_N > 12)
+#error "FFT_LOG2_N must be 6 (64 points) to 12 (4096 points)"
+#endif
+
+#define FFT_N       (1 << FFT_LOG2_N)   // real points
+#define FFT_M       (FFT_N >> 1)        // complex points
+#define FFT_LOG2_M  (FFT_LOG2_N - 1)
+
+// Block is kept below these magnitudes before each kind of pass:
+// a radix-4 pass can grow a component by up to 4*sqrt(2), a radix-2
+// or post-twiddle pass by less than 2.5
+#define FFT_LIMIT_RADIX4    (1 << 27)
+#define FFT_LIMIT_RADIX2    (1 << 28)
+
+
+// W_N^k = cos(2 pi k/N) - i sin(2 pi k/N), Q15, k < N/2
+static int16_t fft_cos[FFT_N/2] ;
+static int16_t fft_sin[FFT_N/2] ;
+// Bit reversal swap list for the N/2-point complex FFT
+static uint16_t fft_swap[FFT_M/2][2] ;
+static int fft_swap_count = 0 ;
+
+// Build the twiddle table and the bit reversal swap list
+void fft_init() {
+    int k, m, r, b ;
+    for (k = 0; k < FFT_N/2; k++) {
+        double c = cos(6.283185307179586 * k / FFT_N) * 32768.0 ;
+        double s = sin(6.283185307179586 * k / FFT_N) * 32768.0 ;
+        // 1.0 does not fit in Q15, the error is 1 part in 32768
+        fft_cos[k] = (int16_t)((c > 32767.0) ? 32767 : lround(c)) ;
+        fft_sin[k] = (int16_t)((s > 32767.0) ? 32767 : lround(s)) ;
+    }
+    fft_swap_count = 0 ;
+    for (m = 1; m < FFT_M - 1; m++) {
+        r = 0 ;
+        for (b = 0; b < FFT_LOG2_M; b++) {
+            r |= ((m >> b) & 1) << (FFT_LOG2_M - 1 - b) ;
+        }
+        if (r > m) {
+            fft_swap[fft_swap_count][0] = m ;
+            fft_swap[fft_swap_count][1] = r ;
+            fft_swap_count++ ;
+        }
+    }
+}
+
+// (a * w) >> 15 for a Q15 twiddle, exact for |a| < 2^30, using two
+// 32-bit multiplies
+static inline fix15 fft_mul(fix15 a, int w) {
+    return (a >> 16) * w * 2 + ((int32_t)((uint32_t)(a & 0xffff) * (uint32_t)w) >> 15) ;
+}
+
+// Twiddle W_N^k for 0 <= k < N (W^(k+N/2) = -W^k)
+static inline void fft_twiddle(int k, int * c, int * s) {
+    if (k < FFT_N/2) {
+        *c = fft_cos[k] ;
+        *s = fft_sin[k] ;
+    }
+    else {
+        *c = -fft_cos[k - FFT_N/2] ;
+        *s = -fft_sin[k - FFT_N/2] ;
+    }
+}
+
+// Right shift that brings the block below limit
+static int fft_block_shift(fix15 * buf, int limit) {
+    uint32_t bits = 0 ;
+    int i, shift = 0 ;
+    for (i = 0; i < FFT_N; i++) {
+        bits |= (uint32_t)((buf[i] < 0) ? -buf[i] : buf[i]) ;
+    }
+    while ((bits >> shift) >= (uint32_t)limit) shift++ ;
+    return shift ;
+}
+
+// In-place real FFT of FFT_N samples. Returns the block exponent.
+int fft_real(fix15 * buf) {
+    int i, j, m, L, shift, step ;
+    int scale ;
+    int c1, s1, c2, s2, c3, s3 ;
+    fix15 ar, ai, br, bi, cr, ci, dr, di, tr, ti ;
+    fix15 t0r, t0i, t1r, t1i, t2r, t2i, t3r, t3i ;
+
+    ////////////////////////////////////////////////////////////////////
+    // Normalize: use the full word for small inputs
+    ////////////////////////////////////////////////////////////////////
+    {
+        uint32_t bits = 0 ;
+        for (i = 0; i < FFT_N; i++) {
+            bits |= (uint32_t)((buf[i] < 0) ? -buf[i] : buf[i]) ;
+        }
+        if (bits == 0) return 0 ;
+        shift = 0 ;
+        while ((bits << (shift + 1)) < (uint32_t)FFT_LIMIT_RADIX4) shift++ ;
+        if (shift) {
+            for (i = 0; i < FFT_N; i++) buf[i] <<= shift ;
+        }
+        scale = -shift ;
+    }
+
+    ////////////////////////////////////////////////////////////////////
+    // Bit reversal (complex points, interleaved re/im)
+    ////////////////////////////////////////////////////////////////////
+    for (m = 0; m < fft_swap_count; m++) {
+        i = fft_swap[m][0] << 1 ;
+        j = fft_swap[m][1] << 1 ;
+        tr = buf[i] ;   buf[i] = buf[j] ;     buf[j] = tr ;
+        ti = buf[i+1] ; buf[i+1] = buf[j+1] ; buf[j+1] = ti ;
+    }
+
+    ////////////////////////////////////////////////////////////////////
+    // One radix-2 pass (no twiddles) if log2(N/2) is odd
+    ////////////////////////////////////////////////////////////////////
+    L = 1 ;
+    if (FFT_LOG2_M & 1) {
+        shift = fft_block_shift(buf, FFT_LIMIT_RADIX2) ;
+        scale += shift ;
+        for (i = 0; i < FFT_N; i += 4) {
+            ar = buf[i] >> shift ;   ai = buf[i+1] >> shift ;
+            br = buf[i+2] >> shift ; bi = buf[i+3] >> shift ;
+            buf[i] = ar + br ;   buf[i+1] = ai + bi ;
+            buf[i+2] = ar - br ; buf[i+3] = ai - bi ;
+        }
+        L = 2 ;
+    }
+
+    ////////////////////////////////////////////////////////////////////
+    // Radix-4 passes. After bit reversal the four length-L sub-FFTs of
+    // a block hold x[4n], x[4n+2], x[4n+1], x[4n+3] (in that order).
+    ////////////////////////////////////////////////////////////////////
+    for (; L < FFT_M; L <<= 2) {
+        shift = fft_block_shift(buf, FFT_LIMIT_RADIX4) ;
+        scale += shift ;
+        // W_{4L}^m = W_N^(m*step)
+        step = FFT_N / (L << 2) ;
+        for (m = 0; m < L; m++) {
+            fft_twiddle(m*step, &c1, &s1) ;
+            fft_twiddle(2*m*step, &c2, &s2) ;
+            fft_twiddle(3*m*step, &c3, &s3) ;
+            for (i = m; i < FFT_M; i += (L << 2)) {
+                int i0 = i << 1, i1 = (i + L) << 1, i2 = (i + 2*L) << 1, i3 = (i + 3*L) << 1 ;
+                ar = buf[i0] >> shift ; ai = buf[i0+1] >> shift ;
+                br = buf[i1] >> shift ; bi = buf[i1+1] >> shift ;
+                cr = buf[i2] >> shift ; ci = buf[i2+1] >> shift ;
+                dr = buf[i3] >> shift ; di = buf[i3+1] >> shift ;
+                if (m) {
+                    // b *= W^2m, c *= W^m, d *= W^3m   (W = cos - i sin)
+                    tr = fft_mul(br, c2) + fft_mul(bi, s2) ;
+                    bi = fft_mul(bi, c2) - fft_mul(br, s2) ;
+                    br = tr ;
+                    tr = fft_mul(cr, c1) + fft_mul(ci, s1) ;
+                    ci = fft_mul(ci, c1) - fft_mul(cr, s1) ;
+                    cr = tr ;
+                    tr = fft_mul(dr, c3) + fft_mul(di, s3) ;
+                    di = fft_mul(di, c3) - fft_mul(dr, s3) ;
+                    dr = tr ;
+                }
+                t0r = ar + br ; t0i = ai + bi ;
+                t1r = ar - br ; t1i = ai - bi ;
+                t2r = cr + dr ; t2i = ci + di ;
+                t3r = cr - dr ; t3i = ci - di ;
+                // X0 = t0 + t2, X1 = t1 - i t3, X2 = t0 - t2, X3 = t1 + i t3
+                buf[i0] = t0r + t2r ; buf[i0+1] = t0i + t2i ;
+                buf[i1] = t1r + t3i ; buf[i1+1] = t1i - t3r ;
+                buf[i2] = t0r - t2r ; buf[i2+1] = t0i - t2i ;
+                buf[i3] = t1r - t3i ; buf[i3+1] = t1i + t3r ;
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////
+    // Separate the spectra of the even and odd samples:
+    //   X[k]   = Fe + W^k Fo
+    //   X[M-k] = conj(Fe - W^k Fo)
+    //   Fe = (Z[k] + conj Z[M-k])/2,  Fo = (Z[k] - conj Z[M-k])/2i
+    ////////////////////////////////////////////////////////////////////
+    shift = fft_block_shift(buf, FFT_LIMIT_RADIX2) ;
+    scale += shift ;
+    ar = buf[0] >> shift ; ai = buf[1] >> shift ;
+    buf[0] = ar + ai ;          // X[0]
+    buf[1] = ar - ai ;          // X[N/2]
+    for (m = 1; m <= FFT_M/2; m++) {
+        i = m << 1 ;
+        j = (FFT_M - m) << 1 ;
+        ar = buf[i] >> shift ; ai = buf[i+1] >> shift ;
+        br = buf[j] >> shift ; bi = buf[j+1] >> shift ;
+        // Fe, Fo
+        cr = (ar + br) >> 1 ; ci = (ai - bi) >> 1 ;
+        dr = (ai + bi) >> 1 ; di = (br - ar) >> 1 ;
+        // W^m Fo
+        tr = fft_mul(dr, fft_cos[m]) + fft_mul(di, fft_sin[m]) ;
+        ti = fft_mul(di, fft_cos[m]) - fft_mul(dr, fft_sin[m]) ;
+        buf[i] = cr + tr ; buf[i+1] = ci + ti ;
+        buf[j] = cr - tr ; buf[j+1] = ti - ci ;
+    }
+    return scale ;
+}
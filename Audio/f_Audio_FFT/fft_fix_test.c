@@ -0,0 +1,150 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Host test for fft_fix.h
+ *
+ * Runs on a PC, not the Pico. fft_real() is compared with a
+ * double-precision FFT of the same input, bin by bin, for:
+ *
+ *  - random (white) input, from full scale down to a few LSBs, which
+ *    exercises the normalization and the block shifts
+ *  - sine waves on and between bins, at several levels
+ *  - an impulse and a constant (all the energy in one place)
+ *
+ * The error is the RMS difference over all N/2 + 1 bins, relative to the
+ * RMS of the reference spectrum, in dB. Every case must be below
+ * MAX_ERROR_DB. The test exits with 1 if any case fails.
+ *
+ * BUILD AND RUN (any size from 6 to 12)
+ *   gcc -O2 -o fft_fix_test fft_fix_test.c -lm && ./fft_fix_test
+ *   gcc -O2 -DFFT_LOG2_N=12 -o fft_fix_test fft_fix_test.c -lm && ./fft_fix_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef signed int fix15 ;
+#include "fft_fix.h"
+
+// Worst error allowed, dB relative to the signal
+#define MAX_ERROR_DB    -80.0
+// Random inputs per level
+#define RANDOM_CASES    50
+
+static fix15 buf[FFT_N] ;
+static double ref_re[FFT_N], ref_im[FFT_N] ;
+static int failures = 0 ;
+
+// Reference: in-place radix-2 complex FFT in double precision
+static void ref_fft(double * re, double * im, int n) {
+    int i, j, k, len ;
+    double t ;
+    for (i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1 ;
+        for (; j & bit; bit >>= 1) j ^= bit ;
+        j ^= bit ;
+        if (i < j) {
+            t = re[i] ; re[i] = re[j] ; re[j] = t ;
+            t = im[i] ; im[i] = im[j] ; im[j] = t ;
+        }
+    }
+    for (len = 2; len <= n; len <<= 1) {
+        double a = -6.283185307179586 / len ;
+        for (i = 0; i < n; i += len) {
+            for (k = 0; k < len / 2; k++) {
+                double wr = cos(a * k), wi = sin(a * k) ;
+                double xr = re[i+k+len/2] * wr - im[i+k+len/2] * wi ;
+                double xi = re[i+k+len/2] * wi + im[i+k+len/2] * wr ;
+                re[i+k+len/2] = re[i+k] - xr ;
+                im[i+k+len/2] = im[i+k] - xi ;
+                re[i+k] += xr ;
+                im[i+k] += xi ;
+            }
+        }
+    }
+}
+
+// Transform buf both ways and compare. Returns the error in dB.
+static double check(const char * name, double level) {
+    int k, scale ;
+    double xr, xi, dr, di, err = 0, sig = 0, db ;
+
+    for (k = 0; k < FFT_N; k++) {
+        ref_re[k] = buf[k] ;
+        ref_im[k] = 0 ;
+    }
+    ref_fft(ref_re, ref_im, FFT_N) ;
+    scale = fft_real(buf) ;
+
+    for (k = 0; k <= FFT_N/2; k++) {
+        if (k == 0) {
+            xr = buf[0] ; xi = 0 ;
+        }
+        else if (k == FFT_N/2) {
+            xr = buf[1] ; xi = 0 ;
+        }
+        else {
+            xr = buf[2*k] ; xi = buf[2*k+1] ;
+        }
+        xr = ldexp(xr, scale) ;
+        xi = ldexp(xi, scale) ;
+        dr = xr - ref_re[k] ;
+        di = xi - ref_im[k] ;
+        err += dr*dr + di*di ;
+        sig += ref_re[k]*ref_re[k] + ref_im[k]*ref_im[k] ;
+    }
+    db = (sig > 0) ? 10.0 * log10(err / sig + 1e-30) : -300.0 ;
+    if (db > MAX_ERROR_DB) {
+        printf("FAIL %-10s level %9.0f: %7.1f dB\n", name, level, db) ;
+        failures++ ;
+    }
+    return db ;
+}
+
+int main() {
+    static const double levels[] = { 1 << 24, 1 << 20, 1 << 15, 1 << 10, 100, 8 } ;
+    int i, k, c ;
+    double db, worst ;
+
+    fft_init() ;
+    srand(1) ;
+    printf("fft_real, N = %d, limit %.0f dB\n", FFT_N, MAX_ERROR_DB) ;
+
+    // White noise
+    for (i = 0; i < (int)(sizeof levels / sizeof levels[0]); i++) {
+        worst = -300 ;
+        for (c = 0; c < RANDOM_CASES; c++) {
+            for (k = 0; k < FFT_N; k++) {
+                buf[k] = (fix15)(levels[i] * (2.0 * rand() / RAND_MAX - 1.0)) ;
+            }
+            db = check("random", levels[i]) ;
+            if (db > worst) worst = db ;
+        }
+        printf("random     level %9.0f: worst %7.1f dB\n", levels[i], worst) ;
+    }
+
+    // Sines, on a bin and between bins
+    for (i = 0; i < (int)(sizeof levels / sizeof levels[0]); i++) {
+        worst = -300 ;
+        for (c = 0; c < 2; c++) {
+            double cycles = (c == 0) ? FFT_N / 8.0 : FFT_N / 8.0 + 0.37 ;
+            for (k = 0; k < FFT_N; k++) {
+                buf[k] = (fix15)lround(levels[i] * sin(6.283185307179586 * cycles * k / FFT_N)) ;
+            }
+            db = check("sine", levels[i]) ;
+            if (db > worst) worst = db ;
+        }
+        printf("sine       level %9.0f: worst %7.1f dB\n", levels[i], worst) ;
+    }
+
+    // Impulse and constant
+    for (k = 0; k < FFT_N; k++) buf[k] = 0 ;
+    buf[3] = 1 << 20 ;
+    printf("impulse    level %9d: %7.1f dB\n", 1 << 20, check("impulse", 1 << 20)) ;
+    for (k = 0; k < FFT_N; k++) buf[k] = 1 << 15 ;
+    printf("constant   level %9d: %7.1f dB\n", 1 << 15, check("constant", 1 << 15)) ;
+
+    printf("%s\n", failures ? "FAILED" : "passed") ;
+    return failures ? 1 : 0 ;
+}
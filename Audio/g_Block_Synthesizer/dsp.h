@@ -0,0 +1,515 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Block-based fixed-point audio effects
+ *
+ * Every effect processes a block of fix15 samples in place, so it fits
+ * between the synthesizer's mix and the DAC (see synth_effects in
+ * synth.h). This file provides:
+ *
+ *  -- BIQUAD FILTERS. Direct form II transposed, cascaded up to
+ *     DSP_FILTER_STAGES sections, with designers for lowpass, highpass,
+ *     peaking and shelving sections (the RBJ "cookbook" formulas) and
+ *     Butterworth lowpass/highpass cascades. Coefficients are Q28 and
+ *     the state is 64 bits, so low cutoffs at 50 kHz stay stable and
+ *     quiet.
+ *  -- DELAY. A circular-buffer echo with feedback.
+ *  -- CHORUS. A delay line read at a delay swept by a triangle LFO,
+ *     with linear interpolation between samples.
+ *  -- REVERB. Freeverb-style: parallel damped comb filters into series
+ *     allpass filters, with the delay lengths scaled to DSP_FS and the
+ *     number of combs chosen to fit in RAM.
+ *  -- A PROCESSING GRAPH. Effects are chained into a dsp_graph, which
+ *     runs them in order and measures each one with the core's SysTick
+ *     counter, so every node reports cycles per sample.
+ *
+ * Delay lines hold int16 samples at 1/4 scale (DSP_LINE_SHIFT), so they
+ * cover +/-4.0, the synthesizer's mix at full output, in half the RAM
+ * of fix15. Gains (mix, feedback, ...) are fix15 from 0 to 1.0.
+ *
+ * USAGE
+ *   struct dsp_filter lpf ;
+ *   struct dsp_graph fx ;
+ *   dsp_filter_butterworth_lowpass(&lpf, 4000, 4) ;   // Hz, order
+ *   dsp_graph_add(&fx, "lowpass", dsp_filter_process, &lpf) ;
+ *   ...
+ *   dsp_graph_process(&fx, buf, n) ;   // fix15 buf[n], in place
+ *   fx.node[0].cycles_per_sample
+ *
+ * Define fix15 (signed int) before including this file.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include "hardware/structs/systick.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Sample rate (Hz) for the designers and delay times
+#ifndef DSP_FS
+#ifdef SYNTH_FS
+#define DSP_FS                  SYNTH_FS
+#else
+#define DSP_FS                  50000
+#endif
+#endif
+// Largest block any effect accepts
+#ifndef DSP_BLOCK_MAX
+#define DSP_BLOCK_MAX           256
+#endif
+// Biquad sections per filter
+#ifndef DSP_FILTER_STAGES
+#define DSP_FILTER_STAGES       4
+#endif
+// Reverb comb filters (1 to 8) and allpass filters (1 to 4). Four combs
+// and four allpasses use about 15 KB at 50 kHz, eight combs about 28 KB.
+#ifndef DSP_REVERB_COMBS
+#define DSP_REVERB_COMBS        4
+#endif
+#ifndef DSP_REVERB_ALLPASSES
+#define DSP_REVERB_ALLPASSES    4
+#endif
+// Nodes per graph
+#ifndef DSP_GRAPH_NODES
+#define DSP_GRAPH_NODES         8
+#endif
+
+// Biquad coefficients are Q28 (|c| < 8), and the filter runs with 12
+// bits below fix15 (samples up to +/-8.0)
+#define DSP_COEF_BITS           28
+#define DSP_GUARD_BITS          12
+// Delay line samples are fix15 >> DSP_LINE_SHIFT
+#define DSP_LINE_SHIFT          2
+
+// Saturate to a delay line sample
+static inline int16_t dsp_line_clamp(int32_t x) {
+    if (x > 32767) x = 32767 ;
+    if (x < -32768) x = -32768 ;
+    return (int16_t)x ;
+}
+
+// fix15 -> delay line sample, saturating
+static inline int16_t dsp_line_store(fix15 x) {
+    return dsp_line_clamp(x >> DSP_LINE_SHIFT) ;
+}
+
+// Delay line sample -> fix15
+static inline fix15 dsp_line_load(int v) {
+    return (fix15)v << DSP_LINE_SHIFT ;
+}
+
+// A delay line sample times a fix15 gain (at most 1.0), as fix15. Only
+// a 32-bit multiply, since the line sample has 16 bits.
+static inline fix15 dsp_line_gain(int v, fix15 gain) {
+    return (v * gain) >> (15 - DSP_LINE_SHIFT) ;
+}
+
+// Gain (0 to 1.0) -> fix15
+static inline fix15 dsp_gain(float g) {
+    return (fix15)(g * 32768.0) ;
+}
+
+// Milliseconds -> samples
+static inline uint32_t dsp_ms_to_samples(float ms) {
+    return (uint32_t)(ms * DSP_FS / 1000.0) ;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+///////////////////////////// BIQUADS //////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+
+struct dsp_biquad {
+    int32_t b0, b1, b2, a1, a2 ;    // Q28, a0 normalized to 1
+    int64_t s1, s2 ;                // state, Q(15 + 12 + 28)
+} ;
+
+struct dsp_filter {
+    int stages ;
+    struct dsp_biquad stage[DSP_FILTER_STAGES] ;
+} ;
+
+// Load normalized coefficients (the state is kept, so a filter can be
+// retuned while it runs)
+static void dsp_biquad_set(struct dsp_biquad * q, double b0, double b1, double b2,
+                           double a0, double a1, double a2) {
+    const double one = (double)(1 << DSP_COEF_BITS) ;
+    q->b0 = (int32_t)lround(b0 / a0 * one) ;
+    q->b1 = (int32_t)lround(b1 / a0 * one) ;
+    q->b2 = (int32_t)lround(b2 / a0 * one) ;
+    q->a1 = (int32_t)lround(a1 / a0 * one) ;
+    q->a2 = (int32_t)lround(a2 / a0 * one) ;
+}
+
+// Second-order sections (fc in Hz, Q 0.707 for a maximally flat section)
+void dsp_biquad_lowpass(struct dsp_biquad * q, float fc, float Q) {
+    double w0 = 6.283185307179586 * fc / DSP_FS ;
+    double alpha = sin(w0) / (2.0 * Q), c = cos(w0) ;
+    dsp_biquad_set(q, (1.0 - c)/2.0, 1.0 - c, (1.0 - c)/2.0, 1.0 + alpha, -2.0*c, 1.0 - alpha) ;
+}
+
+void dsp_biquad_highpass(struct dsp_biquad * q, float fc, float Q) {
+    double w0 = 6.283185307179586 * fc / DSP_FS ;
+    double alpha = sin(w0) / (2.0 * Q), c = cos(w0) ;
+    dsp_biquad_set(q, (1.0 + c)/2.0, -(1.0 + c), (1.0 + c)/2.0, 1.0 + alpha, -2.0*c, 1.0 - alpha) ;
+}
+
+// Boost or cut of gain_db around fc
+void dsp_biquad_peaking(struct dsp_biquad * q, float fc, float Q, float gain_db) {
+    double w0 = 6.283185307179586 * fc / DSP_FS ;
+    double alpha = sin(w0) / (2.0 * Q), c = cos(w0) ;
+    double A = pow(10.0, gain_db / 40.0) ;
+    dsp_biquad_set(q, 1.0 + alpha*A, -2.0*c, 1.0 - alpha*A, 1.0 + alpha/A, -2.0*c, 1.0 - alpha/A) ;
+}
+
+// Boost or cut of gain_db below fc
+void dsp_biquad_lowshelf(struct dsp_biquad * q, float fc, float Q, float gain_db) {
+    double w0 = 6.283185307179586 * fc / DSP_FS ;
+    double alpha = sin(w0) / (2.0 * Q), c = cos(w0) ;
+    double A = pow(10.0, gain_db / 40.0), r = 2.0 * sqrt(A) * alpha ;
+    dsp_biquad_set(q, A*((A + 1.0) - (A - 1.0)*c + r), 2.0*A*((A - 1.0) - (A + 1.0)*c),
+                      A*((A + 1.0) - (A - 1.0)*c - r), (A + 1.0) + (A - 1.0)*c + r,
+                      -2.0*((A - 1.0) + (A + 1.0)*c), (A + 1.0) + (A - 1.0)*c - r) ;
+}
+
+// Boost or cut of gain_db above fc
+void dsp_biquad_highshelf(struct dsp_biquad * q, float fc, float Q, float gain_db) {
+    double w0 = 6.283185307179586 * fc / DSP_FS ;
+    double alpha = sin(w0) / (2.0 * Q), c = cos(w0) ;
+    double A = pow(10.0, gain_db / 40.0), r = 2.0 * sqrt(A) * alpha ;
+    dsp_biquad_set(q, A*((A + 1.0) + (A - 1.0)*c + r), -2.0*A*((A - 1.0) + (A + 1.0)*c),
+                      A*((A + 1.0) + (A - 1.0)*c - r), (A + 1.0) - (A - 1.0)*c + r,
+                      2.0*((A - 1.0) - (A + 1.0)*c), (A + 1.0) - (A - 1.0)*c - r) ;
+}
+
+// Empty cascade of n sections (design each with the functions above)
+void dsp_filter_init(struct dsp_filter * f, int n) {
+    memset(f, 0, sizeof(struct dsp_filter)) ;
+    f->stages = (n > DSP_FILTER_STAGES) ? DSP_FILTER_STAGES : n ;
+}
+
+// Butterworth cascades of even order (2 * DSP_FILTER_STAGES at most).
+// Section k has Q = 1 / (2 cos(pi (2k+1) / (2 order))).
+void dsp_filter_butterworth_lowpass(struct dsp_filter * f, float fc, int order) {
+    int k ;
+    dsp_filter_init(f, order / 2) ;
+    for (k = 0; k < f->stages; k++) {
+        dsp_biquad_lowpass(&f->stage[k], fc, 0.5 / cos(3.141592653589793 * (2*k + 1) / (4 * f->stages))) ;
+    }
+}
+
+void dsp_filter_butterworth_highpass(struct dsp_filter * f, float fc, int order) {
+    int k ;
+    dsp_filter_init(f, order / 2) ;
+    for (k = 0; k < f->stages; k++) {
+        dsp_biquad_highpass(&f->stage[k], fc, 0.5 / cos(3.141592653589793 * (2*k + 1) / (4 * f->stages))) ;
+    }
+}
+
+// One section over a block. The output is fed back with DSP_GUARD_BITS
+// below fix15: near DC the feedback amplifies its rounding error by
+// about (Fs / (2 pi fc))^2, which would swamp a 40 Hz filter.
+static void dsp_biquad_process(struct dsp_biquad * q, fix15 * buf, int n) {
+    int64_t s1 = q->s1, s2 = q->s2 ;
+    int64_t b0 = q->b0, b1 = q->b1, b2 = q->b2, a1 = q->a1, a2 = q->a2 ;
+    int64_t x ;
+    int32_t y ;
+    int i ;
+    for (i = 0; i < n; i++) {
+        x = (int64_t)buf[i] << DSP_GUARD_BITS ;
+        y = (int32_t)((b0 * x + s1 + (1 << (DSP_COEF_BITS - 1))) >> DSP_COEF_BITS) ;
+        s1 = b1 * x - a1 * y + s2 ;
+        s2 = b2 * x - a2 * y ;
+        buf[i] = (y + (1 << (DSP_GUARD_BITS - 1))) >> DSP_GUARD_BITS ;
+    }
+    q->s1 = s1 ;
+    q->s2 = s2 ;
+}
+
+// Graph node: the whole cascade, section by section
+void dsp_filter_process(void * state, fix15 * buf, int n) {
+    struct dsp_filter * f = (struct dsp_filter *)state ;
+    int k ;
+    for (k = 0; k < f->stages; k++) {
+        dsp_biquad_process(&f->stage[k], buf, n) ;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+////////////////////////// DELAY AND CHORUS /////////////////////////////
+////////////////////////////////////////////////////////////////////////
+
+// Echo: out = in + mix * line[t - delay], line[t] = in + feedback * line[t - delay]
+struct dsp_delay {
+    int16_t * line ;            // 2^bits samples, supplied by the caller
+    uint32_t mask ;
+    uint32_t pos ;
+    uint32_t delay ;            // samples, less than the line length
+    fix15 feedback ;
+    fix15 mix ;
+} ;
+
+// line[] must hold 1 << bits samples
+void dsp_delay_init(struct dsp_delay * d, int16_t * line, int bits,
+                    float delay_ms, float feedback, float mix) {
+    d->line = line ;
+    d->mask = (1u << bits) - 1 ;
+    d->pos = 0 ;
+    memset(line, 0, (1u << bits) * sizeof(int16_t)) ;
+    d->delay = dsp_ms_to_samples(delay_ms) ;
+    if (d->delay > d->mask) d->delay = d->mask ;
+    d->feedback = dsp_gain(feedback) ;
+    d->mix = dsp_gain(mix) ;
+}
+
+// Graph node
+void dsp_delay_process(void * state, fix15 * buf, int n) {
+    struct dsp_delay * d = (struct dsp_delay *)state ;
+    uint32_t pos = d->pos ;
+    int i, r ;
+    for (i = 0; i < n; i++) {
+        r = d->line[(pos - d->delay) & d->mask] ;
+        d->line[pos & d->mask] = dsp_line_store(buf[i] + dsp_line_gain(r, d->feedback)) ;
+        buf[i] += dsp_line_gain(r, d->mix) ;
+        pos++ ;
+    }
+    d->pos = pos ;
+}
+
+// Chorus: a copy delayed by base +/- depth, swept by a triangle LFO
+struct dsp_chorus {
+    int16_t * line ;            // 2^bits samples, supplied by the caller
+    uint32_t mask ;
+    uint32_t pos ;
+    uint32_t base ;             // center delay, samples in Q16
+    uint32_t depth ;            // sweep, samples in Q16
+    uint32_t lfo_phase ;
+    uint32_t lfo_incr ;
+    fix15 mix ;
+} ;
+
+// line[] must hold 1 << bits samples, more than (base_ms + depth_ms)
+void dsp_chorus_init(struct dsp_chorus * c, int16_t * line, int bits,
+                     float base_ms, float depth_ms, float rate_hz, float mix) {
+    c->line = line ;
+    c->mask = (1u << bits) - 1 ;
+    c->pos = 0 ;
+    memset(line, 0, (1u << bits) * sizeof(int16_t)) ;
+    c->base = (uint32_t)(base_ms * DSP_FS / 1000.0 * 65536.0) ;
+    c->depth = (uint32_t)(depth_ms * DSP_FS / 1000.0 * 65536.0) ;
+    if (c->depth > c->base) c->depth = c->base ;
+    c->lfo_phase = 0 ;
+    c->lfo_incr = (uint32_t)(rate_hz * 4294967296.0 / DSP_FS) ;
+    c->mix = dsp_gain(mix) ;
+}
+
+// Graph node
+void dsp_chorus_process(void * state, fix15 * buf, int n) {
+    struct dsp_chorus * c = (struct dsp_chorus *)state ;
+    uint32_t pos = c->pos, phase = c->lfo_phase, d, k ;
+    int i, tri, frac, a, b ;
+    for (i = 0; i < n; i++) {
+        c->line[pos & c->mask] = dsp_line_store(buf[i]) ;
+        // triangle LFO, -32768 to 32767
+        phase += c->lfo_incr ;
+        tri = (int)((phase & 0x80000000u) ? ~phase : phase) >> 15 ;
+        tri -= 32768 ;
+        // delay in Q16 samples, then the two samples around it
+        d = c->base + (int32_t)(((int64_t)c->depth * tri) >> 15) ;
+        k = pos - (d >> 16) ;
+        frac = (d >> 1) & 0x7fff ;
+        a = c->line[k & c->mask] ;
+        b = c->line[(k - 1) & c->mask] ;
+        buf[i] += dsp_line_gain(a + (((b - a) * frac) >> 15), c->mix) ;
+        pos++ ;
+    }
+    c->pos = pos ;
+    c->lfo_phase = phase ;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+////////////////////////////// REVERB ///////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+
+// Freeverb delay lengths at 44.1 kHz, scaled to DSP_FS
+#define DSP_REVERB_LEN(n)       ((n) * DSP_FS / 44100)
+#define DSP_REVERB_IF(k, n)     ((DSP_REVERB_COMBS > (k)) ? DSP_REVERB_LEN(n) : 0)
+#define DSP_REVERB_AP_IF(k, n)  ((DSP_REVERB_ALLPASSES > (k)) ? DSP_REVERB_LEN(n) : 0)
+#define DSP_REVERB_COMB_SIZE    (DSP_REVERB_IF(0, 1116) + DSP_REVERB_IF(1, 1188) + \
+                                 DSP_REVERB_IF(2, 1277) + DSP_REVERB_IF(3, 1356) + \
+                                 DSP_REVERB_IF(4, 1422) + DSP_REVERB_IF(5, 1491) + \
+                                 DSP_REVERB_IF(6, 1557) + DSP_REVERB_IF(7, 1617))
+#define DSP_REVERB_AP_SIZE      (DSP_REVERB_AP_IF(0, 556) + DSP_REVERB_AP_IF(1, 441) + \
+                                 DSP_REVERB_AP_IF(2, 341) + DSP_REVERB_AP_IF(3, 225))
+
+static const uint16_t dsp_reverb_comb_tuning[8] = {1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617} ;
+static const uint16_t dsp_reverb_ap_tuning[4] = {556, 441, 341, 225} ;
+
+struct dsp_reverb {
+    int16_t * comb[DSP_REVERB_COMBS] ;
+    uint16_t comb_len[DSP_REVERB_COMBS] ;
+    uint16_t comb_pos[DSP_REVERB_COMBS] ;
+    int32_t comb_filter[DSP_REVERB_COMBS] ;     // damping lowpass state
+    int16_t * ap[DSP_REVERB_ALLPASSES] ;
+    uint16_t ap_len[DSP_REVERB_ALLPASSES] ;
+    uint16_t ap_pos[DSP_REVERB_ALLPASSES] ;
+    fix15 feedback ;            // comb feedback (room size)
+    fix15 damp ;                // comb lowpass
+    fix15 input ;               // input gain into the combs
+    fix15 wet ;
+    // storage
+    int16_t comb_line[DSP_REVERB_COMB_SIZE] ;
+    int16_t ap_line[DSP_REVERB_AP_SIZE] ;
+} ;
+
+// room and damp from 0 to 1 (as in Freeverb), wet is the output gain
+void dsp_reverb_init(struct dsp_reverb * r, float room, float damp, float wet) {
+    int k, offset ;
+    memset(r->comb_line, 0, sizeof(r->comb_line)) ;
+    memset(r->ap_line, 0, sizeof(r->ap_line)) ;
+    offset = 0 ;
+    for (k = 0; k < DSP_REVERB_COMBS; k++) {
+        r->comb[k] = &r->comb_line[offset] ;
+        r->comb_len[k] = DSP_REVERB_LEN(dsp_reverb_comb_tuning[k]) ;
+        r->comb_pos[k] = 0 ;
+        r->comb_filter[k] = 0 ;
+        offset += r->comb_len[k] ;
+    }
+    offset = 0 ;
+    for (k = 0; k < DSP_REVERB_ALLPASSES; k++) {
+        r->ap[k] = &r->ap_line[offset] ;
+        r->ap_len[k] = DSP_REVERB_LEN(dsp_reverb_ap_tuning[k]) ;
+        r->ap_pos[k] = 0 ;
+        offset += r->ap_len[k] ;
+    }
+    r->feedback = dsp_gain(0.7 + 0.28 * room) ;
+    r->damp = dsp_gain(0.4 * damp) ;
+    // keeps the sum of the combs inside the delay lines
+    r->input = dsp_gain(0.25 / DSP_REVERB_COMBS) ;
+    r->wet = dsp_gain(wet) ;
+}
+
+// Graph node. Each comb and allpass runs over the whole block before
+// the next, so its state stays in registers.
+void dsp_reverb_process(void * state, fix15 * buf, int n) {
+    static int32_t in[DSP_BLOCK_MAX] ;
+    static int32_t acc[DSP_BLOCK_MAX] ;
+    struct dsp_reverb * r = (struct dsp_reverb *)state ;
+    int i, k, v, pos, len ;
+    int32_t filt ;
+    int16_t * line ;
+
+    // input, in delay line units
+    for (i = 0; i < n; i++) {
+        in[i] = (dsp_line_store(buf[i]) * r->input) >> 15 ;
+        acc[i] = 0 ;
+    }
+    // parallel damped combs
+    for (k = 0; k < DSP_REVERB_COMBS; k++) {
+        line = r->comb[k] ;
+        len = r->comb_len[k] ;
+        pos = r->comb_pos[k] ;
+        filt = r->comb_filter[k] ;
+        for (i = 0; i < n; i++) {
+            v = line[pos] ;
+            acc[i] += v ;
+            filt = v + ((r->damp * (filt - v)) >> 15) ;
+            line[pos] = dsp_line_clamp(in[i] + ((r->feedback * filt) >> 15)) ;
+            if (++pos >= len) pos = 0 ;
+        }
+        r->comb_pos[k] = pos ;
+        r->comb_filter[k] = filt ;
+    }
+    // series allpasses (gain 0.5)
+    for (k = 0; k < DSP_REVERB_ALLPASSES; k++) {
+        line = r->ap[k] ;
+        len = r->ap_len[k] ;
+        pos = r->ap_pos[k] ;
+        for (i = 0; i < n; i++) {
+            v = line[pos] ;
+            line[pos] = dsp_line_clamp(acc[i] + (v >> 1)) ;
+            acc[i] = v - acc[i] ;
+            if (++pos >= len) pos = 0 ;
+        }
+        r->ap_pos[k] = pos ;
+    }
+    // add the wet signal
+    for (i = 0; i < n; i++) {
+        buf[i] += dsp_line_gain(dsp_line_clamp(acc[i]), r->wet) ;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+////////////////////////////// GRAPH ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+
+typedef void (*dsp_process_fn)(void * state, fix15 * buf, int n) ;
+
+struct dsp_node {
+    const char * name ;
+    dsp_process_fn process ;
+    void * state ;
+    volatile uint8_t bypass ;
+    // last block: clk_sys cycles, and per sample; worst per sample
+    uint32_t cycles ;
+    uint32_t cycles_per_sample ;
+    uint32_t cycles_per_sample_max ;
+} ;
+
+struct dsp_graph {
+    int nodes ;
+    struct dsp_node node[DSP_GRAPH_NODES] ;
+    // all nodes, last block
+    uint32_t cycles_per_sample ;
+} ;
+
+// Empty graph
+void dsp_graph_init(struct dsp_graph * g) {
+    memset(g, 0, sizeof(struct dsp_graph)) ;
+}
+
+// Append a node. Returns its index, or -1 if the graph is full.
+int dsp_graph_add(struct dsp_graph * g, const char * name, dsp_process_fn process, void * state) {
+    struct dsp_node * p ;
+    if (g->nodes >= DSP_GRAPH_NODES) return -1 ;
+    p = &g->node[g->nodes] ;
+    memset(p, 0, sizeof(struct dsp_node)) ;
+    p->name = name ;
+    p->process = process ;
+    p->state = state ;
+    return g->nodes++ ;
+}
+
+// Run every node over a block (n <= DSP_BLOCK_MAX), in place. SysTick
+// is per core, so it is started on the core that runs the graph: a
+// 24-bit down-counter at clk_sys.
+void dsp_graph_process(struct dsp_graph * g, fix15 * buf, int n) {
+    uint32_t start, total = 0, c ;
+    int k ;
+    if (!(systick_hw->csr & 1)) {
+        systick_hw->rvr = 0x00ffffff ;
+        systick_hw->cvr = 0 ;
+        systick_hw->csr = 0x5 ;     // enable, processor clock, no interrupt
+    }
+    for (k = 0; k < g->nodes; k++) {
+        struct dsp_node * p = &g->node[k] ;
+        if (p->bypass) {
+            p->cycles = p->cycles_per_sample = 0 ;
+            continue ;
+        }
+        start = systick_hw->cvr ;
+        p->process(p->state, buf, n) ;
+        c = (start - systick_hw->cvr) & 0x00ffffff ;
+        p->cycles = c ;
+        p->cycles_per_sample = c / n ;
+        if (p->cycles_per_sample > p->cycles_per_sample_max) {
+            p->cycles_per_sample_max = p->cycles_per_sample ;
+        }
+        total += c ;
+    }
+    g->cycles_per_sample = total / n ;
+}
@@ -0,0 +1,195 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * DMA block output to an I2S DAC through the PIO
+ *
+ * The same block scheme as synth_dac.h, with the MCP4822 and its SPI
+ * port replaced by a PIO I2S transmitter (i2s.pio) and a stereo DAC
+ * such as the PCM5102A:
+ *
+ *   data channel plays block k into the PIO TX FIFO --> chains to control channel
+ *   control channel loads block k+1 into the data channel and triggers it
+ *   DMA interrupt: block k is free, fill(block k, I2S_BLOCK frames)
+ *
+ * With two buffers this is a double buffer: one block plays while the
+ * other is refilled. The data channel is paced by the PIO's TX DREQ, so
+ * the sample rate comes from the PIO clock divider instead of a DMA
+ * timer, and no CPU time is spent per sample.
+ *
+ * Frames are 16-bit stereo (I2S_BITS 16: one word per frame, left in
+ * the high half, see i2s_frame16) or 24-bit stereo in 32-bit slots
+ * (I2S_BITS 24: two words per frame, left first, see i2s_word24).
+ *
+ * The PIO clock divider is fractional, so most rates are approximate
+ * (48 kHz at 125 MHz is 48003 Hz) with a little jitter on BCLK; the
+ * rate actually produced is in i2s_fs. A DAC with its own PLL (PCM5102A
+ * with SCK tied low) cleans that up.
+ *
+ * The interrupt runs on the core that called i2s_start().
+ *
+ * HARDWARE CONNECTIONS (PCM5102A)
+ *  - data_pin -----------> DIN
+ *  - clock_pin_base -----> BCK
+ *  - clock_pin_base + 1 -> LRCK
+ *  - GND ----------------> SCK (internal PLL)
+ *
+ * RESOURCES USED
+ *  - 1 PIO state machine (claimed) and 8 instructions
+ *  - 2 DMA channels (claimed)
+ *  - DMA_IRQ_0 (shared handler)
+ */
+
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+// The PIO programs
+#include "i2s.pio.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Bits per sample: 16 or 24
+#ifndef I2S_BITS
+#define I2S_BITS                16
+#endif
+// Frames (stereo samples) per block
+#ifndef I2S_BLOCK
+#define I2S_BLOCK               64
+#endif
+// Blocks in the DMA ring (power of 2, max 8). 2 is a double buffer.
+#ifndef I2S_BUFFERS
+#define I2S_BUFFERS             2
+#endif
+
+#if I2S_BITS != 16 && I2S_BITS != 24
+#error "I2S_BITS must be 16 or 24"
+#endif
+
+// 32-bit words per frame, bits per slot, and per block
+#define I2S_WORDS_PER_FRAME     (I2S_BITS == 16 ? 1 : 2)
+#define I2S_SLOT_BITS           (I2S_BITS == 16 ? 16 : 32)
+#define I2S_BLOCK_WORDS         (I2S_BLOCK * I2S_WORDS_PER_FRAME)
+// log2 of the address table size in bytes (4 bytes per block)
+#define I2S_TABLE_BITS          (I2S_BUFFERS == 8 ? 5 : (I2S_BUFFERS == 4 ? 4 : 3))
+
+// One 16-bit stereo frame
+static inline uint32_t i2s_frame16(int16_t left, int16_t right) {
+    return ((uint32_t)(uint16_t)left << 16) | (uint16_t)right ;
+}
+
+// One channel of a 24-bit frame (sample in the top 24 bits of the slot)
+static inline uint32_t i2s_word24(int32_t sample) {
+    return (uint32_t)sample << 8 ;
+}
+
+// Fills a block with `frames` frames (I2S_WORDS_PER_FRAME words each)
+typedef void (*i2s_fill_fn)(uint32_t * block, int frames) ;
+
+// The blocks, and the table of their addresses the control channel walks
+// (a ring on its read address, so aligned to its size)
+uint32_t i2s_block[I2S_BUFFERS][I2S_BLOCK_WORDS] ;
+uint32_t * i2s_table[I2S_BUFFERS]
+    __attribute__((aligned(1 << I2S_TABLE_BITS))) ;
+
+static int i2s_data_chan ;
+static int i2s_ctrl_chan ;
+static i2s_fill_fn i2s_fill ;
+
+// Sample rate the PIO divider produces (Hz)
+float i2s_fs = 0 ;
+// Blocks played so far
+volatile uint32_t i2s_blocks = 0 ;
+// Time spent filling the last block, and the worst so far (us)
+volatile uint32_t i2s_render_us = 0 ;
+volatile uint32_t i2s_render_max_us = 0 ;
+
+// A block finished playing: refill it
+static void i2s_irq() {
+    uint32_t start ;
+    if (dma_channel_get_irq0_status(i2s_data_chan)) {
+        dma_channel_acknowledge_irq0(i2s_data_chan) ;
+        start = time_us_32() ;
+        i2s_fill(i2s_block[i2s_blocks & (I2S_BUFFERS - 1)], I2S_BLOCK) ;
+        i2s_blocks++ ;
+        i2s_render_us = time_us_32() - start ;
+        if (i2s_render_us > i2s_render_max_us) {
+            i2s_render_max_us = i2s_render_us ;
+        }
+    }
+}
+
+// Fill every block, then start streaming at fs (Hz) from a state machine
+// on pio. fill() is called from the DMA interrupt, on the calling core.
+void i2s_start(PIO pio, uint data_pin, uint clock_pin_base, uint32_t fs, i2s_fill_fn fill) {
+    int i ;
+    uint sm, offset ;
+    float div ;
+    i2s_fill = fill ;
+    for (i = 0; i < I2S_BUFFERS; i++) {
+        i2s_table[i] = i2s_block[i] ;
+        fill(i2s_block[i], I2S_BLOCK) ;
+    }
+
+    // Two cycles per bit, two slots per frame
+    div = (float)clock_get_hz(clk_sys) / (4.0f * I2S_SLOT_BITS * fs) ;
+    sm = pio_claim_unused_sm(pio, true) ;
+#if I2S_BITS == 16
+    offset = pio_add_program(pio, &i2s16_program) ;
+    i2s16_program_init(pio, sm, offset, data_pin, clock_pin_base, div) ;
+#else
+    offset = pio_add_program(pio, &i2s32_program) ;
+    i2s32_program_init(pio, sm, offset, data_pin, clock_pin_base, div) ;
+#endif
+    // The divider is 16.8 fixed point
+    i2s_fs = (float)clock_get_hz(clk_sys) / (4.0f * I2S_SLOT_BITS *
+             ((int)(div * 256.0f) / 256.0f)) ;
+
+    i2s_data_chan = dma_claim_unused_channel(true) ;
+    i2s_ctrl_chan = dma_claim_unused_channel(true) ;
+
+    // Control channel: next block address into the data channel's read
+    // address (and trigger), walking the table
+    dma_channel_config c = dma_channel_get_default_config(i2s_ctrl_chan) ;
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c, true) ;
+    channel_config_set_write_increment(&c, false) ;
+    channel_config_set_ring(&c, false, I2S_TABLE_BITS) ;
+    dma_channel_configure(
+        i2s_ctrl_chan,
+        &c,
+        &dma_hw->ch[i2s_data_chan].al3_read_addr_trig,    // read address, and trigger
+        i2s_table,                                        // table of block addresses
+        1,                                                // one address per block
+        false
+    ) ;
+
+    // Data channel: one block into the TX FIFO, as fast as the PIO takes it
+    dma_channel_config c2 = dma_channel_get_default_config(i2s_data_chan) ;
+    channel_config_set_transfer_data_size(&c2, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c2, true) ;
+    channel_config_set_write_increment(&c2, false) ;
+    channel_config_set_dreq(&c2, pio_get_dreq(pio, sm, true)) ;
+    channel_config_set_chain_to(&c2, i2s_ctrl_chan) ;
+    dma_channel_configure(
+        i2s_data_chan,
+        &c2,
+        &pio->txf[sm],                  // write address (PIO TX FIFO)
+        i2s_block[0],                   // loaded by the control channel
+        I2S_BLOCK_WORDS,                // words per block
+        false
+    ) ;
+
+    // Interrupt at the end of every block
+    dma_channel_set_irq0_enabled(i2s_data_chan, true) ;
+    irq_add_shared_handler(DMA_IRQ_0, i2s_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY) ;
+    irq_set_enabled(DMA_IRQ_0, true) ;
+
+    // Fill the FIFO, then start the clocks
+    dma_start_channel_mask(1u << i2s_ctrl_chan) ;
+    pio_sm_set_enabled(pio, sm, true) ;
+}
+
+// Fill time of the last block as a percentage of the block period
+static inline int i2s_load(uint32_t fs) {
+    return (int)((uint64_t)i2s_render_us * fs / (10000u * I2S_BLOCK)) ;
+}
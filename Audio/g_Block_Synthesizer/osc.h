@@ -0,0 +1,196 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Band-limited oscillators for DDS
+ *
+ * The other audio demos index a 256-entry sine table with the top 8
+ * bits of the phase accumulator. That is fine for a sine, but a naive
+ * square, saw or triangle has harmonics far above Nyquist (25 kHz at
+ * 50 kHz) that fold back as audible aliasing. This file provides:
+ *
+ *  -- MIP-MAPPED WAVETABLES. One table per octave for saw, square and
+ *     triangle, each containing only the harmonics that stay below
+ *     Nyquist for the highest note of its octave. The octave comes
+ *     straight from the leading one of the phase increment, so table
+ *     selection is a count-leading-zeros, once per block.
+ *  -- LINEAR INTERPOLATION between table entries using the fractional
+ *     phase bits (tables have a guard entry, so no wrap test).
+ *  -- POLYBLEP saw and square: a naive waveform with the discontinuity
+ *     smoothed by a 2-sample polynomial step. No tables at all, and
+ *     the cost is only paid on the samples next to an edge.
+ *
+ * Everything is fix15, with full scale +/-1.0. Samples are rendered a
+ * block at a time with osc_render().
+ *
+ * TABLES
+ *   By default osc_init() builds the tables in RAM at startup (integer
+ *   additive synthesis, well under a second). Alternatively generate
+ *   them once on a host computer and keep them in flash:
+ *     gcc -O2 -o osc_table_gen osc_table_gen.c -lm
+ *     ./osc_table_gen > osc_tables.h
+ *   and define OSC_CONST_TABLES before including this file.
+ *
+ * Define fix15 (signed int) before including this file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+//                          CONFIGURATION PARAMETERS
+//
+// log2 of the table length
+#define OSC_TABLE_BITS      10
+#define OSC_TABLE_SIZE      (1 << OSC_TABLE_BITS)
+// log2 of the most harmonics in a table. At least 8 entries per cycle
+// of the top harmonic keep linear interpolation error down. Notes below
+// Fs/256 (195 Hz at 50 kHz) get 128 harmonics, not all up to Nyquist.
+#define OSC_HARMONIC_BITS   (OSC_TABLE_BITS - 3)
+// One level per octave, down to a single harmonic
+#define OSC_LEVELS          (OSC_HARMONIC_BITS + 1)
+// Increments whose leading one is at or below this bit use level 0
+#define OSC_LEVEL0_MSB      (30 - OSC_HARMONIC_BITS)
+
+// Waveforms
+#define OSC_SINE            0
+#define OSC_SAW             1
+#define OSC_SQUARE          2
+#define OSC_TRIANGLE        3
+#define OSC_BLEP_SAW        4
+#define OSC_BLEP_SQUARE     5
+#define OSC_TABLE_WAVES     3       // saw, square, triangle
+
+// Tables (OSC_TABLE_SIZE + 1 entries each, the last repeats the first)
+#ifdef OSC_CONST_TABLES
+#include "osc_tables.h"
+#else
+int16_t osc_sine[OSC_TABLE_SIZE + 1] ;
+int16_t osc_tables[OSC_TABLE_WAVES][OSC_LEVELS][OSC_TABLE_SIZE + 1] ;
+#endif
+
+// Harmonics in a level: those below Nyquist for the top of its octave
+static inline int osc_level_harmonics(int level) {
+    return 1 << (OSC_HARMONIC_BITS - level) ;
+}
+
+#ifndef OSC_CONST_TABLES
+// Build the sine and the band-limited tables by additive synthesis.
+// Harmonic h of sample n is sine[(h*n) mod N], so only integer math is
+// needed. Each waveform is scaled by one factor for all of its levels,
+// so every octave is equally loud.
+void osc_init() {
+    static int16_t q15_sine[OSC_TABLE_SIZE] ;
+    int64_t acc ;
+    int64_t peak ;
+    int w, l, n, h, H ;
+    int32_t coef ;
+
+    for (n = 0; n < OSC_TABLE_SIZE; n++) {
+        q15_sine[n] = (int16_t)lround(32767.0 * sin(6.283185307179586 * n / OSC_TABLE_SIZE)) ;
+        osc_sine[n] = q15_sine[n] ;
+    }
+    osc_sine[OSC_TABLE_SIZE] = osc_sine[0] ;
+
+    for (w = 0; w < OSC_TABLE_WAVES; w++) {
+        peak = 1 ;
+        for (l = 0; l < OSC_LEVELS; l++) {
+            H = osc_level_harmonics(l) ;
+            for (n = 0; n < OSC_TABLE_SIZE; n++) {
+                acc = 0 ;
+                for (h = 1; h <= H; h++) {
+                    // Fourier series, Q15 coefficients
+                    if (w == OSC_SAW - 1) {
+                        coef = 32768 / h ;
+                    }
+                    else {
+                        if (!(h & 1)) continue ;
+                        coef = (w == OSC_SQUARE - 1) ? (32768 / h) :
+                               (((h >> 1) & 1) ? -(32768 / (h*h)) : (32768 / (h*h))) ;
+                    }
+                    acc += (int64_t)coef * q15_sine[(h * n) & (OSC_TABLE_SIZE - 1)] ;
+                }
+                // Q30 -> Q14 (the Gibbs overshoot of a saw is ~1.85)
+                osc_tables[w][l][n] = (int16_t)(acc >> 16) ;
+                if (llabs(acc >> 16) > peak) peak = llabs(acc >> 16) ;
+            }
+        }
+        // then to full scale
+        for (l = 0; l < OSC_LEVELS; l++) {
+            for (n = 0; n < OSC_TABLE_SIZE; n++) {
+                osc_tables[w][l][n] = (int16_t)(((int32_t)osc_tables[w][l][n] * 32767) / (int32_t)peak) ;
+            }
+            osc_tables[w][l][OSC_TABLE_SIZE] = osc_tables[w][l][0] ;
+        }
+    }
+}
+#else
+void osc_init() { }
+#endif
+
+// Table for a waveform and phase increment (the octave is the position
+// of the increment's leading one)
+static inline const int16_t * osc_table(int wave, uint32_t incr) {
+    int level ;
+    if (wave == OSC_SINE) return osc_sine ;
+    level = incr ? ((31 - __builtin_clz(incr)) - OSC_LEVEL0_MSB) : 0 ;
+    if (level < 0) level = 0 ;
+    if (level > OSC_LEVELS - 1) level = OSC_LEVELS - 1 ;
+    return osc_tables[wave - 1][level] ;
+}
+
+// Interpolated table lookup: the top OSC_TABLE_BITS of the phase pick
+// the entry, the next 15 bits interpolate towards the following one
+static inline fix15 osc_lookup(const int16_t * table, uint32_t phase) {
+    uint32_t i = phase >> (32 - OSC_TABLE_BITS) ;
+    int frac = (phase >> (17 - OSC_TABLE_BITS)) & 0x7fff ;
+    int a = table[i] ;
+    return a + (((table[i + 1] - a) * frac) >> 15) ;
+}
+
+// PolyBLEP correction for a unit step at phase 0, for phase t and
+// increment dt (both 0-1 in Q32), as fix15
+static inline fix15 osc_polyblep(uint32_t t, uint32_t dt) {
+    int x ;
+    uint32_t d = dt >> 15 ;
+    if (d == 0) return 0 ;
+    if (t < dt) {
+        // just after the step: x in [0, 1)
+        x = t / d ;
+        return x + x - ((x * x) >> 15) - 32768 ;
+    }
+    if (t > (uint32_t)(0 - dt)) {
+        // just before the step: x in (-1, 0]
+        x = -(int)((0 - t) / d) ;
+        return ((x * x) >> 15) + x + x + 32768 ;
+    }
+    return 0 ;
+}
+
+// Render n samples of a waveform, advancing *phase by incr per sample
+void osc_render(int wave, uint32_t * phase, uint32_t incr, fix15 * out, int n) {
+    uint32_t p = *phase ;
+    int i ;
+    if (wave == OSC_BLEP_SAW) {
+        for (i = 0; i < n; i++) {
+            p += incr ;
+            // naive saw from -1 to +1, step down by 2 at phase 0
+            out[i] = (fix15)(p >> 16) - 32768 - osc_polyblep(p, incr) ;
+        }
+    }
+    else if (wave == OSC_BLEP_SQUARE) {
+        for (i = 0; i < n; i++) {
+            p += incr ;
+            // +1 for the first half, -1 for the second; steps at 0 and 1/2
+            out[i] = ((p & 0x80000000u) ? -32768 : 32767)
+                     + osc_polyblep(p, incr) - osc_polyblep(p + 0x80000000u, incr) ;
+        }
+    }
+    else {
+        const int16_t * table = osc_table(wave, incr) ;
+        for (i = 0; i < n; i++) {
+            p += incr ;
+            out[i] = osc_lookup(table, p) ;
+        }
+    }
+    *phase = p ;
+}
@@ -0,0 +1,47 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Host tool: prints the osc.h tables as const arrays, so they can live
+ * in flash instead of being built in RAM at startup.
+ *
+ *   gcc -O2 -o osc_table_gen osc_table_gen.c -lm
+ *   ./osc_table_gen > osc_tables.h
+ *
+ * then define OSC_CONST_TABLES before including osc.h. Not part of the
+ * Pico build.
+ */
+
+#include <stdio.h>
+
+typedef signed int fix15 ;
+#include "osc.h"
+
+static void print_table(const int16_t * t) {
+    int n ;
+    printf("    {") ;
+    for (n = 0; n <= OSC_TABLE_SIZE; n++) {
+        if ((n % 12) == 0) printf("\n        ") ;
+        printf("%6d,", t[n]) ;
+    }
+    printf("\n    }") ;
+}
+
+int main() {
+    int w, l ;
+    osc_init() ;
+    printf("// Generated by osc_table_gen.c for OSC_TABLE_BITS = %d, do not edit\n\n", OSC_TABLE_BITS) ;
+    printf("const int16_t osc_sine[OSC_TABLE_SIZE + 1] =\n") ;
+    print_table(osc_sine) ;
+    printf(" ;\n\n") ;
+    printf("const int16_t osc_tables[OSC_TABLE_WAVES][OSC_LEVELS][OSC_TABLE_SIZE + 1] = {\n") ;
+    for (w = 0; w < OSC_TABLE_WAVES; w++) {
+        printf("  {\n") ;
+        for (l = 0; l < OSC_LEVELS; l++) {
+            print_table(osc_tables[w][l]) ;
+            printf(",\n") ;
+        }
+        printf("  },\n") ;
+    }
+    printf("} ;\n") ;
+    return 0 ;
+}
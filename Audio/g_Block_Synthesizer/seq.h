@@ -0,0 +1,339 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Sample-accurate note sequencer for the block synthesizer
+ *
+ * The beep demos play their patterns with a state machine inside the
+ * 50 kHz ISR (STATE_0, count_0, BEEP_DURATION, BEEP_REPEAT_INTERVAL),
+ * so changing a pattern means changing ISR code. Here the application
+ * schedules notes ahead of time, and the renderer plays them:
+ *
+ *  -- EVENTS. A start time (on the synth_time sample clock), duration,
+ *     frequency, amplitude, instrument (envelope and waveform) and voice.
+ *  -- A LOCK-FREE QUEUE carries events from the application core to the
+ *     rendering core (one producer, one consumer, no locks). On the
+ *     rendering side they are kept sorted by time, so events can be
+ *     pushed in any order as long as they arrive before they are due.
+ *  -- SAMPLE ACCURACY. synth_render() calls seq_service() through
+ *     synth_sequencer and splits the block at every event time, so
+ *     notes start and release on their exact sample rather than at the
+ *     next block boundary. The renderer does no floating point.
+ *  -- PATTERNS. A compact binary format (4 bytes per note) that lives in
+ *     flash and is streamed into the queue a little ahead of time.
+ *
+ * PATTERN FORMAT (bytes, 16-bit fields little-endian)
+ *   header  0-1  tick length in samples
+ *           2-3  number of notes
+ *           4-5  pattern length in ticks (for looping)
+ *   note    0    ticks since the previous note started
+ *           1    MIDI note number (69 = A4 = 440 Hz), 0 for a rest
+ *           2    duration in ticks, before the release (0 for one
+ *                sample: a blip, just the release)
+ *           3    velocity (high 4 bits, 0-15) and instrument (low 4 bits)
+ * SEQ_PATTERN_HEADER() and SEQ_NOTE() write these in a const array.
+ *
+ * USAGE
+ *   seq_init() ;                                     // after synth_init()
+ *   seq_set_instrument(0, OSC_SAW, 5, 200, 0.4, 300) ;
+ *   seq_note(synth_time + 5000, 440.0, 0.5, 10000, 0, SEQ_ANY_VOICE) ;
+ *   seq_player_start(&player, pattern, synth_time + 1000, SEQ_ANY_VOICE, 1) ;
+ *   while (seq_player_feed(&player, SEQ_HORIZON)) ... ;   // from a thread
+ *
+ * Push events from one core only (several threads on that core are
+ * fine), and don't call synth_note_on() for voices the sequencer uses.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include "hardware/sync.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Events in the queue (power of 2)
+#ifndef SEQ_QUEUE
+#define SEQ_QUEUE           64
+#endif
+// Events waiting for their time on the rendering core
+#ifndef SEQ_PENDING
+#define SEQ_PENDING         32
+#endif
+// Instruments
+#define SEQ_INSTRUMENTS     16
+// How far ahead to schedule (samples). More than a few blocks, so an
+// event is in the queue before the block that plays it is rendered.
+#ifndef SEQ_HORIZON
+#define SEQ_HORIZON         (SYNTH_FS / 10)
+#endif
+
+// Voice for "any free voice" (from seq_first_voice up)
+#define SEQ_ANY_VOICE       0xff
+
+// Pattern authoring
+#define SEQ_PATTERN_HEADER(tick, notes, length) \
+    (tick) & 0xff, (tick) >> 8, (notes) & 0xff, (notes) >> 8, (length) & 0xff, (length) >> 8
+#define SEQ_NOTE(delta, note, duration, velocity, instrument) \
+    (delta), (note), (duration), (((velocity) << 4) | (instrument))
+#define SEQ_HEADER_BYTES    6
+#define SEQ_NOTE_BYTES      4
+
+struct seq_event {
+    uint32_t time ;             // start, in synth_time samples
+    uint32_t duration ;         // samples until release, 0 to hold
+    uint32_t phase_incr ;       // DDS increment
+    fix15 amplitude ;
+    uint8_t instrument ;
+    uint8_t voice ;             // or SEQ_ANY_VOICE
+} ;
+
+// Envelope and waveform, copied to the voice at each note
+struct seq_instrument {
+    uint32_t attack_samples ;
+    uint32_t decay_samples ;
+    uint32_t release_samples ;
+    fix15 sustain_level ;
+    uint8_t wave ;
+} ;
+
+struct seq_instrument seq_instruments[SEQ_INSTRUMENTS] ;
+
+// Application core -> rendering core
+static struct seq_event seq_queue[SEQ_QUEUE] ;
+static volatile uint32_t seq_queue_head = 0 ;     // written by the producer
+static volatile uint32_t seq_queue_tail = 0 ;     // written by the renderer
+
+// Rendering core: events waiting for their time, soonest first, and
+// each voice's release time
+static struct seq_event seq_pending[SEQ_PENDING] ;
+static int seq_pending_count = 0 ;
+static uint32_t seq_release_time[SYNTH_VOICES] ;
+static uint32_t seq_release_mask = 0 ;
+
+// SEQ_ANY_VOICE allocates from this voice up (leave lower voices to
+// events with a fixed voice)
+int seq_first_voice = 0 ;
+
+// Statistics: events that arrived after their time (played late), and
+// events with no free voice (dropped)
+volatile uint32_t seq_late = 0 ;
+volatile uint32_t seq_dropped = 0 ;
+
+// DDS increment of a MIDI note
+static inline uint32_t seq_note_incr(int note) {
+    return (uint32_t)(440.0 * pow(2.0, (note - 69) / 12.0) * two32 / SYNTH_FS) ;
+}
+
+// Envelope and waveform of instrument k (ms, ms, level, ms)
+void seq_set_instrument(int k, int wave, float attack_ms, float decay_ms,
+                        float sustain, float release_ms) {
+    struct seq_instrument * p = &seq_instruments[k] ;
+    p->attack_samples = (uint32_t)(attack_ms * SYNTH_FS / 1000.0) + 1 ;
+    p->decay_samples = (uint32_t)(decay_ms * SYNTH_FS / 1000.0) + 1 ;
+    p->release_samples = (uint32_t)(release_ms * SYNTH_FS / 1000.0) + 1 ;
+    p->sustain_level = float2fix15(sustain) ;
+    p->wave = wave ;
+}
+
+////////////////////////////////////////////////////////////////////////
+////////////////////////// PRODUCER SIDE ////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+
+// Free slots in the queue
+static inline int seq_space() {
+    return SEQ_QUEUE - (int)(seq_queue_head - seq_queue_tail) ;
+}
+
+// Queue an event. Returns 0 if the queue is full.
+int seq_push(const struct seq_event * e) {
+    uint32_t head = seq_queue_head ;
+    if (head - seq_queue_tail >= SEQ_QUEUE) return 0 ;
+    seq_queue[head & (SEQ_QUEUE - 1)] = *e ;
+    // event written before the renderer can see it
+    __dmb() ;
+    seq_queue_head = head + 1 ;
+    return 1 ;
+}
+
+// Queue a note (time and duration in samples, frequency in Hz,
+// amplitude 0-1). Returns 0 if the queue is full.
+int seq_note(uint32_t time, float frequency, float amplitude, uint32_t duration,
+             int instrument, int voice) {
+    struct seq_event e ;
+    e.time = time ;
+    e.duration = duration ;
+    e.phase_incr = (uint32_t)((frequency*two32)/SYNTH_FS) ;
+    e.amplitude = float2fix15(amplitude) ;
+    e.instrument = instrument ;
+    e.voice = voice ;
+    return seq_push(&e) ;
+}
+
+// A pattern being streamed into the queue
+struct seq_player {
+    const uint8_t * pattern ;
+    uint32_t tick ;             // samples per tick
+    int notes ;
+    uint32_t length ;           // ticks
+    int index ;                 // next note
+    uint32_t start ;            // time of this pass through the pattern
+    uint32_t ticks ;            // start of the next note, in ticks
+    uint8_t voice ;
+    uint8_t loop ;
+} ;
+
+static inline uint32_t seq_read16(const uint8_t * p) {
+    return p[0] | (p[1] << 8) ;
+}
+
+// Play a pattern from sample time `time` on a voice (or SEQ_ANY_VOICE),
+// once or looped
+void seq_player_start(struct seq_player * p, const uint8_t * pattern, uint32_t time,
+                      int voice, int loop) {
+    p->pattern = pattern ;
+    p->tick = seq_read16(pattern) ;
+    p->notes = seq_read16(pattern + 2) ;
+    p->length = seq_read16(pattern + 4) ;
+    p->index = 0 ;
+    p->start = time ;
+    p->ticks = 0 ;
+    p->voice = voice ;
+    p->loop = loop ;
+}
+
+// Queue the pattern's notes that start within `horizon` samples of now.
+// Call it regularly. Returns 0 once a non-looping pattern has been
+// queued completely.
+int seq_player_feed(struct seq_player * p, uint32_t horizon) {
+    const uint8_t * rec ;
+    struct seq_event e ;
+    uint32_t time ;
+    while (1) {
+        if (p->index >= p->notes) {
+            if (!p->loop || p->notes == 0 || p->length == 0) return 0 ;
+            p->index = 0 ;
+            p->start += p->length * p->tick ;
+            p->ticks = 0 ;
+        }
+        rec = p->pattern + SEQ_HEADER_BYTES + SEQ_NOTE_BYTES * p->index ;
+        time = p->start + (p->ticks + rec[0]) * p->tick ;
+        if ((int32_t)(time - synth_time) >= (int32_t)horizon) return 1 ;
+        if (rec[1]) {
+            e.time = time ;
+            // a pattern note always ends (0 would hold it forever)
+            e.duration = rec[2] ? rec[2] * p->tick : 1 ;
+            e.phase_incr = seq_note_incr(rec[1]) ;
+            e.amplitude = ((rec[3] >> 4) * 32768) / 15 ;
+            e.instrument = rec[3] & 0x0f ;
+            e.voice = p->voice ;
+            if (!seq_push(&e)) return 1 ;
+        }
+        p->ticks += rec[0] ;
+        p->index++ ;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+////////////////////////// RENDERING SIDE ///////////////////////////////
+////////////////////////////////////////////////////////////////////////
+
+// Start the note of an event
+static void seq_apply(const struct seq_event * e) {
+    struct seq_instrument * inst = &seq_instruments[e->instrument & (SEQ_INSTRUMENTS - 1)] ;
+    struct synth_voice * p ;
+    int v = e->voice ;
+    if (v == SEQ_ANY_VOICE) v = synth_free_voice(seq_first_voice) ;
+    if (v < 0 || v >= SYNTH_VOICES) {
+        seq_dropped++ ;
+        return ;
+    }
+    p = &synth_voices[v] ;
+    p->attack_samples = inst->attack_samples ;
+    p->decay_samples = inst->decay_samples ;
+    p->release_samples = inst->release_samples ;
+    p->sustain_level = inst->sustain_level ;
+    p->wave = inst->wave ;
+    synth_note_on_incr(v, e->phase_incr, e->amplitude) ;
+    if (e->duration) {
+        seq_release_time[v] = e->time + e->duration ;
+        seq_release_mask |= 1u << v ;
+    }
+    else {
+        seq_release_mask &= ~(1u << v) ;
+    }
+}
+
+// synth_sequencer: move new events into the pending list, play what is
+// due at `now`, and return the samples until the next event (at most n)
+int seq_service(uint32_t now, int n) {
+    struct seq_event e ;
+    int32_t dt ;
+    int i, v ;
+
+    // queue -> pending, kept in time order (insertion)
+    while (seq_queue_tail != seq_queue_head && seq_pending_count < SEQ_PENDING) {
+        // head read before the event
+        __dmb() ;
+        e = seq_queue[seq_queue_tail & (SEQ_QUEUE - 1)] ;
+        seq_queue_tail++ ;
+        i = seq_pending_count++ ;
+        while (i > 0 && (int32_t)(seq_pending[i - 1].time - e.time) > 0) {
+            seq_pending[i] = seq_pending[i - 1] ;
+            i-- ;
+        }
+        seq_pending[i] = e ;
+    }
+
+    // releases that are due (before note-ons, so a note can be
+    // released and restarted on the same sample)
+    if (seq_release_mask) {
+        for (v = 0; v < SYNTH_VOICES; v++) {
+            if ((seq_release_mask & (1u << v)) && (int32_t)(seq_release_time[v] - now) <= 0) {
+                synth_note_off(v) ;
+                seq_release_mask &= ~(1u << v) ;
+            }
+        }
+    }
+
+    // note-ons that are due
+    for (i = 0; i < seq_pending_count && (int32_t)(seq_pending[i].time - now) <= 0; i++) {
+        if (seq_pending[i].time != now) seq_late++ ;
+        seq_apply(&seq_pending[i]) ;
+    }
+    if (i) {
+        seq_pending_count -= i ;
+        memmove(seq_pending, &seq_pending[i], seq_pending_count * sizeof(struct seq_event)) ;
+    }
+
+    // render up to the next event
+    if (seq_pending_count) {
+        dt = (int32_t)(seq_pending[0].time - now) ;
+        if (dt < n) n = dt ;
+    }
+    // (a late note can have its release in the past already: release it
+    // now, rather than return a part of 0 or less)
+    if (seq_release_mask) {
+        for (v = 0; v < SYNTH_VOICES; v++) {
+            if (seq_release_mask & (1u << v)) {
+                dt = (int32_t)(seq_release_time[v] - now) ;
+                if (dt <= 0) {
+                    synth_note_off(v) ;
+                    seq_release_mask &= ~(1u << v) ;
+                }
+                else if (dt < n) n = dt ;
+            }
+        }
+    }
+    return (n < 1) ? 1 : n ;
+}
+
+// Default instrument (the synth's default envelope, sine) and hook the
+// sequencer into the renderer
+void seq_init() {
+    int k ;
+    for (k = 0; k < SEQ_INSTRUMENTS; k++) {
+        seq_set_instrument(k, OSC_SINE, 5, 100, 0.5, 300) ;
+    }
+    seq_pending_count = 0 ;
+    seq_release_mask = 0 ;
+    synth_sequencer = seq_service ;
+}
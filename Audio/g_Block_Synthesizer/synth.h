@@ -0,0 +1,326 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Block-based polyphonic DDS synthesizer
+ *
+ * The beep demos compute one sample per timer interrupt (50,000
+ * interrupts per second, per voice). This engine instead renders a
+ * whole block of samples at a time: every active voice adds a block of
+ * DDS samples (the same phase accumulator scheme as the other demos,
+ * with the band-limited oscillators of osc.h) into a fix15 mix buffer,
+ * and the mix is converted to DAC words once at the end. Interrupt and
+ * call overhead is paid once per block, and inactive voices cost
+ * nothing, so 16+ voices fit on one core.
+ *
+ * Each voice has an ADSR envelope:
+ *   ATTACK   ramp from 0 to the note amplitude
+ *   DECAY    ramp down to the sustain level
+ *   SUSTAIN  hold until synth_note_off()
+ *   RELEASE  ramp down to 0, then the voice is free
+ * The envelope is stepped every sample, so ramps are click-free.
+ *
+ * USAGE
+ *   synth_init() ;                              // builds the wavetables
+ *   synth_set_adsr(v, 5, 100, 0.5, 300) ;       // ms, ms, level, ms
+ *   synth_set_wave(v, OSC_SAW) ;                // default OSC_SINE
+ *   v = synth_note_on_any(440.0, 0.5) ;         // or synth_note_on(v, ...)
+ *   synth_note_off(v) ;
+ *   synth_effects = my_effects ;                // optional, on the mix
+ *   synth_render(block, SYNTH_BLOCK, DAC_config_chan_A) ;   // MCP4822 words
+ *   synth_render_i2s(frames, I2S_BLOCK, I2S_BITS) ;          // or I2S frames
+ *
+ * Notes are started and stopped from one core while the other core
+ * renders (see synth_dac.h). Each field has a single writer: note
+ * on/off only write the note parameters, a note counter and the gate,
+ * and the renderer owns the envelope state, so no lock is needed.
+ * Note changes take effect at the start of the next block, or on their
+ * exact sample when they come from the sequencer (seq.h), which splits
+ * the block at event times through synth_sequencer.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+//                          CONFIGURATION PARAMETERS
+//
+// Sample rate (Hz)
+#ifndef SYNTH_FS
+#define SYNTH_FS        50000
+#endif
+// Number of voices
+#ifndef SYNTH_VOICES
+#define SYNTH_VOICES    16
+#endif
+// Largest block synth_render() accepts
+#ifndef SYNTH_BLOCK_MAX
+#define SYNTH_BLOCK_MAX 256
+#endif
+
+// Macros for fixed-point arithmetic (faster than floating point)
+typedef signed int fix15 ;
+#define multfix15(a,b) ((fix15)((((signed long long)(a))*((signed long long)(b)))>>15))
+#define float2fix15(a) ((fix15)((a)*32768.0))
+#define fix2float15(a) ((float)(a)/32768.0)
+#define absfix15(a) abs(a)
+#define int2fix15(a) ((fix15)(a << 15))
+#define fix2int15(a) ((int)(a >> 15))
+#define char2fix15(a) (fix15)(((fix15)(a)) << 15)
+#define divfix(a,b) (fix15)( (((signed long long)(a)) << 15) / (b))
+
+//DDS parameters
+#define two32 4294967296.0 // 2^32
+
+// Band-limited oscillators (tables built in synth_init())
+#include "osc.h"
+
+// Envelope states
+#define SYNTH_OFF       0
+#define SYNTH_ATTACK    1
+#define SYNTH_DECAY     2
+#define SYNTH_SUSTAIN   3
+#define SYNTH_RELEASE   4
+
+struct synth_voice {
+    // DDS
+    uint32_t phase_accum ;
+    uint32_t phase_incr ;
+    uint8_t wave ;              // OSC_SINE, OSC_SAW, ...
+    // envelope, all fix15 (1.0 is a full-scale sine)
+    fix15 amplitude ;           // current
+    fix15 peak ;                // end of attack
+    fix15 sustain ;             // sustain level
+    fix15 attack_inc ;          // per-sample steps
+    fix15 decay_inc ;
+    fix15 release_inc ;
+    // envelope shape (samples, and sustain as a fraction of peak)
+    uint32_t attack_samples ;
+    uint32_t decay_samples ;
+    uint32_t release_samples ;
+    fix15 sustain_level ;
+    // written by note on/off
+    volatile uint32_t notes ;   // note-ons so far
+    volatile uint8_t gate ;     // key held
+    // written by the renderer
+    uint32_t notes_seen ;
+    volatile uint8_t state ;
+} ;
+
+struct synth_voice synth_voices[SYNTH_VOICES] ;
+
+// Output scale: DAC counts for a mix of 1.0 (2047 * master gain)
+int synth_output_scale = 512 ;
+
+// Optional effects on the mix, called once per block before the DAC
+// conversion (e.g. a dsp_graph from dsp.h)
+void (*synth_effects)(fix15 * mix, int n) = NULL ;
+
+// Optional sequencer, called by the renderer with the current sample
+// time before each part of a block. It applies the events due at `now`
+// and returns how many samples (1 to n) to render before the next one.
+int (*synth_sequencer)(uint32_t now, int n) = NULL ;
+
+// Samples rendered so far (the sequencer's clock)
+volatile uint32_t synth_time = 0 ;
+
+// Set the envelope of a voice (takes effect at its next note)
+void synth_set_adsr(int v, float attack_ms, float decay_ms, float sustain, float release_ms) {
+    struct synth_voice * p = &synth_voices[v] ;
+    p->attack_samples = (uint32_t)(attack_ms * SYNTH_FS / 1000.0) + 1 ;
+    p->decay_samples = (uint32_t)(decay_ms * SYNTH_FS / 1000.0) + 1 ;
+    p->release_samples = (uint32_t)(release_ms * SYNTH_FS / 1000.0) + 1 ;
+    p->sustain_level = float2fix15(sustain) ;
+}
+
+// Set the waveform of a voice
+void synth_set_wave(int v, int wave) {
+    synth_voices[v].wave = wave ;
+}
+
+// Master gain: a mix of `gain` full-scale voices reaches the DAC rails
+void synth_set_gain(float gain) {
+    synth_output_scale = (int)(2047.0 * gain) ;
+}
+
+// Build the oscillator tables and give every voice a sine and a
+// default envelope
+void synth_init() {
+    int ii ;
+    osc_init() ;
+    for (ii = 0; ii < SYNTH_VOICES; ii++) {
+        synth_voices[ii].state = SYNTH_OFF ;
+        synth_voices[ii].wave = OSC_SINE ;
+        synth_set_adsr(ii, 5, 100, 0.5, 300) ;
+    }
+    // four full-scale voices before clipping
+    synth_set_gain(0.25) ;
+}
+
+// Start a note on voice v from a DDS increment and a fix15 amplitude
+// (no floating point, so the sequencer can call it while rendering)
+void synth_note_on_incr(int v, uint32_t incr, fix15 amplitude) {
+    struct synth_voice * p = &synth_voices[v] ;
+    p->phase_incr = incr ;
+    p->peak = amplitude ;
+    p->sustain = multfix15(p->peak, p->sustain_level) ;
+    p->attack_inc = p->peak / (fix15)p->attack_samples + 1 ;
+    p->decay_inc = (p->peak - p->sustain) / (fix15)p->decay_samples + 1 ;
+    p->release_inc = p->peak / (fix15)p->release_samples + 1 ;
+    p->gate = 1 ;
+    // the renderer restarts the envelope when it sees a new note
+    p->notes++ ;
+}
+
+// Start a note on voice v (frequency in Hz, amplitude 0-1)
+void synth_note_on(int v, float frequency, float amplitude) {
+    synth_note_on_incr(v, (uint32_t)((frequency*two32)/SYNTH_FS), float2fix15(amplitude)) ;
+}
+
+// Release the note on voice v
+void synth_note_off(int v) {
+    synth_voices[v].gate = 0 ;
+}
+
+// A free voice from first up, or else the quietest released one.
+// Returns -1 if every voice is still held.
+int synth_free_voice(int first) {
+    int v, best = -1 ;
+    for (v = first; v < SYNTH_VOICES; v++) {
+        if (synth_voices[v].state == SYNTH_OFF && synth_voices[v].notes == synth_voices[v].notes_seen) {
+            best = v ;
+            break ;
+        }
+        if (!synth_voices[v].gate &&
+            (best < 0 || synth_voices[v].amplitude < synth_voices[best].amplitude)) {
+            best = v ;
+        }
+    }
+    return best ;
+}
+
+// Start a note on a free voice, or steal the quietest released one.
+// Returns the voice, or -1 if every voice is still held.
+int synth_note_on_any(float frequency, float amplitude) {
+    int v = synth_free_voice(0) ;
+    if (v >= 0) synth_note_on(v, frequency, amplitude) ;
+    return v ;
+}
+
+// Voices currently sounding
+int synth_active_voices() {
+    int v, n = 0 ;
+    for (v = 0; v < SYNTH_VOICES; v++) {
+        if (synth_voices[v].state != SYNTH_OFF || synth_voices[v].gate) n++ ;
+    }
+    return n ;
+}
+
+// Add n samples of voice p into mix
+static void synth_render_voice(struct synth_voice * p, fix15 * mix, int n) {
+    static fix15 wave[SYNTH_BLOCK_MAX] ;
+    fix15 amp ;
+    int state, i ;
+    // new note: restart the envelope
+    if (p->notes != p->notes_seen) {
+        p->notes_seen = p->notes ;
+        p->phase_accum = 0 ;
+        p->amplitude = 0 ;
+        p->state = SYNTH_ATTACK ;
+    }
+    // key released
+    else if (!p->gate && p->state != SYNTH_OFF) {
+        p->state = SYNTH_RELEASE ;
+    }
+    if (p->state == SYNTH_OFF) return ;
+    // a block of the oscillator, then the envelope
+    osc_render(p->wave, &p->phase_accum, p->phase_incr, wave, n) ;
+    amp = p->amplitude ;
+    state = p->state ;
+    for (i = 0; i < n; i++) {
+        // step the envelope
+        switch (state) {
+            case SYNTH_ATTACK:
+                amp += p->attack_inc ;
+                if (amp >= p->peak) {
+                    amp = p->peak ;
+                    state = SYNTH_DECAY ;
+                }
+                break ;
+            case SYNTH_DECAY:
+                amp -= p->decay_inc ;
+                if (amp <= p->sustain) {
+                    amp = p->sustain ;
+                    state = SYNTH_SUSTAIN ;
+                }
+                break ;
+            case SYNTH_RELEASE:
+                amp -= p->release_inc ;
+                if (amp <= 0) {
+                    amp = 0 ;
+                    state = SYNTH_OFF ;
+                }
+                break ;
+            default:
+                break ;
+        }
+        // Both factors are at most 1.0, so a 32-bit multiply is
+        // enough (no 64-bit multfix15)
+        mix[i] += (amp * wave[i]) >> 15 ;
+    }
+    p->amplitude = amp ;
+    p->state = state ;
+}
+
+// Render n samples of all voices, through the effects, into mix (fix15)
+void synth_mix(fix15 * mix, int n) {
+    int v, i, part ;
+    memset(mix, 0, n * sizeof(fix15)) ;
+    // the block, in parts that end where sequencer events fall
+    for (i = 0; i < n; i += part) {
+        part = synth_sequencer ? synth_sequencer(synth_time, n - i) : n ;
+        for (v = 0; v < SYNTH_VOICES; v++) {
+            synth_render_voice(&synth_voices[v], mix + i, part) ;
+        }
+        synth_time += part ;
+    }
+    if (synth_effects) synth_effects(mix, n) ;
+}
+
+// Render n samples of all voices as MCP4822 words (with dac_config bits)
+void synth_render(uint16_t * out, int n, uint16_t dac_config) {
+    static fix15 mix[SYNTH_BLOCK_MAX] ;
+    int i, s ;
+    synth_mix(mix, n) ;
+    for (i = 0; i < n; i++) {
+        // mix is at most SYNTH_VOICES (2^4) in fix15, scale is 11 bits
+        s = (mix[i] * synth_output_scale) >> 15 ;
+        if (s > 2047) s = 2047 ;
+        if (s < -2047) s = -2047 ;
+        out[i] = dac_config | ((s + 2048) & 0x0fff) ;
+    }
+}
+
+// Render n samples of all voices as I2S stereo frames (i2s_out.h), the
+// mix on both channels. bits is 16 (one word per frame, left in the
+// high half) or 24 (two words per frame, samples in the top 24 bits).
+// The master gain is the same as for the DAC: 2047 DAC counts is full
+// scale here too.
+void synth_render_i2s(uint32_t * out, int n, int bits) {
+    static fix15 mix[SYNTH_BLOCK_MAX] ;
+    int i, s ;
+    synth_mix(mix, n) ;
+    for (i = 0; i < n; i++) {
+        // DAC counts << 12 is 24 bits: (mix * scale) >> 15 << 12
+        s = (mix[i] * synth_output_scale) >> 3 ;
+        if (s > 8388607) s = 8388607 ;
+        if (s < -8388607) s = -8388607 ;
+        if (bits == 16) {
+            s >>= 8 ;
+            out[i] = ((uint32_t)s << 16) | (s & 0xffff) ;
+        }
+        else {
+            out[2*i] = (uint32_t)s << 8 ;
+            out[2*i + 1] = (uint32_t)s << 8 ;
+        }
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * DMA block output to the MCP4822 SPI DAC
+ *
+ * Like the DMA demo (e_DMA_Demo), a data channel paced by a DMA timer
+ * writes 16-bit DAC words to the SPI data register, and a control
+ * channel re-points it when it finishes. Here the control channel walks
+ * a table of SYNTH_DAC_BUFFERS block addresses instead of replaying one
+ * static table, so the output is a continuous ring of blocks:
+ *
+ *   data channel plays block k --> chains to control channel
+ *   control channel loads block k+1 into the data channel and triggers it
+ *   DMA interrupt: block k is free, render the next samples into it
+ *
+ * The CPU is involved once per block (SYNTH_BLOCK samples), not once per
+ * sample, and it has (SYNTH_DAC_BUFFERS - 1) blocks of time to render.
+ * The interrupt runs on the core that called synth_dac_start(), so call
+ * it from core 1 to give core 0 to the application.
+ *
+ * RESOURCES USED
+ *  - SPI_PORT (16-bit format, set up by the application)
+ *  - 2 DMA channels and 1 DMA timer (claimed at start)
+ *  - DMA_IRQ_0 (shared handler)
+ */
+
+#include "hardware/dma.h"
+#include "hardware/spi.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Samples per block
+#ifndef SYNTH_BLOCK
+#define SYNTH_BLOCK             64
+#endif
+// Blocks in the DMA ring (power of 2, max 8)
+#ifndef SYNTH_DAC_BUFFERS
+#define SYNTH_DAC_BUFFERS       2
+#endif
+// log2 of the address table size in bytes (4 bytes per block)
+#define SYNTH_DAC_TABLE_BITS    (SYNTH_DAC_BUFFERS == 8 ? 5 : (SYNTH_DAC_BUFFERS == 4 ? 4 : 3))
+
+// Fills a block with n DAC words
+typedef void (*synth_dac_fill_fn)(uint16_t * block, int n) ;
+
+// The blocks, and the table of their addresses the control channel walks
+// (a ring on its read address, so aligned to its size)
+uint16_t synth_dac_block[SYNTH_DAC_BUFFERS][SYNTH_BLOCK] ;
+uint16_t * synth_dac_table[SYNTH_DAC_BUFFERS]
+    __attribute__((aligned(1 << SYNTH_DAC_TABLE_BITS))) ;
+
+static int synth_dac_data_chan ;
+static int synth_dac_ctrl_chan ;
+static synth_dac_fill_fn synth_dac_fill ;
+
+// Blocks played so far
+volatile uint32_t synth_dac_blocks = 0 ;
+// Time spent rendering the last block, and the worst so far (us)
+volatile uint32_t synth_dac_render_us = 0 ;
+volatile uint32_t synth_dac_render_max_us = 0 ;
+
+// A block finished playing: refill it
+static void synth_dac_irq() {
+    uint32_t start ;
+    if (dma_channel_get_irq0_status(synth_dac_data_chan)) {
+        dma_channel_acknowledge_irq0(synth_dac_data_chan) ;
+        start = time_us_32() ;
+        synth_dac_fill(synth_dac_block[synth_dac_blocks & (SYNTH_DAC_BUFFERS - 1)], SYNTH_BLOCK) ;
+        synth_dac_blocks++ ;
+        synth_dac_render_us = time_us_32() - start ;
+        if (synth_dac_render_us > synth_dac_render_max_us) {
+            synth_dac_render_max_us = synth_dac_render_us ;
+        }
+    }
+}
+
+// Render every block, then start streaming at fs (Hz) to the SPI port.
+// fill() is called from the DMA interrupt, on the calling core.
+void synth_dac_start(spi_inst_t * spi, uint32_t fs, synth_dac_fill_fn fill) {
+    int i ;
+    synth_dac_fill = fill ;
+    for (i = 0; i < SYNTH_DAC_BUFFERS; i++) {
+        synth_dac_table[i] = synth_dac_block[i] ;
+        fill(synth_dac_block[i], SYNTH_BLOCK) ;
+    }
+
+    synth_dac_data_chan = dma_claim_unused_channel(true) ;
+    synth_dac_ctrl_chan = dma_claim_unused_channel(true) ;
+    int timer = dma_claim_unused_timer(true) ;
+
+    // Sample clock: clk_sys * 1/Y
+    dma_timer_set_fraction(timer, 1, clock_get_hz(clk_sys) / fs) ;
+
+    // Control channel: next block address into the data channel's read
+    // address (and trigger), walking the table
+    dma_channel_config c = dma_channel_get_default_config(synth_dac_ctrl_chan) ;
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c, true) ;
+    channel_config_set_write_increment(&c, false) ;
+    channel_config_set_ring(&c, false, SYNTH_DAC_TABLE_BITS) ;
+    dma_channel_configure(
+        synth_dac_ctrl_chan,
+        &c,
+        &dma_hw->ch[synth_dac_data_chan].al3_read_addr_trig,  // read address, and trigger
+        synth_dac_table,                                      // table of block addresses
+        1,                                                    // one address per block
+        false
+    ) ;
+
+    // Data channel: one block to the SPI data register at the sample rate
+    dma_channel_config c2 = dma_channel_get_default_config(synth_dac_data_chan) ;
+    channel_config_set_transfer_data_size(&c2, DMA_SIZE_16) ;
+    channel_config_set_read_increment(&c2, true) ;
+    channel_config_set_write_increment(&c2, false) ;
+    channel_config_set_dreq(&c2, dma_get_timer_dreq(timer)) ;
+    channel_config_set_chain_to(&c2, synth_dac_ctrl_chan) ;
+    dma_channel_configure(
+        synth_dac_data_chan,
+        &c2,
+        &spi_get_hw(spi)->dr,           // write address (SPI data register)
+        synth_dac_block[0],             // loaded by the control channel
+        SYNTH_BLOCK,                    // samples per block
+        false
+    ) ;
+
+    // Interrupt at the end of every block
+    dma_channel_set_irq0_enabled(synth_dac_data_chan, true) ;
+    irq_add_shared_handler(DMA_IRQ_0, synth_dac_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY) ;
+    irq_set_enabled(DMA_IRQ_0, true) ;
+
+    dma_start_channel_mask(1u << synth_dac_ctrl_chan) ;
+}
+
+// Render time of the last block as a percentage of the block period
+static inline int synth_dac_load(uint32_t fs) {
+    return (int)((uint64_t)synth_dac_render_us * fs / (10000u * SYNTH_BLOCK)) ;
+}
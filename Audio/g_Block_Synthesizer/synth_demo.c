@@ -0,0 +1,295 @@
+/**
+ *  V. Hunter Adams (vha3@cornell.edu)
+
+    Block-based polyphonic synthesizer.
+
+    The beep demos run one DDS voice per core from 50 kHz alarm
+    interrupts, each writing one sample to the DAC with
+    spi_write16_blocking. Here core 1 renders blocks of SYNTH_BLOCK
+    samples for up to SYNTH_VOICES voices (synth.h), and a DMA channel
+    paced by a DMA timer streams the blocks to the DAC (synth_dac.h).
+    Core 1 takes one interrupt per block instead of one per sample.
+
+    With SYNTH_OUTPUT_I2S set, the blocks go to a stereo I2S DAC (such
+    as a PCM5102A) through the PIO instead (i2s_out.h), at 48 kHz with
+    16 or 24 bits (I2S_BITS). The engine and the music are the same,
+    only the conversion of the mix at the end of each block changes.
+
+    Core 0 schedules the music with the sequencer (seq.h): a looping
+    pentatonic pattern stored in flash, and the beep of the beep demos
+    (400 Hz for 210 ms every second) as events on voice 0 that
+    start and stop on their exact sample. No note logic runs in the
+    sample path. Instruments use the band-limited waveforms of osc.h.
+    Once a second core 0 prints the number of voices and the render
+    time per block.
+
+    The mix goes through an effects chain (dsp.h) before the DAC: a
+    4th-order lowpass, chorus, echo and reverb. The stats line includes
+    the clk_sys cycles per sample each effect takes (a 50 kHz sample at
+    125 MHz is 2500 cycles).
+
+    SPI DAC (default)
+    GPIO 5 (pin 7) Chip select
+    GPIO 6 (pin 9) SCK/spi0_sclk
+    GPIO 7 (pin 10) MOSI/spi0_tx
+    GPIO 8 (pin 11) LDAC (held low)
+    3.3v (pin 36) -> VCC on DAC
+    GND (pin 3)  -> GND on DAC
+
+    I2S DAC (SYNTH_OUTPUT_I2S)
+    GPIO 9 (pin 12) -> DIN
+    GPIO 10 (pin 14) -> BCK
+    GPIO 11 (pin 15) -> LRCK
+    GND -> SCK (the DAC's own PLL makes the master clock)
+
+ */
+
+// Include necessary libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#include "hardware/spi.h"
+// Include protothreads
+#include "pt_cornell_rp2040_v1_4.h"
+
+// Output: 0 for the MCP4822 SPI DAC, 1 for an I2S DAC
+#define SYNTH_OUTPUT_I2S    0
+
+// Synthesizer and its DMA output
+#if SYNTH_OUTPUT_I2S
+#define SYNTH_FS            48000
+#define I2S_BITS            16          // or 24
+#include "synth.h"
+#include "i2s_out.h"
+#define SYNTH_BLOCK         I2S_BLOCK
+#else
+#include "synth.h"
+#include "synth_dac.h"
+#endif
+// Sequencer
+#include "seq.h"
+// Effects
+#include "dsp.h"
+
+// DAC parameters (see the DAC datasheet)
+// A-channel, 1x, active
+#define DAC_config_chan_A 0b0011000000000000
+
+//SPI configurations (note these represent GPIO number, NOT pin number)
+#define PIN_MISO 4
+#define PIN_CS   5
+#define PIN_SCK  6
+#define PIN_MOSI 7
+#define LDAC     8
+#define LED      25
+#define SPI_PORT spi0
+
+// I2S (LRCK is the GPIO after BCLK)
+#define PIN_I2S_DATA    9
+#define PIN_I2S_BCLK    10
+
+// Instruments
+#define LEAD                0
+#define BASS                1
+#define BEEP                2
+
+// The beep of beep_beep.c, in samples: 10500 on, repeating every 50000,
+// with 250-sample attack and release at 50 kHz. Voice 0 is kept for it.
+#define BEEP_FREQUENCY          400.0
+#define BEEP_DURATION           (SYNTH_FS * 21 / 100)
+#define BEEP_REPEAT_INTERVAL    SYNTH_FS
+#define BEEP_RAMP               (SYNTH_FS / 200)
+#define BEEP_VOICE              0
+
+// Two bars of A minor pentatonic, 16th notes at 120 bpm (1/8 second)
+const uint8_t pattern[] = {
+    SEQ_PATTERN_HEADER(SYNTH_FS / 8, 20, 32),
+    SEQ_NOTE(0, 45, 6, 12, BASS),   SEQ_NOTE(0, 57, 1, 10, LEAD),
+    SEQ_NOTE(2, 60, 1, 8, LEAD),    SEQ_NOTE(2, 64, 1, 10, LEAD),
+    SEQ_NOTE(2, 67, 2, 8, LEAD),
+    SEQ_NOTE(2, 45, 6, 12, BASS),   SEQ_NOTE(0, 69, 1, 10, LEAD),
+    SEQ_NOTE(2, 67, 1, 8, LEAD),    SEQ_NOTE(2, 64, 1, 10, LEAD),
+    SEQ_NOTE(2, 62, 2, 8, LEAD),
+    SEQ_NOTE(2, 48, 6, 12, BASS),   SEQ_NOTE(0, 60, 1, 10, LEAD),
+    SEQ_NOTE(2, 64, 1, 8, LEAD),    SEQ_NOTE(2, 67, 1, 10, LEAD),
+    SEQ_NOTE(2, 72, 2, 8, LEAD),
+    SEQ_NOTE(2, 43, 6, 12, BASS),   SEQ_NOTE(0, 69, 1, 10, LEAD),
+    SEQ_NOTE(2, 67, 1, 8, LEAD),    SEQ_NOTE(2, 62, 1, 10, LEAD),
+    SEQ_NOTE(2, 64, 2, 8, LEAD),
+} ;
+
+// Effects chain, and the delay lines it needs
+struct dsp_graph effects ;
+struct dsp_filter tone ;
+struct dsp_chorus chorus ;
+struct dsp_delay echo ;
+struct dsp_reverb reverb ;
+int16_t chorus_line[1 << 10] ;      // 20 ms
+int16_t echo_line[1 << 14] ;        // 327 ms
+
+// Runs on the mix of every block
+void run_effects(fix15 * mix, int n) {
+    dsp_graph_process(&effects, mix, n) ;
+}
+
+// Called from the DMA interrupt on core 1 for every block
+#if SYNTH_OUTPUT_I2S
+void render_block(uint32_t * block, int n) {
+    synth_render_i2s(block, n, I2S_BITS) ;
+}
+// Same statistics as the SPI DAC output
+#define synth_dac_render_us     i2s_render_us
+#define synth_dac_render_max_us i2s_render_max_us
+#define synth_dac_blocks        i2s_blocks
+#define synth_dac_load          i2s_load
+#else
+void render_block(uint16_t * block, int n) {
+    synth_render(block, n, DAC_config_chan_A) ;
+}
+#endif
+
+// This thread runs on core 0: keeps the sequencer SEQ_HORIZON ahead
+static PT_THREAD (protothread_player(struct pt *pt))
+{
+    // Indicate thread beginning
+    PT_BEGIN(pt) ;
+    // locals must be static to survive a yield
+    static struct seq_player player ;
+    static uint32_t next_beep ;
+    // both start one horizon from now
+    seq_player_start(&player, pattern, synth_time + SEQ_HORIZON, SEQ_ANY_VOICE, 1) ;
+    next_beep = synth_time + SEQ_HORIZON ;
+    while(1) {
+        seq_player_feed(&player, SEQ_HORIZON) ;
+        // the beep is released BEEP_RAMP before the end of its duration
+        while ((int32_t)(next_beep - synth_time) < SEQ_HORIZON &&
+               seq_note(next_beep, BEEP_FREQUENCY, 0.5, BEEP_DURATION - BEEP_RAMP, BEEP, BEEP_VOICE)) {
+            next_beep += BEEP_REPEAT_INTERVAL ;
+        }
+        PT_YIELD_usec(10000) ;
+    }
+    // Indicate thread end
+    PT_END(pt) ;
+}
+
+// This thread runs on core 0: prints engine statistics
+static PT_THREAD (protothread_stats(struct pt *pt))
+{
+    // Indicate thread beginning
+    PT_BEGIN(pt) ;
+    // locals must be static to survive a yield
+    static int k ;
+    while(1) {
+        PT_YIELD_usec(1000000) ;
+        printf("voices: %2d  render: %3u us/block (max %3u)  load: %2d%%  blocks: %u  late: %u  dropped: %u\n",
+            synth_active_voices(), (unsigned)synth_dac_render_us,
+            (unsigned)synth_dac_render_max_us, synth_dac_load(SYNTH_FS),
+            (unsigned)synth_dac_blocks, (unsigned)seq_late, (unsigned)seq_dropped) ;
+        // cycles per sample, last block (worst)
+        printf("  effects: %u cycles/sample:", (unsigned)effects.cycles_per_sample) ;
+        for (k = 0; k < effects.nodes; k++) {
+            printf("  %s %u (%u)", effects.node[k].name,
+                (unsigned)effects.node[k].cycles_per_sample,
+                (unsigned)effects.node[k].cycles_per_sample_max) ;
+        }
+        printf("\n") ;
+    }
+    // Indicate thread end
+    PT_END(pt) ;
+}
+
+// This thread runs on core 1: blinks the LED
+static PT_THREAD (protothread_blink(struct pt *pt))
+{
+    // Indicate thread beginning
+    PT_BEGIN(pt) ;
+    while(1) {
+        // Toggle LED, then wait half a second
+        gpio_put(LED, !gpio_get(LED)) ;
+        PT_YIELD_usec(500000) ;
+    }
+    // Indicate thread end
+    PT_END(pt) ;
+}
+
+// This is the core 1 entry point. Essentially main() for core 1
+void core1_entry() {
+    // The DMA interrupt (and all the rendering) lives on core 1
+#if SYNTH_OUTPUT_I2S
+    i2s_start(pio0, PIN_I2S_DATA, PIN_I2S_BCLK, SYNTH_FS, render_block) ;
+#else
+    synth_dac_start(SPI_PORT, SYNTH_FS, render_block) ;
+#endif
+
+    // Add thread to core 1
+    pt_add_thread(protothread_blink) ;
+
+    // Start scheduler on core 1
+    pt_schedule_start ;
+}
+
+// Core 0 entry point
+int main() {
+    // Initialize stdio/uart (printf won't work unless you do this!)
+    stdio_init_all();
+    printf("Block synthesizer, %d voices, %d-sample blocks\n", SYNTH_VOICES, SYNTH_BLOCK);
+
+#if !SYNTH_OUTPUT_I2S
+    // Initialize SPI channel (channel, baud rate set to 20MHz)
+    spi_init(SPI_PORT, 20000000) ;
+    // Format (channel, data bits per transfer, polarity, phase, order)
+    spi_set_format(SPI_PORT, 16, 0, 0, 0);
+
+    // Map SPI signals to GPIO ports
+    gpio_set_function(PIN_MISO, GPIO_FUNC_SPI);
+    gpio_set_function(PIN_SCK, GPIO_FUNC_SPI);
+    gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI);
+    gpio_set_function(PIN_CS, GPIO_FUNC_SPI) ;
+
+    // Map LDAC pin to GPIO port, hold it low (could alternatively tie to GND)
+    gpio_init(LDAC) ;
+    gpio_set_dir(LDAC, GPIO_OUT) ;
+    gpio_put(LDAC, 0) ;
+#endif
+
+    // Map LED to GPIO port, make it low
+    gpio_init(LED) ;
+    gpio_set_dir(LED, GPIO_OUT) ;
+    gpio_put(LED, 0) ;
+
+    // Oscillator tables, voices and the sequencer's instruments
+    synth_init() ;
+    seq_init() ;
+    seq_set_instrument(LEAD, OSC_BLEP_SAW, 5, 300, 0.3, 400) ;
+    seq_set_instrument(BASS, OSC_TRIANGLE, 10, 600, 0.5, 300) ;
+    seq_set_instrument(BEEP, OSC_SINE, BEEP_RAMP * 1000.0 / SYNTH_FS, 0, 1.0,
+                       BEEP_RAMP * 1000.0 / SYNTH_FS) ;
+    seq_first_voice = BEEP_VOICE + 1 ;
+
+    // Effects: tame the top end, widen, echo, then a room
+    dsp_filter_butterworth_lowpass(&tone, 4000, 4) ;
+    dsp_chorus_init(&chorus, chorus_line, 10, 12, 4, 0.8, 0.5) ;
+    dsp_delay_init(&echo, echo_line, 14, 300, 0.35, 0.3) ;
+    dsp_reverb_init(&reverb, 0.7, 0.5, 0.4) ;
+    dsp_graph_init(&effects) ;
+    dsp_graph_add(&effects, "lowpass", dsp_filter_process, &tone) ;
+    dsp_graph_add(&effects, "chorus", dsp_chorus_process, &chorus) ;
+    dsp_graph_add(&effects, "echo", dsp_delay_process, &echo) ;
+    dsp_graph_add(&effects, "reverb", dsp_reverb_process, &reverb) ;
+    synth_effects = run_effects ;
+
+    // Launch core 1
+    multicore_launch_core1(core1_entry);
+
+    // Add core 0 threads
+    pt_add_thread(protothread_player) ;
+    pt_add_thread(protothread_stats) ;
+
+    // Start scheduling core 0 threads
+    pt_schedule_start ;
+
+}
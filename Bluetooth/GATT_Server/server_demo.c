@@ -58,14 +58,14 @@
 #include "GATT_Service/service_implementation.h"
 
 
-// Low-level alarm infrastructure we'll be using for DDS
-#define ALARM_NUM 0
-#define ALARM_IRQ timer_hardware_alarm_get_irq_num(timer_hw, ALARM_NUM)
+// Periodic alarm for DDS (claimed, so it stays clear of the alarm the
+// Bluetooth stack's timers run on, and deadline += period, so no drift)
+#include "alarm_service.h"
+struct periodic_alarm dds_alarm ;
 
 // DDS parameters
 #define two32 4294967296.0 // 2^32 
 #define Fs 50000
-#define DELAY 20 // 1/Fs (in microseconds)
 #define two32overFs 85899
 // the DDS units:
 volatile unsigned int phase_accum_main;
@@ -120,12 +120,6 @@ static void alarm_irq(void) {
     // Assert a GPIO when we enter the interrupt
     gpio_put(ISR_GPIO, 1) ;
 
-    // Clear the alarm irq
-    hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM);
-
-    // Reset the alarm register
-    timer_hw->alarm[ALARM_NUM] = timer_hw->timerawl + DELAY ;
-
     // DDS phase and sine table lookup
     phase_accum_main += phase_incr_main  ;
     DAC_data = (DAC_config_chan_A | ((sin_table[phase_accum_main>>24] + 2048) & 0xffff))  ;
@@ -374,14 +368,8 @@ int main() {
          sin_table[ii] = (int)(2047*sin((float)ii*6.283/(float)sine_table_size));
     }
 
-    // Enable the interrupt for the alarm (we're using Alarm 0)
-    hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM) ;
-    // Associate an interrupt handler with the ALARM_IRQ
-    irq_set_exclusive_handler(ALARM_IRQ, alarm_irq) ;
-    // Enable the alarm interrupt
-    irq_set_enabled(ALARM_IRQ, true) ;
-    // Write the lower 32 bits of the target time to the alarm register, arming it.
-    timer_hw->alarm[ALARM_NUM] = timer_hw->timerawl + DELAY ;
+    // Call alarm_irq at Fs, from an alarm interrupt on this core
+    alarm_service_start(&dds_alarm, Fs, alarm_irq) ;
 
     // Add threads, start threader
     pt_add_thread(protothread_ble);
@@ -0,0 +1,229 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * CAN bus benchmark
+ *
+ * Load generator, and latency/throughput measurements, for the CAN driver.
+ * Flash this to every node on the bus, each built with its own BENCH_NODE
+ * (0 to 15). Node 0 leads: before each test case in can_bench.h it sends a
+ * start frame, and every node (node 0 too) starts the case when the frame
+ * arrives. Each node prints its own report over USB serial at the end of
+ * each case, then node 0 starts the next one.
+ *
+ * TX runs on core 1 and RX on core 0, as in can_demo.c. Each frame is timed
+ * with time_us_32():
+ *  - queued: when canSendFrame() takes it (also in its payload)
+ *  - sent: in the TX interrupt, when the PIO has finished it
+ *  - received: in the RX interrupt (this node's own frames only, which
+ *    come back through its own receiver on the same clock), so the time
+ *    canRxService() takes to get to a frame is not included
+ *
+ * can_bus_sim.c runs the same cases on a simulated bus, on a PC.
+ */
+
+// Standard C libraries
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+// High-level pico libraries
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+// Interface library to sys_clock (SDK 2.0.0 )
+#include "hardware/clocks.h"
+// CAN driver
+#include "can_driver.h"
+// Test cases and statistics
+#include "can_bench.h"
+// Protothreads
+#include "pt_cornell_rp2040_v1_4.h"
+
+
+//                                   USER GLOBALS
+//
+// Which node this is
+#ifndef BENCH_NODE
+#define BENCH_NODE      0
+#endif
+// This node's results for the case running now
+struct bench_stats bench ;
+volatile int bench_running = 0 ;
+// The case node 0 asked for (-1 once it has started)
+volatile int bench_next = -1 ;
+
+
+
+//                        USER INTERRUPT SERVICE ROUTINES
+//
+// ISR entered at the end of packet transmit (or on a lost arbitration)
+void tx_handler() {
+    struct can_tx_slot * slot ;
+    if (resetTransmitter()) {
+        slot = &can_tx_queue[can_tx_done] ;
+        if (bench_running && (slot->id != BENCH_START_ID)) {
+            benchSent(&bench, time_us_32() - slot->queued_us, slot->retries) ;
+        }
+    }
+}
+// ISR entered when a packet is available for attempted receipt.
+void rx_handler() {
+    // Move the DMA to a fresh buffer (canRxService() decodes this one)
+    int bytes = resetReceiver() ;
+    // Every frame on the bus counts for the bus utilization
+    if (bench_running) bench.bus_bits += BENCH_RX_BITS(bytes) ;
+    // Clear the interrupt to receive the next message
+    acceptNewPacket() ;
+}
+
+
+
+//                                 THREADS (USER CODE)
+//
+// Thread runs on core 1. Runs the test cases.
+static PT_THREAD (protothread_load(struct pt *pt))
+{
+    PT_BEGIN(pt);
+
+    static struct can_frame frame ;
+    static const struct bench_case * c ;
+    static uint32_t rng, start, next ;
+    static unsigned int lost, errors ;
+    static uint16_t seq ;
+    static int k = 0 ;
+
+    // Brief delay before starting up
+    sleep_ms(2000) ;
+    rng = 0x9E3779B9u * (BENCH_NODE + 1) ;
+
+      while(1) {
+        // Node 0 tells everybody (itself included) to start the next case
+        if (BENCH_NODE == 0) {
+            memset(&frame, 0, sizeof(frame)) ;
+            frame.arbitration = BENCH_START_ID ;
+            frame.length = 6 ;
+            frame.payload[0] = k ;
+            k = (k + 1) % BENCH_CASES ;
+            PT_YIELD_UNTIL(pt, canTxSpace() > 0) ;
+            canSendFrame(&frame) ;
+        }
+        PT_YIELD_UNTIL(pt, bench_next >= 0) ;
+        c = &bench_cases[bench_next] ;
+        bench_next = -1 ;
+
+        // Clear the counters, and go
+        memset(&bench, 0, sizeof(bench)) ;
+        lost = can_tx_lost ;
+        errors = can_rx_errors ;
+        seq = 0 ;
+        start = next = time_us_32() ;
+        bench_running = 1 ;
+        while ((time_us_32() - start) < (BENCH_CASE_MS * 1000u)) {
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+            // Bus-off: wait 128 * 11 bit times, then start again
+            if (canErrorState() == CAN_BUS_OFF) {
+                PT_YIELD_UNTIL(pt, (time_us_32() - can_bus_off_time) >
+                                   (uint32_t)(128 * 11 * 1000000.0f / can_bitrate)) ;
+                canRecover() ;
+            }
+#endif
+            // As fast as the queue takes them, or at random times
+            if (c->rate == 0) {
+                PT_YIELD_UNTIL(pt, canTxSpace() > 0) ;
+            }
+            else {
+                PT_YIELD_UNTIL(pt, (int32_t)(time_us_32() - next) >= 0) ;
+                next += benchInterval(c, &rng) ;
+            }
+            benchFrame(c, BENCH_NODE, seq++, time_us_32(), &rng, &frame) ;
+            bench.queued++ ;
+            if (!canSendFrame(&frame)) bench.dropped++ ;
+        }
+
+        // Let the queues drain, then report
+        PT_YIELD_usec(BENCH_GAP_MS * 1000) ;
+        bench_running = 0 ;
+        bench.lost = can_tx_lost - lost ;
+        bench.errors = can_rx_errors - errors ;
+        benchReport(c, BENCH_NODE, &bench, BENCH_CASE_MS * 1000u, can_bitrate) ;
+        // Give the other nodes time to print theirs
+        PT_YIELD_usec(BENCH_GAP_MS * 1000) ;
+      }
+  PT_END(pt);
+}
+// Thread runs on core 1. Decodes what the RX interrupt collected (good
+// frames go on the RX queue).
+static PT_THREAD (protothread_rx_service(struct pt *pt))
+{
+    PT_BEGIN(pt);
+
+      while(1) {
+        PT_YIELD_UNTIL(pt, canRxPending()) ;
+        canRxService() ;
+      }
+  PT_END(pt);
+}
+// Thread runs on core 0. Empties the RX queue.
+static PT_THREAD (protothread_receive(struct pt *pt))
+{
+    PT_BEGIN(pt);
+
+    static struct can_frame frame ;
+
+      while(1) {
+        // Wait for a frame
+        PT_YIELD_UNTIL(pt, canReceive(&frame)) ;
+        // Node 0 starting a case, or a benchmark frame
+        if (frame.arbitration == BENCH_START_ID) {
+            if (frame.payload[0] < BENCH_CASES) bench_next = frame.payload[0] ;
+        }
+        else if (bench_running && (frame.length >= 6)) {
+            benchReceived(&bench, BENCH_NODE, &frame) ;
+        }
+      }
+  PT_END(pt);
+}
+
+
+
+//                             MAIN FOR CORES 0 AND 1
+//
+// Main for core 1
+void core1_main() {
+    // CAN transmitter will run on core 1
+    setupCANTX(tx_handler) ;
+    // Add the load and RX threads
+    pt_add_thread(protothread_load) ;
+    pt_add_thread(protothread_rx_service) ;
+    // Start the threader
+    pt_schedule_start ;
+}
+// Main for core 0
+int main() {
+    // Overclock to 160MHz (divides evenly to 1 megabaud) (160/5/32=1)
+    set_sys_clock_khz(OVERCLOCK_RATE, true) ;
+
+    // Initialize stdio
+    stdio_init_all();
+
+    // Initialize LED
+    gpio_init(LED_PIN) ;
+    gpio_set_dir(LED_PIN, GPIO_OUT) ;
+    gpio_put(LED_PIN, 0) ;
+
+    // Every frame on the bus
+    canAddFilter(0, 0) ;
+
+    // Setup the CAN receiver on core 0
+    setupCANRX(rx_handler) ;
+
+    printf("CAN benchmark, node %d, %s frames at %.0f bit/s, %d cases of %d ms\n\n",
+           BENCH_NODE, (CAN_FRAME_FORMAT == CAN_FORMAT_20) ? "CAN 2.0" : "original",
+           can_bitrate, BENCH_CASES, BENCH_CASE_MS) ;
+
+    // start core 1 threads
+    multicore_reset_core1();
+    multicore_launch_core1(&core1_main);
+
+    // Add threads to scheduler, and start them
+    pt_add_thread(protothread_receive) ;
+    pt_schedule_start ;
+}
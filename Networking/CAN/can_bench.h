@@ -0,0 +1,290 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * CAN bus load generator and statistics
+ *
+ * Shared by the benchmark firmware (can_bench.c) and the host bus simulator
+ * (can_bus_sim.c), so both run the same test cases and print the same report.
+ *
+ * Every node runs through bench_cases[]. A case sets the frame rate (per
+ * node), the payload sizes, and how IDs are picked. The first six payload
+ * bytes carry the time the frame was queued (us, on the sender's clock)
+ * and a sequence number (per node):
+ *
+ *   payload[0..3]  time queued, high byte first
+ *   payload[4..5]  sequence number, high byte first
+ *
+ * In the original format a 0xFFFF short ends the frame (bitStuff() stops
+ * there), so the top bit of every high byte is cleared, as can_demo.c does.
+ * The time is then 31 bits and the sequence number 15.
+ *
+ * The sending node is in the low bits of every ID (BENCH_ID), so no two
+ * nodes ever send the same ID, and every node accepts every frame. Its own
+ * frames come back through its own receiver, on the same clock, which gives
+ * the end-to-end latency (queued to received). Everybody's frames give the
+ * bus utilization, and gaps in the other nodes' sequence numbers.
+ *
+ * Bus utilization counts the bits the RX machine collected for each frame
+ * (whole bytes, so it can be up to 7 bits high per frame) plus the start of
+ * frame. The bits between frames (idle wait, intermission) are not counted.
+ */
+
+//                          CONFIGURATION PARAMETERS
+//
+// Length of each test case, and the pause after it for the queues to drain (ms)
+#ifndef BENCH_CASE_MS
+#define BENCH_CASE_MS           5000
+#endif
+#define BENCH_GAP_MS            200
+// Latency histogram buckets: 1 us wide up to 16 us, then four per power
+// of two (within 25%), which covers every 32-bit latency
+#define BENCH_HIST_BUCKETS      128
+// Retry histogram (the last bucket is that many or more)
+#define BENCH_RETRY_BUCKETS     8
+// Most nodes (the node is the low 4 bits of the ID)
+#define BENCH_MAX_NODES         16
+// ID classes (the rest of the ID, above the node)
+#define BENCH_ID_CLASSES        64
+
+// How IDs are picked
+#define BENCH_ID_FIXED          0   // one ID per node
+#define BENCH_ID_UNIFORM        1   // any class, all equally likely
+#define BENCH_ID_SKEWED         2   // 80% from the 4 highest-priority classes
+
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+#define BENCH_ID(cls, node)     ((uint32_t)(((cls) << 4) | (node)))
+#define BENCH_NODE_OF(id)       ((id) & 0xF)
+#define BENCH_MAX_LEN           8
+#else
+// SOF (0), 12 bits of ID, then 100 (as in can_parameters.h)
+#define BENCH_ID(cls, node)     ((uint32_t)(((((cls) << 4) | (node)) << 3) | 0x4))
+#define BENCH_NODE_OF(id)       (((id) >> 3) & 0xF)
+#define BENCH_MAX_LEN           MAX_PAYLOAD_SIZE
+#endif
+// Class 0 is node 0 telling the others which case to run
+#define BENCH_START_ID          BENCH_ID(0, 0)
+// Bits on the bus for a frame the RX machine collected in `bytes` bytes
+#define BENCH_RX_BITS(bytes)    (8 * (bytes) + 1)
+// Bits of the time and sequence number that make it into the payload
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+#define BENCH_TIME_MASK         0xFFFFFFFFu
+#define BENCH_SEQ_BITS          16
+#else
+#define BENCH_TIME_MASK         0x7FFFFFFFu
+#define BENCH_SEQ_BITS          15
+#endif
+
+struct bench_case {
+    const char * name ;
+    unsigned int rate ;             // frames/s per node (0: as fast as the queue takes them)
+    unsigned char min_len ;         // payload bytes, at least 6
+    unsigned char max_len ;
+    unsigned char ids ;             // BENCH_ID_...
+} ;
+
+// The test cases, in order
+struct bench_case bench_cases[] = {
+    {"light load, fixed IDs",        100, 6, 6,             BENCH_ID_FIXED},
+    {"moderate load, uniform IDs",   500, 6, BENCH_MAX_LEN, BENCH_ID_UNIFORM},
+    {"heavy load, skewed IDs",      2000, 6, BENCH_MAX_LEN, BENCH_ID_SKEWED},
+    {"saturated, uniform IDs",         0, 6, BENCH_MAX_LEN, BENCH_ID_UNIFORM},
+} ;
+#define BENCH_CASES             ((int)(sizeof(bench_cases) / sizeof(bench_cases[0])))
+
+
+//                              LOAD GENERATOR
+//
+// xorshift32 (state must not be 0)
+static inline uint32_t benchRand(uint32_t * state) {
+    uint32_t x = *state ;
+    x ^= x << 13 ;
+    x ^= x >> 17 ;
+    x ^= x << 5 ;
+    return *state = x ;
+}
+
+// Time to the next frame (us): random, averaging 1/rate
+static inline uint32_t benchInterval(const struct bench_case * c, uint32_t * rng) {
+    if (c->rate == 0) return 0 ;
+    return benchRand(rng) % (2000000u / c->rate + 1) ;
+}
+
+// Make the next frame for node: ID, length, time and sequence number, and
+// random bytes after them
+void benchFrame(const struct bench_case * c, int node, uint16_t seq, uint32_t now,
+                uint32_t * rng, struct can_frame * frame) {
+    uint32_t r = benchRand(rng) ;
+    int cls, i ;
+    if (c->ids == BENCH_ID_FIXED) cls = 1 + node ;
+    else if ((c->ids == BENCH_ID_SKEWED) && ((r % 10) < 8)) cls = 1 + ((r >> 8) % 4) ;
+    else cls = 1 + ((r >> 8) % (BENCH_ID_CLASSES - 1)) ;
+    frame->arbitration = BENCH_ID(cls, node) ;
+    frame->reserve = 0 ;
+    frame->length = c->min_len + ((r >> 16) % (c->max_len - c->min_len + 1)) ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_ORIGINAL
+    // The original format sends whole shorts
+    frame->length &= ~1 ;
+#endif
+    frame->payload[0] = now >> 24 ;
+    frame->payload[1] = now >> 16 ;
+    frame->payload[2] = now >> 8 ;
+    frame->payload[3] = now ;
+    frame->payload[4] = seq >> 8 ;
+    frame->payload[5] = seq ;
+    for (i = 6; i < frame->length; i++) frame->payload[i] = benchRand(rng) ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_ORIGINAL
+    // No 0xFFFF shorts
+    for (i = 0; i < frame->length; i += 2) frame->payload[i] &= 0x7F ;
+#endif
+}
+
+// The time and sequence number back out of a frame
+static inline uint32_t benchQueuedTime(const struct can_frame * frame) {
+    return ((uint32_t)frame->payload[0] << 24) | ((uint32_t)frame->payload[1] << 16) |
+           ((uint32_t)frame->payload[2] << 8) | frame->payload[3] ;
+}
+static inline uint16_t benchSequence(const struct can_frame * frame) {
+    return (frame->payload[4] << 8) | frame->payload[5] ;
+}
+
+// a - b for sequence numbers, across the wrap
+static inline int benchSeqDiff(uint16_t a, uint16_t b) {
+    return (int16_t)((uint16_t)(a - b) << (16 - BENCH_SEQ_BITS)) >> (16 - BENCH_SEQ_BITS) ;
+}
+
+
+//                                STATISTICS
+//
+struct bench_hist {
+    unsigned int count[BENCH_HIST_BUCKETS] ;
+    unsigned int n ;
+    uint64_t sum ;
+    uint32_t min, max ;
+} ;
+
+// One node's results for one case
+struct bench_stats {
+    unsigned int queued ;           // frames made
+    unsigned int dropped ;          // refused, the TX queue was full
+    unsigned int sent ;
+    unsigned int lost ;             // lost arbitration (tried again)
+    unsigned int retries[BENCH_RETRY_BUCKETS] ;
+    struct bench_hist tx_latency ;  // queued to sent
+    struct bench_hist e2e_latency ; // queued to received (own frames)
+    unsigned int received ;         // good frames from every node
+    unsigned int errors ;           // bad frames on the bus
+    uint32_t bus_bits ;             // bits the bus was busy
+    // Frames from each other node, and the lowest and highest sequence
+    // numbers (a node sends its lowest ID first, so they come out of order)
+    unsigned int from[BENCH_MAX_NODES] ;
+    uint16_t first_seq[BENCH_MAX_NODES] ;
+    uint16_t last_seq[BENCH_MAX_NODES] ;
+} ;
+
+// Bucket for a latency, and the lowest latency in a bucket
+static inline int benchBucket(uint32_t us) {
+    int msb ;
+    if (us < 16) return us ;
+    msb = 31 - __builtin_clz(us) ;
+    return 16 + ((msb - 4) << 2) + ((us >> (msb - 2)) & 3) ;
+}
+static inline uint32_t benchBucketStart(int i) {
+    if (i < 16) return i ;
+    i -= 16 ;
+    return (4u | (i & 3)) << ((i >> 2) + 2) ;
+}
+
+static void benchHistAdd(struct bench_hist * h, uint32_t us) {
+    h->count[benchBucket(us)]++ ;
+    if ((h->n == 0) || (us < h->min)) h->min = us ;
+    if (us > h->max) h->max = us ;
+    h->sum += us ;
+    h->n++ ;
+}
+
+// Latency below which pct percent of the frames were (top of the bucket)
+static uint32_t benchPercentile(const struct bench_hist * h, int pct) {
+    unsigned int want = ((uint64_t)h->n * pct + 99) / 100, seen = 0 ;
+    int i ;
+    for (i = 0; i < BENCH_HIST_BUCKETS - 1; i++) {
+        seen += h->count[i] ;
+        if (seen >= want) break ;
+    }
+    if ((i == BENCH_HIST_BUCKETS - 1) || (benchBucketStart(i + 1) > h->max)) return h->max ;
+    return benchBucketStart(i + 1) ;
+}
+
+// Count a frame the sender's TX interrupt saw go out
+static inline void benchSent(struct bench_stats * s, uint32_t latency, unsigned int retries) {
+    s->sent++ ;
+    s->retries[(retries >= BENCH_RETRY_BUCKETS) ? BENCH_RETRY_BUCKETS - 1 : retries]++ ;
+    benchHistAdd(&s->tx_latency, latency) ;
+}
+
+// Count a good frame from the RX queue (node is this node)
+void benchReceived(struct bench_stats * s, int node, const struct can_frame * frame) {
+    int from = BENCH_NODE_OF(frame->arbitration) ;
+    uint16_t seq = benchSequence(frame) ;
+    s->received++ ;
+    if (from == node) {
+        benchHistAdd(&s->e2e_latency, (frame->time - benchQueuedTime(frame)) & BENCH_TIME_MASK) ;
+    }
+    else {
+        if (s->from[from] == 0) s->first_seq[from] = s->last_seq[from] = seq ;
+        else if (benchSeqDiff(seq, s->first_seq[from]) < 0) s->first_seq[from] = seq ;
+        else if (benchSeqDiff(seq, s->last_seq[from]) > 0) s->last_seq[from] = seq ;
+        s->from[from]++ ;
+    }
+}
+
+// Frames other nodes sent (by their sequence numbers) that never arrived
+static unsigned int benchMissing(const struct bench_stats * s) {
+    unsigned int missing = 0, span ;
+    int i ;
+    for (i = 0; i < BENCH_MAX_NODES; i++) {
+        if (s->from[i] == 0) continue ;
+        span = benchSeqDiff(s->last_seq[i], s->first_seq[i]) + 1 ;
+        if (span > s->from[i]) missing += span - s->from[i] ;
+    }
+    return missing ;
+}
+
+// Summary, then the buckets that aren't empty
+static void benchPrintHist(const char * name, const struct bench_hist * h) {
+    int i ;
+    if (h->n == 0) {
+        printf("  %s: no frames\n", name) ;
+        return ;
+    }
+    printf("  %s (us): min %u, mean %u, p50 %u, p99 %u, max %u\n", name,
+           (unsigned int)h->min, (unsigned int)(h->sum / h->n),
+           (unsigned int)benchPercentile(h, 50), (unsigned int)benchPercentile(h, 99),
+           (unsigned int)h->max) ;
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        if (h->count[i] == 0) continue ;
+        if (i < BENCH_HIST_BUCKETS - 1) {
+            printf("    %8u-%-8u %u\n", (unsigned int)benchBucketStart(i),
+                   (unsigned int)benchBucketStart(i + 1), h->count[i]) ;
+        }
+        else printf("    %8u+         %u\n", (unsigned int)benchBucketStart(i), h->count[i]) ;
+    }
+}
+
+// Print one node's results, for a case that ran for elapsed_us at bitrate
+void benchReport(const struct bench_case * c, int node, const struct bench_stats * s,
+                 uint32_t elapsed_us, float bitrate) {
+    int i ;
+    printf("Node %d, %s (%u frames/s, %d-%d bytes)\n", node, c->name, c->rate,
+           c->min_len, c->max_len) ;
+    printf("  queued %u, dropped %u, sent %u (%.0f frames/s), lost arbitration %u\n",
+           s->queued, s->dropped, s->sent, s->sent * 1e6f / elapsed_us, s->lost) ;
+    printf("  retries:") ;
+    for (i = 0; i < BENCH_RETRY_BUCKETS; i++) printf(" %u", s->retries[i]) ;
+    printf("\n") ;
+    printf("  received %u (%.0f frames/s), errors %u, missing %u\n", s->received,
+           s->received * 1e6f / elapsed_us, s->errors, benchMissing(s)) ;
+    printf("  bus utilization %.1f%%\n", 100.0f * s->bus_bits / (bitrate * elapsed_us * 1e-6f)) ;
+    benchPrintHist("queued to sent", &s->tx_latency) ;
+    benchPrintHist("queued to received", &s->e2e_latency) ;
+    printf("\n") ;
+}
@@ -0,0 +1,423 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Bit-level CAN bus simulator, running the benchmark in can_bench.h
+ *
+ * Runs on a PC, not the Pico. Several nodes share one wired-AND bus (a bit
+ * is dominant if any node drives it dominant), one bit time per step. Each
+ * node copies what the PIO machines and the driver do:
+ *
+ *  - TX: frames are built and stuffed with can_coding.h, exactly as
+ *    canSendFrame() does, and wait in a CAN_TX_QUEUE slot queue (lowest ID
+ *    first). The bus has to be recessive for tx_idle_time + 1 bits (the idle
+ *    checker) before the start of frame. A node reading dominant where it
+ *    sent recessive has lost arbitration: the original format checks the
+ *    first 17 bits and tries the same frame again, CAN 2.0 checks every bit
+ *    and goes back to the queue.
+ *  - RX: waits for the bus to be idle, syncs on the start of frame, and
+ *    collects bits until the end of frame, packed into bytes the way the RX
+ *    machine pushes them. attemptPacketReceive()'s decode then checks them.
+ *  - CAN 2.0: another controller on the bus acknowledges every frame that
+ *    wasn't hit by noise (-a 0 turns it off). Without an ACK the frame goes
+ *    again, as with CAN2_NEED_ACK.
+ *
+ * Interrupt and CPU time are not simulated, so latencies are a lower bound
+ * on what the hardware shows. Error frames are not simulated either: noise
+ * (-e) shows up as bad frames at the receivers, and in CAN 2.0 as bit
+ * errors and missing ACKs at the sender.
+ *
+ * BUILD AND RUN
+ *   gcc -O2 -o can_bus_sim can_bus_sim.c && ./can_bus_sim
+ *   (-DCAN_FRAME_FORMAT=1 for CAN 2.0 frames)
+ *
+ *   ./can_bus_sim [-n nodes] [-t ms per case] [-e bit error rate] [-a 0|1]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "can_parameters.h"
+#include "can_coding.h"
+#include "can_bench.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// As in can.pio: recessive bits that end a frame, and idle bits the RX
+// machine waits for before the next start of frame
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+#define SIM_EOF_BITS            7
+#define SIM_RX_IDLE_BITS        1
+#define SIM_BITRATE             CAN_BITRATE
+#else
+#define SIM_EOF_BITS            16
+#define SIM_RX_IDLE_BITS        8
+#define SIM_BITRATE             1000000
+#endif
+// Longest frame on the bus, in bits
+#define SIM_MAX_BITS            (16 * (MAX_STUFFED_PACKET_LEN >> 1) + 2)
+
+
+// A queued frame, as the bits it puts on the bus
+struct sim_frame {
+    unsigned char bits[SIM_MAX_BITS] ;
+    int n ;                         // bits to send, from the start of frame
+    int arb ;                       // how many are arbitration
+    int check ;                     // how many are read back
+    uint32_t priority ;
+    unsigned int order ;
+    uint32_t queued_us ;
+    unsigned int retries ;
+} ;
+
+struct sim_node {
+    // TX
+    struct sim_frame queue[CAN_TX_QUEUE] ;
+    unsigned int used ;             // slots in use (one bit each)
+    unsigned int order ;
+    int slot ;                      // frame being sent (or retried), -1 for none
+    int pos ;                       // next bit of it, -1 while waiting for idle
+    int idle ;                      // recessive bits counted while waiting
+    int drive ;                     // what this node puts on the bus this bit
+    int tec ;
+    uint16_t seq ;
+    uint32_t next_us ;
+    uint32_t rng ;
+    // RX
+    int rx_idle ;                   // recessive bits seen while waiting for idle
+    int rx_state ;                  // 0: waiting for idle, 1: for SOF, 2: collecting
+    int rx_run ;
+    int rx_n ;
+    unsigned char rx_bits[SIM_MAX_BITS + SIM_EOF_BITS] ;
+    struct bench_stats stats ;
+} ;
+
+struct sim_node nodes[BENCH_MAX_NODES] ;
+int num_nodes = 3 ;
+double noise = 0 ;                  // probability a bus bit is flipped
+int acker = 1 ;                     // CAN 2.0: another controller acknowledges
+uint64_t bit_time = 0 ;
+int frame_hit = 0 ;                 // noise since the last start of frame
+
+static inline uint32_t simMicros() {
+    return (uint32_t)(bit_time * 1000000 / SIM_BITRATE) ;
+}
+
+
+//                              TRANSMITTER
+//
+// Stuff a frame into a slot, as canSendFrame() would. Returns 0 if it
+// refuses the frame.
+static int simEncode(const struct can_frame * frame, struct sim_frame * f) {
+    unsigned short words[MAX_STUFFED_PACKET_LEN >> 1] ;
+    int i, n ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    n = can2Encode(frame, words, &f->arb) ;
+    for (i = 0; i < n; i++) f->bits[i] = (words[i >> 4] >> (15 - (i & 15))) & 1 ;
+    f->bits[n] = 1 ;                // ACK slot (the TX stays recessive)
+    f->n = n + 1 ;
+    f->check = n ;
+    f->priority = can2Priority(frame->arbitration) ;
+    return 1 ;
+#else
+    unsigned short unstuffed[MAX_PACKET_LEN >> 1] ;
+    unsigned short checksum = CRC_INIT ;
+    int len = frame->length ;
+    unstuffed[0] = frame->arbitration ;
+    unstuffed[1] = (frame->reserve << 8) | len ;
+    for (i = 0; i < len; i += 2) {
+        unstuffed[2 + (i >> 1)] = (frame->payload[i] << 8) | frame->payload[i + 1] ;
+    }
+    // As canSend()
+    for (i = 0; i < 2 + (len >> 1); i++) {
+        if (unstuffed[i] == 0xFFFF) return 0 ;
+    }
+    while (checksum == 0xFFFF) {
+        unstuffed[1] ^= 0x8000 ;
+        for (i = 0; i < ((len >> 1) + 2); i++) {
+            checksum = culCalcCRC((unstuffed[i] >> 8) & 0xFF, checksum) ;
+            checksum = culCalcCRC(unstuffed[i] & 0xFF, checksum) ;
+        }
+    }
+    unstuffed[i] = checksum ;
+    unstuffed[i + 1] = 0xFFFF ;
+    n = bitStuff(unstuffed, words) ;
+    // The TX machine adds a start of frame, and stops at the end of the
+    // 0xFFFF (16 recessive bits)
+    f->bits[0] = 0 ;
+    for (i = 0; i < 16 * n; i++) f->bits[i + 1] = (words[i >> 4] >> (15 - (i & 15))) & 1 ;
+    f->n = 16 * n + 1 ;
+    f->arb = 17 ;
+    f->check = 17 ;
+    f->priority = frame->arbitration ;
+    return 1 ;
+#endif
+}
+
+// Best waiting slot (lowest priority value, then oldest)
+static int simBest(struct sim_node * node) {
+    int i, best = -1 ;
+    for (i = 0; i < CAN_TX_QUEUE; i++) {
+        if (!(node->used & (1u << i))) continue ;
+        if ((best < 0) || (node->queue[i].priority < node->queue[best].priority) ||
+            ((node->queue[i].priority == node->queue[best].priority) &&
+             ((int)(node->queue[i].order - node->queue[best].order) < 0))) {
+            best = i ;
+        }
+    }
+    return best ;
+}
+
+// Queue a new frame, if there's room
+static void simQueue(struct sim_node * node, const struct bench_case * c, int id) {
+    struct can_frame frame ;
+    struct sim_frame * f ;
+    unsigned int free = ~node->used & ((1u << CAN_TX_QUEUE) - 1) ;
+    int slot ;
+    node->stats.queued++ ;
+    if (!free) {
+        node->stats.dropped++ ;
+        return ;
+    }
+    slot = __builtin_ctz(free) ;
+    f = &node->queue[slot] ;
+    benchFrame(c, id, node->seq++, simMicros(), &node->rng, &frame) ;
+    if (!simEncode(&frame, f)) {
+        node->stats.dropped++ ;
+        return ;
+    }
+    f->order = node->order++ ;
+    f->queued_us = simMicros() ;
+    f->retries = 0 ;
+    node->used |= (1u << slot) ;
+}
+
+// Before the bus bit: what does this node drive?
+static void simTxDrive(struct sim_node * node) {
+    int idle_needed ;
+    node->drive = 1 ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    if (node->tec > 255) return ;   // bus-off
+    idle_needed = CAN2_IDLE_BITS + ((node->tec > 127) ? CAN2_SUSPEND_BITS : 0) + 1 ;
+#else
+    idle_needed = tx_idle_time + 1 ;
+#endif
+    if ((node->slot < 0) && node->used) {
+        node->slot = simBest(node) ;
+        node->pos = -1 ;
+        node->idle = 0 ;
+    }
+    if (node->slot < 0) return ;
+    if ((node->pos < 0) && (node->idle >= idle_needed)) node->pos = 0 ;
+    if (node->pos >= 0) node->drive = node->queue[node->slot].bits[node->pos] ;
+}
+
+// A frame is done (sent, or dropped without an ACK)
+static void simTxDone(struct sim_node * node, int sent) {
+    struct sim_frame * f = &node->queue[node->slot] ;
+    if (sent) benchSent(&node->stats, simMicros() - f->queued_us, f->retries) ;
+    node->used &= ~(1u << node->slot) ;
+    node->slot = -1 ;
+}
+
+// After the bus bit
+static void simTxRead(struct sim_node * node, int bus) {
+    struct sim_frame * f ;
+    if (node->slot < 0) return ;
+    f = &node->queue[node->slot] ;
+    if (node->pos < 0) {
+        node->idle = bus ? node->idle + 1 : 0 ;
+        return ;
+    }
+    // Sent recessive, read dominant
+    if ((node->pos < f->check) && f->bits[node->pos] && !bus) {
+        f->retries++ ;
+        if (node->pos < f->arb) node->stats.lost++ ;
+        else node->tec += 8 ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+        // Back to the queue, the best frame goes next
+        node->slot = -1 ;
+#endif
+        node->pos = -1 ;
+        node->idle = 0 ;
+        return ;
+    }
+    if (++node->pos < f->n) return ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    // The ACK slot was the last bit
+    if (bus) {
+        if (node->tec <= 127) node->tec += 8 ;
+        if (CAN2_NEED_ACK) {
+            f->retries++ ;
+            node->slot = -1 ;
+            return ;
+        }
+        simTxDone(node, 0) ;
+        return ;
+    }
+    if (node->tec > 0) node->tec-- ;
+#endif
+    simTxDone(node, 1) ;
+}
+
+
+//                               RECEIVER
+//
+// The RX machine's bytes for the bits collected: whole bytes, then the
+// final push (the leftover bits, in the low end)
+static int simPack(struct sim_node * node, unsigned char * bytes) {
+    int i, n = node->rx_n ;
+    memset(bytes, 0, MAX_STUFFED_PACKET_LEN) ;
+    for (i = 0; i < (n & ~7); i++) bytes[i >> 3] |= node->rx_bits[i] << (7 - (i & 7)) ;
+    for (; i < n; i++) bytes[n >> 3] = (bytes[n >> 3] << 1) | node->rx_bits[i] ;
+    return (n >> 3) + 1 ;
+}
+
+// Decode a frame the way attemptPacketReceive() does (no filters)
+static void simDecode(struct sim_node * node, int id) {
+    unsigned char bytes[MAX_STUFFED_PACKET_LEN + SIM_MAX_BITS / 8] ;
+    struct can_frame frame ;
+    int nbytes = simPack(node, bytes) ;
+    node->stats.bus_bits += BENCH_RX_BITS(nbytes) ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    struct can2_bits b ;
+    int ack ;
+    can2Begin(&b, bytes, nbytes - 1) ;
+    frame.arbitration = can2DecodeID(&b) ;
+    if (can2DecodeRest(&b, &frame, &ack) != CAN2_OK) {
+        node->stats.errors++ ;
+        return ;
+    }
+#else
+    unsigned char unstuffed[MAX_PACKET_LEN] ;
+    unsigned short checksum ;
+    int i ;
+    unBitStuff(bytes, unstuffed) ;
+    i = unstuffed[3] + 4 ;
+    if (unstuffed[3] > MAX_PAYLOAD_SIZE) {
+        node->stats.errors++ ;
+        return ;
+    }
+    checksum = canCRC(unstuffed, i, CRC_INIT) ;
+    if ((unstuffed[i] != (checksum >> 8)) || (unstuffed[i + 1] != (checksum & 0xFF))) {
+        node->stats.errors++ ;
+        return ;
+    }
+    frame.arbitration = (unstuffed[0] << 8) | unstuffed[1] ;
+    frame.reserve = unstuffed[2] ;
+    frame.length = unstuffed[3] ;
+    memcpy(frame.payload, &unstuffed[4], frame.length) ;
+#endif
+    // Anything shorter than the benchmark header isn't one of ours
+    if (frame.length < 6) {
+        node->stats.errors++ ;
+        return ;
+    }
+    frame.time = simMicros() ;
+    benchReceived(&node->stats, id, &frame) ;
+}
+
+static void simRx(struct sim_node * node, int id, int bus) {
+    switch (node->rx_state) {
+    case 0:
+        node->rx_idle = bus ? node->rx_idle + 1 : 0 ;
+        if (node->rx_idle >= SIM_RX_IDLE_BITS) node->rx_state = 1 ;
+        break ;
+    case 1:
+        if (!bus) {
+            node->rx_state = 2 ;
+            node->rx_n = 0 ;
+            node->rx_run = 0 ;
+        }
+        break ;
+    default:
+        if (node->rx_n < (int)sizeof(node->rx_bits)) node->rx_bits[node->rx_n++] = bus ;
+        node->rx_run = bus ? node->rx_run + 1 : 0 ;
+        if (node->rx_run == SIM_EOF_BITS) {
+            simDecode(node, id) ;
+            node->rx_state = 0 ;
+            node->rx_idle = 0 ;
+        }
+    }
+}
+
+
+//                                  THE BUS
+//
+// One bit time
+static void simBit(const struct bench_case * c, int generate) {
+    int i, bus = 1 ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    int ack_slot = 0 ;
+#endif
+    struct sim_node * node ;
+    uint32_t now = simMicros() ;
+    for (i = 0; i < num_nodes; i++) {
+        node = &nodes[i] ;
+        if (generate) {
+            if (c->rate == 0) {
+                while (node->used != ((1u << CAN_TX_QUEUE) - 1)) simQueue(node, c, i) ;
+            }
+            else while ((int32_t)(now - node->next_us) >= 0) {
+                simQueue(node, c, i) ;
+                node->next_us += benchInterval(c, &node->rng) ;
+            }
+        }
+        simTxDrive(node) ;
+        bus &= node->drive ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+        if ((node->slot >= 0) && (node->pos == node->queue[node->slot].n - 1)) ack_slot = 1 ;
+#endif
+        if ((node->slot >= 0) && (node->pos == 0)) frame_hit = 0 ;
+    }
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    if (ack_slot && acker && !frame_hit) bus = 0 ;
+#endif
+    if ((noise > 0) && (rand() < noise * RAND_MAX)) {
+        bus = !bus ;
+        frame_hit = 1 ;
+    }
+    for (i = 0; i < num_nodes; i++) {
+        simTxRead(&nodes[i], bus) ;
+        simRx(&nodes[i], i, bus) ;
+    }
+    bit_time++ ;
+}
+
+int main(int argc, char ** argv) {
+    uint64_t bits, stop ;
+    int i, k, ms = BENCH_CASE_MS ;
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-n")) num_nodes = atoi(argv[i + 1]) ;
+        else if (!strcmp(argv[i], "-t")) ms = atoi(argv[i + 1]) ;
+        else if (!strcmp(argv[i], "-e")) noise = atof(argv[i + 1]) ;
+        else if (!strcmp(argv[i], "-a")) acker = atoi(argv[i + 1]) ;
+    }
+    if ((num_nodes < 1) || (num_nodes > BENCH_MAX_NODES)) num_nodes = 3 ;
+
+    canCodingInit() ;
+    printf("%d nodes, %s frames at %d bit/s, %d ms per case, bit error rate %g\n\n",
+           num_nodes, (CAN_FRAME_FORMAT == CAN_FORMAT_20) ? "CAN 2.0" : "original",
+           SIM_BITRATE, ms, noise) ;
+
+    for (k = 0; k < BENCH_CASES; k++) {
+        memset(nodes, 0, sizeof(nodes)) ;
+        for (i = 0; i < num_nodes; i++) {
+            nodes[i].slot = -1 ;
+            nodes[i].rng = 0x9E3779B9u * (i + 1) + k ;
+            nodes[i].next_us = simMicros() ;
+        }
+        // Run the case, then let the queues drain
+        bits = (uint64_t)ms * SIM_BITRATE / 1000 ;
+        stop = bit_time + bits ;
+        while (bit_time < stop) simBit(&bench_cases[k], 1) ;
+        stop = bit_time + (uint64_t)BENCH_GAP_MS * SIM_BITRATE / 1000 ;
+        while (bit_time < stop) simBit(&bench_cases[k], 0) ;
+
+        for (i = 0; i < num_nodes; i++) {
+            benchReport(&bench_cases[k], i, &nodes[i].stats, ms * 1000, SIM_BITRATE) ;
+        }
+    }
+    return 0 ;
+}
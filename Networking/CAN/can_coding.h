@@ -0,0 +1,426 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * CAN frame coding: checksum, bit stuffing and unstuffing
+ *
+ * The first versions of these walked the packet one bit at a time. Here
+ * they work a byte at a time through lookup tables built once by
+ * canCodingInit():
+ *
+ *  - CRC: the usual 256-entry table for CRC16_POLY (MSB first), one
+ *    lookup per byte. (The DMA sniffer can only do CRC-16-CCITT, and
+ *    this protocol uses 0x8005.)
+ *  - Stuffing and unstuffing: a small state machine whose state is the
+ *    value and length of the current run of identical bits (and, when
+ *    unstuffing, whether the next bit is a stuff bit to drop). For every
+ *    state and input byte the table holds the output bits, their number
+ *    and the next state, so a byte costs one lookup. Flipping every bit
+ *    of the input flips every bit of the output, so the tables only hold
+ *    the states whose run is of zeros, and bytes with a run of ones are
+ *    looked up inverted.
+ *
+ * The frames are bit-for-bit the same as those of the bit-at-a-time
+ * code, so old and new nodes share a bus. can_coding_test.c checks that
+ * on a host (fuzzing both against each other) and times them.
+ *
+ * CAN 2.0A/B frames (CAN_FORMAT_20 in can_parameters.h) aren't byte
+ * aligned, and a receiver has to catch stuff errors, so they are coded a
+ * bit at a time (at the end of this file), with the CRC-15 in the same
+ * pass. They are short (at most 148 bits up to the CRC delimiter).
+ *
+ * No hardware is touched here, so the file also builds on a host.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+//                              CHECKSUM PARAMETERS
+//
+// Checksum polynomial and initial value
+#define CRC16_POLY              0x8005
+#define CRC_INIT                0xFFFF
+
+// Stuffing: a bit opposite to the run goes in after this many identical bits
+#define CAN_STUFF_RUN           5
+
+// Table entries. Stuffing, 16 bits: output bits [9:0] (right aligned),
+// number of output bits minus 8 [11:10], next run length [14:12], flip
+// the run value [15]. Unstuffing, 16 bits: output bits [7:0], number of
+// output bits [11:8], next state [14:12], flip the run value [15].
+#define CAN_STATE_FLIP          0x8000
+#define CAN_STATE_SHIFT         12
+#define CAN_STATE_MASK          0x7
+// Unstuffing state "drop the next bit" (run lengths are 0 to 4)
+#define CAN_UNSTUFF_SKIP        5
+
+// A frame, as queued for transmit and as received. In the original
+// format, arbitration is the arbitration short and reserve the reserve
+// byte. In CAN 2.0 format, arbitration is an 11-bit ID, or a 29-bit ID
+// with CAN_EFF_FLAG, plus CAN_RTR_FLAG for a remote frame (reserve is
+// unused, and length is 0 to 8).
+struct can_frame {
+    uint32_t arbitration ;
+    unsigned char reserve ;
+    unsigned char length ;          // payload bytes
+    unsigned char payload[MAX_PAYLOAD_SIZE] ;
+    uint32_t time ;                 // received: when the RX interrupt saw it (us)
+} ;
+
+unsigned short can_crc_table[256] ;
+unsigned short can_stuff_table[CAN_STUFF_RUN][256] ;
+unsigned short can_unstuff_table[CAN_UNSTUFF_SKIP + 1][256] ;
+static int can_coding_ready = 0 ;
+
+
+//               TABLE CONSTRUCTION (ONE BIT AT A TIME, AS BEFORE)
+//
+// The state machines below are the loops of the old bitStuff() and
+// unBitStuff(), for a run of zeros (old value 0) of length run. A run of
+// length 0 is the start of a frame (no old value yet).
+//
+// Stuff one byte, MSB first. Returns the table entry.
+static unsigned short canStuffEntry(int run, int byte) {
+    int old = run ? 0 : 2 ;
+    int i, bit, out = 0, n = 0 ;
+    for (i = 7; i >= 0; i--) {
+        bit = (byte >> i) & 1 ;
+        run = (bit == old) ? run + 1 : 1 ;
+        old = bit ;
+        out = (out << 1) | bit ; n++ ;
+        if (run == CAN_STUFF_RUN) {
+            out = (out << 1) | !bit ; n++ ;
+            run = 1 ;
+            old = !bit ;
+        }
+    }
+    return (unsigned short)(out | ((n - 8) << 10) | (run << CAN_STATE_SHIFT) | (old ? CAN_STATE_FLIP : 0)) ;
+}
+// Unstuff one byte, MSB first. Returns the table entry.
+static unsigned short canUnstuffEntry(int state, int byte) {
+    int old = (state == 0) ? 2 : 0 ;
+    int run = (state == CAN_UNSTUFF_SKIP) ? 1 : state ;
+    int skip = (state == CAN_UNSTUFF_SKIP) ;
+    int i, bit, out = 0, n = 0 ;
+    for (i = 7; i >= 0; i--) {
+        bit = (byte >> i) & 1 ;
+        // a stuff bit: dropped, and (by assumption) the opposite of the run
+        if (skip) {
+            skip = 0 ;
+            continue ;
+        }
+        run = (bit == old) ? run + 1 : 1 ;
+        old = bit ;
+        out = (out << 1) | bit ; n++ ;
+        if (run == CAN_STUFF_RUN) {
+            run = 1 ;
+            old = !bit ;
+            skip = 1 ;
+        }
+    }
+    state = skip ? CAN_UNSTUFF_SKIP : run ;
+    return (unsigned short)(out | (n << 8) | (state << CAN_STATE_SHIFT) | (old == 1 ? CAN_STATE_FLIP : 0)) ;
+}
+
+// Build the tables (call once before the functions below; the setup
+// functions in can_driver.h do)
+void canCodingInit() {
+    int i, j, s ;
+    unsigned short crc ;
+    if (can_coding_ready) return ;
+    for (i = 0; i < 256; i++) {
+        crc = i << 8 ;
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ CRC16_POLY) : (crc << 1) ;
+        }
+        can_crc_table[i] = crc ;
+    }
+    for (s = 0; s < CAN_STUFF_RUN; s++) {
+        for (i = 0; i < 256; i++) can_stuff_table[s][i] = canStuffEntry(s, i) ;
+    }
+    for (s = 0; s <= CAN_UNSTUFF_SKIP; s++) {
+        for (i = 0; i < 256; i++) can_unstuff_table[s][i] = canUnstuffEntry(s, i) ;
+    }
+    can_coding_ready = 1 ;
+}
+
+
+//               FUNCTION WHICH COMPUTES CHECKSUM (TX & RX)
+//
+// Add one byte to the checksum
+static inline unsigned short culCalcCRC(char crcData, unsigned short crcReg) {
+    return (crcReg << 8) ^ can_crc_table[((crcReg >> 8) ^ crcData) & 0xFF] ;
+}
+// Add len bytes to the checksum
+static inline unsigned short canCRC(const unsigned char * data, int len, unsigned short crcReg) {
+    while (len--) {
+        crcReg = (crcReg << 8) ^ can_crc_table[((crcReg >> 8) ^ *data++) & 0xFF] ;
+    }
+    return crcReg ;
+}
+
+
+//                        BIT STUFFING AND UNSTUFFING
+//
+// Stuff the shorts of unstuffed, MSB first, up to (not including) the
+// first 0xFFFF, then pad the last short with zeros, and end with 0xFFFF.
+// As before, a frame that ends on a short boundary gets a whole short of
+// padding. Returns the number of stuffed shorts, including the 0xFFFF.
+int bitStuff(unsigned short * unstuffed, unsigned short * stuffed) {
+    uint32_t acc = 0 ;              // output bits not yet stored
+    int bits = 0 ;                  // how many
+    int state = 0, flip = 0 ;       // run length, and 0xFF if it is a run of ones
+    int i, k, byte ;
+    unsigned short entry ;
+    unsigned short * out = stuffed ;
+
+    // Clear the buffer
+    memset(stuffed, 0, MAX_STUFFED_PACKET_LEN) ;
+
+    // Until we find the end of frame . . .
+    for (i = 0; (unstuffed[i] != 0xFFFF) && (i < MAX_PACKET_LEN); i++) {
+        for (k = 8; k >= 0; k -= 8) {
+            byte = ((unstuffed[i] >> k) & 0xFF) ^ flip ;
+            entry = can_stuff_table[state][byte] ;
+            acc = (acc << (8 + ((entry >> 10) & 0x3))) |
+                  ((entry ^ (flip ? 0x3FF : 0)) & (0x3FF >> (2 - ((entry >> 10) & 0x3)))) ;
+            bits += 8 + ((entry >> 10) & 0x3) ;
+            state = (entry >> CAN_STATE_SHIFT) & CAN_STATE_MASK ;
+            if (entry & CAN_STATE_FLIP) flip ^= 0xFF ;
+            if (bits >= 16) {
+                bits -= 16 ;
+                *out++ = (unsigned short)(acc >> bits) ;
+            }
+        }
+    }
+    // Pack out rest of that short with zeroes, then the end of frame
+    *out++ = (unsigned short)(acc << (16 - bits)) ;
+    *out = 0xFFFF ;
+    return (out - stuffed) + 1 ;
+}
+
+// Unstuff the first n bytes of a received packet (or fewer, if the
+// frame ends first) into unstuffed, stopping at the first 0xFF byte (the
+// recessive end of frame). Returns the number of whole bytes. Checking
+// the arbitration short only costs n = 2.
+int unBitStuffN(const unsigned char * stuffed, unsigned char * unstuffed, int n) {
+    uint32_t acc = 0 ;
+    int bits = 0 ;
+    int state = 0, flip = 0 ;
+    int i, k ;
+    unsigned short entry ;
+    unsigned char * out = unstuffed ;
+    unsigned char * end = unstuffed + n ;
+
+    // Until we find the end of frame . . .
+    for (i = 0; (i < MAX_STUFFED_PACKET_LEN) && (stuffed[i] != 0xFF); i++) {
+        entry = can_unstuff_table[state][stuffed[i] ^ flip] ;
+        k = (entry >> 8) & 0xF ;
+        acc = (acc << k) | ((entry ^ flip) & (0xFF >> (8 - k))) ;
+        bits += k ;
+        state = (entry >> CAN_STATE_SHIFT) & CAN_STATE_MASK ;
+        if (entry & CAN_STATE_FLIP) flip ^= 0xFF ;
+        if (bits >= 8) {
+            bits -= 8 ;
+            *out++ = (unsigned char)(acc >> bits) ;
+            if (out == end) return n ;
+        }
+    }
+    // Bits of the last, partial byte
+    if (bits) *out = (unsigned char)(acc << (8 - bits)) ;
+    return out - unstuffed ;
+}
+
+// Unstuff a received packet into unstuffed (MAX_PACKET_LEN bytes)
+//
+// Why not do an in-place replacement? I think that it will be nice
+// to start gathering the next stuffed buffer while doing work on the
+// last one.
+void unBitStuff(unsigned char * stuffed, unsigned char * unstuffed) {
+    // Clear the buffer
+    memset(unstuffed, 0, MAX_PACKET_LEN) ;
+    unBitStuffN(stuffed, unstuffed, MAX_PACKET_LEN) ;
+}
+
+
+//                               CAN 2.0 FRAMES
+//
+// CRC-15 polynomial (x^15 + x^14 + x^10 + x^8 + x^7 + x^4 + x^3 + 1)
+#define CAN2_CRC_POLY           0x4599
+// ID flags in can_frame.arbitration
+#define CAN_EFF_FLAG            0x80000000u
+#define CAN_RTR_FLAG            0x40000000u
+#define CAN_SFF_MASK            0x000007FFu
+#define CAN_EFF_MASK            0x1FFFFFFFu
+// Longest frame, SOF to CRC delimiter (stuffed), in bits and 16-bit words
+#define CAN2_MAX_BITS           148
+#define CAN2_MAX_WORDS          ((CAN2_MAX_BITS + 15) >> 4)
+// Recessive bits after the CRC delimiter before the next frame (ACK
+// delimiter, EOF, intermission), and the extra wait when error-passive
+#define CAN2_IDLE_BITS          11
+#define CAN2_SUSPEND_BITS       8
+// can2DecodeRest() results
+#define CAN2_OK                 0
+#define CAN2_STUFF_ERROR        1
+#define CAN2_CRC_ERROR          2
+#define CAN2_FORM_ERROR         3
+
+// A frame being stuffed into words (MSB first), or unstuffed from bytes
+struct can2_bits {
+    unsigned short * out ;          // stuffing: the words
+    const unsigned char * in ;      // unstuffing: the received bytes
+    int n ;                         // bits written, or read
+    int end ;                       // bits received (the bus is recessive after)
+    int run, last ;                 // current run of identical bits
+    unsigned short crc ;
+    int error ;
+} ;
+
+// Add one bit to the CRC
+static inline unsigned short can2CRCBit(unsigned short crc, int bit) {
+    int top = ((crc >> 14) ^ bit) & 1 ;
+    crc = (crc << 1) & 0x7FFF ;
+    return top ? (crc ^ CAN2_CRC_POLY) : crc ;
+}
+
+static inline void can2PutRaw(struct can2_bits * b, int bit) {
+    if (bit) b->out[b->n >> 4] |= 0x8000 >> (b->n & 15) ;
+    b->n++ ;
+}
+// Put the n low bits of value, MSB first, stuffed (and in the CRC if crc)
+static void can2Put(struct can2_bits * b, uint32_t value, int n, int crc) {
+    int bit ;
+    while (n--) {
+        bit = (value >> n) & 1 ;
+        if (crc) b->crc = can2CRCBit(b->crc, bit) ;
+        can2PutRaw(b, bit) ;
+        b->run = (bit == b->last) ? b->run + 1 : 1 ;
+        b->last = bit ;
+        if (b->run == CAN_STUFF_RUN) {
+            can2PutRaw(b, !bit) ;
+            b->run = 1 ;
+            b->last = !bit ;
+        }
+    }
+}
+
+// Stuff a frame, SOF to CRC delimiter, into out (CAN2_MAX_WORDS). Returns
+// the number of bits, and the number of them in the arbitration field
+// (a bus conflict after that is a bit error, not a lost arbitration).
+int can2Encode(const struct can_frame * frame, unsigned short * out, int * arb_bits) {
+    struct can2_bits b = {out, NULL, 0, 0, 0, -1, 0, 0} ;
+    uint32_t id = frame->arbitration ;
+    int rtr = (id & CAN_RTR_FLAG) ? 1 : 0 ;
+    int len = (frame->length > 8) ? 8 : frame->length ;
+    int i ;
+    memset(out, 0, CAN2_MAX_WORDS * sizeof(unsigned short)) ;
+
+    can2Put(&b, 0, 1, 1) ;                          // SOF
+    if (id & CAN_EFF_FLAG) {
+        can2Put(&b, (id >> 18) & 0x7FF, 11, 1) ;    // base ID
+        can2Put(&b, 3, 2, 1) ;                      // SRR, IDE (recessive)
+        can2Put(&b, id & 0x3FFFF, 18, 1) ;          // ID extension
+        can2Put(&b, rtr, 1, 1) ;                    // RTR
+        *arb_bits = b.n ;
+        can2Put(&b, 0, 2, 1) ;                      // r1, r0
+    }
+    else {
+        can2Put(&b, id & CAN_SFF_MASK, 11, 1) ;     // ID
+        can2Put(&b, rtr, 1, 1) ;                    // RTR
+        can2Put(&b, 0, 1, 1) ;                      // IDE (dominant, beats an extended ID)
+        *arb_bits = b.n ;
+        can2Put(&b, 0, 1, 1) ;                      // r0
+    }
+    can2Put(&b, len, 4, 1) ;                        // DLC
+    if (!rtr) {
+        for (i = 0; i < len; i++) can2Put(&b, frame->payload[i], 8, 1) ;
+    }
+    can2Put(&b, b.crc, 15, 0) ;                     // CRC (stuffed too)
+    can2PutRaw(&b, 1) ;                             // CRC delimiter
+    return b.n ;
+}
+
+// Transmit order of an ID: lowest first, as it would win arbitration
+static inline uint32_t can2Priority(uint32_t id) {
+    if (id & CAN_EFF_FLAG) {
+        return (((id >> 18) & 0x7FF) << 21) | (3u << 19) | ((id & 0x3FFFF) << 1) |
+               ((id & CAN_RTR_FLAG) ? 1 : 0) ;
+    }
+    return ((id & CAN_SFF_MASK) << 21) | ((id & CAN_RTR_FLAG) ? (1u << 20) : 0) ;
+}
+
+static inline int can2GetRaw(struct can2_bits * b) {
+    int bit = (b->n < b->end) ? ((b->in[b->n >> 3] >> (7 - (b->n & 7))) & 1) : 1 ;
+    b->n++ ;
+    return bit ;
+}
+// Get n bits, MSB first, dropping stuff bits (and adding them to the CRC if crc)
+static uint32_t can2Get(struct can2_bits * b, int n, int crc) {
+    uint32_t value = 0 ;
+    int bit, stuff ;
+    while (n--) {
+        bit = can2GetRaw(b) ;
+        if (crc) b->crc = can2CRCBit(b->crc, bit) ;
+        value = (value << 1) | bit ;
+        b->run = (bit == b->last) ? b->run + 1 : 1 ;
+        b->last = bit ;
+        if (b->run == CAN_STUFF_RUN) {
+            // six in a row: an error flag, or a broken frame
+            stuff = can2GetRaw(b) ;
+            if ((stuff == bit) && !b->error) b->error = CAN2_STUFF_ERROR ;
+            b->run = 1 ;
+            b->last = stuff ;
+        }
+    }
+    return value ;
+}
+
+// Start unstuffing nbytes received bytes. The RX machine syncs on the
+// SOF and starts collecting at the bit after it, so the SOF (dominant)
+// is already in the CRC and the current run.
+void can2Begin(struct can2_bits * b, const unsigned char * raw, int nbytes) {
+    memset(b, 0, sizeof(*b)) ;
+    b->in = raw ;
+    b->end = nbytes << 3 ;
+    b->crc = can2CRCBit(0, 0) ;
+    b->run = 1 ;
+    b->last = 0 ;
+}
+
+// Unstuff the arbitration field and control bits up to the DLC. Returns
+// the ID, with CAN_EFF_FLAG and CAN_RTR_FLAG, so a frame can be dropped
+// before the rest is decoded.
+uint32_t can2DecodeID(struct can2_bits * b) {
+    uint32_t id ;
+    int rtr ;
+    id = can2Get(b, 11, 1) ;
+    rtr = can2Get(b, 1, 1) ;                        // RTR, or SRR
+    if (can2Get(b, 1, 1)) {                         // IDE
+        id = (id << 18) | can2Get(b, 18, 1) | CAN_EFF_FLAG ;
+        rtr = can2Get(b, 1, 1) ;
+        can2Get(b, 2, 1) ;                          // r1, r0 (either value)
+    }
+    else {
+        can2Get(b, 1, 1) ;                          // r0
+    }
+    return rtr ? (id | CAN_RTR_FLAG) : id ;
+}
+
+// Unstuff the rest of the frame into frame (arbitration already set from
+// can2DecodeID), check the CRC and the delimiters. ack is set if a node
+// drove the ACK slot. Returns CAN2_OK or the first error.
+int can2DecodeRest(struct can2_bits * b, struct can_frame * frame, int * ack) {
+    unsigned short crc ;
+    int i, error = CAN2_OK ;
+    i = can2Get(b, 4, 1) ;                          // DLC (9 to 15 mean 8)
+    frame->length = (i > 8) ? 8 : i ;
+    frame->reserve = 0 ;
+    if (!(frame->arbitration & CAN_RTR_FLAG)) {
+        for (i = 0; i < frame->length; i++) frame->payload[i] = can2Get(b, 8, 1) ;
+    }
+    crc = b->crc ;
+    if (can2Get(b, 15, 0) != crc) error = CAN2_CRC_ERROR ;
+    if (!can2GetRaw(b) && !error) error = CAN2_FORM_ERROR ;    // CRC delimiter
+    *ack = !can2GetRaw(b) ;
+    if (!can2GetRaw(b) && !error) error = CAN2_FORM_ERROR ;    // ACK delimiter
+    return b->error ? b->error : error ;
+}
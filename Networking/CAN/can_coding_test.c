@@ -0,0 +1,647 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Host test and benchmark for can_coding.h
+ *
+ * Runs on a PC, not the Pico. The table-driven checksum, stuffing and
+ * unstuffing in can_coding.h must produce exactly the frames the old
+ * bit-at-a-time code did (copied below as the reference), so this
+ * fuzzes the two against each other:
+ *
+ *  - checksums of random byte strings
+ *  - stuffing random packets, assembled the way sendPacket() does
+ *  - round trips: stuffed packets, as the RX machine would collect them,
+ *    unstuffed by both and compared with the original packet
+ *  - unstuffing random garbage (what a receiver sees on a noisy bus)
+ *  - the stuffed length bitStuff() returns, and unstuffing just the
+ *    arbitration short with unBitStuffN()
+ *  - CAN 2.0 frames: the CRC-15 check value, random standard/extended/
+ *    remote frames stuffed by can2Encode() against a plain bit-array
+ *    version, decoded back as the RX machine would collect them (with
+ *    and without an ACK), and with single bit errors (all must be caught)
+ *
+ * then times both versions and prints bits per microsecond (of host
+ * time, so compare the ratio rather than the numbers).
+ *
+ * BUILD AND RUN
+ *   gcc -O2 -o can_coding_test can_coding_test.c && ./can_coding_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "can_parameters.h"
+#include "can_coding.h"
+
+// Number of random cases per test
+#define FUZZ_CASES      200000
+// Benchmark iterations
+#define BENCH_RUNS      200000
+
+
+//            REFERENCE: THE BIT-AT-A-TIME VERSIONS FROM can_driver.h
+//
+unsigned char zero_packet[MAX_STUFFED_PACKET_LEN] = {0} ;
+
+unsigned short ref_culCalcCRC(char crcData, unsigned short crcReg) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        if (((crcReg & 0x8000) >> 8) ^ (crcData & 0x80)) {
+            crcReg = (crcReg << 1) ^ CRC16_POLY;
+        } else {
+          crcReg = (crcReg << 1);
+        }
+        crcData <<= 1;
+    }
+    return crcReg;
+}
+
+
+// Helper function which access a particular bit in an unsigned short.
+// It returns that bit (0 or 1) as an unsigned short.
+unsigned short getBitShort(unsigned short * shorty, unsigned char bitnum) {
+    switch(bitnum) {
+        case 0:
+            return ((*shorty & 0x8000) >> 15) ;
+        case 1:
+            return ((*shorty & 0x4000) >> 14) ;
+        case 2:
+            return ((*shorty & 0x2000) >> 13) ;
+        case 3:
+            return ((*shorty & 0x1000) >> 12) ;
+        case 4:
+            return ((*shorty & 0x0800) >> 11) ;
+        case 5:
+            return ((*shorty & 0x0400) >> 10) ;
+        case 6:
+            return ((*shorty & 0x0200) >> 9) ;
+        case 7:
+            return ((*shorty & 0x0100) >> 8) ;
+        case 8:
+            return ((*shorty & 0x0080) >> 7) ;
+        case 9:
+            return ((*shorty & 0x0040) >> 6) ;
+        case 10:
+            return ((*shorty & 0x0020) >> 5) ;
+        case 11:
+            return ((*shorty & 0x0010) >> 4) ;
+        case 12:
+            return ((*shorty & 0x0008) >> 3) ;
+        case 13:
+            return ((*shorty & 0x0004) >> 2) ;
+        case 14:
+            return ((*shorty & 0x0002) >> 1) ;
+        case 15:
+            return ((*shorty & 0x0001) >> 0) ;
+        default:
+            return 0xFFFF ;
+    }
+}
+// Helper function which modifies a single bit in an unsigned short. The first argument
+// is a pointer to the short that will be modified. The second is the bit number (0-15) to
+// modify. And the third is the value (0 or 1) to which we would like it modified.
+void modifyBitShort(unsigned short * shorty, unsigned char bitnum, unsigned short value) {
+    switch(bitnum) {
+        case 15:
+            *shorty |= ((value << 0) & 0x0001) ;
+            break ;
+        case 14:
+            *shorty |= ((value << 1) & 0x0002) ;
+            break ;
+        case 13:
+            *shorty |= ((value << 2) & 0x0004) ;
+            break ;
+        case 12:
+            *shorty |= ((value << 3) & 0x0008) ;
+            break ;
+        case 11:
+            *shorty |= ((value << 4) & 0x0010) ;
+            break ;
+        case 10:
+            *shorty |= ((value << 5) & 0x0020) ;
+            break ;
+        case 9:
+            *shorty |= ((value << 6) & 0x0040) ;
+            break ;
+        case 8:
+            *shorty |= ((value << 7) & 0x0080) ;
+            break ;
+        case 7:
+            *shorty |= ((value << 8) & 0x0100) ;
+            break ;
+        case 6:
+            *shorty |= ((value << 9) & 0x0200) ;
+            break ;
+        case 5:
+            *shorty |= ((value << 10) & 0x0400) ;
+            break ;
+        case 4:
+            *shorty |= ((value << 11) & 0x0800) ;
+            break ;
+        case 3:
+            *shorty |= ((value << 12) & 0x1000) ;
+            break ;
+        case 2:
+            *shorty |= ((value << 13) & 0x2000) ;
+            break ;
+        case 1:
+            *shorty |= ((value << 14) & 0x4000) ;
+            break ;
+        case 0:
+            *shorty |= ((value << 15) & 0x8000) ;
+            break ;
+        default:
+            printf("Invalid argument to modifyBitChar   \n") ;
+            break ;
+    }
+}
+// Assumes that the final element in the unstuffed buffer is 0xFFFF
+void ref_bitStuff(unsigned short * unstuffed, unsigned short * stuffed) {
+    // Clear the buffer
+    memcpy(&stuffed[0], &zero_packet[0], MAX_STUFFED_PACKET_LEN) ;
+
+    // Variables for monitoring position in each buffer
+    int stuffed_index   = 0 ;
+    int unstuffed_index = 0 ;
+    int stuffed_bit     = 0 ;
+    int unstuffed_bit   = 0 ;
+
+    // Accumulated bit run length
+    int bit_run_len = 1 ;
+
+    // Memory of old bit value
+    unsigned short new_val = 0 ;
+    unsigned short old_val = 2 ;
+
+    // Until we find the end of frame . . .
+    while ((*(unstuffed + unstuffed_index) != 0xFFFF) && (unstuffed_index < MAX_PACKET_LEN)) {
+        new_val = getBitShort((unstuffed + unstuffed_index), unstuffed_bit) ;
+        bit_run_len = (new_val==old_val)?(bit_run_len+1):1 ;
+        old_val = new_val ;
+
+        if (bit_run_len < 5) {
+            modifyBitShort(stuffed+stuffed_index, stuffed_bit, new_val) ;
+            stuffed_bit = (stuffed_bit<15)?(stuffed_bit+1):0 ;
+            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
+            unstuffed_bit = (unstuffed_bit<15)?(unstuffed_bit+1):0 ;
+            unstuffed_index = (unstuffed_bit==0)?(unstuffed_index+1):unstuffed_index ;
+
+        }
+        else {
+            modifyBitShort(stuffed+stuffed_index, stuffed_bit, new_val) ;
+            stuffed_bit = (stuffed_bit<15)?(stuffed_bit+1):0 ;
+            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
+
+            modifyBitShort(stuffed+stuffed_index, stuffed_bit, !new_val) ;
+            stuffed_bit = (stuffed_bit<15)?(stuffed_bit+1):0 ;
+            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
+            unstuffed_bit = (unstuffed_bit<15)?(unstuffed_bit+1):0 ;
+            unstuffed_index = (unstuffed_bit==0)?(unstuffed_index+1):unstuffed_index ;
+
+            bit_run_len = 1 ;
+            old_val = !new_val ;
+        }
+    }
+    // Pack out rest of that index with zeroes
+    while(stuffed_bit <= 15) {
+        modifyBitShort(stuffed+stuffed_index, stuffed_bit, 0) ;
+        stuffed_bit += 1 ;
+    }
+
+    // Postpend a short of all ones
+    stuffed_index += 1 ;
+    *(stuffed + stuffed_index) = *(unstuffed + unstuffed_index) ;
+}
+unsigned char getBitChar(unsigned char * byte, unsigned char bitnum) {
+    switch(bitnum) {
+        case 0:
+            return ((*byte & 0x80) >> 7) ;
+        case 1:
+            return ((*byte & 0x40) >> 6) ;
+        case 2:
+            return ((*byte & 0x20) >> 5) ;
+        case 3:
+            return ((*byte & 0x10) >> 4) ;
+        case 4:
+            return ((*byte & 0x08) >> 3) ;
+        case 5:
+            return ((*byte & 0x04) >> 2) ;
+        case 6:
+            return ((*byte & 0x02) >> 1) ;
+        case 7:
+            return ((*byte & 0x01) >> 0) ;
+        default:
+            return 0xFF ;
+    }
+}
+// Helper function which modifies a single bit in an unsigned char. The first argument
+// is a pointer to the char that will be modified. The second is the bit number (0-7) to
+// modify. And the third is the value (0 or 1) to which we would like it modified.
+void modifyBitChar(unsigned char * byte, unsigned char bitnum, unsigned char value) {
+    switch(bitnum) {
+        case 7:
+            *byte |= ((value << 0) & 0x01) ;
+            break ;
+        case 6:
+            *byte |= ((value << 1) & 0x02) ;
+            break ;
+        case 5:
+            *byte |= ((value << 2) & 0x04) ;
+            break ;
+        case 4:
+            *byte |= ((value << 3) & 0x08) ;
+            break ;
+        case 3:
+            *byte |= ((value << 4) & 0x10) ;
+            break ;
+        case 2:
+            *byte |= ((value << 5) & 0x20) ;
+            break ;
+        case 1:
+            *byte |= ((value << 6) & 0x40) ;
+            break ;
+        case 0:
+            *byte |= ((value << 7) & 0x80) ;
+            break ;
+        default:
+            printf("Invalid argument to modifyBitChar   \n") ;
+            break ;
+    }
+}
+// Function which takes a pointer to a stuffed character array,
+// and a pointer to an array where we would like the unstuffed
+// data to be stored. Function unstuffs the first array and stores
+// the result in the second.
+//
+// Why not do an in-place replacement? I think that it will be nice
+// to start gathering the next stuffed buffer while doing work on the
+// last one.
+void ref_unBitStuff(unsigned char * stuffed, unsigned char * unstuffed) {
+    // Clear the buffer
+    memcpy(&unstuffed[0], &zero_packet[0], MAX_STUFFED_PACKET_LEN) ;
+
+    // Variables for monitoring position in each buffer
+    int stuffed_index   = 0 ;
+    int unstuffed_index = 0 ;
+    int stuffed_bit     = 0 ;
+    int unstuffed_bit   = 0 ;
+
+    // Accumulated bit run length
+    int bit_run_len     = 0 ;
+
+    // Memory of old bit value
+    unsigned char new_val = 0 ;
+    unsigned char old_val = 2 ;
+
+    // Until we find the end of frame . . .
+    while ((*(stuffed + stuffed_index) != 0xFF) && (stuffed_index < (MAX_STUFFED_PACKET_LEN))) {
+        // Get a new bit, update the bit run length, and update the bit memory
+        new_val = getBitChar((stuffed+stuffed_index), stuffed_bit) ;
+        bit_run_len = (new_val==old_val)?(bit_run_len+1):1 ;
+        old_val = new_val ;
+
+        // If our bit run length is less than 5, update the unstuffed buffer
+        // and increment position in each buffer.
+        if (bit_run_len < 5) {
+
+            modifyBitChar(unstuffed+unstuffed_index, unstuffed_bit, new_val) ;
+
+            unstuffed_bit = (unstuffed_bit<7)?(unstuffed_bit+1):0 ;
+            unstuffed_index = (unstuffed_bit==0)?(unstuffed_index+1):unstuffed_index ;
+
+            stuffed_bit = (stuffed_bit<7)?(stuffed_bit+1):0 ;
+            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
+
+        }
+
+        // If our bit run length is 5, update the unstuffed buffer. Then
+        // increment the unstuffed buffer by ONE and the stuffed buffer by TWO
+        // in order to skip over the stuff bit.
+        else {
+            modifyBitChar(unstuffed+unstuffed_index, unstuffed_bit, new_val) ;
+            unstuffed_bit = (unstuffed_bit<7)?(unstuffed_bit+1):0 ;
+            unstuffed_index = (unstuffed_bit==0)?(unstuffed_index+1):unstuffed_index ;
+
+            stuffed_bit = (stuffed_bit<7)?(stuffed_bit+1):0 ;
+            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
+            stuffed_bit = (stuffed_bit<7)?(stuffed_bit+1):0 ;
+            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
+
+            // Reset bit run length
+            bit_run_len = 1 ;
+            // We jumped over a stuffed bit, opposite polarity to
+            // the last bit that we measured
+            old_val = !new_val ;
+        }
+    }
+
+}
+
+
+//                                 TEST HELPERS
+//
+// Number of failures
+int failures = 0 ;
+
+// Assemble a random packet the way sendPacket() does (arbitration,
+// reserve byte and length, payload, checksum, EOF). Returns its length
+// in shorts, not counting the EOF.
+int randomPacket(unsigned short * packet, int use_reference) {
+    int i, len = (rand() % (MAX_PAYLOAD_SIZE/2 + 1)) * 2 ;
+    unsigned short checksum = CRC_INIT ;
+    packet[0] = rand() ;
+    packet[1] = ((rand() & 0xFF) << 8) | len ;
+    for (i = 0; i < len/2; i++) {
+        // mostly random, sometimes long runs (the worst case for
+        // stuffing). Never 0xFFFF: that marks the end of the frame, so
+        // the protocol can't carry it.
+        packet[2 + i] = (rand() & 3) ? rand() % 0xFFFF : ((rand() & 1) ? 0x0000 : 0x7FFF) ;
+    }
+    while (checksum == 0xFFFF) {
+        packet[1] ^= 0x8000 ;
+        for (i = 0; i < (len>>1)+2; i++) {
+            if (use_reference) {
+                checksum = ref_culCalcCRC((packet[i]>>8)&0xFF, checksum) ;
+                checksum = ref_culCalcCRC((packet[i])&0xFF, checksum) ;
+            }
+            else {
+                checksum = culCalcCRC((packet[i]>>8)&0xFF, checksum) ;
+                checksum = culCalcCRC((packet[i])&0xFF, checksum) ;
+            }
+        }
+    }
+    packet[i] = checksum ;
+    packet[i+1] = 0xFFFF ;
+    return i + 1 ;
+}
+
+// Shorts (as transmitted, MSB first) to bytes (as the RX machine packs them)
+void shortsToBytes(unsigned short * shorts, unsigned char * bytes, int n) {
+    int i ;
+    for (i = 0; i < n; i++) {
+        bytes[2*i] = shorts[i] >> 8 ;
+        bytes[2*i + 1] = shorts[i] & 0xFF ;
+    }
+}
+
+void check(int ok, const char * what, int k) {
+    if (!ok && failures++ < 10) printf("  FAIL: %s (case %d)\n", what, k) ;
+}
+
+double seconds() {
+    struct timespec t ;
+    clock_gettime(CLOCK_MONOTONIC, &t) ;
+    return t.tv_sec + 1e-9 * t.tv_nsec ;
+}
+
+
+//                                    TESTS
+//
+void testCRC() {
+    unsigned char data[64] ;
+    unsigned short a, b ;
+    int k, i, len ;
+    for (k = 0; k < FUZZ_CASES; k++) {
+        len = rand() % sizeof(data) ;
+        for (i = 0; i < len; i++) data[i] = rand() ;
+        a = b = CRC_INIT ;
+        for (i = 0; i < len; i++) {
+            a = ref_culCalcCRC(data[i], a) ;
+            b = culCalcCRC(data[i], b) ;
+        }
+        check(a == b, "culCalcCRC", k) ;
+        check(canCRC(data, len, CRC_INIT) == a, "canCRC", k) ;
+    }
+    printf("CRC:            %d random strings\n", FUZZ_CASES) ;
+}
+
+void testStuffing() {
+    unsigned short packet[MAX_PACKET_LEN>>1], packet2[MAX_PACKET_LEN>>1] ;
+    unsigned short a[MAX_STUFFED_PACKET_LEN>>1], b[MAX_STUFFED_PACKET_LEN>>1] ;
+    unsigned char bytes[MAX_STUFFED_PACKET_LEN + 1], original[MAX_PACKET_LEN] ;
+    unsigned char ua[MAX_STUFFED_PACKET_LEN], ub[MAX_PACKET_LEN], id[2] ;
+    int k, n, m, seed ;
+    for (k = 0; k < FUZZ_CASES; k++) {
+        // same packet, checksum from each version
+        seed = rand() ;
+        srand(seed) ; n = randomPacket(packet, 1) ;
+        srand(seed) ; randomPacket(packet2, 0) ;
+        check(memcmp(packet, packet2, (n + 1) * 2) == 0, "packet checksum", k) ;
+
+        ref_bitStuff(packet, a) ;
+        m = bitStuff(packet, b) ;
+        check(memcmp(a, b, sizeof(a)) == 0, "bitStuff", k) ;
+        // the count covers the EOF, and nothing after it
+        check((m >= 2) && (b[m - 1] == 0xFFFF) && (b[m - 2] != 0xFFFF), "bitStuff length", k) ;
+
+        // round trip: the bytes the receiver collects, idle bus after them
+        shortsToBytes(b, bytes, MAX_STUFFED_PACKET_LEN>>1) ;
+        bytes[MAX_STUFFED_PACKET_LEN] = 0xFF ;
+        ref_unBitStuff(bytes, ua) ;
+        unBitStuff(bytes, ub) ;
+        check(memcmp(ua, ub, MAX_PACKET_LEN) == 0, "unBitStuff of a packet", k) ;
+        shortsToBytes(packet, original, n) ;
+        check(memcmp(original, ub, n * 2) == 0, "round trip", k) ;
+        // just the arbitration short, as the receive filter does
+        check((unBitStuffN(bytes, id, 2) == 2) && (memcmp(id, ub, 2) == 0), "unBitStuffN", k) ;
+        srand(seed + 1) ;
+    }
+    printf("Stuffing:       %d random packets, stuffed and round-tripped\n", FUZZ_CASES) ;
+}
+
+void testGarbage() {
+    unsigned char bytes[MAX_STUFFED_PACKET_LEN + 1] ;
+    unsigned char ua[MAX_STUFFED_PACKET_LEN], ub[MAX_PACKET_LEN] ;
+    int k, i, end ;
+    for (k = 0; k < FUZZ_CASES; k++) {
+        // random bits, runs, and an end of frame anywhere (or nowhere)
+        for (i = 0; i < MAX_STUFFED_PACKET_LEN; i++) {
+            bytes[i] = (rand() & 7) ? (rand() & 0xFE) | (rand() & 1) : ((rand() & 1) ? 0x00 : 0xF8) ;
+            if (bytes[i] == 0xFF) bytes[i] = 0xFE ;
+        }
+        end = rand() % (MAX_STUFFED_PACKET_LEN + 1) ;
+        bytes[end] = 0xFF ;
+        ref_unBitStuff(bytes, ua) ;
+        unBitStuff(bytes, ub) ;
+        check(memcmp(ua, ub, MAX_PACKET_LEN) == 0, "unBitStuff of garbage", k) ;
+    }
+    printf("Unstuffing:     %d random streams\n", FUZZ_CASES) ;
+}
+
+// CAN 2.0 reference: the frame as an array of bits, then stuffed
+int refCAN2Bits(const struct can_frame * f, unsigned char * out) {
+    unsigned char bits[160] ;
+    int n = 0, i, k, run = 0, last = -1, m = 0 ;
+    unsigned short crc = 0 ;
+    uint32_t id = f->arbitration ;
+    int rtr = (id & CAN_RTR_FLAG) != 0 ;
+    bits[n++] = 0 ;
+    if (id & CAN_EFF_FLAG) {
+        for (k = 28; k >= 18; k--) bits[n++] = (id >> k) & 1 ;
+        bits[n++] = 1 ; bits[n++] = 1 ;
+        for (k = 17; k >= 0; k--) bits[n++] = (id >> k) & 1 ;
+        bits[n++] = rtr ; bits[n++] = 0 ; bits[n++] = 0 ;
+    }
+    else {
+        for (k = 10; k >= 0; k--) bits[n++] = (id >> k) & 1 ;
+        bits[n++] = rtr ; bits[n++] = 0 ; bits[n++] = 0 ;
+    }
+    for (k = 3; k >= 0; k--) bits[n++] = (f->length >> k) & 1 ;
+    if (!rtr) for (i = 0; i < f->length; i++) for (k = 7; k >= 0; k--) bits[n++] = (f->payload[i] >> k) & 1 ;
+    for (i = 0; i < n; i++) {
+        int top = ((crc >> 14) & 1) ^ bits[i] ;
+        crc = (crc << 1) & 0x7FFF ;
+        if (top) crc ^= 0x4599 ;
+    }
+    for (k = 14; k >= 0; k--) bits[n++] = (crc >> k) & 1 ;
+    for (i = 0; i < n; i++) {
+        out[m++] = bits[i] ;
+        run = (bits[i] == last) ? run + 1 : 1 ;
+        last = bits[i] ;
+        if (run == 5) { out[m++] = !last ; last = !last ; run = 1 ; }
+    }
+    out[m++] = 1 ;
+    return m ;
+}
+
+void randomCAN2Frame(struct can_frame * f) {
+    int i ;
+    memset(f, 0, sizeof(*f)) ;
+    if (rand() & 1) f->arbitration = ((((uint32_t)rand() << 8) ^ rand()) & CAN_EFF_MASK) | CAN_EFF_FLAG ;
+    else f->arbitration = rand() & CAN_SFF_MASK ;
+    if ((rand() & 7) == 0) f->arbitration |= CAN_RTR_FLAG ;
+    f->length = rand() % 9 ;
+    for (i = 0; i < f->length; i++) f->payload[i] = (rand() & 3) ? rand() : ((rand() & 1) ? 0x00 : 0xFF) ;
+}
+
+// A frame's bits (one per byte, SOF to CRC delimiter) as the RX machine
+// collects them: from the bit after the SOF, then the ACK slot, and
+// recessive bits until it has seen 7 in a row. Packed into whole bytes, then the rest in a byte of its
+// own. Returns the whole bytes (the bus is recessive after them).
+int rxBytes(unsigned char * bits, int n, int ack, unsigned char * bytes) {
+    int i, run ;
+    bits[n] = !ack ;
+    bits++ ;
+    n-- ;
+    for (run = 0, i = n; (i >= 0) && bits[i]; i--) run++ ;
+    for (i = n + 1; run < 7; i++, run++) bits[i] = 1 ;
+    n = i ;
+    memset(bytes, 0, (n >> 3) + 1) ;
+    for (i = 0; i < (n & ~7); i++) bytes[i >> 3] |= bits[i] << (7 - (i & 7)) ;
+    for (; i < n; i++) bytes[n >> 3] = (bytes[n >> 3] << 1) | bits[i] ;
+    return n >> 3 ;
+}
+
+void testCAN2() {
+    const char * check_string = "123456789" ;
+    unsigned short crc = 0, words[CAN2_MAX_WORDS] ;
+    unsigned char ref[200], bits[200], bytes[32] ;
+    struct can_frame f, g ;
+    struct can2_bits b ;
+    int k, i, n, m, arb, ack, nbytes, result, missed = 0 ;
+
+    for (i = 0; check_string[i]; i++) {
+        for (k = 7; k >= 0; k--) crc = can2CRCBit(crc, (check_string[i] >> k) & 1) ;
+    }
+    check(crc == 0x059E, "CRC-15 check value", 0) ;
+
+    for (k = 0; k < FUZZ_CASES; k++) {
+        randomCAN2Frame(&f) ;
+        n = can2Encode(&f, words, &arb) ;
+        m = refCAN2Bits(&f, ref) ;
+        check((n == m) && (n <= CAN2_MAX_BITS) && (arb < n), "can2Encode length", k) ;
+        for (i = 0; i < n; i++) bits[i] = (words[i >> 4] >> (15 - (i & 15))) & 1 ;
+        check(memcmp(bits, ref, n) == 0, "can2Encode bits", k) ;
+
+        // as received, acknowledged or not
+        ack = rand() & 1 ;
+        nbytes = rxBytes(bits, n, ack, bytes) ;
+        can2Begin(&b, bytes, nbytes) ;
+        memset(&g, 0, sizeof(g)) ;
+        g.arbitration = can2DecodeID(&b) ;
+        result = can2DecodeRest(&b, &g, &i) ;
+        check(result == CAN2_OK, "can2Decode result", k) ;
+        check((g.arbitration == f.arbitration) && (g.length == f.length) &&
+              (memcmp(g.payload, f.payload, (f.arbitration & CAN_RTR_FLAG) ? 0 : f.length) == 0),
+              "can2Decode frame", k) ;
+        check(i == ack, "can2Decode ACK", k) ;
+
+        // one bit wrong, SOF to CRC delimiter
+        i = 1 + rand() % (n - 1) ;
+        bits[i] ^= 1 ;
+        nbytes = rxBytes(bits, n, ack, bytes) ;
+        can2Begin(&b, bytes, nbytes) ;
+        g.arbitration = can2DecodeID(&b) ;
+        if (can2DecodeRest(&b, &g, &m) == CAN2_OK) missed++ ;
+    }
+    check(missed == 0, "CAN 2.0 single bit errors", missed) ;
+    printf("CAN 2.0:        %d random frames, round-tripped and with a bit error\n", FUZZ_CASES) ;
+}
+
+
+//                                  BENCHMARK
+//
+void benchmark() {
+    static unsigned short packet[MAX_PACKET_LEN>>1], stuffed[MAX_STUFFED_PACKET_LEN>>1] ;
+    static unsigned char bytes[MAX_STUFFED_PACKET_LEN + 1], out[MAX_STUFFED_PACKET_LEN] ;
+    volatile unsigned short sink = 0 ;
+    double t0, t_old, t_new, bits ;
+    int k, n, i ;
+
+    // a full-length packet
+    do { n = randomPacket(packet, 0) ; } while (n != (MAX_PAYLOAD_SIZE>>1) + 3) ;
+    bitStuff(packet, stuffed) ;
+    shortsToBytes(stuffed, bytes, MAX_STUFFED_PACKET_LEN>>1) ;
+    bytes[MAX_STUFFED_PACKET_LEN] = 0xFF ;
+    bits = n * 16.0 ;
+
+    printf("\nBenchmark (%d-bit packet, host time)   bit-at-a-time    table      speedup\n", (int)bits) ;
+
+    t0 = seconds() ;
+    for (k = 0; k < BENCH_RUNS; k++) {
+        unsigned short c = CRC_INIT + k ;
+        for (i = 0; i < n*2; i++) c = ref_culCalcCRC(((unsigned char *)packet)[i], c) ;
+        sink += c ;
+    }
+    t_old = seconds() - t0 ;
+    t0 = seconds() ;
+    for (k = 0; k < BENCH_RUNS; k++) {
+        sink += canCRC((unsigned char *)packet, n*2, CRC_INIT + k) ;
+    }
+    t_new = seconds() - t0 ;
+    printf("  CRC           (bits/us)            %10.1f %10.1f %10.1fx\n",
+        bits * BENCH_RUNS / (t_old * 1e6), bits * BENCH_RUNS / (t_new * 1e6), t_old / t_new) ;
+
+    t0 = seconds() ;
+    for (k = 0; k < BENCH_RUNS; k++) { packet[0] ^= k & 1 ; ref_bitStuff(packet, stuffed) ; }
+    t_old = seconds() - t0 ;
+    t0 = seconds() ;
+    for (k = 0; k < BENCH_RUNS; k++) { packet[0] ^= k & 1 ; bitStuff(packet, stuffed) ; }
+    t_new = seconds() - t0 ;
+    printf("  bitStuff      (bits/us)            %10.1f %10.1f %10.1fx\n",
+        bits * BENCH_RUNS / (t_old * 1e6), bits * BENCH_RUNS / (t_new * 1e6), t_old / t_new) ;
+
+    t0 = seconds() ;
+    for (k = 0; k < BENCH_RUNS; k++) { bytes[0] ^= k & 1 ; ref_unBitStuff(bytes, out) ; }
+    t_old = seconds() - t0 ;
+    t0 = seconds() ;
+    for (k = 0; k < BENCH_RUNS; k++) { bytes[0] ^= k & 1 ; unBitStuff(bytes, out) ; }
+    t_new = seconds() - t0 ;
+    printf("  unBitStuff    (bits/us)            %10.1f %10.1f %10.1fx\n",
+        bits * BENCH_RUNS / (t_old * 1e6), bits * BENCH_RUNS / (t_new * 1e6), t_old / t_new) ;
+    (void)sink ;
+}
+
+
+int main() {
+    canCodingInit() ;
+    srand(1) ;
+    testCRC() ;
+    testStuffing() ;
+    testGarbage() ;
+    testCAN2() ;
+    printf("%s (%d failures)\n", failures ? "FAILED" : "PASSED", failures) ;
+    benchmark() ;
+    return failures != 0 ;
+}
@@ -24,13 +24,12 @@
 
 //                                   USER GLOBALS
 //
-// Let's count sent/received transmissions in the ISR's
+// Let's count sent transmissions in the ISR, and received ones in the
+// frame handler
 volatile int number_sent = 0 ;
 volatile int number_received = 0 ;
-volatile int number_missed = 0 ;
-
-// Flag for indicating that it is unsafe to transmit
-volatile int unsafe_to_tx = 1 ;
+// Frames taken off the RX queue
+int number_read = 0 ;
 
 
 
@@ -38,31 +37,52 @@ volatile int unsafe_to_tx = 1 ;
 //
 // ISR entered at the end of packet transmit.
 void tx_handler() {
-    // Abort/reset DMA channel, clear FIFO, clear PIO irq
-    resetTransmitter() ;
-    // Toggle the LED
-    gpio_put(LED_PIN, !gpio_get(LED_PIN)) ;
-    // Increment number of messages sent
-    number_sent += 1 ;
-    // Signal to thread that it is safe to transmit
-    unsafe_to_tx = 0 ;
+    // Count the frame, start/load the next queued ones, clear PIO irq
+    // (0 if the frame has to go again, CAN 2.0 format only)
+    if (resetTransmitter()) {
+        // Toggle the LED
+        gpio_put(LED_PIN, !gpio_get(LED_PIN)) ;
+        // Increment number of messages sent
+        number_sent += 1 ;
+    }
 }
 // ISR entered when a packet is available for attempted receipt.
 void rx_handler() {
-    // Abort/reset DMA channel
+    // Move the DMA to a fresh buffer (canRxService() decodes this one)
     resetReceiver() ;
-    // Attempt packet receipt
-    if (attemptPacketReceive()) {
-        // Increment number of messages received
-        number_received += 1 ;
-    }
-    // Count number of rejected packets
-    else {
-        number_missed += 1 ;
-    }
     // Clear the interrupt to receive the next message
     acceptNewPacket() ;
 }
+// Called by canRxService() for each good frame sent to my ID
+void frame_handler(const struct can_frame * frame) {
+    // Increment number of messages received
+    number_received += 1 ;
+}
+
+// Print the counters, with a line per ID
+void printStats() {
+    int i ;
+    printf("Sent: %d\n", number_sent) ;
+    printf("Received: %d, broadcast %d (queue overflows %u, buffer overruns %u)\n",
+           number_received, number_read, can_rx_overflows, can_rx_overruns) ;
+    printf("Rejected: %u (filtered %u, errors %u)\n", can_rx_filtered + can_rx_errors,
+           can_rx_filtered, can_rx_errors) ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    printf("%.0f bit/s, TEC %d, REC %d\n", can_bitrate, can_tec, can_rec) ;
+    printf("Lost arbitration %u, bit errors %u, ACK errors %u\n", can_tx_lost,
+           can_tx_bit_errors, can_tx_ack_errors) ;
+    printf("Stuff errors %u, CRC errors %u, form errors %u\n", can_rx_stuff_errors,
+           can_rx_crc_errors, can_rx_form_errors) ;
+#endif
+    for (i = 0; i < can_tx_stats_used; i++) {
+        printf("  TX %04x: %u\n", (unsigned int)can_tx_stats[i].id, can_tx_stats[i].frames) ;
+    }
+    for (i = 0; i < can_rx_stats_used; i++) {
+        printf("  RX %04x: %u (%u bad)\n", (unsigned int)can_rx_stats[i].id,
+               can_rx_stats[i].frames, can_rx_stats[i].errors) ;
+    }
+    printf("\n") ;
+}
 
 
 
@@ -81,37 +101,67 @@ static PT_THREAD (protothread_send(struct pt *pt))
       while(1) {
         // If packets remain . . .
         if (number_to_send) {
-            // Indicate that it is unsafe to transmit
-            unsafe_to_tx = 1 ;
-            // Send a packet
-            sendPacket() ;
-            // Decrement the remaining number of packets to send ;
-            number_to_send -= 1 ;
-            // Randomize the payload WHILE previous packet is being sent
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+            // Bus-off: wait 128 * 11 bit times, then start again
+            if (canErrorState() == CAN_BUS_OFF) {
+                PT_YIELD_UNTIL(pt, (time_us_32() - can_bus_off_time) >
+                                   (uint32_t)(128 * 11 * 1000000.0f / can_bitrate)) ;
+                canRecover() ;
+            }
+#endif
+            // Wait (letting other threads run) for room in the TX queue
+            PT_YIELD_UNTIL(pt, canTxSpace() > 0) ;
+            // Randomize the payload
             payload[0] = rand()&0b0111111111111111 ;
             payload[1] = rand()&0b0111111111111111 ;
             payload[2] = rand()&0b0111111111111111 ;
             payload[3] = rand()&0b0111111111111111 ;
             payload[4] = rand()&0b0111111111111111 ;
+            // Queue a packet (stuffed now, sent when the bus is free)
+            sendPacket() ;
+            // Decrement the remaining number of packets to send ;
+            number_to_send -= 1 ;
             // Print some data occasionally
             if (((number_to_send+1) % 1000)==0) {
-                printf("Sent: %d\n", number_sent) ;
-                printf("Received: %d\n", number_received) ;
-                printf("Rejected: %d\n\n", number_missed) ;
+                printStats() ;
             }
-            // Wait until it's safe to send again
-            while(unsafe_to_tx) {} ;
         }
         // If no packets remain, print some data
         else {
             sleep_ms(500) ;
-            printf("Number sent: %d\n", number_sent) ;
-            printf("Number received: %d\n", number_received) ;
-            printf("Number rejected: %d\n\n", number_missed) ;
+            printStats() ;
         }
       } 
   PT_END(pt);
 }
+// Thread runs on core 1. Decodes what the RX interrupt (on core 0)
+// collected, and runs the frame handler.
+static PT_THREAD (protothread_rx_service(struct pt *pt))
+{
+    PT_BEGIN(pt);
+
+      while(1) {
+        // Wait for packets, then check them all
+        PT_YIELD_UNTIL(pt, canRxPending()) ;
+        canRxService() ;
+      } 
+  PT_END(pt);
+}
+// Thread runs on core 0. Empties the RX queue (broadcast frames).
+static PT_THREAD (protothread_receive(struct pt *pt))
+{
+    PT_BEGIN(pt);
+
+    static struct can_frame frame ;
+
+      while(1) {
+        // Wait for a frame
+        PT_YIELD_UNTIL(pt, canReceive(&frame)) ;
+        // Count it (the payload is in frame.payload[0..frame.length-1])
+        number_read += 1 ;
+      } 
+  PT_END(pt);
+}
 // Thread runs on core 0
 static PT_THREAD (protothread_watchdog(struct pt *pt))
 {
@@ -136,8 +186,9 @@ static PT_THREAD (protothread_watchdog(struct pt *pt))
 void core1_main() {
     // CAN transmitter will run on core 1
     setupCANTX(tx_handler) ;
-    // Add the send thread
+    // Add the send and receive threads
     pt_add_thread(protothread_send) ;
+    pt_add_thread(protothread_rx_service) ;
     // Start the threader
     pt_schedule_start ;
 }
@@ -167,10 +218,15 @@ int main() {
     multicore_reset_core1();
     multicore_launch_core1(&core1_main);
 
+    // Frames to my ID go to the frame handler, broadcasts to the RX queue
+    canAddHandler(MY_ARBITRATION_VALUE, 0xFFFFFFFF, frame_handler) ;
+    canAddFilter(NETWORK_BROADCAST, 0xFFFFFFFF) ;
+
     // Setup the CAN receiver on core 0
     setupCANRX(rx_handler) ;
 
-    // Add thread to scheduler, and start it
+    // Add threads to scheduler, and start them
+    pt_add_thread(protothread_receive) ;
     pt_add_thread(protothread_watchdog) ;
     pt_schedule_start ;
 }
@@ -1,40 +1,207 @@
 /**
  * V. Hunter Adams (vha3@cornell.edu)
- * 
+ *
  * CAN driver code
- * 
+ *
+ * Two frame formats, chosen with CAN_FRAME_FORMAT in can_parameters.h.
+ * The original format of these demos runs at 1 Mbit/s and only talks to
+ * other RP2040s running this code. CAN_FORMAT_20 sends and receives
+ * standard CAN 2.0A/B frames at CAN_BITRATE, with bitwise arbitration,
+ * ACK checking, and the transmit/receive error counters.
+ *
+ * In CAN 2.0 format this node does not acknowledge frames or send error
+ * flags as a receiver: a frame is only checked once the whole of it has
+ * been collected by the DMA, which is too late for the ACK slot. So it
+ * needs at least one other CAN controller on the bus to acknowledge its
+ * frames (or CAN2_NEED_ACK 0), and it behaves like an error-passive
+ * receiver.
+ *
+ * The RX interrupt only collects packets. canRxService(), called from a
+ * thread, decodes them and hands the good frames to handlers registered
+ * with canAddHandler(), or to the RX queue read by canReceive().
+ *
  */
 
 // Includes
 #include "hardware/pio.h"
 #include "hardware/dma.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
 #include "can.pio.h"
 #include "can_parameters.h"
+// Checksum and bit stuffing
+#include "can_coding.h"
 
 
-//                         CLOCK AND CHECKSUM PARAMETERS
+//                              CLOCK PARAMETERS
 //
 // Clock settings
 #define OVERCLOCK_RATE  160000
 #define CLKDIV          5
-// Checksum polynomial and initial value
-#define CRC16_POLY              0x8005
-#define CRC_INIT                0xFFFF
+// PIO cycles per bit (both formats)
+#define CAN_CYCLES_PER_BIT  32
+
+// Bit rate the PIO clock divider actually produces (set up by setupCANTX
+// and setupCANRX)
+float can_bitrate = 0 ;
+
+// PIO clock divider. The original format divides clk_sys by CLKDIV (1 Mbit/s
+// at OVERCLOCK_RATE). CAN 2.0 format divides whatever clk_sys is down to
+// CAN_BITRATE. The divider is 16.8 fixed point: a fractional divider moves
+// edges by at most one clk_sys cycle, which the receivers' resync absorbs.
+static float canClockDiv() {
+    float sys = (float)clock_get_hz(clk_sys) ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    float div = sys / ((float)CAN_CYCLES_PER_BIT * CAN_BITRATE) ;
+    div = (int)(div * 256.0f + 0.5f) / 256.0f ;
+#else
+    float div = CLKDIV ;
+#endif
+    can_bitrate = sys / (CAN_CYCLES_PER_BIT * div) ;
+    return div ;
+}
+
+#if (CAN_FRAME_FORMAT == CAN_FORMAT_20) && ((MAX_STUFFED_PACKET_LEN>>1) < (CAN2_MAX_WORDS + 1))
+#error "MAX_STUFFED_PACKET_LEN is too short for a CAN 2.0 frame"
+#endif
 
 
 //          OTHER BUFFERS FOR STORING STUFFED/UNSTUFFED PACKETS FOR TX/RX
 //
-// Assembled packet for transmission (unstuffed then stuffed)
-unsigned short tx_packet_unstuffed[MAX_PACKET_LEN>>1] = {0} ;
-unsigned short tx_packet_stuffed[MAX_STUFFED_PACKET_LEN>>1] = {0} ;
-unsigned short * tx_packet_stuffed_pointer = &tx_packet_stuffed[0] ;
-
-// Buffer for received packets (stuffed then unstuffed)
-unsigned char rx_packet_stuffed[MAX_STUFFED_PACKET_LEN] = {0} ;
-unsigned char * rx_packet_stuffed_pointer = &rx_packet_stuffed[0] ;
-
-// For re-initializing these buffers
-unsigned char zero_packet[MAX_STUFFED_PACKET_LEN] = {0} ;
+// Pool of buffers for received packets (stuffed), used in turn as a ring.
+// The RX interrupt only moves the DMA on to the next buffer and publishes
+// the one it filled; canRxService() decodes them later, out of interrupt
+// context. Single producer (RX interrupt), single consumer (canRxService).
+struct can_rx_buffer {
+    unsigned char stuffed[MAX_STUFFED_PACKET_LEN] ;
+    int bytes ;                     // bytes the DMA wrote
+    uint32_t time ;                 // when its interrupt came (time_us_32)
+} ;
+struct can_rx_buffer can_rx_buffers[CAN_RX_BUFFERS] ;
+// Buffers filled and waiting are [tail, head). The DMA fills buffer head.
+volatile unsigned int can_rx_buffer_head = 0 ;
+volatile unsigned int can_rx_buffer_tail = 0 ;
+// Where the DMA is collecting the next packet
+unsigned char * rx_packet_stuffed_pointer = can_rx_buffers[0].stuffed ;
+// The packet being decoded by attemptPacketReceive(), the number of bytes
+// the DMA wrote, and when its interrupt came
+unsigned char * rx_packet_stuffed = can_rx_buffers[0].stuffed ;
+int rx_packet_bytes = 0 ;
+uint32_t rx_packet_time = 0 ;
+
+
+//                              TX AND RX QUEUES
+//
+// A frame waiting in the TX queue, already stuffed
+struct can_tx_slot {
+    unsigned short stuffed[MAX_STUFFED_PACKET_LEN>>1] ;
+    int length ;                    // stuffed shorts, including the EOF (or bit count)
+    uint32_t id ;                   // as given to canSend()/canSendFrame()
+    uint32_t priority ;             // lowest goes first
+    unsigned int order ;            // first in, first out among equals
+    uint32_t queued_us ;            // when it was queued (time_us_32)
+    unsigned int retries ;          // times it lost arbitration (or had to go again)
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    int bits ;                      // stuffed bits, SOF to CRC delimiter
+    int arb_bits ;                  // how many of them are arbitration
+#endif
+} ;
+struct can_tx_slot can_tx_queue[CAN_TX_QUEUE] ;
+// Slots waiting to go (one bit each), and slots in use (waiting, or
+// being sent, or loaded to be sent next)
+volatile unsigned int can_tx_pending = 0 ;
+volatile unsigned int can_tx_used = 0 ;
+// Slot on the bus now, and the slot loaded to follow it (-1 for none)
+volatile int can_tx_inflight = -1 ;
+volatile int can_tx_committed = -1 ;
+// Where the control channel finds the next frame (NULL for none)
+unsigned short * volatile can_tx_next = NULL ;
+static unsigned int can_tx_order = 0 ;
+// The slot resetTransmitter() just counted as sent. Still holds the frame
+// for the rest of the tx_handler.
+volatile int can_tx_done = -1 ;
+
+// Received frames (struct can_frame, in can_coding.h). Single producer
+// (canRxService), single consumer (canReceive)
+struct can_frame can_rx_queue[CAN_RX_QUEUE] ;
+volatile unsigned int can_rx_head = 0 ;
+volatile unsigned int can_rx_tail = 0 ;
+
+
+//                       ACCEPTANCE FILTERS AND COUNTERS
+//
+// A frame is accepted when (arbitration & mask) == (id & mask) for any
+// filter. A mask of 0xFFFF (original format) or 0xFFFFFFFF (CAN 2.0,
+// which includes CAN_EFF_FLAG and CAN_RTR_FLAG) matches one ID. The first
+// filter that matches decides where the frame goes: to its handler, or to
+// the RX queue if it has none.
+typedef void (*can_rx_handler_t)(const struct can_frame * frame) ;
+struct can_filter {
+    uint32_t id ;
+    uint32_t mask ;
+    can_rx_handler_t handler ;      // NULL for the RX queue
+} ;
+struct can_filter can_filters[CAN_MAX_FILTERS] ;
+int can_num_filters = 0 ;
+
+// Frames counted per ID. The TX table is written by the TX interrupt and
+// the RX table by canRxService(), which may be on different cores.
+struct can_id_stats {
+    uint32_t id ;
+    unsigned int frames ;           // sent (TX) or accepted (RX)
+    unsigned int errors ;           // RX: passed the filter, bad length or checksum
+} ;
+struct can_id_stats can_tx_stats[CAN_ID_COUNTERS] ;
+struct can_id_stats can_rx_stats[CAN_ID_COUNTERS] ;
+volatile int can_tx_stats_used = 0 ;
+volatile int can_rx_stats_used = 0 ;
+
+// Totals
+volatile unsigned int can_tx_sent = 0 ;
+volatile unsigned int can_tx_lost = 0 ;         // lost arbitration, and tried again
+volatile unsigned int can_rx_accepted = 0 ;
+volatile unsigned int can_rx_filtered = 0 ;     // dropped on the arbitration field
+volatile unsigned int can_rx_errors = 0 ;       // runt frames, bad length or checksum
+volatile unsigned int can_rx_overflows = 0 ;    // accepted, but the RX queue was full
+volatile unsigned int can_rx_overruns = 0 ;     // dropped by the RX interrupt, no free buffer
+
+
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+//                           CAN 2.0 ERROR COUNTERS
+//
+// Transmit and receive error counters, as in the CAN spec. TEC is kept by
+// the TX interrupt, and REC by canRxService() as it decodes packets (on
+// whatever thread calls it).
+volatile int can_tec = 0 ;
+volatile int can_rec = 0 ;
+// What they counted
+volatile unsigned int can_tx_bit_errors = 0 ;   // bus dominant after arbitration
+volatile unsigned int can_tx_ack_errors = 0 ;   // nobody acknowledged
+volatile unsigned int can_rx_stuff_errors = 0 ; // includes error flags from other nodes
+volatile unsigned int can_rx_crc_errors = 0 ;
+volatile unsigned int can_rx_form_errors = 0 ;
+// When the node went bus-off (time_us_32)
+volatile uint32_t can_bus_off_time = 0 ;
+
+
+#define CAN_ERROR_ACTIVE        0
+#define CAN_ERROR_PASSIVE       1
+#define CAN_BUS_OFF             2
+static inline int canErrorState() {
+    if (can_tec > 255) return CAN_BUS_OFF ;
+    if ((can_tec > 127) || (can_rec > 127)) return CAN_ERROR_PASSIVE ;
+    return CAN_ERROR_ACTIVE ;
+}
+#endif
+
+// Is the transmitter stopped (bus-off)?
+static inline int canTxStopped() {
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    return canErrorState() == CAN_BUS_OFF ;
+#else
+    return 0 ;
+#endif
+}
 
 
 
@@ -47,6 +214,8 @@ PIO pio_1 = pio1 ;
 int can_tx_sm         = 0 ;
 int can_idle_check_sm = 1 ;
 int can_rx_sm         = 0 ;
+// Where the TX program was loaded (to restart it)
+uint can_tx_offset = 0 ;
 // Select dma channels
 int dma_chan_0  = 0 ;
 int dma_chan_1  = 1 ;
@@ -58,413 +227,405 @@ unsigned int dummy_source = 0 ;
 unsigned int dummy_dest   = 0 ;
 
 
-//               FUNCTION WHICH COMPUTES CHECKSUM (TX & RX)
+//                 FUNCTIONS USED FOR PACKET TRANSMISSION
+//
+// Frames are stuffed when they are queued. DMA channel 0 sends one frame
+// to the TX PIO and then chains to channel 4, which loads the address in
+// can_tx_next into channel 0 (and triggers it). So the frame after the
+// one on the bus is already in the DMA, and goes out without waiting for
+// the CPU. When can_tx_next is NULL the write is a null trigger and the
+// chain stops.
 //
-// Function which computes the checksum over a series of bytes
-unsigned short culCalcCRC(char crcData, unsigned short crcReg) {
-    int i;
-    for (i = 0; i < 8; i++) {
-        if (((crcReg & 0x8000) >> 8) ^ (crcData & 0x80)) {
-            crcReg = (crcReg << 1) ^ CRC16_POLY;
-        } else {
-          crcReg = (crcReg << 1);
+// Each time the PIO finishes a frame, resetTransmitter() (from the TX
+// interrupt) loads the best waiting frame into can_tx_next. A frame that
+// is queued after that waits behind the loaded one, whatever its ID.
+//
+// In CAN 2.0 format a frame can also lose arbitration. The PIO stops on
+// irq 3, and resetTransmitter() rewinds: both frames go back on the queue
+// and the best one starts again once the bus is idle.
+//
+// Find a slot in the queue with the lowest priority value (the one that
+// would win on the bus), take it off the pending list
+static int canTxBest() {
+    int i, best = -1 ;
+    for (i = 0; i < CAN_TX_QUEUE; i++) {
+        if (!(can_tx_pending & (1u << i))) continue ;
+        if ((best < 0) ||
+            (can_tx_queue[i].priority < can_tx_queue[best].priority) ||
+            ((can_tx_queue[i].priority == can_tx_queue[best].priority) &&
+             ((int)(can_tx_queue[i].order - can_tx_queue[best].order) < 0))) {
+            best = i ;
         }
-        crcData <<= 1;
     }
-    return crcReg;
+    if (best >= 0) can_tx_pending &= ~(1u << best) ;
+    return best ;
 }
 
-
-//                 FUNCTIONS USED FOR PACKET TRANSMISSION
-//
-// Helper function which access a particular bit in an unsigned short.
-// It returns that bit (0 or 1) as an unsigned short.
-unsigned short getBitShort(unsigned short * shorty, unsigned char bitnum) {
-    switch(bitnum) {
-        case 0:
-            return ((*shorty & 0x8000) >> 15) ;
-        case 1:
-            return ((*shorty & 0x4000) >> 14) ;
-        case 2:
-            return ((*shorty & 0x2000) >> 13) ;
-        case 3:
-            return ((*shorty & 0x1000) >> 12) ;
-        case 4:
-            return ((*shorty & 0x0800) >> 11) ;
-        case 5:
-            return ((*shorty & 0x0400) >> 10) ;
-        case 6:
-            return ((*shorty & 0x0200) >> 9) ;
-        case 7:
-            return ((*shorty & 0x0100) >> 8) ;
-        case 8:
-            return ((*shorty & 0x0080) >> 7) ;
-        case 9:
-            return ((*shorty & 0x0040) >> 6) ;
-        case 10:
-            return ((*shorty & 0x0020) >> 5) ;
-        case 11:
-            return ((*shorty & 0x0010) >> 4) ;
-        case 12:
-            return ((*shorty & 0x0008) >> 3) ;
-        case 13:
-            return ((*shorty & 0x0004) >> 2) ;
-        case 14:
-            return ((*shorty & 0x0002) >> 1) ;
-        case 15:
-            return ((*shorty & 0x0001) >> 0) ;
-        default:
-            return 0xFFFF ;
-    }
+// Start a slot on an idle DMA channel
+static void canTxStart(int slot) {
+    can_tx_inflight = slot ;
+    dma_channel_set_trans_count(dma_chan_0, can_tx_queue[slot].length, false) ;
+    dma_channel_set_read_addr(dma_chan_0, can_tx_queue[slot].stuffed, true) ;
 }
-// Helper function which modifies a single bit in an unsigned short. The first argument
-// is a pointer to the short that will be modified. The second is the bit number (0-15) to
-// modify. And the third is the value (0 or 1) to which we would like it modified.
-void modifyBitShort(unsigned short * shorty, unsigned char bitnum, unsigned short value) {
-    switch(bitnum) {
-        case 15:
-            *shorty |= ((value << 0) & 0x0001) ;
-            break ;
-        case 14:
-            *shorty |= ((value << 1) & 0x0002) ;
-            break ;
-        case 13:
-            *shorty |= ((value << 2) & 0x0004) ;
-            break ;
-        case 12:
-            *shorty |= ((value << 3) & 0x0008) ;
-            break ;
-        case 11:
-            *shorty |= ((value << 4) & 0x0010) ;
-            break ;
-        case 10:
-            *shorty |= ((value << 5) & 0x0020) ;
-            break ;
-        case 9:
-            *shorty |= ((value << 6) & 0x0040) ;
-            break ;
-        case 8:
-            *shorty |= ((value << 7) & 0x0080) ;
-            break ;
-        case 7:
-            *shorty |= ((value << 8) & 0x0100) ;
-            break ;
-        case 6:
-            *shorty |= ((value << 9) & 0x0200) ;
-            break ;
-        case 5:
-            *shorty |= ((value << 10) & 0x0400) ;
-            break ;
-        case 4:
-            *shorty |= ((value << 11) & 0x0800) ;
-            break ;
-        case 3:
-            *shorty |= ((value << 12) & 0x1000) ;
-            break ;
-        case 2:
-            *shorty |= ((value << 13) & 0x2000) ;
-            break ;
-        case 1:
-            *shorty |= ((value << 14) & 0x4000) ;
-            break ;
-        case 0:
-            *shorty |= ((value << 15) & 0x8000) ;
-            break ;
-        default:
-            printf("Invalid argument to modifyBitChar   \n") ;
-            break ;
+
+// Load a slot to follow the one in flight. Writing the count with the
+// channel busy only sets the count for its next trigger.
+static void canTxCommit(int slot) {
+    struct can_tx_slot * f = &can_tx_queue[slot] ;
+    can_tx_committed = slot ;
+    dma_channel_set_trans_count(dma_chan_0, f->length, false) ;
+    can_tx_next = f->stuffed ;
+    __dmb() ;
+    // If the frame in flight left the DMA before can_tx_next was set, the
+    // control channel found NULL: its null trigger left channel 0 idle with
+    // a read address of 0. Start this one by hand. (Still at the end of the
+    // frame, the control channel hasn't run yet, and will load this one.)
+    while (dma_channel_is_busy(dma_chan_4)) ;
+    if (!dma_channel_is_busy(dma_chan_0) &&
+        (dma_hw->ch[dma_chan_0].read_addr == 0)) {
+        dma_channel_set_read_addr(dma_chan_0, f->stuffed, true) ;
     }
 }
-// Assumes that the final element in the unstuffed buffer is 0xFFFF
-void bitStuff(unsigned short * unstuffed, unsigned short * stuffed) {
-    // Clear the buffer
-    memcpy(&stuffed[0], &zero_packet[0], MAX_STUFFED_PACKET_LEN) ;
-
-    // Variables for monitoring position in each buffer
-    int stuffed_index   = 0 ;
-    int unstuffed_index = 0 ;
-    int stuffed_bit     = 0 ;
-    int unstuffed_bit   = 0 ;
-
-    // Accumulated bit run length
-    int bit_run_len = 1 ;
-
-    // Memory of old bit value
-    unsigned short new_val = 0 ;
-    unsigned short old_val = 2 ;
-
-    // Until we find the end of frame . . .
-    while ((*(unstuffed + unstuffed_index) != 0xFFFF) && (unstuffed_index < MAX_PACKET_LEN)) {
-        new_val = getBitShort((unstuffed + unstuffed_index), unstuffed_bit) ;
-        bit_run_len = (new_val==old_val)?(bit_run_len+1):1 ;
-        old_val = new_val ;
-
-        if (bit_run_len < 5) {
-            modifyBitShort(stuffed+stuffed_index, stuffed_bit, new_val) ;
-            stuffed_bit = (stuffed_bit<15)?(stuffed_bit+1):0 ;
-            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
-            unstuffed_bit = (unstuffed_bit<15)?(unstuffed_bit+1):0 ;
-            unstuffed_index = (unstuffed_bit==0)?(unstuffed_index+1):unstuffed_index ;
 
-        }
-        else {
-            modifyBitShort(stuffed+stuffed_index, stuffed_bit, new_val) ;
-            stuffed_bit = (stuffed_bit<15)?(stuffed_bit+1):0 ;
-            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
-
-            modifyBitShort(stuffed+stuffed_index, stuffed_bit, !new_val) ;
-            stuffed_bit = (stuffed_bit<15)?(stuffed_bit+1):0 ;
-            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
-            unstuffed_bit = (unstuffed_bit<15)?(unstuffed_bit+1):0 ;
-            unstuffed_index = (unstuffed_bit==0)?(unstuffed_index+1):unstuffed_index ;
-
-            bit_run_len = 1 ;
-            old_val = !new_val ;
-        }
+// Start the best waiting frame if nothing is in flight, and load the one
+// to follow it. Interrupts off (or in the TX interrupt).
+static void canTxFeed() {
+    if (canTxStopped()) return ;
+    if ((can_tx_inflight < 0) && can_tx_pending) {
+        canTxStart(canTxBest()) ;
     }
-    // Pack out rest of that index with zeroes
-    while(stuffed_bit <= 15) {
-        modifyBitShort(stuffed+stuffed_index, stuffed_bit, 0) ;
-        stuffed_bit += 1 ;
+    if ((can_tx_inflight >= 0) && (can_tx_committed < 0) && can_tx_pending) {
+        canTxCommit(canTxBest()) ;
     }
+}
 
-    // Postpend a short of all ones
-    stuffed_index += 1 ;
-    *(stuffed + stuffed_index) = *(unstuffed + unstuffed_index) ;
+// Number of free slots in the TX queue
+static inline int canTxSpace() {
+    return CAN_TX_QUEUE - __builtin_popcount(can_tx_used) ;
 }
-// Assemble the unstuffed packet for transmit using the global values for
-// arbitration, reserve byte, payload length, and the payload. This function
-// automatically computes and appends the checksum, then appends the EOF.
-void sendPacket() {
-    // Incrementer
-    int i ;
+
+// A free slot, or -1 if the queue is full. Only the queueing functions
+// take slots, so a free slot stays free.
+static inline int canTxFree() {
+    unsigned int free = ~can_tx_used & ((1u << CAN_TX_QUEUE) - 1) ;
+    return free ? __builtin_ctz(free) : -1 ;
+}
+
+// Put a filled slot on the queue, and keep the DMA fed
+static void canTxQueue(int slot) {
+    unsigned int irq_state = save_and_disable_interrupts() ;
+    can_tx_queue[slot].order = can_tx_order++ ;
+    can_tx_queue[slot].queued_us = time_us_32() ;
+    can_tx_queue[slot].retries = 0 ;
+    can_tx_used |= (1u << slot) ;
+    can_tx_pending |= (1u << slot) ;
+    canTxFeed() ;
+    restore_interrupts(irq_state) ;
+}
+
+#if CAN_FRAME_FORMAT == CAN_FORMAT_ORIGINAL
+// Queue a packet: arbitration, reserve byte, and len bytes of payload
+// (the shorts are sent high byte first). The checksum and EOF are
+// appended and the packet is stuffed here. Returns 1 if queued, 0 if
+// the queue is full, or if the ID or a payload short is 0xFFFF (the EOF,
+// which would end the frame there). Call from the core that called
+// setupCANTX(), not from an interrupt.
+int canSend(unsigned short id, unsigned char reserve, const unsigned short * data, unsigned char len) {
+    unsigned short unstuffed[MAX_PACKET_LEN>>1] ;
+    int i, slot ;
+    if ((len > MAX_PAYLOAD_SIZE) || (id == 0xFFFF)) return 0 ;
+    for (i = 0; i < (len>>1); i++) {
+        if (data[i] == 0xFFFF) return 0 ;
+    }
+    slot = canTxFree() ;
+    if (slot < 0) return 0 ;
+
     // Load arbitration
-    tx_packet_unstuffed[0] = arbitration ;
+    unstuffed[0] = id ;
     // Load reserve byte and payload length
-    tx_packet_unstuffed[1] =  (((((unsigned short)reserve_byte)<<8) & 0xFF00) |
-                             (((unsigned short)payload_len) & 0x00FF));
+    unstuffed[1] =  (((((unsigned short)reserve)<<8) & 0xFF00) |
+                    (((unsigned short)len) & 0x00FF));
     // Load payload
-    memcpy(&tx_packet_unstuffed[2], &payload[0], payload_len) ;
+    memcpy(&unstuffed[2], data, len) ;
     // Compute checksum
     unsigned short checksum = CRC_INIT; // Init value for CRC calculation
     while (checksum == 0xFFFF) {
-        tx_packet_unstuffed[1] ^= 0x8000 ;
-        for (i = 0; i < ((payload_len>>1)+2); i++) {
-          checksum = culCalcCRC((tx_packet_unstuffed[i]>>8)&0xFF, checksum);
-          checksum = culCalcCRC((tx_packet_unstuffed[i])&0xFF, checksum);
+        unstuffed[1] ^= 0x8000 ;
+        for (i = 0; i < ((len>>1)+2); i++) {
+          checksum = culCalcCRC((unstuffed[i]>>8)&0xFF, checksum);
+          checksum = culCalcCRC((unstuffed[i])&0xFF, checksum);
         }
     }
-
     // Load checksum
-    tx_packet_unstuffed[i] = checksum ;
+    unstuffed[i] = checksum ;
     // Load EOF
-    tx_packet_unstuffed[i+1] = 0xFFFF ;
-
-    // // Print the populated packet
-    // printf("\nPopulated packet\n") ;
-    // for(i=0; i<((payload_len>>1)+6); i++){
-    //     printf("%04x", tx_packet_unstuffed[i]) ;
-    // }
-    // printf("\n") ;
-
-    // Bit stuff the packet
-    bitStuff(tx_packet_unstuffed, tx_packet_stuffed) ;
-
-    // // Print packet after stuffing
-    // printf("Stuffed packet:\n") ;
-    // for (i=0; i<((payload_len>>1)+6); i++){
-    //     printf("%04x", tx_packet_stuffed[i]) ;
-    // }
-    // printf("\n") ;
-
-    // BEGIN TRANSMISSION
-    dma_start_channel_mask((1u << dma_chan_0)) ;
+    unstuffed[i+1] = 0xFFFF ;
+
+    // Bit stuff the packet into its slot, and queue it
+    can_tx_queue[slot].length = bitStuff(unstuffed, can_tx_queue[slot].stuffed) ;
+    can_tx_queue[slot].id = id ;
+    can_tx_queue[slot].priority = id ;
+    canTxQueue(slot) ;
+    return 1 ;
 }
-
-
-//                   FUNCTIONS USED FOR PACKET RECEPTION
-//
-// Helper function which access a particular bit in an unsigned char.
-// It returns that bit (0 or 1) as an unsigned char.
-unsigned char getBitChar(unsigned char * byte, unsigned char bitnum) {
-    switch(bitnum) {
-        case 0:
-            return ((*byte & 0x80) >> 7) ;
-        case 1:
-            return ((*byte & 0x40) >> 6) ;
-        case 2:
-            return ((*byte & 0x20) >> 5) ;
-        case 3:
-            return ((*byte & 0x10) >> 4) ;
-        case 4:
-            return ((*byte & 0x08) >> 3) ;
-        case 5:
-            return ((*byte & 0x04) >> 2) ;
-        case 6:
-            return ((*byte & 0x02) >> 1) ;
-        case 7:
-            return ((*byte & 0x01) >> 0) ;
-        default:
-            return 0xFF ;
+#endif
+
+// Queue a frame (either format). Returns 1 if queued, 0 if the queue is
+// full (or, in the original format, the frame has a 0xFFFF short). Same
+// rules as canSend().
+int canSendFrame(const struct can_frame * frame) {
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    struct can_tx_slot * f ;
+    int slot = canTxFree() ;
+    if (slot < 0) return 0 ;
+    // A word with the bit count (minus one) for the PIO, then the frame
+    f = &can_tx_queue[slot] ;
+    f->bits = can2Encode(frame, &f->stuffed[1], &f->arb_bits) ;
+    f->stuffed[0] = f->bits - 1 ;
+    f->length = 1 + ((f->bits + 15) >> 4) ;
+    f->id = frame->arbitration ;
+    f->priority = can2Priority(frame->arbitration) ;
+    canTxQueue(slot) ;
+    return 1 ;
+#else
+    unsigned short data[MAX_PAYLOAD_SIZE>>1] ;
+    int i ;
+    if (frame->length > MAX_PAYLOAD_SIZE) return 0 ;
+    for (i = 0; i < frame->length; i += 2) {
+        data[i>>1] = (frame->payload[i] << 8) | frame->payload[i+1] ;
     }
+    return canSend(frame->arbitration, frame->reserve, data, frame->length) ;
+#endif
 }
-// Helper function which modifies a single bit in an unsigned char. The first argument
-// is a pointer to the char that will be modified. The second is the bit number (0-7) to
-// modify. And the third is the value (0 or 1) to which we would like it modified.
-void modifyBitChar(unsigned char * byte, unsigned char bitnum, unsigned char value) {
-    switch(bitnum) {
-        case 7:
-            *byte |= ((value << 0) & 0x01) ;
-            break ;
-        case 6:
-            *byte |= ((value << 1) & 0x02) ;
-            break ;
-        case 5:
-            *byte |= ((value << 2) & 0x04) ;
-            break ;
-        case 4:
-            *byte |= ((value << 3) & 0x08) ;
-            break ;
-        case 3:
-            *byte |= ((value << 4) & 0x10) ;
-            break ;
-        case 2:
-            *byte |= ((value << 5) & 0x20) ;
-            break ;
-        case 1:
-            *byte |= ((value << 6) & 0x40) ;
-            break ;
-        case 0:
-            *byte |= ((value << 7) & 0x80) ;
-            break ;
-        default:
-            printf("Invalid argument to modifyBitChar   \n") ;
-            break ;
+
+// Queue a packet using the global values for arbitration, reserve byte,
+// payload length, and the payload. Returns 1 if queued, 0 if the queue
+// is full.
+int sendPacket() {
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    struct can_frame frame ;
+    int i ;
+    frame.arbitration = arbitration ;
+    frame.reserve = 0 ;
+    frame.length = (payload_len > 8) ? 8 : payload_len ;
+    // The shorts are sent high byte first
+    for (i = 0; i < frame.length; i++) {
+        frame.payload[i] = (i & 1) ? payload[i>>1] : (payload[i>>1] >> 8) ;
     }
+    return canSendFrame(&frame) ;
+#else
+    return canSend(arbitration, reserve_byte, payload, payload_len) ;
+#endif
 }
-// Function which takes a pointer to a stuffed character array,
-// and a pointer to an array where we would like the unstuffed
-// data to be stored. Function unstuffs the first array and stores
-// the result in the second.
-//
-// Why not do an in-place replacement? I think that it will be nice
-// to start gathering the next stuffed buffer while doing work on the
-// last one.
-void unBitStuff(unsigned char * stuffed, unsigned char * unstuffed) {
-    // Clear the buffer
-    memcpy(&unstuffed[0], &zero_packet[0], MAX_STUFFED_PACKET_LEN) ;
 
-    // Variables for monitoring position in each buffer
-    int stuffed_index   = 0 ;
-    int unstuffed_index = 0 ;
-    int stuffed_bit     = 0 ;
-    int unstuffed_bit   = 0 ;
 
-    // Accumulated bit run length
-    int bit_run_len     = 0 ;
-
-    // Memory of old bit value
-    unsigned char new_val = 0 ;
-    unsigned char old_val = 2 ;
+//                   FUNCTIONS USED FOR PACKET RECEPTION
+//
+// Add an acceptance filter, for frames that go on the RX queue. Returns 0
+// if the table is full. With no filters, setupCANRX() adds
+// MY_ARBITRATION_VALUE and NETWORK_BROADCAST. Add filters before
+// setupCANRX().
+int canAddFilter(uint32_t id, uint32_t mask) {
+    if (can_num_filters == CAN_MAX_FILTERS) return 0 ;
+    can_filters[can_num_filters].id = id ;
+    can_filters[can_num_filters].mask = mask ;
+    can_filters[can_num_filters].handler = NULL ;
+    can_num_filters++ ;
+    return 1 ;
+}
 
-    // Until we find the end of frame . . .
-    while ((*(stuffed + stuffed_index) != 0xFF) && (stuffed_index < (MAX_STUFFED_PACKET_LEN))) {
-        // Get a new bit, update the bit run length, and update the bit memory
-        new_val = getBitChar((stuffed+stuffed_index), stuffed_bit) ;
-        bit_run_len = (new_val==old_val)?(bit_run_len+1):1 ;
-        old_val = new_val ;
+// Add an acceptance filter whose frames go to handler instead of the RX
+// queue. The handler runs in canRxService(), on that thread's core.
+int canAddHandler(uint32_t id, uint32_t mask, can_rx_handler_t handler) {
+    if (!canAddFilter(id, mask)) return 0 ;
+    can_filters[can_num_filters-1].handler = handler ;
+    return 1 ;
+}
 
-        // If our bit run length is less than 5, update the unstuffed buffer
-        // and increment position in each buffer.
-        if (bit_run_len < 5) {
+// The first filter that accepts this arbitration value (NULL for none)
+static inline struct can_filter * canFilterMatch(uint32_t id) {
+    int i ;
+    for (i = 0; i < can_num_filters; i++) {
+        if (((id ^ can_filters[i].id) & can_filters[i].mask) == 0) return &can_filters[i] ;
+    }
+    return NULL ;
+}
 
-            modifyBitChar(unstuffed+unstuffed_index, unstuffed_bit, new_val) ;
+// Find (or add) the counters for an ID. NULL once the table is full; those
+// IDs are only in the totals.
+static struct can_id_stats * canStats(struct can_id_stats * table, volatile int * used, uint32_t id) {
+    int i ;
+    for (i = 0; i < *used; i++) {
+        if (table[i].id == id) return &table[i] ;
+    }
+    if (i == CAN_ID_COUNTERS) return NULL ;
+    table[i].id = id ;
+    table[i].frames = 0 ;
+    table[i].errors = 0 ;
+    *used = i + 1 ;
+    return &table[i] ;
+}
 
-            unstuffed_bit = (unstuffed_bit<7)?(unstuffed_bit+1):0 ;
-            unstuffed_index = (unstuffed_bit==0)?(unstuffed_index+1):unstuffed_index ;
+// Take the oldest received frame off the RX queue. Returns 0 if empty.
+int canReceive(struct can_frame * frame) {
+    unsigned int tail = can_rx_tail ;
+    if (tail == can_rx_head) return 0 ;
+    __dmb() ;
+    *frame = can_rx_queue[tail % CAN_RX_QUEUE] ;
+    __dmb() ;
+    can_rx_tail = tail + 1 ;
+    return 1 ;
+}
 
-            stuffed_bit = (stuffed_bit<7)?(stuffed_bit+1):0 ;
-            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
+// Hand a good frame to its filter's handler, or put it on the RX queue if
+// there's room
+static void canRxPush(const struct can_filter * filter, const struct can_frame * frame) {
+    unsigned int head = can_rx_head ;
+    if (filter->handler) {
+        filter->handler(frame) ;
+        return ;
+    }
+    if ((head - can_rx_tail) == CAN_RX_QUEUE) {
+        can_rx_overflows++ ;
+        return ;
+    }
+    can_rx_queue[head % CAN_RX_QUEUE] = *frame ;
+    __dmb() ;
+    can_rx_head = head + 1 ;
+}
 
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+// Function assumes that the packet to decode (from canRxService()) lives
+// in rx_packet_stuffed. It decodes the arbitration field and drops the
+// packet if no filter accepts it, then decodes the rest and checks the
+// stuffing, the CRC and the delimiters. A good packet goes to its handler
+// or the RX queue and the function returns 1. Else it returns 0. Errors in frames that
+// are filtered out before the CRC are not counted.
+unsigned char attemptPacketReceive() {
+    struct can_id_stats * stats = NULL ;
+    struct can_filter * filter = NULL ;
+    struct can2_bits bits ;
+    struct can_frame frame ;
+    int result, ack ;
+
+    // The last byte the DMA wrote is the RX machine's final (partial) push
+    can2Begin(&bits, rx_packet_stuffed, rx_packet_bytes - 1) ;
+    frame.arbitration = can2DecodeID(&bits) ;
+    frame.time = rx_packet_time ;
+    if (!bits.error) {
+        filter = canFilterMatch(frame.arbitration) ;
+        if (!filter) {
+            can_rx_filtered++ ;
+            return 0 ;
         }
+        stats = canStats(can_rx_stats, &can_rx_stats_used, frame.arbitration) ;
+    }
 
-        // If our bit run length is 5, update the unstuffed buffer. Then
-        // increment the unstuffed buffer by ONE and the stuffed buffer by TWO
-        // in order to skip over the stuff bit.
-        else {
-            modifyBitChar(unstuffed+unstuffed_index, unstuffed_bit, new_val) ;
-            unstuffed_bit = (unstuffed_bit<7)?(unstuffed_bit+1):0 ;
-            unstuffed_index = (unstuffed_bit==0)?(unstuffed_index+1):unstuffed_index ;
-
-            stuffed_bit = (stuffed_bit<7)?(stuffed_bit+1):0 ;
-            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
-            stuffed_bit = (stuffed_bit<7)?(stuffed_bit+1):0 ;
-            stuffed_index = (stuffed_bit==0)?(stuffed_index+1):stuffed_index ;
-
-            // Reset bit run length
-            bit_run_len = 1 ;
-            // We jumped over a stuffed bit, opposite polarity to
-            // the last bit that we measured
-            old_val = !new_val ;
-        }
+    // The rest of the frame
+    result = can2DecodeRest(&bits, &frame, &ack) ;
+    if (result != CAN2_OK) {
+        can_rx_errors++ ;
+        if (result == CAN2_STUFF_ERROR) can_rx_stuff_errors++ ;
+        else if (result == CAN2_CRC_ERROR) can_rx_crc_errors++ ;
+        else can_rx_form_errors++ ;
+        if (stats) stats->errors++ ;
+        if (can_rec < 255) can_rec++ ;
+        return 0 ;
     }
 
+    // Good packet. Count it, and queue it if there's room.
+    if (can_rec > 127) can_rec = 127 ;
+    else if (can_rec > 0) can_rec-- ;
+    can_rx_accepted++ ;
+    if (stats) stats->frames++ ;
+    canRxPush(filter, &frame) ;
+    return 1 ;
 }
-// Function assumes that a stuffed packet lives in rx_packet_stuffed.
-// It unpacks that packet, checks the arbitration bits, and checks the
-// checksum. If it is a valid packet (correct arbitration and checksum)
-// then the function returns 1. Else it returns 0. Valid packet will
-// remain in rx_packet_unstuffed for user to access.
+#else
+// Function assumes that the packet to decode (from canRxService()) lives
+// in rx_packet_stuffed. It unstuffs the arbitration short and drops the
+// packet if no filter accepts it, then unpacks the rest and checks the
+// length and the checksum. If it is a valid packet then it goes to its
+// handler or the RX queue and the function returns 1. Else it returns 0. Valid packet
+// will also remain in rx_packet_unstuffed for user to access.
 unsigned char attemptPacketReceive() {
-    // // Print packet received stuffed packet
+    struct can_id_stats * stats ;
+    struct can_filter * filter ;
+    struct can_frame frame ;
+    unsigned short id ;
     int i ;
-    // printf("Received (stuffed) packet:\n") ;
-    // for (i=0; i<22; i++){
-    //     printf("%02x", rx_packet_stuffed[i]) ;
-    // }
-    // printf("\n") ;
-
-    // Unstuff the received packet
-    unBitStuff(rx_packet_stuffed, rx_packet_unstuffed) ;
 
-    // // Print the packet after unstuffing
-    // printf("Packet after unstuffing:\n") ;
-    // for (i=0; i<22; i++){
-    //     printf("%02x", rx_packet_unstuffed[i]) ;
-    // }
-    // printf("\n\n") ;
-
-    // Check arbitration bits
-    if ((rx_packet_unstuffed[0]!=((MY_ARBITRATION_VALUE>>8)&0xFF))&&
-        (rx_packet_unstuffed[0]!=((NETWORK_BROADCAST>>8)&0xFF))) {
-        // printf("Failed at arbitration 1\n");
+    // Unstuff just the arbitration short, and check it
+    if (unBitStuffN(rx_packet_stuffed, rx_packet_unstuffed, 2) < 2) {
+        can_rx_errors++ ;
         return 0 ;
     }
-    if ((rx_packet_unstuffed[1]!=((MY_ARBITRATION_VALUE)&0xFF))&&
-        (rx_packet_unstuffed[1]!=((NETWORK_BROADCAST)&0xFF))) {
-        // printf("Failed at arbitration 2\n");
+    id = (rx_packet_unstuffed[0] << 8) | rx_packet_unstuffed[1] ;
+    filter = canFilterMatch(id) ;
+    if (!filter) {
+        can_rx_filtered++ ;
         return 0 ;
     }
+    stats = canStats(can_rx_stats, &can_rx_stats_used, id) ;
+
+    // Unstuff the rest of the received packet
+    unBitStuff(rx_packet_stuffed, rx_packet_unstuffed) ;
 
     // Check packet length
     if (rx_packet_unstuffed[3] > MAX_PAYLOAD_SIZE) {
-        // printf("Invalid packet length\n") ;
+        can_rx_errors++ ;
+        if (stats) stats->errors++ ;
         return 0 ;
     }
 
     // Compute and check checksum
-    unsigned short checksum = CRC_INIT; // Init value for CRC calculation
-    for (i = 0; i < (rx_packet_unstuffed[3]+4); i++) {
-      checksum = culCalcCRC((rx_packet_unstuffed[i])&0xFF, checksum);
-    }
-    if ((rx_packet_unstuffed[i]==((checksum>>8)&0xFF)) &&
-        (rx_packet_unstuffed[i+1]==((checksum)&0xFF))) {
-        return 1 ;
-    }
-    else {
-        // printf("Failed at checksum\n") ;
+    i = rx_packet_unstuffed[3] + 4 ;
+    unsigned short checksum = canCRC(rx_packet_unstuffed, i, CRC_INIT) ;
+    if ((rx_packet_unstuffed[i]!=((checksum>>8)&0xFF)) ||
+        (rx_packet_unstuffed[i+1]!=((checksum)&0xFF))) {
+        can_rx_errors++ ;
+        if (stats) stats->errors++ ;
         return 0 ;
     }
+
+    // Good packet. Count it, and queue it if there's room.
+    can_rx_accepted++ ;
+    if (stats) stats->frames++ ;
+    frame.arbitration = id ;
+    frame.time = rx_packet_time ;
+    frame.reserve = rx_packet_unstuffed[2] ;
+    frame.length = rx_packet_unstuffed[3] ;
+    memcpy(frame.payload, &rx_packet_unstuffed[4], frame.length) ;
+    canRxPush(filter, &frame) ;
+    return 1 ;
+}
+#endif
+
+// Are there packets from the RX interrupt waiting for canRxService()?
+static inline int canRxPending() {
+    return can_rx_buffer_tail != can_rx_buffer_head ;
+}
+
+// Decode the packets the RX interrupt has collected, oldest first: check
+// each one, and hand the good ones to their handlers or the RX queue (with
+// attemptPacketReceive()). Call from one thread, on either core; handlers
+// run here. Returns the number of good frames.
+int canRxService() {
+    unsigned int tail = can_rx_buffer_tail ;
+    struct can_rx_buffer * b ;
+    int good = 0 ;
+    while (tail != can_rx_buffer_head) {
+        __dmb() ;
+        b = &can_rx_buffers[tail % CAN_RX_BUFFERS] ;
+        rx_packet_stuffed = b->stuffed ;
+        rx_packet_bytes = b->bytes ;
+        rx_packet_time = b->time ;
+        good += attemptPacketReceive() ;
+        // Give the buffer back to the RX interrupt
+        __dmb() ;
+        can_rx_buffer_tail = ++tail ;
+    }
+    return good ;
 }
 
 
@@ -490,7 +651,7 @@ void setupIdleCheck() {
     uint can_idle_offset = pio_add_program(pio_0, &idle_check_program) ;
 
     // Initialize the PIO program
-    idle_check_program_init(pio_0, can_idle_check_sm, can_idle_offset, CAN_TX+1, CLKDIV) ;
+    idle_check_program_init(pio_0, can_idle_check_sm, can_idle_offset, CAN_TX+1, canClockDiv()) ;
 
     // Zero the irq 1
     pio_interrupt_clear(pio_0, 1) ;
@@ -542,37 +703,66 @@ void setupCANTX(irq_handler_t handler) {
     gpio_set_dir(TRANSCIEVER_EN, GPIO_OUT) ;
     gpio_put(TRANSCIEVER_EN, 0) ;
 
+    // Checksum and stuffing tables
+    canCodingInit() ;
+
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    // Wait for the end of a frame (ACK delimiter, EOF, intermission)
+    tx_idle_time = CAN2_IDLE_BITS ;
+#endif
+
     // Setup the idle checking system
     setupIdleCheck() ;
 
-    // Load PIO programs onto PIO0
-    uint can_tx_offset = pio_add_program(pio_0, &can_tx_program) ;
-
-    // Initialize the PIO program
-    can_tx_program_init(pio_0, can_tx_sm, can_tx_offset, CAN_TX, CLKDIV) ;
+    // Load PIO programs onto PIO0, and initialize
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    can_tx_offset = pio_add_program(pio_0, &can2_tx_program) ;
+    can2_tx_program_init(pio_0, can_tx_sm, can_tx_offset, CAN_TX, canClockDiv()) ;
+#else
+    can_tx_offset = pio_add_program(pio_0, &can_tx_program) ;
+    can_tx_program_init(pio_0, can_tx_sm, can_tx_offset, CAN_TX, canClockDiv()) ;
+#endif
 
-    // Setup interrupts for TX machine
+    // Setup interrupts for TX machine (irq 3 is a lost arbitration)
     pio_interrupt_clear(pio_0, 0) ;
+    pio_interrupt_clear(pio_0, 3) ;
     pio_set_irq0_source_enabled(pio_0, pis_interrupt0, true) ;
+    pio_set_irq0_source_enabled(pio_0, pis_interrupt3, true) ;
     irq_set_exclusive_handler(PIO0_IRQ_0, handler) ;
     irq_set_enabled(PIO0_IRQ_0, true) ;
 
-    // Channel Zero (sends data to TX PIO machine)
+    // Channel Zero (sends frames to TX PIO machine)
     dma_channel_config c0 = dma_channel_get_default_config(dma_chan_0);
     channel_config_set_transfer_data_size(&c0, DMA_SIZE_16);
     channel_config_set_read_increment(&c0, true);
     channel_config_set_write_increment(&c0, false);
     channel_config_set_dreq(&c0, DREQ_PIO0_TX0) ;
+    channel_config_set_chain_to(&c0, dma_chan_4);
 
     dma_channel_configure(
         dma_chan_0,                     // Channel to be configured
         &c0,                            // The configuration we just created
         &pio_0->txf[can_tx_sm],         // write address (transmit PIO TX FIFO)
-        tx_packet_stuffed_pointer,      // read address (start of stuffed packet)
-        sizeof(tx_packet_stuffed)>>1,   // Number of transfers (aborts early!)
+        can_tx_queue[0].stuffed,        // read address (set per frame)
+        0,                              // Number of transfers (set per frame)
         false                           // Don't start immediately.
     );
 
+    // Channel Four (loads the next queued frame into channel zero)
+    dma_channel_config c4 = dma_channel_get_default_config(dma_chan_4);
+    channel_config_set_transfer_data_size(&c4, DMA_SIZE_32);
+    channel_config_set_read_increment(&c4, false);
+    channel_config_set_write_increment(&c4, false);
+
+    dma_channel_configure(
+        dma_chan_4,                                 // Channel to be configured
+        &c4,                                        // The configuration we just created
+        &dma_hw->ch[dma_chan_0].al3_read_addr_trig, // write address (read address, and trigger)
+        &can_tx_next,                               // read address (next frame, or NULL)
+        1,                                          // Number of transfers
+        false                                       // Don't start immediately.
+    );
+
     // Start the TX PIO program (sets output high, among other things)
     pio_sm_set_enabled(pio_0, can_tx_sm, true) ;
 
@@ -588,11 +778,23 @@ void setupCANTX(irq_handler_t handler) {
 // channel for moving data from the receive PIO.
 void setupCANRX(irq_handler_t handler) {
 
-    // Load pio program onto PIO 1
-    uint can_rx_offset = pio_add_program(pio_1, &can_rx_program) ;
+    // Checksum and stuffing tables
+    canCodingInit() ;
 
-    // Initialize the PIO programs
-    can_rx_program_init(pio_1, can_rx_sm, can_rx_offset, CAN_TX+1, CLKDIV) ;
+    // Default acceptance filters (as before, my ID and the broadcast ID)
+    if (can_num_filters == 0) {
+        canAddFilter(MY_ARBITRATION_VALUE, 0xFFFFFFFF) ;
+        canAddFilter(NETWORK_BROADCAST, 0xFFFFFFFF) ;
+    }
+
+    // Load pio program onto PIO 1, and initialize
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    uint can_rx_offset = pio_add_program(pio_1, &can2_rx_program) ;
+    can2_rx_program_init(pio_1, can_rx_sm, can_rx_offset, CAN_TX+1, canClockDiv()) ;
+#else
+    uint can_rx_offset = pio_add_program(pio_1, &can_rx_program) ;
+    can_rx_program_init(pio_1, can_rx_sm, can_rx_offset, CAN_TX+1, canClockDiv()) ;
+#endif
 
     // Setup interrupts for RX machine
     pio_interrupt_clear(pio_1, 0) ;
@@ -612,10 +814,10 @@ void setupCANRX(irq_handler_t handler) {
         &c1,                        // The configuration we just created
         rx_packet_stuffed_pointer,  // write address (receive buffer)
         &pio_1->rxf[can_rx_sm],     // read address (receive PIO RX FIFO)
-        sizeof(rx_packet_stuffed),  // Number of transfers (aborts early!!)
+        MAX_STUFFED_PACKET_LEN,     // Number of transfers (aborts early!!)
         false                       // Don't start immediately.
     );
-  
+
     // Tell DMA to rasie IRQ line 0 when channel 1 finished a block
     dma_channel_set_irq0_enabled(dma_chan_1, true);
 
@@ -633,22 +835,152 @@ void setupCANRX(irq_handler_t handler) {
 
 //                              API HELPER FUNCTIONS
 //
-// Call in the tx_handler interrupt service routine to reset the transmitter
-static inline void resetTransmitter() {
-    // Abort the DMA channel sending data to the TX PIO (EOF found)
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+// Stop the DMA and the TX machine, put the frame on the bus and the one
+// loaded after it back on the queue, and start again from the best
+// waiting frame (unless the node is bus-off). The PIO is stopped on irq 0
+// or irq 3, with the bus recessive.
+static void canTxRewind() {
+    can_tx_next = NULL ;
+    dma_channel_abort(dma_chan_4) ;
     dma_channel_abort(dma_chan_0) ;
-    // Drain the TX FIFO
-    pio_sm_drain_tx_fifo(pio_0, can_tx_sm) ;
+    // The control channel may have been triggered by the abort
+    dma_channel_abort(dma_chan_4) ;
+    // Restart the machine from standby, with empty FIFOs
+    pio_sm_set_enabled(pio_0, can_tx_sm, false) ;
+    pio_sm_clear_fifos(pio_0, can_tx_sm) ;
+    pio_sm_restart(pio_0, can_tx_sm) ;
+    pio_sm_exec(pio_0, can_tx_sm, pio_encode_jmp(can_tx_offset)) ;
+    pio_interrupt_clear(pio_0, 0) ;
+    pio_interrupt_clear(pio_0, 3) ;
+    pio_sm_set_enabled(pio_0, can_tx_sm, true) ;
+    // Both frames wait again (in priority order)
+    if (can_tx_inflight >= 0) can_tx_pending |= (1u << can_tx_inflight) ;
+    if (can_tx_committed >= 0) can_tx_pending |= (1u << can_tx_committed) ;
+    can_tx_inflight = -1 ;
+    can_tx_committed = -1 ;
+    canTxFeed() ;
+}
+
+// Leave bus-off: clear the error counters and start sending again. Call on
+// the TX core. CAN asks for 128 runs of 11 recessive bits on the bus
+// before this; waiting 128 * 11 bit times after can_bus_off_time (1.4 ms
+// at 1 Mbit/s) is the simple version.
+void canRecover() {
+    unsigned int irq_state = save_and_disable_interrupts() ;
+    can_tec = 0 ;
+    can_rec = 0 ;
+    tx_idle_time = CAN2_IDLE_BITS ;
+    canTxFeed() ;
+    restore_interrupts(irq_state) ;
+}
+#endif
+
+// Call in the tx_handler interrupt service routine when a frame is done.
+// Counts it, makes sure the next frame is in the DMA, loads the one after
+// that, and lets the PIO go on. The PIO is stopped until its irq is
+// cleared, and every frame is longer than the TX FIFO (at least 5 shorts),
+// so the frame now in the DMA can't finish before the next is loaded.
+// Returns 1 if a frame was sent (its slot is in can_tx_done). The handler
+// also runs on irq 3, for a lost arbitration: then it returns 0. In CAN 2.0
+// format it also returns 0 when the frame hit a bit error or wasn't
+// acknowledged; it goes out again (unless CAN2_NEED_ACK is 0 and it was
+// only the ACK).
+static inline int resetTransmitter() {
+    struct can_id_stats * stats ;
+    int done = can_tx_inflight ;
+    int sent = (done >= 0) ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    int bit ;
+    // Lost arbitration, or a bit error: the PIO pushed the bits it had left
+    if (pio_interrupt_get(pio_0, 3)) {
+        bit = pio_sm_get(pio_0, can_tx_sm) ;
+        if (done >= 0) {
+            can_tx_queue[done].retries++ ;
+            bit = can_tx_queue[done].bits - 1 - bit ;
+            if (bit < can_tx_queue[done].arb_bits) {
+                can_tx_lost++ ;
+            }
+            else {
+                can_tx_bit_errors++ ;
+                can_tec += 8 ;
+                if (canTxStopped()) can_bus_off_time = time_us_32() ;
+            }
+        }
+        canTxRewind() ;
+        return 0 ;
+    }
+    // The ACK slot (dominant if a receiver acknowledged)
+    if (pio_sm_get(pio_0, can_tx_sm) & 1) {
+        can_tx_ack_errors++ ;
+        // An error-passive node doesn't count ACK errors
+        if (canErrorState() == CAN_ERROR_ACTIVE) can_tec += 8 ;
+        if (CAN2_NEED_ACK && (done >= 0)) {
+            can_tx_queue[done].retries++ ;
+            can_tx_pending |= (1u << done) ;
+            sent = 0 ;
+        }
+    }
+    else if (can_tec > 0) {
+        can_tec-- ;
+    }
+    // An error-passive transmitter waits longer before its next frame
+    tx_idle_time = CAN2_IDLE_BITS +
+                   ((canErrorState() == CAN_ERROR_PASSIVE) ? CAN2_SUSPEND_BITS : 0) ;
+#else
+    // Lost arbitration. The PIO tries again by itself, just count it.
+    if (pio_interrupt_get(pio_0, 3)) {
+        pio_interrupt_clear(pio_0, 3) ;
+        can_tx_lost++ ;
+        if (done >= 0) can_tx_queue[done].retries++ ;
+        if (!pio_interrupt_get(pio_0, 0)) return 0 ;
+    }
+#endif
+    // Count the frame that was sent, and free its slot
+    if (sent) {
+        can_tx_done = done ;
+        can_tx_sent++ ;
+        stats = canStats(can_tx_stats, &can_tx_stats_used, can_tx_queue[done].id) ;
+        if (stats) stats->frames++ ;
+        can_tx_used &= ~(1u << done) ;
+    }
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+    // A frame sent again goes back through the queue (behind any better
+    // one), and bus-off stops everything
+    if (!sent || canTxStopped()) {
+        if (canTxStopped()) can_bus_off_time = time_us_32() ;
+        can_tx_inflight = can_tx_committed ;
+        can_tx_committed = -1 ;
+        canTxRewind() ;
+        return sent ;
+    }
+#endif
+    // The control channel already loaded the committed frame
+    can_tx_inflight = can_tx_committed ;
+    can_tx_committed = -1 ;
+    can_tx_next = NULL ;
+    // Start the best waiting frame if nothing was loaded, and load the
+    // one to follow it
+    canTxFeed() ;
     // Unstall the PIO state machine
     pio_interrupt_clear(pio_0, 0) ;
-    // Reset the DMA channel read address, don't start channel yet
-    dma_channel_set_read_addr(dma_chan_0, tx_packet_stuffed_pointer, false) ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_ORIGINAL
     // WHY IS THIS NECESSARY? Did not need this until I added the transcievers
     sleep_us(10) ;
+#endif
+    return sent ;
 }
 
-// Call in the rx_handler interrupt service routing to reset the receiver
-static inline void resetReceiver() {
+// Call in the rx_handler interrupt service routing to reset the receiver.
+// The buffer just filled goes to canRxService(), and the DMA starts on the
+// next one. If canRxService() has fallen so far behind that there's no
+// free buffer, the packet is dropped (counted in can_rx_overruns) and the
+// DMA collects the next one into the same buffer. Returns the number of
+// bytes the DMA wrote. Decoding is left to canRxService(), so this (and
+// the interrupt) takes a few microseconds.
+static inline int resetReceiver() {
+    unsigned int head = can_rx_buffer_head ;
+    struct can_rx_buffer * filled = &can_rx_buffers[head % CAN_RX_BUFFERS] ;
     // Full message received, abort DMA channel 2
     // disable the channel on IRQ0
     dma_channel_set_irq0_enabled(dma_chan_1, false);
@@ -658,8 +990,21 @@ static inline void resetReceiver() {
     dma_channel_acknowledge_irq0(dma_chan_1);
     // re-enable the channel on IRQ0
     dma_channel_set_irq0_enabled(dma_chan_1, true);
+    // When it came, and the bytes written into the filled buffer
+    filled->time = time_us_32() ;
+    filled->bytes = MAX_STUFFED_PACKET_LEN - dma_hw->ch[dma_chan_1].transfer_count ;
+    // Publish it, if there's another buffer to move on to
+    if ((head + 1 - can_rx_buffer_tail) < CAN_RX_BUFFERS) {
+        __dmb() ;
+        can_rx_buffer_head = ++head ;
+        rx_packet_stuffed_pointer = can_rx_buffers[head % CAN_RX_BUFFERS].stuffed ;
+    }
+    else {
+        can_rx_overruns++ ;
+    }
     // Reset the DMA channel write address, and start the channel
     dma_channel_set_write_addr(dma_chan_1, rx_packet_stuffed_pointer, true) ;
+    return filled->bytes ;
 }
 
 // At end of receive ISR, clear interrupt to accept new packets
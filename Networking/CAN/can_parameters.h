@@ -15,26 +15,72 @@
 
 //                                CAN PARAMETERS
 //
+// Frame format. CAN_FORMAT_ORIGINAL is the format of these demos (16-bit
+// arbitration, reserve byte, CRC-16, 16 recessive bits for EOF) at 1 Mbit/s
+// from a 160 MHz clock. CAN_FORMAT_20 is standard CAN 2.0A/B (11 or 29-bit
+// IDs, up to 8 bytes, CRC-15, ACK slot, error counters) at CAN_BITRATE,
+// for talking to other CAN controllers.
+#define CAN_FORMAT_ORIGINAL     0
+#define CAN_FORMAT_20           1
+#ifndef CAN_FRAME_FORMAT
+#define CAN_FRAME_FORMAT        CAN_FORMAT_ORIGINAL
+#endif
+// CAN 2.0 bit rate: 125000, 250000, 500000 or 1000000 (clk_sys must be at
+// least 32x this; 160 MHz divides evenly into all four)
+#ifndef CAN_BITRATE
+#define CAN_BITRATE             1000000
+#endif
+// CAN 2.0: 1 sends a frame again when no node acknowledges it, as CAN
+// requires. 0 counts the ACK error and drops the frame, for a bus with
+// only these nodes on it (they don't acknowledge, see can_driver.h).
+#ifndef CAN2_NEED_ACK
+#define CAN2_NEED_ACK           1
+#endif
 // Size of TX buffer
 #define MAX_PAYLOAD_SIZE        16
-#define MAX_PACKET_LEN          MAX_PAYLOAD_SIZE+8
-#define MAX_STUFFED_PACKET_LEN  MAX_PACKET_LEN+(MAX_PACKET_LEN>>1)
+#define MAX_PACKET_LEN          (MAX_PAYLOAD_SIZE+8)
+#define MAX_STUFFED_PACKET_LEN  (MAX_PACKET_LEN+(MAX_PACKET_LEN>>1))
 // My own identity, and a broadcast value
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+#define MY_ARBITRATION_VALUE    0x323
+#define NETWORK_BROADCAST       0x555
+#else
 #define MY_ARBITRATION_VALUE    0x3234
 #define NETWORK_BROADCAST       0x5555
-// Time to wait (in bit times) for bus to be idle before tx. Dynamically modifiable.
+#endif
+// Frames in the TX and RX queues (TX at most 31)
+#define CAN_TX_QUEUE            8
+#define CAN_RX_QUEUE            16
+// Buffers for packets the RX interrupt has collected but canRxService()
+// hasn't decoded yet (at least 2)
+#define CAN_RX_BUFFERS          8
+// Acceptance filters, and IDs counted separately (per direction)
+#define CAN_MAX_FILTERS         8
+#define CAN_ID_COUNTERS         16
+// Time to wait (in bit times) for bus to be idle before tx. Dynamically
+// modifiable (in CAN 2.0 format the driver sets it from the error state).
 unsigned int tx_idle_time = 500 ;
 
 
 //            PACKET INFORMATION WHICH WILL BE MODIFIED AT RUNTIME
 //
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+// CAN ID (11 bits, or 29 bits with CAN_EFF_FLAG set, see can_coding.h)
+unsigned int arbitration = 0x423 ;
+#else
 // Start of frame (1 bit), arbitration (12 bits), stuffer buffer (3 bits).
 // This specifies the destination for the packet. 
 unsigned short arbitration = 0x4234 ;
-// Reserve byte (data request? routing?)
+#endif
+// Reserve byte (data request? routing?) Not sent in CAN 2.0 format.
 unsigned char reserve_byte = 0x55 ;
+#if CAN_FRAME_FORMAT == CAN_FORMAT_20
+// Payload length in bytes (at most 8)
+unsigned char payload_len  = 8 ;
+#else
 // Payload length in bytes (should be even)
 unsigned char payload_len  = 10 ;
+#endif
 // The payload (modified at runtime)
 unsigned short payload[MAX_PAYLOAD_SIZE] = {0x1335, 0x5678, 0x9012,
                                             0x3456, 0x7890};
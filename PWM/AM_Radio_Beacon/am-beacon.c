@@ -1,132 +1,110 @@
-/**
- * V. Hunter Adams (vha3@cornell.edu)
- * 
- * AM Radio beacon with PWM
- * 
- * This demonstration uses a PWM channel
- * to generate a 1KHz AM radio beacon.
- * Tune your SDR to 41.667MHz.
- * 
- * HARDWARE CONNECTIONS
- *   - GPIO 4 ---> PWM output
- * 
- * RESOURCES CONSUMED
- *   - 1 repeating timer
- *   - 1 PWM channel
- * 
- */
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include "pico/stdlib.h"
-#include "pico/multicore.h"
-
-// Interface library to sys_clock
-#include "hardware/clocks.h"
-#include "hardware/pwm.h"
-
-// Low-level alarm infrastructure we'll be using
-#define ALARM_NUM 0
-#define ALARM_IRQ timer_hardware_alarm_get_irq_num(ALARM_NUM)
-#define DELAY 1000 // 1/Fs (in microseconds) - 1KHz tone
-
-// PWM wrap value and clock divide value
-// For a CPU rate of 250 MHz, this gives
-// a PWM frequency of 50MHz
-#define WRAPVAL 5
-#define CLKDIV 1.0f
-#define DEFAULT_DUTY 3
-
-// PWM pin
-#define PWM_PIN 4
-
-// Variable to hold PWM slice number
-uint slice_num ;
-
-// DMA channel
-int control_chan = 3 ;
-
-// Some state information for use in ISR
-unsigned int counter ;
-unsigned int state ;
-
-// Alarm ISR
-static void alarm_irq(void) {
-
-    // Clear the alarm irq
-    hw_clear_bits(&timer_hw->intr, 1u << ALARM_NUM);
-
-    // Reset the alarm register
-    timer_hw->alarm[ALARM_NUM] = timer_hw->timerawl + DELAY ;
-
-    // Generate 1KHz tone
-    if (counter < 1000){
-        if (state) {
-            pwm_set_chan_level(slice_num, PWM_CHAN_A, DEFAULT_DUTY) ;
-            state = 0 ;
-        }
-        else {
-            pwm_set_chan_level(slice_num, PWM_CHAN_A, 0) ;
-            state = 1 ;
-        }
-    }
-    // Generate carrier wave
-    else if (counter < 2000) {
-        pwm_set_chan_level(slice_num, PWM_CHAN_A, DEFAULT_DUTY) ;
-    }
-    // Reset
-    else {
-        counter = 0 ;
-    }
-    counter += 1 ;
-}
-
-
-int main() {
-
-    // Overclock to 250MHz
-    set_sys_clock_khz(250000, true);
-
-    // Initialize stdio
-    stdio_init_all();
-
-    ////////////////////////////////////////////////////////////////////////
-    ///////////////////////// PWM CONFIGURATION ////////////////////////////
-    ////////////////////////////////////////////////////////////////////////
-    // Tell GPIO 4 that it is allocated to the PWM, max slew rate and 
-    // drive strength
-    gpio_set_function(PWM_PIN, GPIO_FUNC_PWM);
-    gpio_set_drive_strength(PWM_PIN, 3);
-    gpio_set_slew_rate(PWM_PIN, 1);
-
-    // Find out which PWM slice is connected to GPIO 4 (it's slice 2)
-    slice_num = pwm_gpio_to_slice_num(PWM_PIN);
-
-    // This section configures the period of the PWM signals
-    pwm_set_wrap(slice_num, WRAPVAL) ;
-    pwm_set_clkdiv(slice_num, CLKDIV) ;
-
-    // This sets duty cycle. Will be modified by the DMA channel
-    pwm_set_chan_level(slice_num, PWM_CHAN_A, DEFAULT_DUTY);
-
-    // Start the channel
-    pwm_set_mask_enabled((1u << slice_num));
-
-    ////////////////////////////////////////////////////////////////////////
-    /////////////////////////// REPEATING TIMER ////////////////////////////
-    ////////////////////////////////////////////////////////////////////////
-    // Enable the interrupt for the alarm (we're using Alarm 0)
-    hw_set_bits(&timer_hw->inte, 1u << ALARM_NUM) ;
-    // Associate an interrupt handler with the ALARM_IRQ
-    irq_set_exclusive_handler(ALARM_IRQ, alarm_irq) ;
-    // Enable the alarm interrupt
-    irq_set_enabled(ALARM_IRQ, true) ;
-    // Write the lower 32 bits of the target time to the alarm register, arming it.
-    timer_hw->alarm[ALARM_NUM] = timer_hw->timerawl + DELAY ;
-
-    while(1) {
-
-    }
-
-}
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * AM Radio beacon with PWM
+ *
+ * This demonstration uses a PWM channel
+ * to generate an AM radio beacon.
+ * Tune your SDR to 41.667MHz.
+ *
+ * The transmitter (am_tx.h) precomputes the modulation as PWM duty
+ * cycles, and DMA plays them: there are no interrupts at all once it
+ * starts. Pick what the beacon sends with BEACON_MODE:
+ *   - BEACON_MORSE: its ID in Morse, as a 1 kHz tone keyed on the
+ *     carrier, then a few seconds of carrier
+ *   - BEACON_FSK: a line of text as 300 baud serial, 1200/2100 Hz audio
+ *     FSK (decode it with minimodem or similar)
+ *   - BEACON_TONE: 0.8 s of 1 kHz tone, then 0.8 s of carrier
+ *
+ * HARDWARE CONNECTIONS
+ *   - GPIO 4 ---> PWM output
+ *
+ * RESOURCES CONSUMED
+ *   - 1 PWM channel
+ *   - 2 DMA channels, 1 DMA timer
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+
+// Interface library to sys_clock
+#include "hardware/clocks.h"
+#include "hardware/pwm.h"
+
+// Transmitter (and the PWM waveform engine it plays through)
+#include "am_tx.h"
+
+// What to send
+#define BEACON_MORSE 0
+#define BEACON_FSK 1
+#define BEACON_TONE 2
+#define BEACON_MODE BEACON_MORSE
+
+// Carrier, and the fewest PWM counts per carrier period. At 41.667MHz
+// that's 250MHz / 6. (980kHz with 200 gives 240 counts, for an AM radio.)
+#define CARRIER_HZ 41.667e6f
+#define MIN_COUNTS 6
+
+// Morse ID, speed (words per minute) and tone
+#define BEACON_ID "VVV DE RP2040 BEACON"
+#define MORSE_WPM 15
+#define TONE_HZ 1000.0f
+
+// FSK message, bit rate and tones
+#define FSK_TEXT "RP2040 AM BEACON\r\n"
+#define FSK_BAUD 300
+#define FSK_MARK_HZ 1200.0f
+#define FSK_SPACE_HZ 2100.0f
+
+// PWM pin
+#define PWM_PIN 4
+
+// Serial bits for the FSK message
+uint8_t fsk_bits[10 * sizeof(FSK_TEXT)] ;
+
+
+int main() {
+
+    float carrier, pass ;
+    int units ;
+
+    // Carrier: picks and sets the system clock (250MHz for 41.667MHz),
+    // so before anything else
+    carrier = am_tx_init(PWM_PIN, CARRIER_HZ, MIN_COUNTS) ;
+
+    // Initialize stdio
+    stdio_init_all();
+
+    ////////////////////////////////////////////////////////////////////////
+    ///////////////////////// PRECOMPUTE MODULATION ////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+#if BEACON_MODE == BEACON_MORSE
+    units = am_tx_morse(BEACON_ID, MORSE_WPM, TONE_HZ, 1.0f) ;
+#elif BEACON_MODE == BEACON_FSK
+    units = am_tx_fsk(fsk_bits, am_tx_uart_bits(FSK_TEXT, fsk_bits, sizeof(fsk_bits)),
+                      FSK_BAUD, FSK_MARK_HZ, FSK_SPACE_HZ, 1.0f) ;
+#else
+    // 100 ms units: 8 of tone, 8 of carrier
+    am_tx_units_make(AM_TX_MCW, am_tx_fs / 10, TONE_HZ, 0, 1.0f) ;
+    am_tx_key(1, 8) ;
+    am_tx_key(0, 8) ;
+    units = am_tx_used ;
+#endif
+
+    ////////////////////////////////////////////////////////////////////////
+    ///////////////////////////// ROCK AND ROLL ////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+    // Round and round, by DMA
+    pass = am_tx_start() ;
+
+    while(1) {
+        printf("Carrier %.0f Hz (clk_sys %lu Hz, %d counts), %d units, %.1f s per pass\n",
+               carrier, (unsigned long)clock_get_hz(clk_sys), am_tx_wrap + 1, units, pass) ;
+        sleep_ms(5000) ;
+    }
+
+}
@@ -0,0 +1,364 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * AM/OOK transmitter with PWM: precomputed modulation, played by DMA
+ *
+ * The carrier is a PWM output. Its fundamental has amplitude
+ * sin(pi * duty), so every envelope sample a (0 to 1) becomes the duty
+ * asin(a) / pi, which makes the modulation linear (a plain duty of
+ * a / 2 would flatten the peaks). All of that is worked out before
+ * transmitting, into compare words for the waveform engine
+ * (pwm_engine.h), which plays them by DMA with no interrupts:
+ *
+ *  - Audio: am_tx_audio() pre-emphasizes a buffer of samples, scales it
+ *    to the modulation depth, and writes one compare word per sample
+ *  - Keyed and bit-serial modes: a few units (one Morse dot, or one bit)
+ *    are precomputed, and a table of pointers strings them together.
+ *    am_tx_morse() (tone keyed on a steady carrier, MCW), am_tx_ook()
+ *    (carrier keyed on and off) and am_tx_fsk() (two audio tones). Key
+ *    edges are raised cosines AM_TX_EDGE long, which keeps the keying
+ *    clicks off the neighboring channels.
+ *
+ * Samples are paced by a DMA timer at AM_TX_RATE (as near as its X/Y
+ * fraction of clk_sys gets, alarm_service.h). The PWM latches each
+ * new compare value at the end of a carrier period, so the envelope
+ * changes cleanly between carrier cycles. (Pacing by the PWM wrap would
+ * need one word per carrier cycle, a million a second at 1 MHz.)
+ *
+ * The carrier frequency is set by choosing clk_sys and the PWM period
+ * together (am_tx_plan). More counts per period give finer duty steps:
+ * at 1 MHz there are about 250, at 41.667 MHz only 6.
+ *
+ * USAGE
+ *   am_tx_init(4, 41.667e6f, 6) ;        // pin, carrier, counts per period
+ *   stdio_init_all() ;                   // after: clk_sys has changed
+ *   am_tx_morse("VVV DE RP2040", 15, 1000.0f, 1.0f) ;
+ *   am_tx_start() ;                      // repeats for ever
+ *
+ * RESOURCES USED
+ *  - 1 PWM slice
+ *  - 2 DMA channels (claimed), 1 DMA timer (claimed)
+ */
+
+#include <math.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+// DMA playback
+#include "pwm_engine.h"
+#include "alarm_service.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Sample rate (Hz)
+#ifndef AM_TX_RATE
+#define AM_TX_RATE              24000
+#endif
+// Longest unit, in samples (100 ms: Morse down to 12 words per minute,
+// bits down to 10 baud)
+#ifndef AM_TX_MAX_UNIT
+#define AM_TX_MAX_UNIT          (AM_TX_RATE / 10)
+#endif
+// Sequence table: log2 of its size in bytes (4 per unit, at most 15)
+#ifndef AM_TX_TABLE_BITS
+#define AM_TX_TABLE_BITS        12
+#endif
+// Length of a key edge (s)
+#ifndef AM_TX_EDGE
+#define AM_TX_EDGE              0.005f
+#endif
+// Range of clk_sys the carrier planner picks from (kHz)
+#ifndef AM_TX_MAX_KHZ
+#define AM_TX_MAX_KHZ           250000
+#endif
+#define AM_TX_MIN_KHZ           100000
+
+#define AM_TX_TABLE_LEN         (1 << (AM_TX_TABLE_BITS - 2))
+
+// Modulation of the units
+#define AM_TX_MCW               0   // audio tone keyed on a steady carrier
+#define AM_TX_OOK               1   // carrier keyed on and off
+#define AM_TX_FSK               2   // one of two audio tones per bit
+
+// Units (key up or down for one unit of time). In FSK, MARK is a 1 and
+// SPACE a 0.
+#define AM_TX_SPACE             0   // key up
+#define AM_TX_MARK              1   // key down
+#define AM_TX_RISE              2   // key down, after key up
+#define AM_TX_FALL              3   // key down, before key up
+#define AM_TX_DOT               4   // key down, between key ups
+#define AM_TX_UNITS             5
+
+// The PWM output, and the carrier and sample rate it produces
+uint am_tx_slice ;
+uint am_tx_channel ;
+uint16_t am_tx_wrap ;
+float am_tx_carrier_hz = 0 ;
+float am_tx_fs = AM_TX_RATE ;
+
+// Precomputed units, and the sequence of them (a DMA ring)
+uint32_t am_tx_units[AM_TX_UNITS][AM_TX_MAX_UNIT] ;
+const uint32_t * am_tx_table[AM_TX_TABLE_LEN] __attribute__((aligned(1 << AM_TX_TABLE_BITS))) ;
+int am_tx_unit_len = 0 ;            // samples per unit
+int am_tx_used = 0 ;                // units in the sequence
+static int am_tx_idle = AM_TX_SPACE ;
+
+// Find clk_sys (a rate the PLL can make, AM_TX_MIN_KHZ to AM_TX_MAX_KHZ)
+// and a PWM period of at least min_levels counts for the carrier closest
+// to carrier_hz, preferring more counts when two are as close (within
+// 1 Hz). Returns that carrier (0 if there is none).
+float am_tx_plan(float carrier_hz, int min_levels, uint32_t * khz_out, uint16_t * wrap_out) {
+    uint vco, postdiv1, postdiv2, fbdiv, pd1, pd2 ;
+    uint32_t n, khz, best_n = 0 ;
+    double f, err, best = 1e30, best_f = 0 ;
+    // Every clock the PLL can make from the 12 MHz crystal, in kHz
+    for (fbdiv = 16; fbdiv <= 320; fbdiv++) {
+        for (pd1 = 1; pd1 <= 7; pd1++) {
+            for (pd2 = 1; pd2 <= pd1; pd2++) {
+                if ((12000 * fbdiv) % (pd1 * pd2)) continue ;
+                khz = 12000 * fbdiv / (pd1 * pd2) ;
+                if ((khz < AM_TX_MIN_KHZ) || (khz > AM_TX_MAX_KHZ)) continue ;
+                // nearest period in counts
+                n = (uint32_t)(khz * 1000.0 / carrier_hz + 0.5) ;
+                if ((n < (uint32_t)min_levels) || (n > 65536)) continue ;
+                f = khz * 1000.0 / n ;
+                err = fabs(f - carrier_hz) ;
+                if ((err > best + 1.0) || ((err > best - 1.0) && (n <= best_n))) continue ;
+                // the VCO must be in range too
+                if (!check_sys_clock_khz(khz, &vco, &postdiv1, &postdiv2)) continue ;
+                best = err ;
+                best_f = f ;
+                best_n = n ;
+                *khz_out = khz ;
+                *wrap_out = n - 1 ;
+            }
+        }
+    }
+    return (float)best_f ;
+}
+
+// Set up the transmitter on pin: picks clk_sys and the PWM period for
+// carrier_hz (with at least min_levels counts per period), sets the clock,
+// and claims a DMA timer for the sample rate. Call before stdio_init_all(),
+// since clk_sys changes. Returns the carrier (0 if it can't be made).
+float am_tx_init(uint pin, float carrier_hz, int min_levels) {
+    uint32_t khz = 0 ;
+    uint16_t wrap = 0 ;
+    int timer ;
+
+    am_tx_carrier_hz = am_tx_plan(carrier_hz, min_levels, &khz, &wrap) ;
+    if (am_tx_carrier_hz == 0) return 0 ;
+    set_sys_clock_khz(khz, true) ;
+
+    // PWM output, max slew rate and drive strength
+    gpio_set_function(pin, GPIO_FUNC_PWM) ;
+    gpio_set_drive_strength(pin, GPIO_DRIVE_STRENGTH_12MA) ;
+    gpio_set_slew_rate(pin, GPIO_SLEW_RATE_FAST) ;
+    am_tx_slice = pwm_gpio_to_slice_num(pin) ;
+    am_tx_channel = pwm_gpio_to_channel(pin) ;
+    am_tx_wrap = wrap ;
+    pwm_engine_init(am_tx_slice, wrap, 1.0f, false, 0) ;
+
+    // Samples at AM_TX_RATE, or as close as the DMA timer gets
+    timer = alarm_service_dma_timer(AM_TX_RATE, &am_tx_fs) ;
+    pwm_engine_pace(am_tx_slice, dma_get_timer_dreq(timer)) ;
+    return am_tx_carrier_hz ;
+}
+
+// Compare word for envelope a (0 to 1, 1 is a 50% duty)
+static uint32_t am_tx_word(float a) {
+    uint16_t level ;
+    if (a < 0) a = 0 ;
+    if (a > 1) a = 1 ;
+    level = (uint16_t)(asinf(a) * 0.31830989f * (am_tx_wrap + 1) + 0.5f) ;
+    return am_tx_channel ? PWM_ENGINE_CC(0, level) : PWM_ENGINE_CC(level, 0) ;
+}
+
+// Envelope for a carrier modulated by x (-1 to 1) to depth (0 to 1). The
+// carrier sits at 1 / (1 + depth), so the peaks reach full power.
+static inline float am_tx_envelope(float x, float depth) {
+    return (1.0f + depth * x) / (1.0f + depth) ;
+}
+
+
+//                                  AUDIO
+//
+// Precompute n samples of audio (at am_tx_fs) into n compare words. tau
+// (s, 0 for none) is a first-order pre-emphasis: frequencies above
+// 1 / (2 pi tau) are lifted, up to 1 + 2 tau fs times at the top. The
+// result is scaled so its peak modulates to depth.
+void am_tx_audio(const int16_t * in, uint32_t * out, uint32_t n, float depth, float tau) {
+    float g = tau * am_tx_fs, y, peak = 1.0f ;
+    uint32_t i ;
+    // Peak after pre-emphasis
+    for (i = 0; i < n; i++) {
+        y = in[i] + g * (in[i] - (i ? in[i-1] : in[i])) ;
+        if (fabsf(y) > peak) peak = fabsf(y) ;
+    }
+    for (i = 0; i < n; i++) {
+        y = in[i] + g * (in[i] - (i ? in[i-1] : in[i])) ;
+        out[i] = am_tx_word(am_tx_envelope(y / peak, depth)) ;
+    }
+}
+
+// Play precomputed audio (once, or round and round)
+void am_tx_play(const uint32_t * wave, uint32_t n, int loop) {
+    pwm_engine_play(am_tx_slice, wave, n, loop) ;
+    pwm_engine_start(1u << am_tx_slice) ;
+}
+
+
+//                            KEYED AND BIT-SERIAL MODES
+//
+// A tone of about tone_hz with a whole number of cycles per unit, so
+// consecutive units join without a phase step
+static float am_tx_tone(float tone_hz, int n) {
+    float cycles = floorf(tone_hz * n / am_tx_fs + 0.5f) ;
+    return cycles / n ;
+}
+
+// Precompute the units for a mode, n samples each. MCW and FSK tones
+// modulate to depth. In FSK, MARK carries tone_hz and SPACE space_hz.
+// Returns 0 if n is too long.
+int am_tx_units_make(int mode, int n, float tone_hz, float space_hz, float depth) {
+    int type, i, edge = (int)(AM_TX_EDGE * am_tx_fs) ;
+    float tone = am_tx_tone(tone_hz, n), space = am_tx_tone(space_hz, n), e, a ;
+    if ((n < 1) || (n > AM_TX_MAX_UNIT)) return 0 ;
+    if (edge > n / 2) edge = n / 2 ;
+    for (type = 0; type < AM_TX_UNITS; type++) {
+        for (i = 0; i < n; i++) {
+            // Key envelope, with raised-cosine edges
+            e = (type == AM_TX_SPACE) ? 0.0f : 1.0f ;
+            if (((type == AM_TX_RISE) || (type == AM_TX_DOT)) && (i < edge)) {
+                e = 0.5f - 0.5f * cosf(3.14159265f * i / edge) ;
+            }
+            if (((type == AM_TX_FALL) || (type == AM_TX_DOT)) && (i >= n - edge)) {
+                e = 0.5f - 0.5f * cosf(3.14159265f * (n - 1 - i) / edge) ;
+            }
+            if (mode == AM_TX_OOK) {
+                a = e ;
+            }
+            else if (mode == AM_TX_MCW) {
+                a = am_tx_envelope(e * sinf(6.2831853f * tone * i), depth) ;
+            }
+            else {
+                a = am_tx_envelope(sinf(6.2831853f * ((type == AM_TX_SPACE) ? space : tone) * i), depth) ;
+            }
+            am_tx_units[type][i] = am_tx_word(a) ;
+        }
+    }
+    am_tx_unit_len = n ;
+    am_tx_used = 0 ;
+    am_tx_idle = (mode == AM_TX_FSK) ? AM_TX_MARK : AM_TX_SPACE ;
+    return 1 ;
+}
+
+// Add a unit to the sequence (dropped once the table is full)
+static inline void am_tx_add(int type) {
+    if (am_tx_used < AM_TX_TABLE_LEN) am_tx_table[am_tx_used++] = am_tx_units[type] ;
+}
+
+// Add count units of key down (with its edges) or key up
+void am_tx_key(int down, int count) {
+    if (count < 1) return ;
+    if (!down) {
+        while (count--) am_tx_add(AM_TX_SPACE) ;
+    }
+    else if (count == 1) {
+        am_tx_add(AM_TX_DOT) ;
+    }
+    else {
+        am_tx_add(AM_TX_RISE) ;
+        while (count-- > 2) am_tx_add(AM_TX_MARK) ;
+        am_tx_add(AM_TX_FALL) ;
+    }
+}
+
+// Morse code: letters, then digits
+static const char * const am_tx_morse_letters[26] = {
+    ".-", "-...", "-.-.", "-..", ".", "..-.", "--.", "....", "..", ".---",
+    "-.-", ".-..", "--", "-.", "---", ".--.", "--.-", ".-.", "...", "-",
+    "..-", "...-", ".--", "-..-", "-.--", "--.."
+} ;
+static const char * const am_tx_morse_digits[10] = {
+    "-----", ".----", "..---", "...--", "....-", ".....", "-....", "--...",
+    "---..", "----."
+} ;
+
+// Morse (MCW) for text at wpm words per minute (a dot is 1.2 / wpm s),
+// with a tone_hz tone at depth. Characters other than letters, digits,
+// '/' and spaces are skipped. Returns the units in the sequence (0 if
+// wpm is too slow).
+int am_tx_morse(const char * text, int wpm, float tone_hz, float depth) {
+    const char * code ;
+    char ch ;
+    if (!am_tx_units_make(AM_TX_MCW, (int)(1.2f * am_tx_fs / wpm), tone_hz, 0, depth)) return 0 ;
+    for ( ; *text; text++) {
+        ch = *text ;
+        if ((ch >= 'a') && (ch <= 'z')) ch -= 'a' - 'A' ;
+        if ((ch >= 'A') && (ch <= 'Z')) code = am_tx_morse_letters[ch - 'A'] ;
+        else if ((ch >= '0') && (ch <= '9')) code = am_tx_morse_digits[ch - '0'] ;
+        else if (ch == '/') code = "-..-." ;
+        else {
+            // a word gap is 7 units, 3 of them already after the letter
+            if (ch == ' ') am_tx_key(0, 4) ;
+            continue ;
+        }
+        // dot 1 unit, dash 3, 1 between them, 3 after the letter
+        for ( ; *code; code++) {
+            am_tx_key(1, (*code == '.') ? 1 : 3) ;
+            am_tx_key(0, 1) ;
+        }
+        am_tx_key(0, 2) ;
+    }
+    return am_tx_used ;
+}
+
+// On-off keying of nbits bits (one per byte, 0 or 1) at baud. Returns the
+// units in the sequence (0 if baud is too slow).
+int am_tx_ook(const uint8_t * bits, int nbits, int baud) {
+    int i, run ;
+    if (!am_tx_units_make(AM_TX_OOK, (int)(am_tx_fs / baud + 0.5f), 0, 0, 0)) return 0 ;
+    // key down or up for each run of equal bits
+    for (i = 0; i < nbits; i += run) {
+        for (run = 1; (i + run < nbits) && (!bits[i + run] == !bits[i]); run++) ;
+        am_tx_key(bits[i], run) ;
+    }
+    return am_tx_used ;
+}
+
+// Audio FSK of nbits bits at baud: mark_hz for a 1, space_hz for a 0, at
+// depth. Tones are rounded to a whole number of cycles per bit, which
+// keeps the phase continuous. Returns the units in the sequence.
+int am_tx_fsk(const uint8_t * bits, int nbits, int baud, float mark_hz, float space_hz, float depth) {
+    int i ;
+    if (!am_tx_units_make(AM_TX_FSK, (int)(am_tx_fs / baud + 0.5f), mark_hz, space_hz, depth)) return 0 ;
+    for (i = 0; i < nbits; i++) am_tx_add(bits[i] ? AM_TX_MARK : AM_TX_SPACE) ;
+    return am_tx_used ;
+}
+
+// Frame text as serial bits (one per byte): a start bit (0), 8 data bits
+// LSB first, and a stop bit (1) per character. Returns the bits written.
+int am_tx_uart_bits(const char * text, uint8_t * bits, int max) {
+    int n = 0, i ;
+    for ( ; *text && (n + 10 <= max); text++) {
+        bits[n++] = 0 ;
+        for (i = 0; i < 8; i++) bits[n++] = (*text >> i) & 1 ;
+        bits[n++] = 1 ;
+    }
+    return n ;
+}
+
+// Pad the sequence to a power of two units with key up (a 1 in FSK) and
+// transmit it, round and round. Build sequences with the transmitter
+// stopped (pwm_engine_stop). Returns the time for one pass (s).
+float am_tx_start() {
+    int bits = 3 ;
+    while ((1 << (bits - 2)) < am_tx_used) bits++ ;
+    while (am_tx_used < (1 << (bits - 2))) am_tx_add(am_tx_idle) ;
+    pwm_engine_play_blocks(am_tx_slice, am_tx_table, bits, am_tx_unit_len) ;
+    pwm_engine_start(1u << am_tx_slice) ;
+    return (float)am_tx_used * am_tx_unit_len / am_tx_fs ;
+}
@@ -0,0 +1,290 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * DMA-driven PWM waveform engine
+ *
+ * Plays precomputed waveforms on PWM outputs (slices, A and B) with no
+ * CPU time per sample. Each slice gets a DMA channel that copies one
+ * word per PWM period from a buffer into the slice's counter compare
+ * register (CC: level A in the low half, level B in the high half),
+ * paced by the slice's wrap DREQ:
+ *
+ *   data channel: wave[i] --> pwm_hw->slice[s].cc, one per wrap
+ *     --> chains to the control channel at the end of the buffer (loop)
+ *   control channel: loads the start of the buffer into the data
+ *     channel's read address, and triggers it
+ *
+ * CC is double-buffered by the PWM, so each word takes effect at the
+ * start of the next period and the first one appears one period after
+ * the slice starts. Playing once needs just the data channel.
+ *
+ * DMA channels are what limit the slices. The RP2040 has 12, so all 8
+ * slices can play once, but at most 6 can loop (or play blocks), and
+ * fewer if anything else has claimed channels. The claim panics when
+ * they run out.
+ *
+ * Slices are set up and loaded first, then started together with
+ * pwm_engine_start(): their counters are preset to each slice's phase
+ * offset and they are all enabled with a single write to the PWM enable
+ * register (pwm_set_mask_enabled), so they run in lock step from the
+ * same clock.
+ *
+ * Uses
+ *  - Motor drive: sine tables on several channels, phase-correct PWM,
+ *    all slices started together
+ *  - Audio over PWM: a high carrier frequency, with the samples paced by
+ *    a DMA timer (pwm_engine_pace) instead of the wrap. Loop a ring and
+ *    keep it filled ahead of pwm_engine_position().
+ *  - LED dimming: a gamma-corrected brightness curve, looped
+ *  - Sequences: pwm_engine_play_blocks() plays a table of pointers to
+ *    equal-sized blocks, so a long sequence can be built from a few
+ *    short precomputed pieces
+ *
+ * USAGE
+ *   gpio_set_function(4, GPIO_FUNC_PWM) ;            // slice 2, A
+ *   pwm_engine_init(2, 6249, 1.0f, true, 0) ;        // wrap, clkdiv, phase-correct, phase
+ *   pwm_engine_fill_sine(wave, 500, PWM_CHAN_A, 1, 0, 3125, 3000) ;
+ *   pwm_engine_play(2, wave, 500, true) ;            // loop it
+ *   pwm_engine_start(1u << 2) ;
+ *
+ * RESOURCES USED
+ *  - 1 DMA channel per slice played once, 2 per slice looped (claimed,
+ *    out of 12)
+ *  - The PWM slices passed to pwm_engine_init()
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Slices on the RP2040
+#define PWM_ENGINE_SLICES       NUM_PWM_SLICES
+
+// Compare word: level for channel A in the low half, B in the high half
+#define PWM_ENGINE_CC(a, b)     ((((uint32_t)(b)) << 16) | ((uint32_t)(a) & 0xFFFF))
+
+// State for one slice
+struct pwm_engine_slice {
+    int data_chan ;                     // DMA channels (-1 until claimed)
+    int ctrl_chan ;
+    const uint32_t * volatile start ;   // the control channel reloads this
+    uint32_t length ;                   // words per pass
+    int loop ;
+    int dreq ;                          // pacing (the wrap, or a DMA timer)
+    uint16_t wrap ;
+    uint16_t phase ;                    // counter value at start
+    int ready ;                         // set up by pwm_engine_init()
+} ;
+struct pwm_engine_slice pwm_engine[PWM_ENGINE_SLICES] ;
+
+// Set up a slice: counter wraps after wrap+1 counts (or counts up and
+// back down if phase_correct) at clk_sys / clkdiv, and starts from phase
+// (0 to wrap). The slice stays stopped until pwm_engine_start(). Call
+// gpio_set_function(pin, GPIO_FUNC_PWM) for its pins.
+void pwm_engine_init(uint slice, uint16_t wrap, float clkdiv, bool phase_correct, uint16_t phase) {
+    struct pwm_engine_slice * s = &pwm_engine[slice] ;
+    pwm_config c = pwm_get_default_config() ;
+    pwm_config_set_wrap(&c, wrap) ;
+    pwm_config_set_clkdiv(&c, clkdiv) ;
+    pwm_config_set_phase_correct(&c, phase_correct) ;
+    pwm_init(slice, &c, false) ;
+    if (!s->ready) {
+        s->data_chan = -1 ;
+        s->ctrl_chan = -1 ;
+    }
+    s->wrap = wrap ;
+    s->phase = (phase > wrap) ? wrap : phase ;
+    s->dreq = pwm_get_dreq(slice) ;
+    s->ready = 1 ;
+}
+
+// Output frequency of a slice (Hz): one sample per period
+static inline float pwm_engine_frequency(uint slice) {
+    float div = (float)(pwm_hw->slice[slice].div) / 16.0f ;
+    float counts = (float)pwm_engine[slice].wrap + 1.0f ;
+    if (pwm_hw->slice[slice].csr & PWM_CH0_CSR_PH_CORRECT_BITS) counts *= 2.0f ;
+    return (float)clock_get_hz(clk_sys) / (div * counts) ;
+}
+
+// Pace the slice's samples with another DREQ, such as a DMA timer
+// (dma_get_timer_dreq), instead of its wrap. Call before pwm_engine_play().
+// A sample then lasts until the next PWM period after the DREQ.
+static inline void pwm_engine_pace(uint slice, int dreq) {
+    pwm_engine[slice].dreq = dreq ;
+}
+
+// Stop the DMA on a slice (its output keeps the last level)
+static void pwm_engine_halt(uint slice) {
+    struct pwm_engine_slice * s = &pwm_engine[slice] ;
+    if (s->data_chan < 0) return ;
+    if (s->ctrl_chan >= 0) dma_channel_abort(s->ctrl_chan) ;
+    dma_channel_abort(s->data_chan) ;
+    // The abort may have triggered the control channel
+    if (s->ctrl_chan >= 0) dma_channel_abort(s->ctrl_chan) ;
+}
+
+// Load a waveform of n compare words (PWM_ENGINE_CC) onto a slice, to
+// play once or to loop. The DMA is armed and waits for the slice to
+// start (or, if it is running, starts at its next period). The buffer
+// must stay put while it plays. Looping takes a second DMA channel.
+void pwm_engine_play(uint slice, const uint32_t * wave, uint32_t n, int loop) {
+    struct pwm_engine_slice * s = &pwm_engine[slice] ;
+    dma_channel_config c ;
+
+    pwm_engine_halt(slice) ;
+    if (s->data_chan < 0) s->data_chan = dma_claim_unused_channel(true) ;
+    if (loop && (s->ctrl_chan < 0)) s->ctrl_chan = dma_claim_unused_channel(true) ;
+    s->start = wave ;
+    s->length = n ;
+    s->loop = loop ;
+
+    if (loop) {
+        // Control channel (looping): start of the buffer into the data
+        // channel's read address, and trigger. Set up before the data channel
+        // starts, which may reach the end of a short buffer at once.
+        c = dma_channel_get_default_config(s->ctrl_chan) ;
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32) ;
+        channel_config_set_read_increment(&c, false) ;
+        channel_config_set_write_increment(&c, false) ;
+        dma_channel_configure(
+            s->ctrl_chan,
+            &c,
+            &dma_hw->ch[s->data_chan].al3_read_addr_trig,  // write address (read address, and trigger)
+            &s->start,                                      // read address (start of the buffer)
+            1,                                              // one address per pass
+            false                                           // started by the data channel
+        ) ;
+    }
+
+    // Data channel: one compare word per DREQ
+    c = dma_channel_get_default_config(s->data_chan) ;
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c, true) ;
+    channel_config_set_write_increment(&c, false) ;
+    channel_config_set_dreq(&c, s->dreq) ;
+    // Chain to the control channel at the end of the buffer (chaining
+    // to itself means no chain)
+    channel_config_set_chain_to(&c, loop ? s->ctrl_chan : s->data_chan) ;
+    dma_channel_configure(
+        s->data_chan,
+        &c,
+        &pwm_hw->slice[slice].cc,   // write address (counter compare)
+        wave,                       // read address
+        n,                          // words per pass
+        true                        // start (waits for the DREQ)
+    ) ;
+}
+
+// Play a table of blocks of block words each, one after the other, going
+// round the table for ever. The control channel walks the table as a DMA
+// ring, so it holds (1 << table_bits) / 4 pointers and is aligned to
+// 1 << table_bits bytes (table_bits 3 to 15). Repeat a pointer to play a
+// block again: a few short blocks make a long sequence. A NULL entry
+// stops playback there. Starts at once (with the slice's DREQ).
+void pwm_engine_play_blocks(uint slice, const uint32_t * const * table, int table_bits, uint32_t block) {
+    struct pwm_engine_slice * s = &pwm_engine[slice] ;
+    dma_channel_config c ;
+
+    pwm_engine_halt(slice) ;
+    if (s->data_chan < 0) s->data_chan = dma_claim_unused_channel(true) ;
+    if (s->ctrl_chan < 0) s->ctrl_chan = dma_claim_unused_channel(true) ;
+    s->start = NULL ;
+    s->length = block ;
+    s->loop = 1 ;
+
+    // Data channel: block words per trigger, then back to the control channel
+    c = dma_channel_get_default_config(s->data_chan) ;
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c, true) ;
+    channel_config_set_write_increment(&c, false) ;
+    channel_config_set_dreq(&c, s->dreq) ;
+    channel_config_set_chain_to(&c, s->ctrl_chan) ;
+    dma_channel_configure(
+        s->data_chan,
+        &c,
+        &pwm_hw->slice[slice].cc,   // write address (counter compare)
+        NULL,                       // read address (from the table)
+        block,                      // words per block
+        false                       // started by the control channel
+    ) ;
+
+    // Control channel: next table entry into the data channel's read
+    // address, and trigger
+    c = dma_channel_get_default_config(s->ctrl_chan) ;
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c, true) ;
+    channel_config_set_write_increment(&c, false) ;
+    channel_config_set_ring(&c, false, table_bits) ;
+    dma_channel_configure(
+        s->ctrl_chan,
+        &c,
+        &dma_hw->ch[s->data_chan].al3_read_addr_trig,  // write address (read address, and trigger)
+        table,                                          // read address (the table, a ring)
+        1,                                              // one block per trigger
+        true                                            // start
+    ) ;
+}
+
+// Swap a looping slice to another waveform of the same length at the end
+// of the current pass (no glitch). The old buffer is still read until
+// then.
+static inline void pwm_engine_queue(uint slice, const uint32_t * wave) {
+    pwm_engine[slice].start = wave ;
+}
+
+// Start a set of slices (bit n for slice n) together, each from its
+// phase offset. Slices already running keep running.
+void pwm_engine_start(uint32_t mask) {
+    uint slice ;
+    for (slice = 0; slice < PWM_ENGINE_SLICES; slice++) {
+        if (mask & (1u << slice)) pwm_set_counter(slice, pwm_engine[slice].phase) ;
+    }
+    pwm_set_mask_enabled(pwm_hw->en | mask) ;
+}
+
+// Stop a set of slices together, and their DMA. Their outputs hold the
+// level they had.
+void pwm_engine_stop(uint32_t mask) {
+    uint slice ;
+    pwm_set_mask_enabled(pwm_hw->en & ~mask) ;
+    for (slice = 0; slice < PWM_ENGINE_SLICES; slice++) {
+        if (mask & (1u << slice)) pwm_engine_halt(slice) ;
+    }
+}
+
+// Is a slice still playing (always, if it loops)?
+static inline int pwm_engine_busy(uint slice) {
+    return (pwm_engine[slice].data_chan >= 0) && dma_channel_is_busy(pwm_engine[slice].data_chan) ;
+}
+
+// Words of the current pass played so far
+static inline uint32_t pwm_engine_position(uint slice) {
+    struct pwm_engine_slice * s = &pwm_engine[slice] ;
+    if (s->data_chan < 0) return 0 ;
+    return s->length - dma_hw->ch[s->data_chan].transfer_count ;
+}
+
+// Set channel's level (PWM_CHAN_A or PWM_CHAN_B) in a compare word
+static inline void pwm_engine_set_level(uint32_t * word, uint channel, uint16_t level) {
+    int shift = channel ? 16 : 0 ;
+    *word = (*word & ~(0xFFFFu << shift)) | ((uint32_t)level << shift) ;
+}
+
+// Fill one channel of n compare words with a sine: cycles periods over
+// the buffer, starting at phase (radians), center +/- swing (counts).
+// The other channel's levels are left alone.
+void pwm_engine_fill_sine(uint32_t * wave, uint32_t n, uint channel, float cycles,
+                          float phase, uint16_t center, uint16_t swing) {
+    uint32_t i ;
+    float x ;
+    for (i = 0; i < n; i++) {
+        x = center + swing * sinf(6.2831853f * cycles * i / n + phase) ;
+        if (x < 0) x = 0 ;
+        if (x > 65535.0f) x = 65535.0f ;
+        pwm_engine_set_level(&wave[i], channel, (uint16_t)(x + 0.5f)) ;
+    }
+}
@@ -0,0 +1,365 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Audio input stage: 500 ksps capture, decimation, DC removal and AGC
+ *
+ * The demos used to clock the ADC at the audio rate and keep 8 bits of
+ * each sample (adc_fifo_setup with shift). Here the ADC runs free at its
+ * full 500 ksps with 12-bit samples, and the DMA fills a ring of raw
+ * blocks. Each block is filtered down to the audio rate in the DMA
+ * interrupt:
+ *
+ *   ADC (500 ksps, 12 bits) --DMA--> raw block
+ *     --> CIC filter, 4th order, decimate by INPUT_CIC_DECIMATE
+ *     --> FIR lowpass that also flattens the CIC droop, decimate by
+ *         INPUT_FIR_DECIMATE
+ *     --> DC blocker --> automatic gain control
+ *     --> input_samples[] ring, and an optional callback per block
+ *
+ * Averaging R*D conversions per output sample adds about log2(R*D)/2
+ * bits (2.8 bits for 50) to the 12-bit ADC. The CIC filter needs only
+ * adds and subtracts at 500 ksps. The FIR filter runs at the lower
+ * rate, and only for the samples that are kept.
+ *
+ * Output samples are fix15 (full scale +/-1.0) stored in int16.
+ *
+ * USAGE
+ *   #define INPUT_CIC_DECIMATE 25           // optional, before including
+ *   #include "audio_input.h"
+ *   input_init(26, 0, my_block_fn) ;        // pin, ADC channel, callback or NULL
+ *   input_start() ;
+ *   // input_count samples produced so far, sample n at
+ *   // input_samples[n & INPUT_RING_MASK]
+ *
+ * The interrupt runs on the core that called input_init().
+ *
+ * RESOURCES USED
+ *  - ADC
+ *  - 2 DMA channels (claimed), DMA_IRQ_0 (shared handler)
+ */
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// ADC rate: one conversion every 96 cycles of the 48 MHz ADC clock
+#define INPUT_ADC_RATE          500000
+// Decimation in the CIC filter (at most 31: 12 + 4*log2(R) bits must
+// fit in 32) and in the FIR filter
+#ifndef INPUT_CIC_DECIMATE
+#define INPUT_CIC_DECIMATE      25
+#endif
+#ifndef INPUT_FIR_DECIMATE
+#define INPUT_FIR_DECIMATE      2
+#endif
+// Output sample rate
+#define INPUT_FS                (INPUT_ADC_RATE / (INPUT_CIC_DECIMATE * INPUT_FIR_DECIMATE))
+// FIR length (at the CIC output rate)
+#ifndef INPUT_FIR_TAPS
+#define INPUT_FIR_TAPS          64
+#endif
+// Output samples per block
+#ifndef INPUT_BLOCK
+#define INPUT_BLOCK             32
+#endif
+// Raw blocks in the DMA ring (power of 2, max 8)
+#ifndef INPUT_RAW_BUFFERS
+#define INPUT_RAW_BUFFERS       4
+#endif
+// Output ring (power of 2, a multiple of INPUT_BLOCK)
+#ifndef INPUT_RING
+#define INPUT_RING              4096
+#endif
+// DC blocker corner: about INPUT_FS / (2 pi 2^INPUT_DC_SHIFT)
+#ifndef INPUT_DC_SHIFT
+#define INPUT_DC_SHIFT          8
+#endif
+// Automatic gain control: 0 for a fixed gain of 1.0
+#ifndef INPUT_AGC
+#define INPUT_AGC               1
+#endif
+// AGC: peak level it aims for, and the most gain it will apply
+#ifndef INPUT_AGC_TARGET
+#define INPUT_AGC_TARGET        0.5
+#endif
+#ifndef INPUT_AGC_MAX_GAIN
+#define INPUT_AGC_MAX_GAIN      32.0
+#endif
+// AGC envelope: rises by 1/2^ATTACK and falls by 1/2^RELEASE of the
+// difference per block
+#define INPUT_AGC_ATTACK_SHIFT  1
+#define INPUT_AGC_RELEASE_SHIFT 7
+// AGC: envelope (fix15) below which the gain stays at its most
+#define INPUT_AGC_KNEE          ((fix15)(INPUT_AGC_TARGET * 32768 / INPUT_AGC_MAX_GAIN))
+
+#if INPUT_CIC_DECIMATE > 31
+#error "INPUT_CIC_DECIMATE must be 31 or less"
+#endif
+
+#define INPUT_RAW_BLOCK         (INPUT_BLOCK * INPUT_CIC_DECIMATE * INPUT_FIR_DECIMATE)
+#define INPUT_RING_MASK         (INPUT_RING - 1)
+// log2 of the address table size in bytes (4 bytes per block)
+#define INPUT_TABLE_BITS        (INPUT_RAW_BUFFERS == 8 ? 5 : (INPUT_RAW_BUFFERS == 4 ? 4 : 3))
+
+// Called from the interrupt with each new block of output samples
+// (first is the index of block[0] in the input_count sequence)
+typedef void (*input_block_fn)(const int16_t * block, uint32_t first, int n) ;
+
+// Raw 12-bit samples, and the table of block addresses the control
+// channel walks (a ring on its read address, so aligned to its size)
+uint16_t input_raw[INPUT_RAW_BUFFERS][INPUT_RAW_BLOCK] ;
+uint16_t * input_raw_table[INPUT_RAW_BUFFERS]
+    __attribute__((aligned(1 << INPUT_TABLE_BITS))) ;
+
+// Output samples (fix15 in int16) and the number produced so far
+int16_t input_samples[INPUT_RING] ;
+volatile uint32_t input_count = 0 ;
+
+// Status: current AGC gain (fix15), raw blocks processed, blocks that
+// were processed late (the DMA was already two blocks ahead), and the
+// time spent on the last block (us)
+volatile fix15 input_gain ;
+volatile uint32_t input_blocks = 0 ;
+volatile uint32_t input_late = 0 ;
+volatile uint32_t input_process_us = 0 ;
+
+static int input_data_chan ;
+static int input_ctrl_chan ;
+static input_block_fn input_callback ;
+static uint32_t input_next_raw = 0 ;
+
+// CIC state (wraps modulo 2^32, which the combs undo)
+static uint32_t input_int[4] ;
+static uint32_t input_comb[4] ;
+// Centered CIC output to fix15: (x * scale) >> 32
+static int64_t input_cic_scale ;
+// FIR taps (Q14) and history (twice over, so no wrap in the inner loop)
+static int16_t input_fir[INPUT_FIR_TAPS] ;
+static fix15 input_fir_history[2 * INPUT_FIR_TAPS] ;
+static int input_fir_pos = 0 ;
+static int input_fir_phase = 0 ;
+// DC blocker and AGC state
+static int32_t input_dc ;
+static fix15 input_envelope ;
+
+// CIC magnitude response at f (Hz)
+static double input_cic_response(double f) {
+    double x = 3.141592653589793 * f / INPUT_ADC_RATE ;
+    double h ;
+    if (x < 1e-9) return 1.0 ;
+    h = sin(x * INPUT_CIC_DECIMATE) / (INPUT_CIC_DECIMATE * sin(x)) ;
+    return h * h * h * h ;
+}
+
+// FIR lowpass with its cutoff at the output Nyquist frequency and 1/CIC
+// gain in the passband: the inverse transform of that response,
+// integrated numerically, with a Blackman window
+static void input_design_fir() {
+    const double fs = (double)INPUT_ADC_RATE / INPUT_CIC_DECIMATE ;
+    const double fc = 0.5 * INPUT_FS ;
+    const int steps = 256 ;
+    double h[INPUT_FIR_TAPS], sum = 0, t, w, f, acc ;
+    int n, k ;
+    for (n = 0; n < INPUT_FIR_TAPS; n++) {
+        t = n - (INPUT_FIR_TAPS - 1) / 2.0 ;
+        acc = 0 ;
+        for (k = 0; k < steps; k++) {
+            f = (k + 0.5) * fc / steps ;
+            acc += cos(6.283185307179586 * f * t / fs) / input_cic_response(f) ;
+        }
+        w = 0.42 - 0.5 * cos(6.283185307179586 * (n + 0.5) / INPUT_FIR_TAPS)
+                 + 0.08 * cos(12.566370614359172 * (n + 0.5) / INPUT_FIR_TAPS) ;
+        h[n] = acc * w ;
+        sum += h[n] ;
+    }
+    // unity gain at DC
+    for (n = 0; n < INPUT_FIR_TAPS; n++) {
+        input_fir[n] = (int16_t)lround(h[n] / sum * 16384.0) ;
+    }
+}
+
+// Filter one raw block into INPUT_BLOCK output samples
+static void input_process(const uint16_t * raw) {
+    static fix15 out[INPUT_BLOCK] ;
+    uint32_t i1 = input_int[0], i2 = input_int[1], i3 = input_int[2], i4 = input_int[3] ;
+    uint32_t c, d ;
+    int32_t acc ;
+    fix15 x, peak = 0, g, g1, step ;
+    int i, j, k, m = 0 ;
+    const uint16_t * p = raw ;
+
+    for (i = 0; i < INPUT_BLOCK * INPUT_FIR_DECIMATE; i++) {
+        // CIC integrators at the ADC rate
+        for (j = 0; j < INPUT_CIC_DECIMATE; j++) {
+            i1 += *p++ ;
+            i2 += i1 ;
+            i3 += i2 ;
+            i4 += i3 ;
+        }
+        // combs at the decimated rate
+        c = i4 ;
+        for (k = 0; k < 4; k++) {
+            d = c - input_comb[k] ;
+            input_comb[k] = c ;
+            c = d ;
+        }
+        // remove the mid-scale offset (2048 * R^4), scale to fix15
+        x = (fix15)((((int64_t)(int32_t)(c - 2048u * INPUT_CIC_DECIMATE * INPUT_CIC_DECIMATE
+                * INPUT_CIC_DECIMATE * INPUT_CIC_DECIMATE)) * input_cic_scale) >> 32) ;
+        input_fir_history[input_fir_pos] = x ;
+        input_fir_history[input_fir_pos + INPUT_FIR_TAPS] = x ;
+        if (++input_fir_pos >= INPUT_FIR_TAPS) input_fir_pos = 0 ;
+        // FIR, only for the samples that are kept
+        if (++input_fir_phase >= INPUT_FIR_DECIMATE) {
+            input_fir_phase = 0 ;
+            acc = 0 ;
+            for (k = 0; k < INPUT_FIR_TAPS; k++) {
+                acc += input_fir[k] * input_fir_history[input_fir_pos + k] ;
+            }
+            x = acc >> 14 ;
+            // DC blocker: subtract a slow average
+            input_dc += x - (input_dc >> INPUT_DC_SHIFT) ;
+            x -= input_dc >> INPUT_DC_SHIFT ;
+            out[m++] = x ;
+            if (x < 0) x = -x ;
+            if (x > peak) peak = x ;
+        }
+    }
+    input_int[0] = i1 ; input_int[1] = i2 ; input_int[2] = i3 ; input_int[3] = i4 ;
+
+    // Gain for this block, ramped from the last one
+    g = input_gain ;
+#if INPUT_AGC
+    if (peak > input_envelope) input_envelope += (peak - input_envelope) >> INPUT_AGC_ATTACK_SHIFT ;
+    else input_envelope -= (input_envelope - peak) >> INPUT_AGC_RELEASE_SHIFT ;
+    if (input_envelope > INPUT_AGC_KNEE) {
+        g1 = (fix15)(((int64_t)(INPUT_AGC_TARGET * 32768) << 15) / input_envelope) ;
+    }
+    else {
+        g1 = (fix15)(INPUT_AGC_MAX_GAIN * 32768) ;
+    }
+#else
+    g1 = g ;
+#endif
+    step = (g1 - g) / INPUT_BLOCK ;
+    k = input_count & INPUT_RING_MASK ;
+    for (i = 0; i < INPUT_BLOCK; i++) {
+        g += step ;
+        x = (fix15)(((int64_t)out[i] * g) >> 15) ;
+        if (x > 32767) x = 32767 ;
+        if (x < -32767) x = -32767 ;
+        input_samples[k + i] = (int16_t)x ;
+    }
+    input_gain = g1 ;
+    if (input_callback) input_callback(&input_samples[k], input_count, INPUT_BLOCK) ;
+    __dmb() ;
+    input_count += INPUT_BLOCK ;
+}
+
+// Raw blocks are done: filter every one before the block the DMA is
+// filling now (normally just one)
+static void input_irq() {
+    uint32_t start, filling, pending ;
+    if (dma_channel_get_irq0_status(input_data_chan)) {
+        dma_channel_acknowledge_irq0(input_data_chan) ;
+        start = time_us_32() ;
+        // the blocks are contiguous, so the end of the last one maps to 0
+        filling = ((dma_hw->ch[input_data_chan].write_addr - (uint32_t)input_raw)
+                   / (INPUT_RAW_BLOCK * sizeof(uint16_t))) & (INPUT_RAW_BUFFERS - 1) ;
+        pending = (filling - input_next_raw) & (INPUT_RAW_BUFFERS - 1) ;
+        if (pending > 1) input_late++ ;
+        while (input_next_raw != filling) {
+            input_process(input_raw[input_next_raw]) ;
+            input_next_raw = (input_next_raw + 1) & (INPUT_RAW_BUFFERS - 1) ;
+            input_blocks++ ;
+        }
+        input_process_us = time_us_32() - start ;
+    }
+}
+
+// Set up the ADC on a pin/channel at full rate, the filters and the DMA.
+// block_fn (or NULL) is called from the interrupt with each output block.
+void input_init(int adc_pin, int adc_chan, input_block_fn block_fn) {
+    int i ;
+    uint64_t r4 = (uint64_t)INPUT_CIC_DECIMATE * INPUT_CIC_DECIMATE * INPUT_CIC_DECIMATE * INPUT_CIC_DECIMATE ;
+
+    input_callback = block_fn ;
+    input_design_fir() ;
+    // 2048 * R^4 at the CIC output is full scale: 2^36 / R^4
+    input_cic_scale = (int64_t)(((1ull << 36) + r4 / 2) / r4) ;
+    input_gain = 32768 ;
+    input_envelope = (fix15)(INPUT_AGC_TARGET * 32768) ;
+
+    // ADC: hi-Z pin, free running, 12-bit samples into the FIFO with a DREQ
+    adc_gpio_init(adc_pin) ;
+    adc_init() ;
+    adc_select_input(adc_chan) ;
+    adc_fifo_setup(
+        true,    // Write each completed conversion to the sample FIFO
+        true,    // Enable DMA data request (DREQ)
+        1,       // DREQ (and IRQ) asserted when at least 1 sample present
+        false,   // No ERR bit in the FIFO (bit 15)
+        false    // Keep all 12 bits
+    ) ;
+    // Divisor of 0 -> back-to-back conversions, 96 ADC clocks each
+    adc_set_clkdiv(0) ;
+
+    for (i = 0; i < INPUT_RAW_BUFFERS; i++) {
+        input_raw_table[i] = input_raw[i] ;
+    }
+
+    input_data_chan = dma_claim_unused_channel(true) ;
+    input_ctrl_chan = dma_claim_unused_channel(true) ;
+
+    // Data channel: ADC FIFO into a raw block, one sample per DREQ
+    dma_channel_config c = dma_channel_get_default_config(input_data_chan) ;
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16) ;
+    channel_config_set_read_increment(&c, false) ;
+    channel_config_set_write_increment(&c, true) ;
+    channel_config_set_dreq(&c, DREQ_ADC) ;
+    // when a block is full the control channel starts the next one (the
+    // 4-deep ADC FIFO holds the samples that arrive in the meantime)
+    channel_config_set_chain_to(&c, input_ctrl_chan) ;
+    dma_channel_configure(
+        input_data_chan,
+        &c,
+        input_raw[0],               // write address (rewritten by the control channel)
+        &adc_hw->fifo,              // read address
+        INPUT_RAW_BLOCK,            // samples per block
+        false
+    ) ;
+
+    // Control channel: next block address into the data channel's write
+    // address (and trigger), walking the table
+    dma_channel_config c2 = dma_channel_get_default_config(input_ctrl_chan) ;
+    channel_config_set_transfer_data_size(&c2, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c2, true) ;
+    channel_config_set_write_increment(&c2, false) ;
+    channel_config_set_ring(&c2, false, INPUT_TABLE_BITS) ;
+    dma_channel_configure(
+        input_ctrl_chan,
+        &c2,
+        &dma_hw->ch[input_data_chan].al2_write_addr_trig,  // write address, and trigger
+        input_raw_table,                                    // table of block addresses
+        1,                                                  // one address per block
+        false
+    ) ;
+
+    // Interrupt at the end of every raw block
+    dma_channel_set_irq0_enabled(input_data_chan, true) ;
+    irq_add_shared_handler(DMA_IRQ_0, input_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY) ;
+    irq_set_enabled(DMA_IRQ_0, true) ;
+}
+
+// Start capturing (the control channel loads the first block and
+// triggers the data channel)
+void input_start() {
+    dma_start_channel_mask(1u << input_ctrl_chan) ;
+    adc_run(true) ;
+}
@@ -0,0 +1,532 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Closed-loop DC motor control: PID in the PWM wrap interrupt, with a
+ * PIO quadrature encoder
+ *
+ * One PWM slice drives an H-bridge (channel A forward, channel B
+ * reverse, sign-magnitude). The slice's wrap interrupt runs the control
+ * loop once per PWM period (20 kHz at the defaults), so the loop rate is
+ * the PWM rate and the duty cycle it computes goes out on the very next
+ * period. The interrupt does no I/O: it reads one word that DMA keeps
+ * up to date, runs the PID and writes the compare register.
+ *
+ * ENCODER
+ *   quadrature.pio counts edges in a PIO state machine and stamps each
+ *   one with a 24-bit time (clk_sys / 13 per tick, 104 ns at 125 MHz).
+ *   A DMA channel copies each stamped count from the FIFO to one word of
+ *   memory, so the interrupt always reads the latest edge.
+ *
+ *   Velocity is measured by edge timing (the M/T method): the count
+ *   difference between two edges, over the time between them. Those
+ *   are at least MOTOR_ENC_EDGES edges apart, and never less than one
+ *   loop period. At speed that's every edge of the period, exactly
+ *   timed. At crawling speed it's still a timed interval of a few
+ *   edges, not a count per period that flickers between 0 and 1. (Four
+ *   edges are one full cycle of A and B, so uneven spacing between the
+ *   two channels cancels out.) When no edge comes, the speed can be at
+ *   most one edge over the time since the last one, so the estimate
+ *   decays toward 0 instead of holding its last value.
+ *
+ *   The count field is 8 bits, so the loop must see fewer than 128 edges
+ *   per period (2.5 M edges/s at 20 kHz).
+ *
+ * PID (struct pid, fixed point)
+ *   u = kp*e + integral + derivative + kff*feedforward, clamped
+ *   - derivative on the measurement (no kick on setpoint steps), low-pass
+ *     filtered with a first-order filter at d_cutoff_hz
+ *   - anti-windup: the integrator stops when the output is saturated and
+ *     the error would push it further, and is clamped to the output range
+ *   - feed-forward: in velocity mode the setpoint (kff is duty per rev/s),
+ *     in position mode the velocity given with the setpoint
+ *   pid_init() takes continuous-time gains and folds the loop rate in.
+ *
+ * UNITS (fix15, 16.15 fixed point)
+ *   position: revolutions. velocity: revolutions/second. output: duty,
+ *   -1 to 1.
+ *
+ * TELEMETRY
+ *   Every MOTOR_TELEMETRY_DIVIDE periods the interrupt puts a sample
+ *   (struct motor_sample) in a ring. motor_telemetry_read() takes them
+ *   out from a thread, to be sent in frames by the DMA UART driver
+ *   (pt_uart_dma.h, see motor_demo.c).
+ *
+ * DETERMINISM
+ *   The handler runs from RAM at the highest interrupt priority. Call
+ *   motor_init() on a core with nothing else to do (core 1 in the demo).
+ *   motor_latency_max is the longest delay from the wrap to the start of
+ *   the handler (PWM counts), and motor_isr_max_us the longest run.
+ *
+ * RESOURCES USED
+ *  - 1 PWM slice (both channels), PWM_IRQ_WRAP (exclusive handler)
+ *  - 1 PIO state machine, and 29 instructions at offset 0
+ *  - 1 DMA channel (claimed)
+ */
+
+#include <math.h>
+
+#include "hardware/pwm.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+// The PIO program
+#include "quadrature.pio.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Encoder counts (edges, 4 per line) per revolution of the output shaft
+#ifndef MOTOR_COUNTS_PER_REV
+#define MOTOR_COUNTS_PER_REV    1200
+#endif
+// Fewest edges a velocity measurement spans
+#ifndef MOTOR_ENC_EDGES
+#define MOTOR_ENC_EDGES         4
+#endif
+// Encoder PIO clock divider (1: a 104 ns tick at 125 MHz)
+#ifndef MOTOR_ENC_CLKDIV
+#define MOTOR_ENC_CLKDIV        1.0f
+#endif
+// Samples in the telemetry ring (power of 2), and periods per sample
+#ifndef MOTOR_TELEMETRY_RING
+#define MOTOR_TELEMETRY_RING    256
+#endif
+#ifndef MOTOR_TELEMETRY_DIVIDE
+#define MOTOR_TELEMETRY_DIVIDE  10
+#endif
+
+// Control modes
+#define MOTOR_MODE_OFF          0   // both channels low, coasting
+#define MOTOR_MODE_DUTY         1   // open loop, setpoint is the duty
+#define MOTOR_MODE_VELOCITY     2
+#define MOTOR_MODE_POSITION     3
+
+// PIO cycles per encoder tick (the length of a pass in quadrature.pio)
+#define MOTOR_ENC_CYCLES        13
+
+// Fixed point
+typedef signed int fix15 ;
+#define multfix15(a,b) ((fix15)((((signed long long)(a))*((signed long long)(b)))>>15))
+#define float2fix15(a) ((fix15)((a)*32768.0))
+#define fix2float15(a) ((float)(a)/32768.0)
+
+
+//                                     PID
+//
+struct pid {
+    // gains (kd times the loop rate), derivative filter
+    fix15 kp, kd, kff ;
+    fix15 d_alpha ;
+    // integral gain per period, 1.31 fixed point (it's small: ki / rate)
+    int32_t ki ;
+    // output limits
+    fix15 out_min, out_max ;
+    // state: the integrator (in 1.31 fixed point, so that small errors
+    // still add up), the filtered derivative, the last measurement
+    int64_t integral ;
+    fix15 derivative ;
+    fix15 last_measurement ;
+} ;
+
+// Gains in output units per unit error (kp), per unit error-second (ki),
+// per unit/second (kd), per unit of feed-forward (kff). The derivative is
+// filtered at d_cutoff_hz. rate_hz is the loop rate (and must be more
+// than ki). The derivative gain is kept per period (kd * rate_hz) in fix15,
+// so it's limited to 65535: kd up to about 3.2 at 20 kHz. Larger is
+// clamped.
+void pid_init(struct pid * p, float kp, float ki, float kd, float kff,
+              float d_cutoff_hz, float rate_hz, float out_min, float out_max) {
+    float kd_period = kd * rate_hz ;
+    if (kd_period > 65535.0f) kd_period = 65535.0f ;
+    else if (kd_period < -65535.0f) kd_period = -65535.0f ;
+    p->kp = float2fix15(kp) ;
+    p->ki = (int32_t)(ki / rate_hz * 2147483648.0) ;
+    p->kd = float2fix15(kd_period) ;
+    p->kff = float2fix15(kff) ;
+    p->d_alpha = float2fix15(1.0f - expf(-6.2831853f * d_cutoff_hz / rate_hz)) ;
+    p->out_min = float2fix15(out_min) ;
+    p->out_max = float2fix15(out_max) ;
+    p->integral = 0 ;
+    p->derivative = 0 ;
+    p->last_measurement = 0 ;
+}
+
+// Clear the state, with the derivative starting from measurement
+static inline void pid_reset(struct pid * p, fix15 measurement) {
+    p->integral = 0 ;
+    p->derivative = 0 ;
+    p->last_measurement = measurement ;
+}
+
+// One step of the loop. Returns the output, within the limits.
+static inline fix15 pid_update(struct pid * p, fix15 setpoint, fix15 measurement, fix15 feedforward) {
+    fix15 error, u, base ;
+    int64_t step ;
+    error = setpoint - measurement ;
+
+    // Filtered derivative of the measurement
+    p->derivative += multfix15(p->d_alpha,
+                               multfix15(p->kd, p->last_measurement - measurement) - p->derivative) ;
+    p->last_measurement = measurement ;
+
+    // Everything but the integrator
+    base = multfix15(p->kp, error) + p->derivative + multfix15(p->kff, feedforward) ;
+
+    // Integrate, unless the output is already pinned in that direction
+    step = ((int64_t)p->ki * error) >> 15 ;
+    u = base + (fix15)(p->integral >> 16) ;
+    if (!((u >= p->out_max && step > 0) || (u <= p->out_min && step < 0))) {
+        p->integral += step ;
+        if (p->integral > ((int64_t)p->out_max << 16)) p->integral = (int64_t)p->out_max << 16 ;
+        else if (p->integral < ((int64_t)p->out_min << 16)) p->integral = (int64_t)p->out_min << 16 ;
+    }
+
+    u = base + (fix15)(p->integral >> 16) ;
+    if (u > p->out_max) u = p->out_max ;
+    else if (u < p->out_min) u = p->out_min ;
+    return u ;
+}
+
+
+//                                 MOTOR STATE
+//
+// One telemetry sample
+struct motor_sample {
+    uint32_t period ;           // loop periods since motor_init()
+    fix15 setpoint ;
+    fix15 position ;            // revolutions
+    fix15 velocity ;            // revolutions/second
+    fix15 output ;              // duty, -1 to 1
+} ;
+
+// Hardware
+static uint motor_slice ;
+static uint motor_wrap ;
+static int motor_dma_chan ;
+
+// Latest encoder word (written by DMA), and the last one the loop saw
+static volatile uint32_t motor_enc_word = 0 ;
+static uint32_t motor_enc_last = 0 ;
+// Encoder ticks per loop period, and the longest gap (in periods) the
+// 24-bit time stamps can span
+static uint32_t motor_enc_period_ticks ;
+static uint32_t motor_enc_max_age ;
+// Velocity in fix15 rev/s is motor_vel_k * edges / ticks
+static int64_t motor_vel_k ;
+// The edge the velocity is measured from: count, time, and periods since
+static int32_t motor_ref_count = 0 ;
+static uint32_t motor_ref_time = 0 ;
+static uint32_t motor_ref_age = 0 ;
+// Periods since the last edge
+static uint32_t motor_edge_age = 0 ;
+
+// Controllers, and the loop rate (Hz)
+struct pid motor_velocity_pid ;
+struct pid motor_position_pid ;
+float motor_rate = 0 ;
+
+// Mode, setpoint, and feed-forward (position mode). Set with the
+// functions below.
+volatile int motor_mode = MOTOR_MODE_OFF ;
+volatile fix15 motor_setpoint = 0 ;
+volatile fix15 motor_feedforward = 0 ;
+
+// Changes from the other core, picked up by the loop at the start of
+// the next period: new gains for one controller, a new mode and setpoint
+static struct pid motor_next_pid ;
+static struct pid * volatile motor_next_target = 0 ;
+static int motor_next_mode ;
+static fix15 motor_next_setpoint ;
+static fix15 motor_next_feedforward ;
+static volatile bool motor_next_pending = false ;
+
+// Measurements and output
+volatile int32_t motor_count = 0 ;          // encoder edges
+volatile fix15 motor_position = 0 ;         // revolutions
+volatile fix15 motor_velocity = 0 ;         // revolutions/second
+volatile fix15 motor_output = 0 ;           // duty
+volatile uint32_t motor_periods = 0 ;
+
+// Timing: handler run time (us) and latency after the wrap (PWM counts)
+volatile uint32_t motor_isr_us = 0 ;
+volatile uint32_t motor_isr_max_us = 0 ;
+volatile uint32_t motor_latency_max = 0 ;
+
+// Telemetry ring (written by the loop, read by motor_telemetry_read)
+static struct motor_sample motor_telemetry[MOTOR_TELEMETRY_RING] ;
+static volatile uint32_t motor_telemetry_head = 0 ;
+static volatile uint32_t motor_telemetry_tail = 0 ;
+volatile uint32_t motor_telemetry_dropped = 0 ;
+// Periods per sample (may be changed at run time)
+volatile uint32_t motor_telemetry_divide = MOTOR_TELEMETRY_DIVIDE ;
+
+
+//                                   ENCODER
+//
+// Bring the count, position and velocity up to date with the latest edge
+static inline void motor_encoder_update() {
+    uint32_t word, time, dt ;
+    int32_t edges ;
+    fix15 bound ;
+
+    // The DMA channel stops after 2^32 edges: start it again
+    if (!dma_channel_is_busy(motor_dma_chan)) {
+        dma_channel_set_trans_count(motor_dma_chan, 0xffffffff, true) ;
+    }
+
+    if (motor_ref_age < motor_enc_max_age) motor_ref_age++ ;
+    if (motor_edge_age < motor_enc_max_age) motor_edge_age++ ;
+    word = motor_enc_word ;
+    if (word != motor_enc_last) {
+        // New edge(s): extend the 8-bit count, and turn the time (which
+        // counts down) around
+        motor_count += (int8_t)((word >> 24) - (motor_enc_last >> 24)) ;
+        motor_enc_last = word ;
+        time = (0u - word) & 0xffffff ;
+        motor_edge_age = 0 ;
+
+        edges = motor_count - motor_ref_count ;
+        if (motor_ref_age >= motor_enc_max_age) {
+            // Too long since the reference edge to time it: start over
+            motor_velocity = 0 ;
+            motor_ref_count = motor_count ;
+            motor_ref_time = time ;
+            motor_ref_age = 0 ;
+        }
+        else if (edges >= MOTOR_ENC_EDGES || edges <= -MOTOR_ENC_EDGES) {
+            dt = (time - motor_ref_time) & 0xffffff ;
+            if (dt > 0) {
+                motor_velocity = (fix15)(motor_vel_k * edges / (int32_t)dt) ;
+            }
+            motor_ref_count = motor_count ;
+            motor_ref_time = time ;
+            motor_ref_age = 0 ;
+        }
+    }
+    else if (motor_edge_age >= motor_enc_max_age) {
+        // Stopped
+        motor_velocity = 0 ;
+    }
+    else {
+        // No edge: at most one edge in the time since the last one
+        bound = (fix15)(motor_vel_k / (motor_edge_age * motor_enc_period_ticks)) ;
+        if (motor_velocity > bound) motor_velocity = bound ;
+        else if (motor_velocity < -bound) motor_velocity = -bound ;
+    }
+
+    motor_position = (fix15)(((int64_t)motor_count << 15) / MOTOR_COUNTS_PER_REV) ;
+}
+
+
+//                               THE CONTROL LOOP
+//
+// Duty (-1 to 1) to the H-bridge: A high for forward, B for reverse
+static inline void motor_drive(fix15 duty) {
+    uint32_t level ;
+    if (duty >= 0) {
+        level = ((uint32_t)duty * (motor_wrap + 1)) >> 15 ;
+        pwm_set_both_levels(motor_slice, level, 0) ;
+    }
+    else {
+        level = ((uint32_t)(-duty) * (motor_wrap + 1)) >> 15 ;
+        pwm_set_both_levels(motor_slice, 0, level) ;
+    }
+}
+
+// PWM wrap: one pass of the loop
+void __not_in_flash_func(motor_isr)() {
+    uint32_t start, latency, head ;
+    fix15 output ;
+    struct pid * target ;
+    struct motor_sample * s ;
+
+    latency = pwm_get_counter(motor_slice) ;
+    start = time_us_32() ;
+    pwm_clear_irq(motor_slice) ;
+
+    // New gains
+    target = motor_next_target ;
+    if (target) {
+        target->kp = motor_next_pid.kp ;
+        target->ki = motor_next_pid.ki ;
+        target->kd = motor_next_pid.kd ;
+        target->kff = motor_next_pid.kff ;
+        target->d_alpha = motor_next_pid.d_alpha ;
+        target->out_min = motor_next_pid.out_min ;
+        target->out_max = motor_next_pid.out_max ;
+        motor_next_target = 0 ;
+    }
+
+    // New mode or setpoint. A controller coming in starts from a clean
+    // state, with the derivative following the measurement.
+    if (motor_next_pending) {
+        if (motor_next_mode != motor_mode) {
+            if (motor_next_mode == MOTOR_MODE_VELOCITY) pid_reset(&motor_velocity_pid, motor_velocity) ;
+            if (motor_next_mode == MOTOR_MODE_POSITION) pid_reset(&motor_position_pid, motor_position) ;
+        }
+        motor_mode = motor_next_mode ;
+        motor_setpoint = motor_next_setpoint ;
+        motor_feedforward = motor_next_feedforward ;
+        motor_next_pending = false ;
+    }
+
+    motor_encoder_update() ;
+
+    switch (motor_mode) {
+        case MOTOR_MODE_DUTY:
+            output = motor_setpoint ;
+            break ;
+        case MOTOR_MODE_VELOCITY:
+            output = pid_update(&motor_velocity_pid, motor_setpoint, motor_velocity, motor_setpoint) ;
+            break ;
+        case MOTOR_MODE_POSITION:
+            output = pid_update(&motor_position_pid, motor_setpoint, motor_position, motor_feedforward) ;
+            break ;
+        default:
+            output = 0 ;
+    }
+    if (output > 32768) output = 32768 ;
+    else if (output < -32768) output = -32768 ;
+    motor_drive(output) ;
+    motor_output = output ;
+
+    // Telemetry
+    motor_periods++ ;
+    if (motor_periods % motor_telemetry_divide == 0) {
+        head = motor_telemetry_head ;
+        if (head - motor_telemetry_tail < MOTOR_TELEMETRY_RING) {
+            s = &motor_telemetry[head & (MOTOR_TELEMETRY_RING - 1)] ;
+            s->period = motor_periods ;
+            s->setpoint = motor_setpoint ;
+            s->position = motor_position ;
+            s->velocity = motor_velocity ;
+            s->output = output ;
+            motor_telemetry_head = head + 1 ;
+        }
+        else {
+            motor_telemetry_dropped++ ;
+        }
+    }
+
+    if (latency > motor_latency_max) motor_latency_max = latency ;
+    motor_isr_us = time_us_32() - start ;
+    if (motor_isr_us > motor_isr_max_us) motor_isr_max_us = motor_isr_us ;
+}
+
+
+//                                  INTERFACE
+//
+// Set up the PWM slice on pin_pwm (channel A, and B on the next pin) at
+// pwm_hz, and the encoder on pin_enc (A, and B on the next pin) on pio,
+// then start the loop. Runs on the calling core. Returns the loop rate.
+float motor_init(uint pin_pwm, float pwm_hz, PIO pio, uint pin_enc) {
+    uint sm ;
+    float rate, tick_hz ;
+    uint32_t sys_hz = clock_get_hz(clk_sys) ;
+
+    // PWM: divide by 1, so the duty has as many steps as the rate allows
+    gpio_set_function(pin_pwm, GPIO_FUNC_PWM) ;
+    gpio_set_function(pin_pwm + 1, GPIO_FUNC_PWM) ;
+    motor_slice = pwm_gpio_to_slice_num(pin_pwm) ;
+    motor_wrap = (uint)(sys_hz / pwm_hz + 0.5f) - 1 ;
+    if (motor_wrap > 0xfffe) motor_wrap = 0xfffe ;
+    pwm_set_wrap(motor_slice, motor_wrap) ;
+    pwm_set_clkdiv(motor_slice, 1.0f) ;
+    pwm_set_both_levels(motor_slice, 0, 0) ;
+    rate = (float)sys_hz / (motor_wrap + 1) ;
+    motor_rate = rate ;
+
+    // Encoder, from the state the pins are in
+    tick_hz = (float)sys_hz / (MOTOR_ENC_CYCLES * MOTOR_ENC_CLKDIV) ;
+    motor_enc_period_ticks = (uint32_t)(tick_hz / rate + 0.5f) ;
+    motor_enc_max_age = (1u << 24) / motor_enc_period_ticks - 1 ;
+    motor_vel_k = (int64_t)(tick_hz * 32768.0f / MOTOR_COUNTS_PER_REV) ;
+    sm = pio_claim_unused_sm(pio, true) ;
+    pio_add_program_at_offset(pio, &quadrature_program, 0) ;
+    quadrature_program_init(pio, sm, 0, pin_enc, MOTOR_ENC_CLKDIV) ;
+
+    // Stamped counts from the FIFO to motor_enc_word, one per edge
+    motor_dma_chan = dma_claim_unused_channel(true) ;
+    dma_channel_config c = dma_channel_get_default_config(motor_dma_chan) ;
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c, false) ;
+    channel_config_set_write_increment(&c, false) ;
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false)) ;
+    dma_channel_configure(
+        motor_dma_chan,
+        &c,
+        &motor_enc_word,                // write address
+        &pio->rxf[sm],                  // read address (PIO RX FIFO)
+        0xffffffff,                     // as many as it can (restarted in the loop)
+        true                            // start now
+    ) ;
+    pio_sm_set_enabled(pio, sm, true) ;
+
+    // Default gains: a gentle PI on velocity, PD on position
+    pid_init(&motor_velocity_pid, 0.05f, 1.0f, 0.0f, 0.0f, 500.0f, rate, -1.0f, 1.0f) ;
+    pid_init(&motor_position_pid, 2.0f, 0.0f, 0.05f, 0.0f, 200.0f, rate, -1.0f, 1.0f) ;
+
+    // The loop, in the wrap interrupt, ahead of everything else
+    pwm_clear_irq(motor_slice) ;
+    pwm_set_irq_enabled(motor_slice, true) ;
+    irq_set_exclusive_handler(PWM_IRQ_WRAP, motor_isr) ;
+    irq_set_priority(PWM_IRQ_WRAP, PICO_HIGHEST_IRQ_PRIORITY) ;
+    irq_set_enabled(PWM_IRQ_WRAP, true) ;
+    pwm_set_enabled(motor_slice, true) ;
+
+    return rate ;
+}
+
+// New gains for one of the controllers (see pid_init), picked up at the
+// start of the next period. Keeps the controller's state. From any core.
+void motor_set_gains(struct pid * p, float kp, float ki, float kd, float kff, float d_cutoff_hz) {
+    while (motor_next_target) tight_loop_contents() ;
+    pid_init(&motor_next_pid, kp, ki, kd, kff, d_cutoff_hz, motor_rate,
+             fix2float15(p->out_min), fix2float15(p->out_max)) ;
+    __dmb() ;
+    motor_next_target = p ;
+}
+
+// Change mode and setpoint, at the start of the next period. From any core.
+static void motor_set_mode(int mode, fix15 setpoint, fix15 feedforward) {
+    while (motor_next_pending) tight_loop_contents() ;
+    motor_next_mode = mode ;
+    motor_next_setpoint = setpoint ;
+    motor_next_feedforward = feedforward ;
+    __dmb() ;
+    motor_next_pending = true ;
+}
+
+// Coast
+static inline void motor_off() {
+    motor_set_mode(MOTOR_MODE_OFF, 0, 0) ;
+}
+
+// Open loop duty, -1 to 1
+static inline void motor_set_duty(float duty) {
+    motor_set_mode(MOTOR_MODE_DUTY, float2fix15(duty), 0) ;
+}
+
+// Velocity (rev/s)
+static inline void motor_set_velocity(float velocity) {
+    motor_set_mode(MOTOR_MODE_VELOCITY, float2fix15(velocity), 0) ;
+}
+
+// Position (rev), and the velocity the setpoint is moving at (rev/s,
+// feed-forward through kff)
+static inline void motor_set_position(float position, float velocity) {
+    motor_set_mode(MOTOR_MODE_POSITION, float2fix15(position), float2fix15(velocity)) ;
+}
+
+// Take up to max telemetry samples out of the ring. Returns how many.
+int motor_telemetry_read(struct motor_sample * out, int max) {
+    int n = 0 ;
+    uint32_t tail = motor_telemetry_tail ;
+    while (n < max && tail != motor_telemetry_head) {
+        out[n++] = motor_telemetry[tail & (MOTOR_TELEMETRY_RING - 1)] ;
+        tail++ ;
+    }
+    motor_telemetry_tail = tail ;
+    return n ;
+}
@@ -0,0 +1,239 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Closed-loop DC motor control demo
+ *
+ * A DC motor with a quadrature encoder, driven through an H-bridge
+ * (DRV8833, L298N, ...). Core 1 does nothing but the control loop
+ * (motor_control.h): a PID in the PWM wrap interrupt at 20 kHz, with
+ * position and velocity from a PIO encoder counter. Core 0 runs the
+ * protothreads that talk to the host over the DMA UART driver
+ * (pt_uart_dma.h), so nothing on core 0 can delay the loop.
+ *
+ * The serial link carries COBS frames both ways (motor_tune.py is the
+ * host end). The first byte of each frame from the board says what it
+ * is:
+ *   'T' telemetry: struct motor_sample, back to back (20 bytes each)
+ *   'M' a line of text (status once a second, replies)
+ * Frames to the board are text commands:
+ *   o                      off (coast)
+ *   d <duty>               open loop, -1 to 1
+ *   v <rev/s>              velocity
+ *   p <rev>                position
+ *   s <rev/s> <ms>         velocity steps between +/- rev/s, for tuning
+ *                          (0 stops)
+ *   gv <kp> <ki> <kd> <kff> <cutoff Hz>   velocity gains
+ *   gp <kp> <ki> <kd> <kff> <cutoff Hz>   position gains
+ *   t <periods>            loop periods per telemetry sample
+ *
+ * HARDWARE CONNECTIONS
+ *   - GPIO 0 ---> UART TX (921600 baud)
+ *   - GPIO 1 ---> UART RX
+ *   - GPIO 2 ---> encoder A
+ *   - GPIO 3 ---> encoder B
+ *   - GPIO 4 ---> H-bridge IN1 (PWM slice 2 A)
+ *   - GPIO 5 ---> H-bridge IN2 (PWM slice 2 B)
+ *
+ * RESOURCES CONSUMED
+ *   - PWM slice 2, PWM_IRQ_WRAP (core 1)
+ *   - PIO 0, 1 state machine and 29 instructions
+ *   - 3 DMA channels (1 encoder, 2 UART), DMA_IRQ_1 (core 0)
+ *   - UART 0
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+
+#include "hardware/pwm.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+
+// Encoder: 12 lines on the motor shaft, 25:1 gearbox, 4 edges per line
+#define MOTOR_COUNTS_PER_REV    (12 * 25 * 4)
+#include "motor_control.h"
+
+// Protothreads, and the DMA serial driver
+#include "pt_cornell_rp2040_v1_4.h"
+#include "pt_uart_dma.h"
+
+// Pins
+#define UART_TX_PIN     0
+#define UART_RX_PIN     1
+#define ENCODER_PIN     2
+#define MOTOR_PWM_PIN   4
+#define BAUD_RATE       921600
+
+// PWM (and loop) rate
+#define MOTOR_PWM_HZ    20000.0f
+
+// Telemetry samples per frame
+#define TELEMETRY_BATCH 12
+
+// Step test: amplitude (rev/s, 0 for off) and half period (ms)
+volatile float step_amplitude = 0 ;
+volatile int step_ms = 1000 ;
+
+// Loop rate, from core 1
+float loop_rate ;
+
+// Telemetry frame out: the tag byte, then the samples. The samples have
+// to be word aligned (the M0+ faults on an unaligned word access), so the
+// tag goes in the last byte of a header word, and the frame is sent from
+// there.
+struct {
+    uint8_t pad[3] ;
+    uint8_t tag ;
+    struct motor_sample samples[TELEMETRY_BATCH] ;
+} telemetry_frame ;
+
+
+// ==================================================
+// === telemetry thread -- core 0
+// ==================================================
+// Moves samples from the loop's ring into frames. The DMA sends them.
+static PT_THREAD (protothread_telemetry(struct pt *pt))
+{
+    PT_BEGIN(pt) ;
+    static int n ;
+    telemetry_frame.tag = 'T' ;
+    while(1) {
+        n = motor_telemetry_read(telemetry_frame.samples, TELEMETRY_BATCH) ;
+        if (n > 0) {
+            PT_UART_WRITE(pt, &telemetry_frame.tag, 1 + n * sizeof(struct motor_sample)) ;
+        }
+        if (n < TELEMETRY_BATCH) {
+            PT_YIELD_usec(2000) ;
+        }
+    }
+    PT_END(pt) ;
+}
+
+// ==================================================
+// === command thread -- core 0
+// ==================================================
+static PT_THREAD (protothread_command(struct pt *pt))
+{
+    PT_BEGIN(pt) ;
+    // Each writer has its own buffer: PT_UART_WRITE yields until the ring
+    // has room, and another thread could fill a shared one meanwhile
+    static char message[128] ;
+    static char cmd[4] ;
+    static float a, b, c, d, e ;
+    static int n ;
+    while(1) {
+        PT_UART_READ_FRAME(pt) ;
+        pt_uart_frame[pt_uart_frame_len] = 0 ;
+        n = sscanf((char *)pt_uart_frame, "%3s %f %f %f %f %f", cmd, &a, &b, &c, &d, &e) ;
+        if (n < 1) continue ;
+
+        message[0] = 'M' ;
+        sprintf(&message[1], "ok") ;
+        if (strcmp(cmd, "o") == 0) {
+            step_amplitude = 0 ;
+            motor_off() ;
+        }
+        else if (strcmp(cmd, "d") == 0 && n == 2) {
+            step_amplitude = 0 ;
+            motor_set_duty(a) ;
+        }
+        else if (strcmp(cmd, "v") == 0 && n == 2) {
+            step_amplitude = 0 ;
+            motor_set_velocity(a) ;
+        }
+        else if (strcmp(cmd, "p") == 0 && n == 2) {
+            step_amplitude = 0 ;
+            motor_set_position(a, 0) ;
+        }
+        else if (strcmp(cmd, "s") == 0 && n == 3) {
+            step_ms = (int)b ;
+            step_amplitude = a ;
+        }
+        else if (strcmp(cmd, "gv") == 0 && n == 6) {
+            motor_set_gains(&motor_velocity_pid, a, b, c, d, e) ;
+        }
+        else if (strcmp(cmd, "gp") == 0 && n == 6) {
+            motor_set_gains(&motor_position_pid, a, b, c, d, e) ;
+        }
+        else if (strcmp(cmd, "t") == 0 && n == 2 && a >= 1) {
+            motor_telemetry_divide = (uint32_t)a ;
+        }
+        else {
+            snprintf(&message[1], sizeof message - 1, "? %s", (char *)pt_uart_frame) ;
+        }
+        PT_UART_WRITE(pt, message, strlen(message)) ;
+    }
+    PT_END(pt) ;
+}
+
+// ==================================================
+// === step test thread -- core 0
+// ==================================================
+static PT_THREAD (protothread_step(struct pt *pt))
+{
+    PT_BEGIN(pt) ;
+    static int sign = 1 ;
+    while(1) {
+        PT_YIELD_UNTIL(pt, step_amplitude != 0) ;
+        motor_set_velocity(sign * step_amplitude) ;
+        sign = -sign ;
+        PT_YIELD_usec(step_ms * 1000) ;
+    }
+    PT_END(pt) ;
+}
+
+// ==================================================
+// === status thread -- core 0
+// ==================================================
+static PT_THREAD (protothread_status(struct pt *pt))
+{
+    PT_BEGIN(pt) ;
+    static char message[128] ;
+    while(1) {
+        PT_YIELD_usec(1000000) ;
+        message[0] = 'M' ;
+        snprintf(&message[1], sizeof message - 1, "loop %.0f Hz  isr %u us (max %u)  latency max %u cycles  dropped %u",
+                loop_rate, (unsigned)motor_isr_us, (unsigned)motor_isr_max_us,
+                (unsigned)motor_latency_max, (unsigned)motor_telemetry_dropped) ;
+        PT_UART_WRITE(pt, message, strlen(message)) ;
+    }
+    PT_END(pt) ;
+}
+
+// ========================================
+// === core 1: the control loop, and nothing else
+// ========================================
+void core1_entry() {
+    float rate = motor_init(MOTOR_PWM_PIN, MOTOR_PWM_HZ, pio0, ENCODER_PIN) ;
+    multicore_fifo_push_blocking((uint32_t)rate) ;
+    while (1) {
+        __wfi() ;
+    }
+}
+
+int main() {
+
+    ////////////////////////////////////////////////////////////////////////
+    ///////////////////////////// ROCK AND ROLL ////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+    // The loop, on core 1. Wait for it to be running.
+    multicore_reset_core1() ;
+    multicore_launch_core1(core1_entry) ;
+    loop_rate = (float)multicore_fifo_pop_blocking() ;
+
+    // Serial link: uart0, COBS frames, on core 0
+    pt_uart_dma_init(BAUD_RATE, UART_TX_PIN, UART_RX_PIN, PT_UART_MODE_COBS, false) ;
+
+    // Threads on core 0 (all the UART writers are here)
+    pt_add_thread(protothread_telemetry) ;
+    pt_add_thread(protothread_command) ;
+    pt_add_thread(protothread_step) ;
+    pt_add_thread(protothread_status) ;
+    pt_sched_method = SCHED_ROUND_ROBIN ;
+    pt_schedule_start ;
+
+}
@@ -0,0 +1,85 @@
+# V. Hunter Adams (vha3@cornell.edu)
+#
+# Host end of the motor control demo. Type commands (see motor_demo.c),
+# they go to the board as COBS frames. Status lines are printed, and
+# telemetry is written to a CSV file:
+#
+#   time (s), setpoint, position (rev), velocity (rev/s), duty
+#
+# The setpoint is in rev/s in velocity mode, rev in position mode and
+# duty in open loop.
+#
+# usage: python3 motor_tune.py /dev/ttyUSB0 [telemetry.csv]
+
+import struct
+import sys
+import threading
+
+import serial
+
+LOOP_HZ = 20000.0
+SAMPLE = struct.Struct('<Iiiii')
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for b in data:
+        if b == 0:
+            out.append(len(block) + 1)
+            out += block
+            block = bytearray()
+        else:
+            block.append(b)
+            if len(block) == 254:
+                out.append(255)
+                out += block
+                block = bytearray()
+    out.append(len(block) + 1)
+    out += block
+    out.append(0)
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 255 and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def reader(ser, csv):
+    frame = bytearray()
+    while True:
+        for b in ser.read(ser.in_waiting or 1):
+            if b != 0:
+                frame.append(b)
+                continue
+            data = cobs_decode(bytes(frame))
+            frame = bytearray()
+            if not data:
+                continue
+            if data[0:1] == b'M':
+                print(data[1:].decode(errors='replace'))
+            elif data[0:1] == b'T':
+                for i in range(1, len(data) - SAMPLE.size + 1, SAMPLE.size):
+                    period, sp, pos, vel, out = SAMPLE.unpack_from(data, i)
+                    csv.write('%.5f,%.4f,%.5f,%.4f,%.4f\n' % (period / LOOP_HZ,
+                              sp / 32768.0, pos / 32768.0, vel / 32768.0, out / 32768.0))
+
+
+ser = serial.Serial(port=sys.argv[1], baudrate=921600, timeout=0.1)
+csv = open(sys.argv[2] if len(sys.argv) > 2 else 'telemetry.csv', 'w', buffering=1)
+csv.write('time,setpoint,position,velocity,duty\n')
+threading.Thread(target=reader, args=(ser, csv), daemon=True).start()
+
+for line in sys.stdin:
+    if line.strip():
+        ser.write(cobs_encode(line.strip().encode()))
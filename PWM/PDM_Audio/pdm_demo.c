@@ -0,0 +1,121 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Sigma-delta (PDM) audio demo
+ *
+ * A 1 kHz tone that fades from -6 dB to -66 dB and back every 8
+ * seconds, played as a 1-bit PDM stream (pdm_out.h) on one pin. The
+ * tone stays clean all the way down, where 8-bit PWM would have run out
+ * of levels at -48 dB. Change OSR to hear (or scope, after the filter)
+ * the noise floor move.
+ *
+ * Samples come from a DDS with a 1024-entry sine table, linearly
+ * interpolated, in the DMA interrupt. Once a second core 0 prints the
+ * sample rate and the share of the core the modulator takes.
+ *
+ * HARDWARE CONNECTIONS
+ *   - GPIO 10 ---> 1 kohm ---+---> amplifier or headphone amp
+ *                            |
+ *                          10 nF
+ *                            |
+ *                           GND
+ *
+ * RESOURCES CONSUMED
+ *   - 1 PIO state machine (PIO 0)
+ *   - 2 DMA channels, DMA_IRQ_0
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "pico/stdlib.h"
+
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+
+#include "pdm_out.h"
+
+// Output pin
+#define PDM_PIN         10
+
+// Sample rate and oversampling ratio (32, 64, 128 or 256). At 125 MHz,
+// 32 kHz * 128 is a 4.1 Mbit/s stream.
+#define SAMPLE_RATE     32000
+#define OSR             128
+
+// Tone, and the fade: 8 s from -6 dB down to -66 dB and back
+#define TONE_HZ         1000.0f
+#define FADE_SECONDS    8
+#define FADE_DB         60.0f
+
+// Sine table (16 bits, one extra entry for the interpolation)
+#define SINE_BITS       10
+#define SINE_SIZE       (1 << SINE_BITS)
+int16_t sine_table[SINE_SIZE + 1] ;
+
+// DDS phase and increment, and the tone's amplitude (fix15)
+volatile uint32_t phase = 0 ;
+volatile uint32_t phase_incr ;
+volatile int32_t amplitude = 0 ;
+
+// Fill a block with the tone (DMA interrupt)
+void fill_tone(int16_t * samples, int n) {
+    int i ;
+    uint32_t index, frac ;
+    int32_t a, b, s ;
+    for (i = 0; i < n; i++) {
+        index = phase >> (32 - SINE_BITS) ;
+        frac = (phase >> (16 - SINE_BITS)) & 0xffff ;
+        a = sine_table[index] ;
+        b = sine_table[index + 1] ;
+        s = a + (((b - a) * (int32_t)frac) >> 16) ;
+        samples[i] = (int16_t)((s * amplitude) >> 15) ;
+        phase += phase_incr ;
+    }
+}
+
+int main() {
+
+    int i, t ;
+    float db ;
+
+    // Initialize stdio
+    stdio_init_all();
+
+    ////////////////////////////////////////////////////////////////////////
+    ///////////////////////////// SINE TABLE ///////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+    for (i = 0; i <= SINE_SIZE; i++) {
+        sine_table[i] = (int16_t)(32767.0f * sinf(6.2831853f * i / SINE_SIZE)) ;
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    ///////////////////////////// ROCK AND ROLL ////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+    // Starts silent (amplitude 0). The sample rate is rounded to a
+    // whole-number PIO divider, so set the tone from the rate produced.
+    pdm_start(pio0, PDM_PIN, SAMPLE_RATE, OSR, fill_tone) ;
+    phase_incr = (uint32_t)(TONE_HZ / pdm_fs * 4294967296.0f) ;
+
+    printf("PDM: %.0f Hz sample rate, osr %d, %.2f Mbit/s\n",
+           pdm_fs, pdm_osr, pdm_fs * pdm_osr / 1e6f) ;
+
+    // Fade the tone in 100 ms steps, and report once a second
+    t = 0 ;
+    while (1) {
+        i = t % (FADE_SECONDS * 10) ;
+        if (i >= FADE_SECONDS * 5) i = FADE_SECONDS * 10 - i ;
+        db = -6.0f - FADE_DB * i / (FADE_SECONDS * 5) ;
+        amplitude = (int32_t)(32768.0f * powf(10.0f, db / 20.0f)) ;
+        if (t % 10 == 0) {
+            printf("tone %5.1f dB  render: %3u us/block (max %3u)  load: %2d%%  blocks: %u\n",
+                   db, (unsigned)pdm_render_us, (unsigned)pdm_render_max_us,
+                   pdm_load(), (unsigned)pdm_blocks) ;
+        }
+        t++ ;
+        sleep_ms(100) ;
+    }
+
+}
@@ -0,0 +1,263 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Sigma-delta (PDM) audio output on one pin, through the PIO
+ *
+ * PWM audio trades resolution against carrier frequency: at 125 MHz a
+ * 488 kHz carrier only has 256 levels (8 bits). This instead turns
+ * 16-bit samples into a 1-bit stream at osr times the sample rate with
+ * a second-order sigma-delta modulator, which pushes the quantization
+ * noise up out of the audio band. An RC low-pass filter on the pin
+ * removes it again.
+ *
+ * The PIO can shift bits out but can't do the modulator's arithmetic,
+ * so the work is split. The same block scheme as i2s_out.h moves the
+ * bits:
+ *
+ *   data channel plays block k into the PIO TX FIFO --> chains to control channel
+ *   control channel loads block k+1 into the data channel and triggers it
+ *   DMA interrupt: block k is free, fill(PDM_BLOCK samples), then modulate
+ *                  them into block k, 32 bits per word
+ *
+ * The PIO program (pdm.pio) puts out one bit per PIO clock, so the bit
+ * rate is fs * osr. The clock divider is kept to a whole number so that
+ * every edge lands on the same phase of the system clock (a fractional
+ * divider adds jitter, which is noise in the output). The sample rate
+ * actually produced is in pdm_fs.
+ *
+ * Modulator: Boser-Wooley second-order loop (two integrators with gains
+ * of 1/2, one-bit quantizer), NTF = (1 - z^-1)^2. Samples are linearly
+ * interpolated over the osr bits of each sample period, which keeps
+ * images of the sample rate down. The integrators are clamped once per
+ * word, so an overload recovers instead of latching up. Keep peaks
+ * below about 90% of full scale: above that, the noise floor rises.
+ *
+ * Measured in simulation (noise from 0 to 16 kHz at fs = 32 kHz with a
+ * -20 dB sine, relative to full scale): about -59 dB at osr 32, -73 dB
+ * at osr 64, -83 dB at osr 128, -89 dB at osr 256. In practice the pin's
+ * rise and fall times and supply noise on IOVDD limit it before that.
+ *
+ * The modulator costs a few instructions per output bit, so the CPU
+ * time is set by the bit rate (fs * osr), not by the sample rate. It
+ * runs from RAM in the DMA interrupt, on the core that called
+ * pdm_start(). pdm_load() reports the share of that core it takes.
+ *
+ * HARDWARE CONNECTIONS
+ *  - pin ---> 1 kohm ---+---> amplifier input
+ *                       |
+ *                     10 nF (16 kHz)
+ *                       |
+ *                      GND
+ *
+ * RESOURCES USED
+ *  - 1 PIO state machine (claimed) and 1 instruction
+ *  - 2 DMA channels (claimed)
+ *  - DMA_IRQ_0 (shared handler)
+ */
+
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+// The PIO program
+#include "pdm.pio.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Samples per block
+#ifndef PDM_BLOCK
+#define PDM_BLOCK               32
+#endif
+// Blocks in the DMA ring (power of 2, max 8). 2 is a double buffer.
+#ifndef PDM_BUFFERS
+#define PDM_BUFFERS             2
+#endif
+// Largest oversampling ratio pdm_start() accepts (sets the block size)
+#ifndef PDM_MAX_OSR
+#define PDM_MAX_OSR             256
+#endif
+
+// Words per block at the largest ratio
+#define PDM_BLOCK_WORDS         (PDM_BLOCK * PDM_MAX_OSR / 32)
+// log2 of the address table size in bytes (4 bytes per block)
+#define PDM_TABLE_BITS          (PDM_BUFFERS == 8 ? 5 : (PDM_BUFFERS == 4 ? 4 : 3))
+// Quantizer output (+/- full scale of a 16-bit sample), and the integrator limit
+#define PDM_FULL_SCALE          32768
+#define PDM_CLAMP               (2 * PDM_FULL_SCALE)
+
+// Fills n 16-bit samples
+typedef void (*pdm_fill_fn)(int16_t * samples, int n) ;
+
+// The blocks, and the table of their addresses the control channel walks
+// (a ring on its read address, so aligned to its size)
+uint32_t pdm_block[PDM_BUFFERS][PDM_BLOCK_WORDS] ;
+uint32_t * pdm_table[PDM_BUFFERS]
+    __attribute__((aligned(1 << PDM_TABLE_BITS))) ;
+
+// Samples for the block being modulated
+static int16_t pdm_samples[PDM_BLOCK] ;
+
+static int pdm_data_chan ;
+static int pdm_ctrl_chan ;
+static pdm_fill_fn pdm_fill ;
+
+// Oversampling ratio (log2), and 32-bit words per sample
+static int pdm_osr_bits ;
+static int pdm_words ;
+
+// Modulator state: the two integrators, and the last sample (where the
+// interpolation starts)
+static int32_t pdm_i1 = 0 ;
+static int32_t pdm_i2 = 0 ;
+static int32_t pdm_last = 0 ;
+
+// Sample rate the PIO divider produces (Hz), and the oversampling ratio
+float pdm_fs = 0 ;
+int pdm_osr = 0 ;
+// Blocks played so far
+volatile uint32_t pdm_blocks = 0 ;
+// Time spent filling and modulating the last block, and the worst so far (us)
+volatile uint32_t pdm_render_us = 0 ;
+volatile uint32_t pdm_render_max_us = 0 ;
+
+// Modulate n samples into n * osr bits, MSB first
+void __not_in_flash_func(pdm_modulate)(const int16_t * in, uint32_t * out, int n) {
+    int i, j, k ;
+    int32_t x, step, y ;
+    int32_t i1 = pdm_i1 ;
+    int32_t i2 = pdm_i2 ;
+    uint32_t word ;
+    for (i = 0; i < n; i++) {
+        // Ramp from the last sample to this one, in steps of 1/osr
+        x = pdm_last << pdm_osr_bits ;
+        step = in[i] - pdm_last ;
+        pdm_last = in[i] ;
+        for (j = 0; j < pdm_words; j++) {
+            word = 0 ;
+            for (k = 0; k < 32; k++) {
+                x += step ;
+                if (i2 >= 0) {
+                    word = (word << 1) | 1 ;
+                    y = PDM_FULL_SCALE ;
+                }
+                else {
+                    word <<= 1 ;
+                    y = -PDM_FULL_SCALE ;
+                }
+                i1 += ((x >> pdm_osr_bits) - y) >> 1 ;
+                i2 += (i1 - y) >> 1 ;
+            }
+            *out++ = word ;
+            // Limit the integrators (only reached on overload)
+            if (i1 > PDM_CLAMP) i1 = PDM_CLAMP ;
+            else if (i1 < -PDM_CLAMP) i1 = -PDM_CLAMP ;
+            if (i2 > PDM_CLAMP) i2 = PDM_CLAMP ;
+            else if (i2 < -PDM_CLAMP) i2 = -PDM_CLAMP ;
+        }
+    }
+    pdm_i1 = i1 ;
+    pdm_i2 = i2 ;
+}
+
+// Fill and modulate one block
+static void pdm_render(uint32_t * block) {
+    pdm_fill(pdm_samples, PDM_BLOCK) ;
+    pdm_modulate(pdm_samples, block, PDM_BLOCK) ;
+}
+
+// A block finished playing: refill it
+static void pdm_irq() {
+    uint32_t start ;
+    if (dma_channel_get_irq0_status(pdm_data_chan)) {
+        dma_channel_acknowledge_irq0(pdm_data_chan) ;
+        start = time_us_32() ;
+        pdm_render(pdm_block[pdm_blocks & (PDM_BUFFERS - 1)]) ;
+        pdm_blocks++ ;
+        pdm_render_us = time_us_32() - start ;
+        if (pdm_render_us > pdm_render_max_us) {
+            pdm_render_max_us = pdm_render_us ;
+        }
+    }
+}
+
+// Fill every block, then start streaming from a state machine on pio, at
+// close to fs (Hz) with osr bits per sample (a power of 2, 32 to
+// PDM_MAX_OSR). fill() is called from the DMA interrupt, on the calling
+// core. Returns the sample rate (also in pdm_fs).
+float pdm_start(PIO pio, uint pin, uint32_t fs, int osr, pdm_fill_fn fill) {
+    int i ;
+    uint sm, offset ;
+    uint32_t div ;
+
+    if (osr < 32) osr = 32 ;
+    if (osr > PDM_MAX_OSR) osr = PDM_MAX_OSR ;
+    pdm_osr_bits = 31 - __builtin_clz(osr) ;
+    pdm_osr = 1 << pdm_osr_bits ;
+    pdm_words = pdm_osr / 32 ;
+
+    // Whole-number divider, rounded to the nearest
+    div = (clock_get_hz(clk_sys) + fs * pdm_osr / 2) / (fs * pdm_osr) ;
+    if (div < 1) div = 1 ;
+    pdm_fs = (float)clock_get_hz(clk_sys) / (float)(div * pdm_osr) ;
+
+    pdm_fill = fill ;
+    for (i = 0; i < PDM_BUFFERS; i++) {
+        pdm_table[i] = pdm_block[i] ;
+        pdm_render(pdm_block[i]) ;
+    }
+
+    sm = pio_claim_unused_sm(pio, true) ;
+    offset = pio_add_program(pio, &pdm_program) ;
+    pdm_program_init(pio, sm, offset, pin, (float)div) ;
+
+    pdm_data_chan = dma_claim_unused_channel(true) ;
+    pdm_ctrl_chan = dma_claim_unused_channel(true) ;
+
+    // Control channel: next block address into the data channel's read
+    // address (and trigger), walking the table
+    dma_channel_config c = dma_channel_get_default_config(pdm_ctrl_chan) ;
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c, true) ;
+    channel_config_set_write_increment(&c, false) ;
+    channel_config_set_ring(&c, false, PDM_TABLE_BITS) ;
+    dma_channel_configure(
+        pdm_ctrl_chan,
+        &c,
+        &dma_hw->ch[pdm_data_chan].al3_read_addr_trig,    // read address, and trigger
+        pdm_table,                                        // table of block addresses
+        1,                                                // one address per block
+        false
+    ) ;
+
+    // Data channel: one block into the TX FIFO, as fast as the PIO takes it
+    dma_channel_config c2 = dma_channel_get_default_config(pdm_data_chan) ;
+    channel_config_set_transfer_data_size(&c2, DMA_SIZE_32) ;
+    channel_config_set_read_increment(&c2, true) ;
+    channel_config_set_write_increment(&c2, false) ;
+    channel_config_set_dreq(&c2, pio_get_dreq(pio, sm, true)) ;
+    channel_config_set_chain_to(&c2, pdm_ctrl_chan) ;
+    dma_channel_configure(
+        pdm_data_chan,
+        &c2,
+        &pio->txf[sm],                  // write address (PIO TX FIFO)
+        pdm_block[0],                   // loaded by the control channel
+        PDM_BLOCK * pdm_words,          // words per block at this ratio
+        false
+    ) ;
+
+    // Interrupt at the end of every block
+    dma_channel_set_irq0_enabled(pdm_data_chan, true) ;
+    irq_add_shared_handler(DMA_IRQ_0, pdm_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY) ;
+    irq_set_enabled(DMA_IRQ_0, true) ;
+
+    // Fill the FIFO, then start the bit clock
+    dma_start_channel_mask(1u << pdm_ctrl_chan) ;
+    pio_sm_set_enabled(pio, sm, true) ;
+
+    return pdm_fs ;
+}
+
+// Render time of the last block as a percentage of the block period
+static inline int pdm_load() {
+    return (int)(pdm_render_us * pdm_fs / (10000.0f * PDM_BLOCK)) ;
+}
@@ -0,0 +1,158 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * PWM waveform engine demo
+ *
+ * Three uses of the waveform engine (pwm_engine.h), running at once
+ * with no CPU time per sample:
+ *
+ *  - Motor drive: three-phase sines (50 Hz) on three channels of 20 kHz
+ *    phase-correct PWM, for a three-phase bridge driver. Both slices
+ *    start together. Every 5 seconds the direction changes, by swapping
+ *    two phases at the end of a cycle.
+ *  - LED dimming: the on-board LED breathes, with a gamma-corrected
+ *    brightness curve at 1 kHz PWM.
+ *  - Audio over PWM: a 1 kHz tone, 40 ksps paced by a DMA timer, on a
+ *    488 kHz carrier. Low-pass filter the output (1 kohm, 10 nF) into
+ *    an amplifier.
+ *
+ * HARDWARE CONNECTIONS
+ *   - GPIO 4 ---> phase U (PWM slice 2 A)
+ *   - GPIO 5 ---> phase V (PWM slice 2 B)
+ *   - GPIO 6 ---> phase W (PWM slice 3 A)
+ *   - GPIO 10 --> audio (PWM slice 5 A)
+ *   - GPIO 25 --> on-board LED (PWM slice 4 B)
+ *
+ * RESOURCES CONSUMED
+ *   - PWM slices 2, 3, 4 and 5
+ *   - 8 DMA channels, 1 DMA timer
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "pico/stdlib.h"
+
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+
+#include "pwm_engine.h"
+
+// Pins
+#define PHASE_U_PIN 4
+#define PHASE_V_PIN 5
+#define PHASE_W_PIN 6
+#define AUDIO_PIN   10
+#define LED_PIN     25
+
+// Motor PWM: phase-correct, 125 MHz / (2 * 3125) = 20 kHz. 400 samples
+// per electrical cycle is 50 Hz, at up to 90% modulation.
+#define MOTOR_WRAP      3124
+#define MOTOR_SAMPLES   400
+#define MOTOR_SWING     (0.45f * (MOTOR_WRAP + 1))
+
+// LED PWM: 125 MHz / 10 / 12500 = 1 kHz. 2000 samples is a 2 s breath.
+#define LED_WRAP        12499
+#define LED_CLKDIV      10.0f
+#define LED_SAMPLES     2000
+
+// Audio PWM: 125 MHz / 256 = 488 kHz carrier, 8-bit levels. Samples at
+// 40 ksps, 40 per cycle of a 1 kHz tone.
+#define AUDIO_WRAP      255
+#define AUDIO_RATE      40000
+#define AUDIO_SAMPLES   40
+
+// Waveforms. Slice 2 carries U and V, slice 3 carries W. Reversing the
+// motor swaps V and W.
+uint32_t motor_slice2[2][MOTOR_SAMPLES] ;
+uint32_t motor_slice3[2][MOTOR_SAMPLES] ;
+uint32_t led_wave[LED_SAMPLES] ;
+uint32_t audio_wave[AUDIO_SAMPLES] ;
+
+int main() {
+
+    uint slice_u, slice_w, slice_led, slice_audio ;
+    int i, timer, reverse = 0 ;
+    float b ;
+
+    // Initialize stdio
+    stdio_init_all();
+
+    ////////////////////////////////////////////////////////////////////////
+    ///////////////////////// PWM CONFIGURATION ////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+    gpio_set_function(PHASE_U_PIN, GPIO_FUNC_PWM) ;
+    gpio_set_function(PHASE_V_PIN, GPIO_FUNC_PWM) ;
+    gpio_set_function(PHASE_W_PIN, GPIO_FUNC_PWM) ;
+    gpio_set_function(AUDIO_PIN, GPIO_FUNC_PWM) ;
+    gpio_set_function(LED_PIN, GPIO_FUNC_PWM) ;
+
+    slice_u = pwm_gpio_to_slice_num(PHASE_U_PIN) ;
+    slice_w = pwm_gpio_to_slice_num(PHASE_W_PIN) ;
+    slice_led = pwm_gpio_to_slice_num(LED_PIN) ;
+    slice_audio = pwm_gpio_to_slice_num(AUDIO_PIN) ;
+
+    // Both motor slices count from 0, so their centers line up
+    pwm_engine_init(slice_u, MOTOR_WRAP, 1.0f, true, 0) ;
+    pwm_engine_init(slice_w, MOTOR_WRAP, 1.0f, true, 0) ;
+    pwm_engine_init(slice_led, LED_WRAP, LED_CLKDIV, false, 0) ;
+    pwm_engine_init(slice_audio, AUDIO_WRAP, 1.0f, false, 0) ;
+
+    ////////////////////////////////////////////////////////////////////////
+    ///////////////////////////// WAVEFORMS ////////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+    // Motor: U, V, W at 0, -120 and -240 degrees (forward), V and W
+    // swapped (reverse)
+    for (i = 0; i < 2; i++) {
+        pwm_engine_fill_sine(motor_slice2[i], MOTOR_SAMPLES, PWM_CHAN_A, 1, 0,
+                             (MOTOR_WRAP + 1) / 2, MOTOR_SWING) ;
+        pwm_engine_fill_sine(motor_slice2[i], MOTOR_SAMPLES, PWM_CHAN_B, 1,
+                             i ? -4.18879f : -2.09440f, (MOTOR_WRAP + 1) / 2, MOTOR_SWING) ;
+        pwm_engine_fill_sine(motor_slice3[i], MOTOR_SAMPLES, PWM_CHAN_A, 1,
+                             i ? -2.09440f : -4.18879f, (MOTOR_WRAP + 1) / 2, MOTOR_SWING) ;
+    }
+
+    // LED: raised cosine brightness, gamma 2.2
+    for (i = 0; i < LED_SAMPLES; i++) {
+        b = 0.5f - 0.5f * cosf(6.2831853f * i / LED_SAMPLES) ;
+        led_wave[i] = PWM_ENGINE_CC(0, (uint16_t)(powf(b, 2.2f) * LED_WRAP)) ;
+    }
+
+    // Audio: one cycle of a 1 kHz sine, half scale
+    pwm_engine_fill_sine(audio_wave, AUDIO_SAMPLES, PWM_CHAN_A, 1, 0,
+                         (AUDIO_WRAP + 1) / 2, (AUDIO_WRAP + 1) / 4) ;
+
+    ////////////////////////////////////////////////////////////////////////
+    ///////////////////////////// ROCK AND ROLL ////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+    // Audio samples come from a DMA timer at AUDIO_RATE:
+    // clk_sys * (1 / (clk_sys / AUDIO_RATE))
+    timer = dma_claim_unused_timer(true) ;
+    dma_timer_set_fraction(timer, 1, clock_get_hz(clk_sys) / AUDIO_RATE) ;
+    pwm_engine_pace(slice_audio, dma_get_timer_dreq(timer)) ;
+
+    // Load everything, looping, then start all four slices together
+    pwm_engine_play(slice_u, motor_slice2[0], MOTOR_SAMPLES, true) ;
+    pwm_engine_play(slice_w, motor_slice3[0], MOTOR_SAMPLES, true) ;
+    pwm_engine_play(slice_led, led_wave, LED_SAMPLES, true) ;
+    pwm_engine_play(slice_audio, audio_wave, AUDIO_SAMPLES, true) ;
+    pwm_engine_start((1u << slice_u) | (1u << slice_w) | (1u << slice_led) | (1u << slice_audio)) ;
+
+    printf("Motor PWM %.0f Hz, LED PWM %.0f Hz, audio carrier %.0f Hz\n",
+           pwm_engine_frequency(slice_u), pwm_engine_frequency(slice_led),
+           pwm_engine_frequency(slice_audio)) ;
+
+    // The rest is DMA. Change the motor direction every 5 seconds, in the
+    // second half of a cycle, so both slices switch at the end of it.
+    while (1) {
+        sleep_ms(5000) ;
+        while (pwm_engine_position(slice_u) < MOTOR_SAMPLES / 2) tight_loop_contents() ;
+        reverse = !reverse ;
+        pwm_engine_queue(slice_u, motor_slice2[reverse]) ;
+        pwm_engine_queue(slice_w, motor_slice3[reverse]) ;
+        printf("Motor %s\n", reverse ? "reverse" : "forward") ;
+    }
+
+}
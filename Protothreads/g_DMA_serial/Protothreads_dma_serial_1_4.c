@@ -0,0 +1,156 @@
+/*
+ Protothreads 1.4 demo code:
+ for more info see
+ https://people.ece.cornell.edu/land/courses/ece4760/RP2040/protothreads_1_4/index_Protothreads_1_4.html
+
+ DMA-backed serial I/O (pt_uart_dma.h) instead of the polled
+ serial_read/serial_write threads.
+
+ Core 0:
+ -- command thread: reads lines from the terminal (line mode, with echo)
+    and sets the telemetry period, or prints driver statistics
+ -- telemetry thread: streams a status line at the requested period.
+    At 921600 baud the DMA moves every character, so this thread
+    costs one memcpy per line no matter how fast it runs.
+
+ Core 1:
+ -- blinky thread
+
+ Set your terminal to 921600 baud.
+ */
+
+#include "hardware/gpio.h"
+#include "hardware/timer.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <string.h>
+#include <pico/multicore.h>
+#include "hardware/sync.h"
+#include "stdlib.h"
+#include "pico/sync.h"
+
+// ==========================================
+// === protothreads globals
+// ==========================================
+// protothreads header
+#include "pt_cornell_rp2040_v1_4.h"
+// DMA serial driver (uart0 on the usual GPIO 0/1, 2 kB rings)
+#define PT_UART_RX_BUFFER_BITS 11
+#define PT_UART_TX_BUFFER_BITS 11
+#include "pt_uart_dma.h"
+
+# define LED_PIN 25
+# define UART_TX_PIN 0
+# define UART_RX_PIN 1
+# define BAUD_RATE 921600
+
+// telemetry period in microseconds, set by the command thread
+int32_t telemetry_period = 100000 ;
+// number of telemetry lines sent
+uint32_t telemetry_count = 0 ;
+
+// ==================================================
+// === command thread -- core 0
+// ==================================================
+// PT_UART_READ_FRAME yields until a whole line is in,
+// so this thread costs nothing while the human types
+static PT_THREAD (protothread_command(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      static char cmd ;
+      static int value ;
+      // PT_UART_WRITE_STRING can yield, so each thread formats into its
+      // own buffer
+      static char buffer[128] ;
+      while(1) {
+        PT_UART_WRITE_STRING(pt, "\r\ncmd (t <usec> | s)> ") ;
+        // wait for <enter>
+        PT_UART_READ_FRAME(pt) ;
+        cmd = 0 ;
+        value = 0 ;
+        sscanf((char *)pt_uart_frame, "%c %d", &cmd, &value) ;
+        if (cmd == 't' && value > 0) {
+          telemetry_period = value ;
+        }
+        else if (cmd == 's') {
+          sprintf(buffer,
+            "lines=%u rx_overruns=%u frame_errors=%u echo_dropped=%u\r\n",
+            (unsigned)telemetry_count, (unsigned)pt_uart_rx_overruns,
+            (unsigned)pt_uart_frame_errors, (unsigned)pt_uart_echo_dropped) ;
+          PT_UART_WRITE_STRING(pt, buffer) ;
+        }
+        // NEVER exit while
+      } // END WHILE(1)
+  PT_END(pt);
+} // command thread
+
+// ==================================================
+// === telemetry thread -- core 0
+// ==================================================
+static PT_THREAD (protothread_telemetry(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      static char buffer[64] ;
+      while(1) {
+        sprintf(buffer, "t=%llu count=%u\r\n",
+          (unsigned long long)PT_GET_TIME_usec(), (unsigned)telemetry_count) ;
+        // yields only if the 2 kB transmit ring is full
+        PT_UART_WRITE_STRING(pt, buffer) ;
+        telemetry_count++ ;
+        PT_YIELD_usec(telemetry_period) ;
+        // NEVER exit while
+      } // END WHILE(1)
+  PT_END(pt);
+} // telemetry thread
+
+// ==================================================
+// === blink thread -- core 1
+// ==================================================
+static PT_THREAD (protothread_blink(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      while(1) {
+        gpio_put(LED_PIN, !gpio_get(LED_PIN)) ;
+        PT_YIELD_usec(500000) ;
+      } // END WHILE(1)
+  PT_END(pt);
+} // blink thread
+
+// ========================================
+// === core 1 main -- started in main below
+// ========================================
+void core1_main(){
+    pt_add_thread(protothread_blink);
+    pt_sched_method = SCHED_ROUND_ROBIN ;
+    pt_schedule_start ;
+    // NEVER exits
+  }
+
+// ========================================
+// === core 0 main
+// ========================================
+int main(){
+  // need sleep to let progammer finish
+  sleep_ms(10);
+
+  gpio_init(LED_PIN) ;
+  gpio_set_dir(LED_PIN, GPIO_OUT) ;
+
+  // uart0, DMA rings, line mode with echo for the human
+  pt_uart_dma_init(BAUD_RATE, UART_TX_PIN, UART_RX_PIN, PT_UART_MODE_LINE, true) ;
+  pt_uart_write_string("\r\nProtothreads RP2040 v1.4 DMA serial\r\n") ;
+
+  // start core 1 threads
+  multicore_reset_core1();
+  multicore_launch_core1(&core1_main);
+
+  // === config threads ========================
+  // both uart writers live on core 0 (see pt_uart_dma.h)
+  pt_add_thread(protothread_command);
+  pt_add_thread(protothread_telemetry);
+
+  // === initalize the scheduler ===============
+  pt_sched_method = SCHED_ROUND_ROBIN ;
+  pt_schedule_start ;
+  // !!pt_schedule_start NEVER exits
+} // end main
@@ -0,0 +1,547 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Interrupt-driven, DMA-backed UART driver for protothreads
+ *
+ * The polled serial threads in pt_cornell_rp2040_v1_4.h move one
+ * character per pass through the scheduler. This driver instead
+ * lets two DMA channels move the data:
+ *
+ *  - RX: a DMA channel paced by the UART RX DREQ writes every received
+ *    byte into a ring buffer (hardware address wrapping). The CPU never
+ *    touches the UART data register. Threads drain the ring whenever
+ *    they are scheduled.
+ *  - TX: threads copy data into a software ring buffer. A DMA channel
+ *    paced by the UART TX DREQ sends the contiguous chunk between the
+ *    read and write indices. The DMA completion interrupt starts the
+ *    next chunk, so a thread never waits on a character.
+ *
+ * Received bytes are assembled into frames according to a framing mode:
+ *  - PT_UART_MODE_RAW:  every read returns whatever bytes are available
+ *  - PT_UART_MODE_LINE: text lines terminated by <enter>, with optional
+ *                       echo and backspace handling (human at a terminal)
+ *  - PT_UART_MODE_COBS: binary packets, Consistent Overhead Byte Stuffing,
+ *                       delimited by 0x00
+ *  - PT_UART_MODE_SLIP: binary packets, RFC 1055 SLIP framing
+ *
+ * Outgoing frames are encoded with the same mode (LINE and RAW are sent
+ * verbatim). Everything is exposed through non-blocking protothread
+ * macros (PT_UART_READ_FRAME, PT_UART_WRITE, ...) which yield until
+ * the operation can complete.
+ *
+ * RESOURCES USED
+ *  - 1 UART (PT_UART_DMA_ID, default uart0)
+ *  - 2 DMA channels (claimed at init)
+ *  - DMA_IRQ_1 (shared handler, so other libraries may also use it)
+ *
+ * NOTE: Buffer sizes are set with the log2 macros below (define them
+ * before including this file to override). The RX buffer is used as a
+ * DMA write ring, so its size must be a power of two no larger than 32 kB.
+ */
+
+#include <string.h>
+#include "hardware/uart.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// UART instance driven by this library
+#ifndef PT_UART_DMA_ID
+#define PT_UART_DMA_ID              uart0
+#endif
+// log2 of receive ring size (10 -> 1024 bytes)
+#ifndef PT_UART_RX_BUFFER_BITS
+#define PT_UART_RX_BUFFER_BITS      10
+#endif
+// log2 of transmit ring size (10 -> 1024 bytes)
+#ifndef PT_UART_TX_BUFFER_BITS
+#define PT_UART_TX_BUFFER_BITS      10
+#endif
+// Largest decoded frame (bytes) that can be returned to a thread
+#ifndef PT_UART_MAX_FRAME
+#define PT_UART_MAX_FRAME           256
+#endif
+
+#define PT_UART_RX_BUFFER_SIZE      (1u << PT_UART_RX_BUFFER_BITS)
+#define PT_UART_TX_BUFFER_SIZE      (1u << PT_UART_TX_BUFFER_BITS)
+#define PT_UART_RX_MASK             (PT_UART_RX_BUFFER_SIZE - 1)
+#define PT_UART_TX_MASK             (PT_UART_TX_BUFFER_SIZE - 1)
+
+// The RX channel is re-armed from the DMA interrupt each time this
+// many bytes have been received (~3 minutes at 921600 baud)
+#define PT_UART_RX_TRANSFERS        0x01000000u
+
+// Framing modes
+#define PT_UART_MODE_RAW            0
+#define PT_UART_MODE_LINE           1
+#define PT_UART_MODE_COBS           2
+#define PT_UART_MODE_SLIP           3
+
+// SLIP special characters
+#define SLIP_END                    0xC0
+#define SLIP_ESC                    0xDB
+#define SLIP_ESC_END                0xDC
+#define SLIP_ESC_ESC                0xDD
+
+// Backspace character for line mode (matches pt_backspace)
+#define PT_UART_BACKSPACE           0x7f
+
+
+//                               DRIVER STATE
+//
+// Receive ring. Must be aligned to its size for DMA address wrapping.
+uint8_t pt_uart_rx_buffer[PT_UART_RX_BUFFER_SIZE]
+    __attribute__ ((aligned (PT_UART_RX_BUFFER_SIZE))) ;
+// Transmit ring (software-managed, no alignment requirement)
+uint8_t pt_uart_tx_buffer[PT_UART_TX_BUFFER_SIZE] ;
+
+// Decoded frame, valid after PT_UART_READ_FRAME until the next read.
+// Line mode frames are null-terminated.
+uint8_t pt_uart_frame[PT_UART_MAX_FRAME + 1] ;
+int pt_uart_frame_len = 0 ;
+
+// DMA channels (claimed in pt_uart_dma_init)
+int pt_uart_rx_chan ;
+int pt_uart_tx_chan ;
+
+// Free-running receive indices. Head is computed from the DMA
+// transfer count, tail is advanced by the thread consuming bytes.
+volatile uint32_t pt_uart_rx_base = 0 ;
+uint32_t pt_uart_rx_tail = 0 ;
+
+// Free-running transmit indices. Head is advanced by writers,
+// tail by the DMA interrupt when a chunk completes.
+volatile uint32_t pt_uart_tx_head = 0 ;
+volatile uint32_t pt_uart_tx_tail = 0 ;
+volatile uint32_t pt_uart_tx_inflight = 0 ;
+
+// Framing state
+int pt_uart_mode = PT_UART_MODE_LINE ;
+// Line mode echoes from the receive path, which can't wait: if the TX ring
+// is full the echo is dropped (and counted in pt_uart_echo_dropped)
+bool pt_uart_echo = true ;
+static bool pt_uart_frame_complete = false ;
+static bool pt_uart_escaped = false ;
+static bool pt_uart_discard = false ;
+static uint8_t pt_uart_cobs_code = 0 ;
+static uint8_t pt_uart_cobs_left = 0 ;
+
+// Statistics
+volatile uint32_t pt_uart_rx_overruns = 0 ;    // bytes lost to ring overflow
+volatile uint32_t pt_uart_frame_errors = 0 ;   // oversize or malformed frames
+volatile uint32_t pt_uart_echo_dropped = 0 ;   // echoes lost to a full TX ring
+
+
+//                          TRANSMIT (RING + DMA CHUNKS)
+//
+// Start a DMA transfer of the contiguous chunk at the tail of the TX ring,
+// if the channel is idle and there is data waiting. Called with interrupts
+// disabled from thread context, or from the DMA interrupt.
+static void pt_uart_tx_kick() {
+    if (pt_uart_tx_inflight) return ;
+    uint32_t pending = pt_uart_tx_head - pt_uart_tx_tail ;
+    if (pending == 0) return ;
+    uint32_t start = pt_uart_tx_tail & PT_UART_TX_MASK ;
+    uint32_t chunk = PT_UART_TX_BUFFER_SIZE - start ;
+    if (chunk > pending) chunk = pending ;
+    pt_uart_tx_inflight = chunk ;
+    dma_channel_transfer_from_buffer_now(pt_uart_tx_chan,
+                                         &pt_uart_tx_buffer[start], chunk) ;
+}
+
+// Free space in the TX ring
+static inline uint32_t pt_uart_tx_free() {
+    return PT_UART_TX_BUFFER_SIZE - (pt_uart_tx_head - pt_uart_tx_tail) ;
+}
+
+// True when every queued byte has left the DMA (the UART FIFO may
+// still be shifting out the last few characters)
+static inline bool pt_uart_tx_idle() {
+    return pt_uart_tx_head == pt_uart_tx_tail ;
+}
+
+// Frames are staged past the head, and only published (by moving the
+// head) once complete, so the DMA never sends a half-encoded frame.
+// Writers must all run on one core.
+static uint32_t pt_uart_tx_stage ;
+
+// Append one byte to the staged data. Caller has checked for space.
+static inline void pt_uart_tx_put(uint8_t c) {
+    pt_uart_tx_buffer[pt_uart_tx_stage & PT_UART_TX_MASK] = c ;
+    pt_uart_tx_stage++ ;
+}
+
+// Publish the staged bytes to the DMA
+static inline void pt_uart_tx_commit() {
+    uint32_t irq_status = save_and_disable_interrupts() ;
+    pt_uart_tx_head = pt_uart_tx_stage ;
+    pt_uart_tx_kick() ;
+    restore_interrupts(irq_status) ;
+}
+
+// Queue raw bytes. All-or-nothing: returns false (and queues nothing)
+// if there is not enough room.
+bool pt_uart_write_raw(const uint8_t * data, int len) {
+    if ((uint32_t)len > pt_uart_tx_free()) return false ;
+    pt_uart_tx_stage = pt_uart_tx_head ;
+    for (int i = 0; i < len; i++) {
+        pt_uart_tx_put(data[i]) ;
+    }
+    pt_uart_tx_commit() ;
+    return true ;
+}
+
+// Queue one frame, encoded according to the current framing mode.
+// All-or-nothing, so frames are never split between calls.
+bool pt_uart_send_frame(const uint8_t * data, int len) {
+    int i ;
+    if (pt_uart_mode == PT_UART_MODE_SLIP) {
+        // Worst case every byte is escaped, plus two END markers
+        if ((uint32_t)(2*len + 2) > pt_uart_tx_free()) return false ;
+        pt_uart_tx_stage = pt_uart_tx_head ;
+        pt_uart_tx_put(SLIP_END) ;
+        for (i = 0; i < len; i++) {
+            if (data[i] == SLIP_END) {
+                pt_uart_tx_put(SLIP_ESC) ;
+                pt_uart_tx_put(SLIP_ESC_END) ;
+            }
+            else if (data[i] == SLIP_ESC) {
+                pt_uart_tx_put(SLIP_ESC) ;
+                pt_uart_tx_put(SLIP_ESC_ESC) ;
+            }
+            else {
+                pt_uart_tx_put(data[i]) ;
+            }
+        }
+        pt_uart_tx_put(SLIP_END) ;
+    }
+    else if (pt_uart_mode == PT_UART_MODE_COBS) {
+        // One code byte per 254 data bytes, plus the first code and delimiter
+        if ((uint32_t)(len + len/254 + 2) > pt_uart_tx_free()) return false ;
+        pt_uart_tx_stage = pt_uart_tx_head ;
+        // Remember where the current code byte lives, fill it in later
+        uint32_t code_index = pt_uart_tx_stage ;
+        uint8_t code = 1 ;
+        pt_uart_tx_put(0) ;
+        for (i = 0; i < len; i++) {
+            if (data[i] == 0) {
+                pt_uart_tx_buffer[code_index & PT_UART_TX_MASK] = code ;
+                code_index = pt_uart_tx_stage ;
+                code = 1 ;
+                pt_uart_tx_put(0) ;
+            }
+            else {
+                pt_uart_tx_put(data[i]) ;
+                code++ ;
+                if (code == 0xFF) {
+                    pt_uart_tx_buffer[code_index & PT_UART_TX_MASK] = code ;
+                    code_index = pt_uart_tx_stage ;
+                    code = 1 ;
+                    pt_uart_tx_put(0) ;
+                }
+            }
+        }
+        pt_uart_tx_buffer[code_index & PT_UART_TX_MASK] = code ;
+        // Frame delimiter
+        pt_uart_tx_put(0) ;
+    }
+    else {
+        // Raw and line modes are sent verbatim
+        return pt_uart_write_raw(data, len) ;
+    }
+    pt_uart_tx_commit() ;
+    return true ;
+}
+
+// Queue a null-terminated string, verbatim
+static inline bool pt_uart_write_string(const char * str) {
+    return pt_uart_write_raw((const uint8_t *)str, strlen(str)) ;
+}
+
+
+//                         RECEIVE (DMA RING + FRAMING)
+//
+// Free-running count of bytes written into the RX ring by the DMA
+// (interrupts off so the re-arm in the DMA ISR can't split the two reads)
+static inline uint32_t pt_uart_rx_head() {
+    uint32_t irq_status = save_and_disable_interrupts() ;
+    uint32_t head = pt_uart_rx_base +
+           (PT_UART_RX_TRANSFERS - dma_hw->ch[pt_uart_rx_chan].transfer_count) ;
+    restore_interrupts(irq_status) ;
+    return head ;
+}
+
+// Number of received bytes waiting in the RX ring. If the DMA has
+// lapped the reader, the oldest data is discarded and counted.
+static inline uint32_t pt_uart_rx_available() {
+    uint32_t waiting = pt_uart_rx_head() - pt_uart_rx_tail ;
+    if (waiting > PT_UART_RX_BUFFER_SIZE) {
+        pt_uart_rx_overruns += waiting - PT_UART_RX_BUFFER_SIZE ;
+        pt_uart_rx_tail += waiting - PT_UART_RX_BUFFER_SIZE ;
+        waiting = PT_UART_RX_BUFFER_SIZE ;
+    }
+    return waiting ;
+}
+
+// Append one decoded byte to the frame, flagging oversize frames
+static inline void pt_uart_frame_put(uint8_t c) {
+    if (pt_uart_frame_len < PT_UART_MAX_FRAME) {
+        pt_uart_frame[pt_uart_frame_len++] = c ;
+    }
+    else {
+        pt_uart_discard = true ;
+    }
+}
+
+// Finish a frame. Returns true if it should be handed to the thread.
+static inline bool pt_uart_frame_end() {
+    if (pt_uart_discard) {
+        pt_uart_frame_errors++ ;
+        pt_uart_discard = false ;
+        pt_uart_frame_len = 0 ;
+        return false ;
+    }
+    pt_uart_frame[pt_uart_frame_len] = 0 ;
+    return true ;
+}
+
+// Echo in line mode, if it's on (never waits, see pt_uart_echo)
+static inline void pt_uart_echo_out(const uint8_t * data, int len) {
+    if (pt_uart_echo && !pt_uart_write_raw(data, len)) pt_uart_echo_dropped++ ;
+}
+
+// Feed one received byte through the line-mode decoder
+static inline bool pt_uart_decode_line(uint8_t c) {
+    if (c == '\r' || c == '\n') {
+        // Ignore the second half of a \r\n pair (empty line)
+        if (pt_uart_frame_len == 0 && !pt_uart_discard && c == '\n') return false ;
+        pt_uart_echo_out((const uint8_t *)"\r\n", 2) ;
+        return pt_uart_frame_end() ;
+    }
+    if (c == PT_UART_BACKSPACE || c == '\b') {
+        if (pt_uart_frame_len > 0) {
+            pt_uart_frame_len-- ;
+            pt_uart_echo_out((const uint8_t *)"\b \b", 3) ;
+        }
+        return false ;
+    }
+    pt_uart_echo_out(&c, 1) ;
+    pt_uart_frame_put(c) ;
+    return false ;
+}
+
+// Feed one received byte through the SLIP decoder
+static inline bool pt_uart_decode_slip(uint8_t c) {
+    if (c == SLIP_END) {
+        pt_uart_escaped = false ;
+        // Back-to-back END markers delimit empty frames; skip them
+        if (pt_uart_frame_len == 0 && !pt_uart_discard) return false ;
+        return pt_uart_frame_end() ;
+    }
+    if (pt_uart_escaped) {
+        pt_uart_escaped = false ;
+        if (c == SLIP_ESC_END) c = SLIP_END ;
+        else if (c == SLIP_ESC_ESC) c = SLIP_ESC ;
+        else pt_uart_discard = true ;   // protocol violation
+        pt_uart_frame_put(c) ;
+        return false ;
+    }
+    if (c == SLIP_ESC) {
+        pt_uart_escaped = true ;
+        return false ;
+    }
+    pt_uart_frame_put(c) ;
+    return false ;
+}
+
+// Feed one received byte through the COBS decoder
+static inline bool pt_uart_decode_cobs(uint8_t c) {
+    if (c == 0) {
+        // Delimiter. A frame must end exactly at a code boundary.
+        if (pt_uart_cobs_left != 0) pt_uart_discard = true ;
+        pt_uart_cobs_code = 0 ;
+        pt_uart_cobs_left = 0 ;
+        if (pt_uart_frame_len == 0 && !pt_uart_discard) return false ;
+        return pt_uart_frame_end() ;
+    }
+    if (pt_uart_cobs_left == 0) {
+        // New code byte. The previous block implies a zero unless it
+        // was a maximum-length (0xFF) block or this is the first block.
+        if (pt_uart_cobs_code != 0 && pt_uart_cobs_code != 0xFF) {
+            pt_uart_frame_put(0) ;
+        }
+        pt_uart_cobs_code = c ;
+        pt_uart_cobs_left = c - 1 ;
+        return false ;
+    }
+    pt_uart_frame_put(c) ;
+    pt_uart_cobs_left-- ;
+    return false ;
+}
+
+// Drain the RX ring through the framing decoder. Returns true once a
+// complete frame is sitting in pt_uart_frame. The frame stays valid until
+// the next call after it was returned. Non-blocking.
+bool pt_uart_frame_ready() {
+    // The previous frame has been consumed, start a new one
+    if (pt_uart_frame_complete) {
+        pt_uart_frame_complete = false ;
+        pt_uart_frame_len = 0 ;
+    }
+    uint32_t waiting = pt_uart_rx_available() ;
+    // Raw mode: hand over whatever has arrived, up to one frame
+    if (pt_uart_mode == PT_UART_MODE_RAW) {
+        if (waiting == 0) return false ;
+        if (waiting > PT_UART_MAX_FRAME) waiting = PT_UART_MAX_FRAME ;
+        while (waiting--) {
+            pt_uart_frame[pt_uart_frame_len++] =
+                pt_uart_rx_buffer[pt_uart_rx_tail++ & PT_UART_RX_MASK] ;
+        }
+        pt_uart_frame_complete = true ;
+        return true ;
+    }
+    // Framed modes: decode byte-by-byte until a frame boundary
+    while (waiting--) {
+        uint8_t c = pt_uart_rx_buffer[pt_uart_rx_tail++ & PT_UART_RX_MASK] ;
+        bool done ;
+        switch (pt_uart_mode) {
+            case PT_UART_MODE_SLIP:
+                done = pt_uart_decode_slip(c) ;
+                break ;
+            case PT_UART_MODE_COBS:
+                done = pt_uart_decode_cobs(c) ;
+                break ;
+            default:
+                done = pt_uart_decode_line(c) ;
+                break ;
+        }
+        if (done) {
+            pt_uart_frame_complete = true ;
+            return true ;
+        }
+    }
+    return false ;
+}
+
+// Change the framing mode (and echo, for line mode). Resets the decoder.
+void pt_uart_set_mode(int mode, bool echo) {
+    pt_uart_mode = mode ;
+    pt_uart_echo = echo ;
+    pt_uart_frame_len = 0 ;
+    pt_uart_frame_complete = false ;
+    pt_uart_escaped = false ;
+    pt_uart_discard = false ;
+    pt_uart_cobs_code = 0 ;
+    pt_uart_cobs_left = 0 ;
+}
+
+
+//                         DRIVER INTERRUPT SERVICE ROUTINE
+//
+// Shared DMA_IRQ_1 handler. TX completion retires the chunk and starts the
+// next one. RX completion (every PT_UART_RX_TRANSFERS bytes) re-arms the
+// receive channel without moving its write pointer.
+void pt_uart_dma_handler() {
+    if (dma_hw->ints1 & (1u << pt_uart_tx_chan)) {
+        dma_hw->ints1 = 1u << pt_uart_tx_chan ;
+        pt_uart_tx_tail += pt_uart_tx_inflight ;
+        pt_uart_tx_inflight = 0 ;
+        pt_uart_tx_kick() ;
+    }
+    if (dma_hw->ints1 & (1u << pt_uart_rx_chan)) {
+        dma_hw->ints1 = 1u << pt_uart_rx_chan ;
+        pt_uart_rx_base += PT_UART_RX_TRANSFERS ;
+        dma_channel_set_trans_count(pt_uart_rx_chan, PT_UART_RX_TRANSFERS, true) ;
+    }
+}
+
+
+//                    UART SETUP. CALL ON CORE WHERE YOU WANT THE IRQ
+//
+// Sets up the UART at the requested baud rate, claims and configures both
+// DMA channels, and starts reception. Returns the actual baud rate.
+uint pt_uart_dma_init(uint baud, uint tx_pin, uint rx_pin, int mode, bool echo) {
+
+    // UART hardware, 8N1, FIFOs on
+    uint actual_baud = uart_init(PT_UART_DMA_ID, baud) ;
+    gpio_set_function(tx_pin, GPIO_FUNC_UART) ;
+    gpio_set_function(rx_pin, GPIO_FUNC_UART) ;
+    uart_set_hw_flow(PT_UART_DMA_ID, false, false) ;
+    uart_set_format(PT_UART_DMA_ID, 8, 1, UART_PARITY_NONE) ;
+    uart_set_fifo_enabled(PT_UART_DMA_ID, true) ;
+
+    pt_uart_set_mode(mode, echo) ;
+
+    // Claim DMA channels
+    pt_uart_rx_chan = dma_claim_unused_channel(true) ;
+    pt_uart_tx_chan = dma_claim_unused_channel(true) ;
+
+    // RX channel: UART data register to ring buffer, wrapping the write address
+    dma_channel_config c0 = dma_channel_get_default_config(pt_uart_rx_chan) ;
+    channel_config_set_transfer_data_size(&c0, DMA_SIZE_8) ;
+    channel_config_set_read_increment(&c0, false) ;
+    channel_config_set_write_increment(&c0, true) ;
+    channel_config_set_ring(&c0, true, PT_UART_RX_BUFFER_BITS) ;
+    channel_config_set_dreq(&c0, uart_get_dreq(PT_UART_DMA_ID, false)) ;
+
+    dma_channel_configure(
+        pt_uart_rx_chan,                    // Channel to be configured
+        &c0,                                // The configuration we just created
+        pt_uart_rx_buffer,                  // write address (receive ring)
+        &uart_get_hw(PT_UART_DMA_ID)->dr,   // read address (UART data register)
+        PT_UART_RX_TRANSFERS,               // Number of transfers before re-arm
+        false                               // Don't start yet
+    ) ;
+
+    // TX channel: ring buffer chunk to UART data register
+    dma_channel_config c1 = dma_channel_get_default_config(pt_uart_tx_chan) ;
+    channel_config_set_transfer_data_size(&c1, DMA_SIZE_8) ;
+    channel_config_set_read_increment(&c1, true) ;
+    channel_config_set_write_increment(&c1, false) ;
+    channel_config_set_dreq(&c1, uart_get_dreq(PT_UART_DMA_ID, true)) ;
+
+    dma_channel_configure(
+        pt_uart_tx_chan,                    // Channel to be configured
+        &c1,                                // The configuration we just created
+        &uart_get_hw(PT_UART_DMA_ID)->dr,   // write address (UART data register)
+        pt_uart_tx_buffer,                  // read address (set per chunk)
+        0,                                  // Number of transfers (set per chunk)
+        false                               // Don't start yet
+    ) ;
+
+    // Completion interrupts for both channels on (shared) DMA IRQ 1
+    dma_channel_set_irq1_enabled(pt_uart_rx_chan, true) ;
+    dma_channel_set_irq1_enabled(pt_uart_tx_chan, true) ;
+    irq_add_shared_handler(DMA_IRQ_1, pt_uart_dma_handler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY) ;
+    irq_set_enabled(DMA_IRQ_1, true) ;
+
+    // Throw away anything already sitting in the UART FIFO, then start RX
+    while (uart_is_readable(PT_UART_DMA_ID)) uart_getc(PT_UART_DMA_ID) ;
+    dma_channel_start(pt_uart_rx_chan) ;
+
+    return actual_baud ;
+}
+
+
+//                          PROTOTHREAD MACROS (NON-BLOCKING)
+//
+// Yield until a complete frame has been received. The frame is in
+// pt_uart_frame[0 .. pt_uart_frame_len-1] (null-terminated in line mode).
+#define PT_UART_READ_FRAME(pt) \
+    PT_YIELD_UNTIL(pt, pt_uart_frame_ready())
+
+// Yield until the frame fits in the TX ring, then queue it (encoded
+// according to the framing mode)
+#define PT_UART_WRITE(pt, data, len) \
+    PT_YIELD_UNTIL(pt, pt_uart_send_frame((const uint8_t *)(data), (len)))
+
+// Yield until the string fits in the TX ring, then queue it verbatim
+#define PT_UART_WRITE_STRING(pt, str) \
+    PT_YIELD_UNTIL(pt, pt_uart_write_string(str))
+
+// Yield until every queued byte has been handed to the UART
+#define PT_UART_FLUSH(pt) \
+    PT_YIELD_UNTIL(pt, pt_uart_tx_idle())
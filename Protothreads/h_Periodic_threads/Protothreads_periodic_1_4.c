@@ -0,0 +1,188 @@
+/*
+ Protothreads 1.4 demo code:
+ for more info see
+ https://people.ece.cornell.edu/land/courses/ece4760/RP2040/protothreads_1_4/index_Protothreads_1_4.html
+
+ Drift-free periodic threads (pt_timer_wheel.h) instead of
+ PT_YIELD_usec/PT_YIELD_INTERVAL.
+
+ Core 0:
+ -- 1 kHz "control" thread, phase 0: toggles GPIO 2 every activation
+ -- 100 Hz load thread: burns a random 0-3 ms, which would make an
+    interval-based thread drift (and makes the control thread jitter)
+ -- stats thread (1 Hz): prints activations, overruns and release
+    latency (min/mean/max) for every periodic thread
+ Core 1:
+ -- 1 kHz "control" thread, phase 500 us: toggles GPIO 3.
+    GPIO 2 and 3 stay 500 us apart on average, forever (no drift). Each
+    edge can be late by up to the release latency the stats thread
+    prints, mostly from the load thread holding core 0.
+ -- blinky thread, 2 Hz
+
+ Serial: 115200 baud
+ */
+
+#include "hardware/gpio.h"
+#include "hardware/timer.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <string.h>
+#include <pico/multicore.h>
+#include "hardware/sync.h"
+#include "stdlib.h"
+#include "pico/sync.h"
+
+// ==========================================
+// === protothreads globals
+// ==========================================
+// protothreads header
+#include "pt_cornell_rp2040_v1_4.h"
+// periodic timer wheel
+#include "pt_timer_wheel.h"
+
+# define LED_PIN 25
+# define CONTROL0_PIN 2
+# define CONTROL1_PIN 3
+
+// one timer per periodic thread
+struct pt_timer control0_timer ;
+struct pt_timer control1_timer ;
+struct pt_timer load_timer ;
+struct pt_timer blink_timer ;
+struct pt_timer stats_timer ;
+
+// ==================================================
+// === print the statistics of one timer
+// ==================================================
+void print_timer_stats(char * name, struct pt_timer * t) {
+    printf("%-9s act=%8u ovr=%5u lat(us) min=%4u mean=%4u max=%4u\n",
+        name, (unsigned)t->activations, (unsigned)t->overruns,
+        (unsigned)t->latency_min, (unsigned)pt_timer_latency_mean(t),
+        (unsigned)t->latency_max) ;
+}
+
+// ==================================================
+// === 1 kHz control thread -- core 0
+// ==================================================
+static PT_THREAD (protothread_control0(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      // 1000 us period, activations at t = 0 mod 1000
+      PT_PERIODIC_INIT(&control0_timer, 1000, 0) ;
+      while(1) {
+        PT_YIELD_PERIOD(pt, &control0_timer) ;
+        gpio_put(CONTROL0_PIN, !gpio_get(CONTROL0_PIN)) ;
+        // NEVER exit while
+      } // END WHILE(1)
+  PT_END(pt);
+} // control0 thread
+
+// ==================================================
+// === 100 Hz load thread -- core 0
+// ==================================================
+static PT_THREAD (protothread_load(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      PT_PERIODIC_INIT(&load_timer, 10000, 0) ;
+      while(1) {
+        PT_YIELD_PERIOD(pt, &load_timer) ;
+        // simulate a variable amount of work without yielding
+        busy_wait_us(rand() % 3000) ;
+        // NEVER exit while
+      } // END WHILE(1)
+  PT_END(pt);
+} // load thread
+
+// ==================================================
+// === stats thread -- core 0
+// ==================================================
+static PT_THREAD (protothread_stats(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      PT_PERIODIC_INIT(&stats_timer, 1000000, 0) ;
+      while(1) {
+        PT_YIELD_PERIOD(pt, &stats_timer) ;
+        printf("\n") ;
+        print_timer_stats("control0", &control0_timer) ;
+        print_timer_stats("control1", &control1_timer) ;
+        print_timer_stats("load", &load_timer) ;
+        print_timer_stats("blink", &blink_timer) ;
+        // NEVER exit while
+      } // END WHILE(1)
+  PT_END(pt);
+} // stats thread
+
+// ==================================================
+// === 1 kHz control thread -- core 1
+// ==================================================
+static PT_THREAD (protothread_control1(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      // same period as control0, half a period later
+      PT_PERIODIC_INIT(&control1_timer, 1000, 500) ;
+      while(1) {
+        PT_YIELD_PERIOD(pt, &control1_timer) ;
+        gpio_put(CONTROL1_PIN, !gpio_get(CONTROL1_PIN)) ;
+        // NEVER exit while
+      } // END WHILE(1)
+  PT_END(pt);
+} // control1 thread
+
+// ==================================================
+// === blink thread -- core 1
+// ==================================================
+static PT_THREAD (protothread_blink(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      PT_PERIODIC_INIT(&blink_timer, 250000, 0) ;
+      while(1) {
+        PT_YIELD_PERIOD(pt, &blink_timer) ;
+        gpio_put(LED_PIN, !gpio_get(LED_PIN)) ;
+      } // END WHILE(1)
+  PT_END(pt);
+} // blink thread
+
+// ========================================
+// === core 1 main -- started in main below
+// ========================================
+void core1_main(){
+    pt_add_thread(protothread_control1);
+    pt_add_thread(protothread_blink);
+    pt_sched_method = SCHED_ROUND_ROBIN ;
+    pt_schedule_start ;
+    // NEVER exits
+  }
+
+// ========================================
+// === core 0 main
+// ========================================
+int main(){
+  // need sleep to let progammer finish
+  sleep_ms(10);
+  stdio_init_all() ;
+  printf("Protothreads RP2040 v1.4 periodic threads\n") ;
+
+  gpio_init(LED_PIN) ;
+  gpio_set_dir(LED_PIN, GPIO_OUT) ;
+  gpio_init(CONTROL0_PIN) ;
+  gpio_set_dir(CONTROL0_PIN, GPIO_OUT) ;
+  gpio_init(CONTROL1_PIN) ;
+  gpio_set_dir(CONTROL1_PIN, GPIO_OUT) ;
+
+  // the wheel is shared by both cores, set it up before either scheduler
+  pt_wheel_init() ;
+
+  // start core 1 threads
+  multicore_reset_core1();
+  multicore_launch_core1(&core1_main);
+
+  // === config threads ========================
+  pt_add_thread(protothread_control0);
+  pt_add_thread(protothread_load);
+  pt_add_thread(protothread_stats);
+
+  // === initalize the scheduler ===============
+  pt_sched_method = SCHED_ROUND_ROBIN ;
+  pt_schedule_start ;
+  // !!pt_schedule_start NEVER exits
+} // end main
@@ -0,0 +1,307 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Drift-free periodic protothreads on a hierarchical timer wheel
+ *
+ * PT_YIELD_INTERVAL re-arms its marker relative to "now" after the wait,
+ * so a periodic thread slips by its own execution time (plus scheduler
+ * latency) every period. Here each periodic thread owns a pt_timer with
+ * an ABSOLUTE deadline. When the timer expires its next deadline is the
+ * old one plus the period, so activations stay phase-locked to the
+ * microsecond timer no matter how late a particular activation runs.
+ *
+ * All timers, from both cores, live in one hierarchical timing wheel:
+ *
+ *   level 0: 256 slots of 1 tick        (2.56 ms at 10 us/tick)
+ *   level 1:  64 slots of 256 ticks     (164 ms)
+ *   level 2:  64 slots of 16384 ticks   (10.5 s)
+ *   level 3:  64 slots of 1048576 ticks (11 min, longer timers re-cascade)
+ *
+ * Inserting or expiring a timer is O(1) regardless of how many timers
+ * exist. The wheel is advanced by whichever core's threads poll it first
+ * (a hardware spinlock keeps the cores out of each other's way), so no
+ * extra interrupt is consumed.
+ *
+ * Per-timer statistics:
+ *   - activations and overruns (an activation fired while the previous
+ *     one had not been consumed, or the deadline was missed entirely)
+ *   - release latency (thread resume time minus deadline): min, max, mean.
+ *     max - min is the peak-to-peak jitter of the thread.
+ *
+ * USAGE
+ *   static struct pt_timer control_timer ;
+ *   ...
+ *   PT_BEGIN(pt) ;
+ *   // 1 kHz, activations at t = 250 us (mod 1000 us)
+ *   PT_PERIODIC_INIT(&control_timer, 1000, 250) ;
+ *   while(1) {
+ *       PT_YIELD_PERIOD(pt, &control_timer) ;
+ *       ... control loop ...
+ *   }
+ *
+ * Call pt_wheel_init() once (on core 0, before starting either scheduler).
+ */
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Wheel resolution in microseconds
+#ifndef PT_WHEEL_TICK_US
+#define PT_WHEEL_TICK_US        10
+#endif
+
+// Wheel geometry (level 0 is 2^8 slots, higher levels 2^6 slots)
+#define PT_WHEEL_L0_BITS        8
+#define PT_WHEEL_LN_BITS        6
+#define PT_WHEEL_L0_SIZE        (1 << PT_WHEEL_L0_BITS)
+#define PT_WHEEL_LN_SIZE        (1 << PT_WHEEL_LN_BITS)
+#define PT_WHEEL_L0_MASK        (PT_WHEEL_L0_SIZE - 1)
+#define PT_WHEEL_LN_MASK        (PT_WHEEL_LN_SIZE - 1)
+#define PT_WHEEL_LEVELS         4
+// Slot index of a tick at level n (n >= 1)
+#define PT_WHEEL_INDEX(tick, n) \
+    (((tick) >> (PT_WHEEL_L0_BITS + ((n)-1)*PT_WHEEL_LN_BITS)) & PT_WHEEL_LN_MASK)
+
+
+//                               TIMER STRUCTURE
+//
+struct pt_timer {
+    // wheel linkage (doubly linked so a timer can be removed in O(1))
+    struct pt_timer * next ;
+    struct pt_timer ** pprev ;
+    // absolute deadline of the next activation (us), and the period (us)
+    uint64_t deadline ;
+    uint32_t period ;
+    // deadline of the activation the thread is about to consume
+    uint64_t released_deadline ;
+    // set by the wheel on expiry, cleared by the thread
+    volatile uint8_t pending ;
+    uint8_t active ;
+    // statistics
+    uint32_t activations ;
+    uint32_t overruns ;
+    uint32_t latency_min ;
+    uint32_t latency_max ;
+    uint64_t latency_sum ;
+} ;
+
+
+//                                WHEEL STATE
+//
+static struct pt_timer * pt_wheel_l0[PT_WHEEL_L0_SIZE] ;
+static struct pt_timer * pt_wheel_ln[PT_WHEEL_LEVELS-1][PT_WHEEL_LN_SIZE] ;
+// Next tick to be processed
+static uint64_t pt_wheel_tick ;
+// Number of linked timers (lets an empty wheel skip straight to "now")
+static int pt_wheel_count = 0 ;
+// Hardware spinlock shared by both cores
+static spin_lock_t * pt_wheel_lock ;
+
+
+//                            INTERNAL OPERATIONS
+//
+// Link a timer into the list at *slot
+static inline void pt_wheel_link(struct pt_timer ** slot, struct pt_timer * t) {
+    t->next = *slot ;
+    if (t->next) t->next->pprev = &t->next ;
+    t->pprev = slot ;
+    *slot = t ;
+}
+
+// Remove a timer from whatever list it is in
+static inline void pt_wheel_unlink(struct pt_timer * t) {
+    *(t->pprev) = t->next ;
+    if (t->next) t->next->pprev = t->pprev ;
+    t->next = NULL ;
+    t->pprev = NULL ;
+}
+
+// Put a timer in the slot matching its deadline (relative to pt_wheel_tick).
+// Deadlines are rounded UP to a tick so a timer never fires early.
+static void pt_wheel_insert(struct pt_timer * t) {
+    uint64_t expires = (t->deadline + PT_WHEEL_TICK_US - 1) / PT_WHEEL_TICK_US ;
+    uint64_t delta ;
+    struct pt_timer ** slot ;
+    // Already due: expire on the next tick processed
+    if (expires < pt_wheel_tick) expires = pt_wheel_tick ;
+    delta = expires - pt_wheel_tick ;
+    if (delta < PT_WHEEL_L0_SIZE) {
+        slot = &pt_wheel_l0[expires & PT_WHEEL_L0_MASK] ;
+    }
+    else if (delta < (1ull << (PT_WHEEL_L0_BITS + PT_WHEEL_LN_BITS))) {
+        slot = &pt_wheel_ln[0][PT_WHEEL_INDEX(expires, 1)] ;
+    }
+    else if (delta < (1ull << (PT_WHEEL_L0_BITS + 2*PT_WHEEL_LN_BITS))) {
+        slot = &pt_wheel_ln[1][PT_WHEEL_INDEX(expires, 2)] ;
+    }
+    else if (delta < (1ull << (PT_WHEEL_L0_BITS + 3*PT_WHEEL_LN_BITS))) {
+        slot = &pt_wheel_ln[2][PT_WHEEL_INDEX(expires, 3)] ;
+    }
+    else {
+        // Beyond the wheel: park in the farthest top-level slot, it will
+        // be re-inserted (closer to its deadline) when that slot cascades
+        slot = &pt_wheel_ln[2][(PT_WHEEL_INDEX(pt_wheel_tick, 3) + PT_WHEEL_LN_MASK)
+                               & PT_WHEEL_LN_MASK] ;
+    }
+    pt_wheel_link(slot, t) ;
+}
+
+// Move every timer in a higher-level slot down toward level 0.
+// Returns the slot index so the caller knows whether to cascade further.
+static int pt_wheel_cascade(int level, int index) {
+    struct pt_timer * t = pt_wheel_ln[level-1][index] ;
+    pt_wheel_ln[level-1][index] = NULL ;
+    while (t) {
+        struct pt_timer * next = t->next ;
+        pt_wheel_insert(t) ;
+        t = next ;
+    }
+    return index ;
+}
+
+// A timer's slot came up: release the thread and schedule the next
+// activation one period after the previous DEADLINE (not after "now").
+static void pt_wheel_expire(struct pt_timer * t, uint64_t now) {
+    // Previous activation never consumed by the thread
+    if (t->pending) {
+        t->overruns++ ;
+    }
+    else {
+        t->released_deadline = t->deadline ;
+        t->pending = 1 ;
+    }
+    t->deadline += t->period ;
+    // Wheel fell behind by more than a period: skip (and count) the missed
+    // activations, but keep the original phase
+    if (t->deadline <= now) {
+        uint32_t missed = (uint32_t)((now - t->deadline) / t->period) + 1 ;
+        t->overruns += missed ;
+        t->deadline += (uint64_t)missed * t->period ;
+    }
+    pt_wheel_insert(t) ;
+}
+
+// Process one tick: cascade higher levels on wrap, then expire level 0
+static void pt_wheel_process_tick(uint64_t now) {
+    int index = pt_wheel_tick & PT_WHEEL_L0_MASK ;
+    if (index == 0 &&
+        pt_wheel_cascade(1, PT_WHEEL_INDEX(pt_wheel_tick, 1)) == 0 &&
+        pt_wheel_cascade(2, PT_WHEEL_INDEX(pt_wheel_tick, 2)) == 0) {
+        pt_wheel_cascade(3, PT_WHEEL_INDEX(pt_wheel_tick, 3)) ;
+    }
+    struct pt_timer * t = pt_wheel_l0[index] ;
+    pt_wheel_l0[index] = NULL ;
+    while (t) {
+        struct pt_timer * next = t->next ;
+        t->next = NULL ;
+        t->pprev = NULL ;
+        pt_wheel_expire(t, now) ;
+        t = next ;
+    }
+    pt_wheel_tick++ ;
+}
+
+
+//                                 PUBLIC API
+//
+// Claim the spinlock and align the wheel with the system timer
+void pt_wheel_init() {
+    pt_wheel_lock = spin_lock_instance(spin_lock_claim_unused(true)) ;
+    pt_wheel_tick = time_us_64() / PT_WHEEL_TICK_US ;
+}
+
+// Advance the wheel up to the current time. Called by every
+// PT_YIELD_PERIOD poll, on either core.
+void pt_wheel_service() {
+    uint32_t irq_status = spin_lock_blocking(pt_wheel_lock) ;
+    uint64_t now = time_us_64() ;
+    uint64_t now_tick = now / PT_WHEEL_TICK_US ;
+    if (pt_wheel_count == 0) {
+        pt_wheel_tick = now_tick + 1 ;
+    }
+    while (pt_wheel_tick <= now_tick) {
+        pt_wheel_process_tick(now) ;
+    }
+    spin_unlock(pt_wheel_lock, irq_status) ;
+}
+
+// Start (or restart) a periodic timer. Activations happen at
+//   t = k*period + phase   (microseconds since boot)
+// so timers that share a period and phase stay in lock-step. Periods
+// shorter than one wheel tick (including 0) are rounded up to one tick.
+void pt_timer_start(struct pt_timer * t, uint32_t period_us, uint32_t phase_us) {
+    if (period_us < PT_WHEEL_TICK_US) period_us = PT_WHEEL_TICK_US ;
+    uint32_t irq_status = spin_lock_blocking(pt_wheel_lock) ;
+    if (t->active) {
+        if (t->pprev) pt_wheel_unlink(t) ;
+        pt_wheel_count-- ;
+    }
+    uint64_t now = time_us_64() ;
+    t->period = period_us ;
+    t->deadline = (now / period_us + 1) * period_us + (phase_us % period_us) ;
+    t->pending = 0 ;
+    t->active = 1 ;
+    t->activations = 0 ;
+    t->overruns = 0 ;
+    t->latency_min = 0xFFFFFFFF ;
+    t->latency_max = 0 ;
+    t->latency_sum = 0 ;
+    if (pt_wheel_count == 0) pt_wheel_tick = now / PT_WHEEL_TICK_US ;
+    pt_wheel_insert(t) ;
+    pt_wheel_count++ ;
+    spin_unlock(pt_wheel_lock, irq_status) ;
+}
+
+// Stop a periodic timer
+void pt_timer_stop(struct pt_timer * t) {
+    uint32_t irq_status = spin_lock_blocking(pt_wheel_lock) ;
+    if (t->active) {
+        if (t->pprev) pt_wheel_unlink(t) ;
+        t->active = 0 ;
+        t->pending = 0 ;
+        pt_wheel_count-- ;
+    }
+    spin_unlock(pt_wheel_lock, irq_status) ;
+}
+
+// Non-blocking: has the timer released an activation?
+static inline bool pt_timer_expired(struct pt_timer * t) {
+    if (!t->pending) pt_wheel_service() ;
+    return t->pending ;
+}
+
+// Consume an activation and record the release latency. The deadline is
+// read and the activation cleared under the lock, so a release from the
+// other core can't land in between.
+static inline void pt_timer_consume(struct pt_timer * t) {
+    uint32_t irq_status = spin_lock_blocking(pt_wheel_lock) ;
+    uint64_t released = t->released_deadline ;
+    t->pending = 0 ;
+    spin_unlock(pt_wheel_lock, irq_status) ;
+    uint32_t latency = (uint32_t)(time_us_64() - released) ;
+    t->activations++ ;
+    t->latency_sum += latency ;
+    if (latency < t->latency_min) t->latency_min = latency ;
+    if (latency > t->latency_max) t->latency_max = latency ;
+}
+
+// Mean release latency (us)
+static inline uint32_t pt_timer_latency_mean(struct pt_timer * t) {
+    return t->activations ? (uint32_t)(t->latency_sum / t->activations) : 0 ;
+}
+
+
+//                              PROTOTHREAD MACROS
+//
+// Start the calling thread's periodic timer (period and phase in us)
+#define PT_PERIODIC_INIT(t, period_us, phase_us) \
+    pt_timer_start((t), (period_us), (phase_us))
+
+// Yield until the next activation of the timer. Drift-free: the
+// activation times do not depend on how long the thread body took.
+#define PT_YIELD_PERIOD(pt, t) do { \
+    PT_YIELD_UNTIL(pt, pt_timer_expired(t)) ; \
+    pt_timer_consume(t) ; \
+} while(0)
@@ -0,0 +1,254 @@
+/*
+ Protothreads 1.5 scheduler benchmarks
+
+ Builds for the Pico (default) or for the host with the POSIX backend
+ of pt_platform.h, where two pthreads play the two cores:
+
+   cmake -S . -B build -DPT_HOST=ON && cmake --build build && ./build/pt_bench
+
+ Measures:
+ -- context switch: two threads on core 0 that do nothing but PT_YIELD.
+    Time per switch = scheduler dispatch + local continuation resume.
+ -- semaphore ping-pong: core 0 signals, core 1 answers, using the
+    core-safe PT_SEM_SDK_WAIT/SIGNAL. Time per round trip.
+ -- FIFO throughput: core 0 streams words to core 1 with PT_FIFO_WRITE,
+    core 1 checks the sequence with PT_FIFO_READ.
+ -- scheduler overhead vs thread count: 1 counting thread plus up to
+    MAX_THREADS-1 threads blocked in PT_YIELD_UNTIL. Time per scheduler
+    pass, and per polled thread, for both scheduling methods.
+
+ Run it before and after touching the scheduler to catch regressions.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pt_cornell_rp2040_v1_5.h"
+
+// iterations: hardware is ~100x slower than a desktop
+#ifdef PT_PLATFORM_POSIX
+#define BENCH_ITERATIONS 2000000
+#else
+#define BENCH_ITERATIONS 20000
+#endif
+
+// cross-core iterations (fewer on a single-CPU host, see main)
+uint32_t bench_cross_iterations = BENCH_ITERATIONS ;
+
+// shared benchmark state (protothread locals must be static anyway)
+volatile uint32_t bench_count ;
+volatile uint32_t bench_errors ;
+volatile int bench_reader_done ;
+volatile int bench_wake = 0 ;
+pt_semaphore_t bench_ping, bench_pong ;
+
+// ==========================================
+// === two-core harness
+// ==========================================
+// adds core 1's threads, then runs its scheduler until pt_sched_exit
+static void (*bench_core1_setup)(void) ;
+static volatile int bench_core1_done ;
+
+void bench_core1_main() {
+    if (bench_core1_setup) bench_core1_setup() ;
+    pt_schedule_start ;
+    bench_core1_done = 1 ;
+}
+
+// empty both thread tables and clear the statistics
+void bench_reset() {
+    pt_task_count = 0 ;
+    pt_task_count1 = 0 ;
+    pt_sched_exit = 0 ;
+    pt_sched_method = SCHED_ROUND_ROBIN ;
+    bench_count = 0 ;
+    bench_errors = 0 ;
+    bench_reader_done = 0 ;
+    memset(sched_thread_stats, 0, sizeof(sched_thread_stats)) ;
+    memset(sched_thread_time, 0, sizeof(sched_thread_time)) ;
+}
+
+// run the core 0 scheduler (and core 1's, if setup1 is given),
+// return elapsed microseconds
+uint64_t bench_run(void (*setup1)(void)) {
+    uint64_t start ;
+    bench_core1_done = 0 ;
+    bench_core1_setup = setup1 ;
+    if (setup1) pt_launch_core1(bench_core1_main) ;
+    start = pt_time_us() ;
+    pt_schedule_start ;
+    start = pt_time_us() - start ;
+    if (setup1) {
+        while (!bench_core1_done) ;
+        pt_join_core1() ;
+    }
+    return start ;
+}
+
+// ==========================================
+// === context switch
+// ==========================================
+static PT_THREAD (bench_yield_thread(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      while (bench_count < BENCH_ITERATIONS) {
+        bench_count++ ;
+        PT_YIELD(pt) ;
+      }
+      pt_sched_exit = 1 ;
+    PT_END(pt);
+}
+
+void bench_context_switch() {
+    bench_reset() ;
+    pt_add_thread(bench_yield_thread) ;
+    pt_add_thread(bench_yield_thread) ;
+    uint64_t t = bench_run(NULL) ;
+    printf("context switch          %10.1f ns/switch\n",
+        1000.0 * (double)t / (double)bench_count) ;
+}
+
+// ==========================================
+// === semaphore ping-pong
+// ==========================================
+static PT_THREAD (bench_ping_thread(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      while (bench_count < bench_cross_iterations) {
+        PT_SEM_SDK_SIGNAL(pt, &bench_ping) ;
+        PT_SEM_SDK_WAIT(pt, &bench_pong) ;
+        bench_count++ ;
+      }
+      pt_sched_exit = 1 ;
+    PT_END(pt);
+}
+
+static PT_THREAD (bench_pong_thread(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      while (1) {
+        PT_SEM_SDK_WAIT(pt, &bench_ping) ;
+        PT_SEM_SDK_SIGNAL(pt, &bench_pong) ;
+      }
+    PT_END(pt);
+}
+
+void bench_pong_setup() {
+    pt_add_thread(bench_pong_thread) ;
+}
+
+void bench_sem_pingpong() {
+    bench_reset() ;
+    pt_sem_init(&bench_ping, 0, 1) ;
+    pt_sem_init(&bench_pong, 0, 1) ;
+    pt_add_thread(bench_ping_thread) ;
+    uint64_t t = bench_run(bench_pong_setup) ;
+    printf("semaphore ping-pong     %10.1f ns/round trip\n",
+        1000.0 * (double)t / (double)bench_count) ;
+}
+
+// ==========================================
+// === FIFO throughput
+// ==========================================
+static PT_THREAD (bench_fifo_writer(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      while (bench_count < bench_cross_iterations) {
+        PT_FIFO_WRITE(bench_count) ;
+        bench_count++ ;
+      }
+      // time includes draining the FIFO on the other side
+      PT_YIELD_UNTIL(pt, bench_reader_done) ;
+      pt_sched_exit = 1 ;
+    PT_END(pt);
+}
+
+static PT_THREAD (bench_fifo_reader(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      static uint32_t expected, word ;
+      expected = 0 ;
+      while (expected < bench_cross_iterations) {
+        PT_FIFO_READ(word) ;
+        if (word != expected) bench_errors++ ;
+        expected++ ;
+      }
+      bench_reader_done = 1 ;
+      PT_YIELD_UNTIL(pt, 0) ;
+    PT_END(pt);
+}
+
+void bench_fifo_setup() {
+    pt_add_thread(bench_fifo_reader) ;
+}
+
+void bench_fifo() {
+    bench_reset() ;
+    PT_FIFO_FLUSH ;
+    pt_add_thread(bench_fifo_writer) ;
+    uint64_t t = bench_run(bench_fifo_setup) ;
+    printf("FIFO throughput         %10.3f Mword/s  (%u sequence errors)\n",
+        (double)bench_count / (double)t, (unsigned)bench_errors) ;
+}
+
+// ==========================================
+// === scheduler overhead vs thread count
+// ==========================================
+// never runs: costs one poll per scheduler pass
+static PT_THREAD (bench_idle_thread(struct pt *pt))
+{
+    PT_BEGIN(pt);
+      while (1) {
+        PT_YIELD_UNTIL(pt, bench_wake) ;
+      }
+    PT_END(pt);
+}
+
+void bench_sched_overhead(int method) {
+    int threads, i ;
+    printf("%s scheduler:\n",
+        (method == SCHED_ROUND_ROBIN) ? "round-robin" : "priority") ;
+    for (threads = 1; threads <= MAX_THREADS; threads++) {
+        bench_reset() ;
+        pt_sched_method = method ;
+        // the counting thread is added last (lowest priority), so every
+        // pass polls all the idle threads first
+        for (i = 1; i < threads; i++) {
+            pt_add_thread(bench_idle_thread) ;
+        }
+        pt_add_thread(bench_yield_thread) ;
+        uint64_t t = bench_run(NULL) ;
+        double pass = 1000.0 * (double)t / (double)bench_count ;
+        printf("  %2d threads            %10.1f ns/pass  %8.1f ns/thread\n",
+            threads, pass, pass / threads) ;
+    }
+}
+
+// ========================================
+// === main
+// ========================================
+int main() {
+#ifndef PT_PLATFORM_POSIX
+    stdio_init_all() ;
+    // time to open a terminal
+    sleep_ms(2000) ;
+#endif
+#ifdef PT_PLATFORM_POSIX
+    // with one CPU the two "cores" only alternate on OS time slices
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        bench_cross_iterations = BENCH_ITERATIONS / 1000 ;
+        printf("WARNING: one CPU online, cross-core results measure the OS time slice\n") ;
+    }
+#endif
+    printf("Protothreads v1.5 benchmarks, %d iterations (%u cross-core)\n",
+        BENCH_ITERATIONS, (unsigned)bench_cross_iterations) ;
+    bench_context_switch() ;
+    bench_sem_pingpong() ;
+    bench_fifo() ;
+    bench_sched_overhead(SCHED_ROUND_ROBIN) ;
+    bench_sched_overhead(SCHED_PRIORITY) ;
+    printf("done\n") ;
+#ifndef PT_PLATFORM_POSIX
+    while (1) tight_loop_contents() ;
+#endif
+    return 0 ;
+}
@@ -0,0 +1,240 @@
+/*
+ * File:   pt_platform.h
+ *
+ * Platform layer for pt_cornell_rp2040_v1_5.h
+ *
+ * Everything the protothreads scheduler needs from the outside world:
+ *   -- time in microseconds                pt_time_us()
+ *   -- which core is running               pt_core_num()
+ *   -- core-safe semaphore and mutex       pt_sem_*, pt_mutex_*
+ *   -- inter-core FIFO                     pt_fifo_*
+ *   -- starting a thread on core 1         pt_launch_core1()
+ *   -- console character I/O               pt_uart_*
+ *
+ * Two backends:
+ *   PICO (default)  maps straight onto the Pico SDK, so code built with
+ *                   v1.5 is identical to v1.4 on hardware.
+ *   POSIX           (define PT_PLATFORM_POSIX, or build with -DPT_HOST=ON)
+ *                   runs "core 0" on the main thread and "core 1" on a
+ *                   second pthread. The FIFO has the RP2040's depth (8)
+ *                   and the semaphores/mutexes are C11 atomics, so the
+ *                   scheduler can be profiled and regression-tested on
+ *                   a Linux box.
+ */
+
+#ifndef __PT_PLATFORM_H__
+#define __PT_PLATFORM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifndef PT_PLATFORM_POSIX
+//=====================================================================
+//=== Pico SDK backend ================================================
+//=====================================================================
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/sync.h"
+#include "hardware/uart.h"
+
+// time and core
+#define pt_time_us()                time_us_64()
+#define pt_core_num()               get_core_num()
+
+// core-safe semaphore: (sem, initial permits, max permits)
+typedef semaphore_t pt_semaphore_t ;
+#define pt_sem_init(s, init, max)   sem_init((s), (init), (max))
+#define pt_sem_try_acquire(s)       sem_try_acquire(s)
+#define pt_sem_release(s)           sem_release(s)
+
+// core-safe mutex
+typedef mutex_t pt_mutex_t ;
+#define pt_mutex_init(m)            mutex_init(m)
+#define pt_mutex_try_enter(m)       mutex_try_enter((m), NULL)
+#define pt_mutex_exit(m)            mutex_exit(m)
+
+// inter-core FIFO (each core writes the other's)
+#define pt_fifo_wready()            multicore_fifo_wready()
+#define pt_fifo_rvalid()            multicore_fifo_rvalid()
+#define pt_fifo_push(data)          multicore_fifo_push_blocking(data)
+#define pt_fifo_pop()               multicore_fifo_pop_blocking()
+#define pt_fifo_drain()             multicore_fifo_drain()
+
+// core 1 entry (a second launch first resets core 1)
+static inline void pt_launch_core1(void (*entry)(void)) {
+    multicore_reset_core1() ;
+    multicore_launch_core1(entry) ;
+}
+
+// the entry function signals its own completion on hardware
+static inline void pt_join_core1(void) { }
+
+// console
+#define PT_UART_ID                  uart0
+#define pt_uart_readable()          uart_is_readable(PT_UART_ID)
+#define pt_uart_writable()          uart_is_writable(PT_UART_ID)
+#define pt_uart_getc()              uart_getc(PT_UART_ID)
+#define pt_uart_putc(c)             uart_putc(PT_UART_ID, (c))
+
+#else
+//=====================================================================
+//=== POSIX backend (two pthreads as two cores) =======================
+//=====================================================================
+#include <stdio.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// monotonic time in microseconds
+static inline uint64_t pt_time_us(void) {
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)(ts.tv_nsec / 1000) ;
+}
+
+// "core" number of the calling pthread
+static _Thread_local int pt_posix_core = 0 ;
+#define pt_core_num()               (pt_posix_core)
+
+// core-safe semaphore
+typedef struct {
+    atomic_int permits ;
+    int max_permits ;
+} pt_semaphore_t ;
+
+static inline void pt_sem_init(pt_semaphore_t * s, int init, int max) {
+    atomic_init(&s->permits, init) ;
+    s->max_permits = max ;
+}
+
+static inline bool pt_sem_try_acquire(pt_semaphore_t * s) {
+    int p = atomic_load_explicit(&s->permits, memory_order_relaxed) ;
+    while (p > 0) {
+        if (atomic_compare_exchange_weak_explicit(&s->permits, &p, p - 1,
+                memory_order_acquire, memory_order_relaxed)) {
+            return true ;
+        }
+    }
+    return false ;
+}
+
+// like the SDK: returns false (and does nothing) at max permits
+static inline bool pt_sem_release(pt_semaphore_t * s) {
+    int p = atomic_load_explicit(&s->permits, memory_order_relaxed) ;
+    while (p < s->max_permits) {
+        if (atomic_compare_exchange_weak_explicit(&s->permits, &p, p + 1,
+                memory_order_release, memory_order_relaxed)) {
+            return true ;
+        }
+    }
+    return false ;
+}
+
+// core-safe mutex
+typedef struct {
+    atomic_flag locked ;
+} pt_mutex_t ;
+
+static inline void pt_mutex_init(pt_mutex_t * m) {
+    atomic_flag_clear(&m->locked) ;
+}
+#define pt_mutex_try_enter(m) \
+    (!atomic_flag_test_and_set_explicit(&(m)->locked, memory_order_acquire))
+#define pt_mutex_exit(m) \
+    atomic_flag_clear_explicit(&(m)->locked, memory_order_release)
+
+// inter-core FIFO: one 8-deep single-producer/single-consumer ring
+// per direction, like the RP2040 SIO FIFOs
+#define PT_POSIX_FIFO_DEPTH 8
+typedef struct {
+    uint32_t data[PT_POSIX_FIFO_DEPTH] ;
+    // padded so the two cores do not share a cache line
+    _Alignas(64) atomic_uint head ;
+    _Alignas(64) atomic_uint tail ;
+} pt_posix_fifo_t ;
+// pt_posix_fifo[n] is read by core n
+static pt_posix_fifo_t pt_posix_fifo[2] ;
+
+#define pt_posix_fifo_out()  (&pt_posix_fifo[pt_posix_core ^ 1])
+#define pt_posix_fifo_in()   (&pt_posix_fifo[pt_posix_core])
+
+static inline bool pt_fifo_wready(void) {
+    pt_posix_fifo_t * f = pt_posix_fifo_out() ;
+    return (atomic_load_explicit(&f->head, memory_order_relaxed) -
+            atomic_load_explicit(&f->tail, memory_order_acquire)) < PT_POSIX_FIFO_DEPTH ;
+}
+
+static inline bool pt_fifo_rvalid(void) {
+    pt_posix_fifo_t * f = pt_posix_fifo_in() ;
+    return atomic_load_explicit(&f->head, memory_order_acquire) !=
+           atomic_load_explicit(&f->tail, memory_order_relaxed) ;
+}
+
+static inline void pt_fifo_push(uint32_t data) {
+    pt_posix_fifo_t * f = pt_posix_fifo_out() ;
+    while (!pt_fifo_wready()) ;
+    unsigned head = atomic_load_explicit(&f->head, memory_order_relaxed) ;
+    f->data[head % PT_POSIX_FIFO_DEPTH] = data ;
+    atomic_store_explicit(&f->head, head + 1, memory_order_release) ;
+}
+
+static inline uint32_t pt_fifo_pop(void) {
+    pt_posix_fifo_t * f = pt_posix_fifo_in() ;
+    while (!pt_fifo_rvalid()) ;
+    unsigned tail = atomic_load_explicit(&f->tail, memory_order_relaxed) ;
+    uint32_t data = f->data[tail % PT_POSIX_FIFO_DEPTH] ;
+    atomic_store_explicit(&f->tail, tail + 1, memory_order_release) ;
+    return data ;
+}
+
+static inline void pt_fifo_drain(void) {
+    while (pt_fifo_rvalid()) pt_fifo_pop() ;
+}
+
+// core 1 is a pthread; a second launch waits for the first to return
+static pthread_t pt_posix_core1 ;
+static bool pt_posix_core1_running = false ;
+
+static void * pt_posix_core1_entry(void * entry) {
+    pt_posix_core = 1 ;
+    ((void (*)(void))entry)() ;
+    return NULL ;
+}
+
+static inline void pt_launch_core1(void (*entry)(void)) {
+    if (pt_posix_core1_running) {
+        pthread_join(pt_posix_core1, NULL) ;
+    }
+    memset(pt_posix_fifo, 0, sizeof(pt_posix_fifo)) ;
+    pthread_create(&pt_posix_core1, NULL, pt_posix_core1_entry, (void *)entry) ;
+    pt_posix_core1_running = true ;
+}
+
+// wait for core 1's entry function to return (host only)
+static inline void pt_join_core1(void) {
+    if (pt_posix_core1_running) {
+        pthread_join(pt_posix_core1, NULL) ;
+        pt_posix_core1_running = false ;
+    }
+}
+
+// console on stdin/stdout
+static inline bool pt_uart_readable(void) {
+    struct pollfd p = { .fd = 0, .events = POLLIN } ;
+    return poll(&p, 1, 0) > 0 ;
+}
+#define pt_uart_writable()          (true)
+static inline char pt_uart_getc(void) {
+    char c = 0 ;
+    if (read(0, &c, 1) != 1) c = '\r' ;
+    // terminals send '\n', the serial threads expect '\r'
+    return (c == '\n') ? '\r' : c ;
+}
+#define pt_uart_putc(c)             do { putchar(c) ; fflush(stdout) ; } while(0)
+
+#endif // PT_PLATFORM_POSIX
+
+#endif // __PT_PLATFORM_H__
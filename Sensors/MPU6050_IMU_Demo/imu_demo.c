@@ -6,6 +6,11 @@
  * them, and plots them to the VGA display. The top plot
  * shows gyro measurements, bottom plot shows accelerometer
  * measurements.
+ *
+ * The PWM ISR no longer reads the IMU itself: it only starts a DMA
+ * burst read (pt_async_io.h) and returns. A protothread awaits the
+ * completion token, scales the measurements and fills the display
+ * buffers, so the 14-byte I2C transaction never stalls core 0.
  * 
  * HARDWARE CONNECTIONS
  *  - GPIO 16 ---> VGA Hsync
@@ -43,6 +48,7 @@
 #include "VGA/vga16_graphics_v3.h"
 #include "mpu6050.h"
 #include "pt_cornell_rp2040_v1_4.h"
+#include "pt_async_io.h"
 
 // We will start drawing at column 81
 #define LEFT_EDGE 81 
@@ -62,6 +68,13 @@
 // Arrays in which raw measurements will be stored
 fix15 acceleration[3], gyro[3];
 
+// Raw IMU registers, filled by DMA
+uint8_t imu_buffer[MPU6050_DATA_BYTES] ;
+// Completion token for the IMU read
+static struct pt_io_token imu_token ;
+// PWM periods on which the previous read was still in progress
+volatile uint32_t imu_missed = 0 ;
+
 // Arrays for circular display buffer
 fix15 ax[PLOT_WIDTH] ;
 fix15 ay[PLOT_WIDTH] ;
@@ -138,33 +151,60 @@ void on_pwm_wrap() {
     pwm_clear_irq(pwm_gpio_to_slice_num(5));
     gpio_put(14, !gpio_get(14)) ;
 
-    // Read the IMU
-    // NOTE! This is in 15.16 fixed point. Accel in g's, gyro in deg/s
-    // If you want these values in floating point, call fix2float15() on
-    // the raw measurements.
-    mpu6050_read_raw(acceleration, gyro);
-
-    // Increment drawspeed controller
-    throttle += 1 ;
-    // Maintain a circular buffer for display
-    if ((throttle >= threshold)) { 
-        // Zero drawspeed controller
-        throttle = 0 ;
+    // Start reading the IMU, unless the imu thread has not yet
+    // consumed the last sample. Returns right away, DMA does the rest.
+    if (imu_token.state == PT_IO_IDLE) {
+        pt_i2c_read_reg_async(I2C_CHAN, ADDRESS, MPU6050_DATA_REG,
+                              imu_buffer, MPU6050_DATA_BYTES, &imu_token) ;
+    }
+    else {
+        imu_missed += 1 ;
+    }
+}
 
-        // Replace oldest data in accel arrays with new sample
-        ax[head] = acceleration[0] ;
-        ay[head] = acceleration[1] ;
-        az[head] = acceleration[2] ;
+// Finishes the read started by the PWM ISR
+static PT_THREAD (protothread_imu(struct pt *pt))
+{
+    PT_BEGIN(pt) ;
 
-        // Replace oldest data in gyro arrays with new sample
-        gx[head] = gyro[0] ;
-        gy[head] = gyro[1] ;
-        gz[head] = gyro[2] ;
+    while(1) {
+        // Yields to the other threads while the I2C transfer runs
+        PT_AWAIT(pt, &imu_token) ;
+
+        if (imu_token.state == PT_IO_DONE) {
+            // NOTE! This is in 15.16 fixed point. Accel in g's, gyro in deg/s
+            // If you want these values in floating point, call fix2float15() on
+            // the raw measurements.
+            mpu6050_convert_raw(imu_buffer, acceleration, gyro) ;
+
+            // Increment drawspeed controller
+            throttle += 1 ;
+            // Maintain a circular buffer for display
+            if ((throttle >= threshold)) { 
+                // Zero drawspeed controller
+                throttle = 0 ;
+
+                // Replace oldest data in accel arrays with new sample
+                ax[head] = acceleration[0] ;
+                ay[head] = acceleration[1] ;
+                az[head] = acceleration[2] ;
+
+                // Replace oldest data in gyro arrays with new sample
+                gx[head] = gyro[0] ;
+                gy[head] = gyro[1] ;
+                gz[head] = gyro[2] ;
+
+                // Move the pointer to the oldest data
+                head = ((head+1) == PLOT_WIDTH) ? 0 : (head + 1) ;
 
-        // Move the pointer to the oldest data
-        head = ((head+1) == PLOT_WIDTH) ? 0 : (head + 1) ;
+            }
+        }
 
+        // Buffer is free, the ISR may start the next read
+        pt_io_release(&imu_token) ;
     }
+
+    PT_END(pt) ;
 }
 
 static PT_THREAD (protothread_draw(struct pt *pt))
@@ -270,6 +310,10 @@ int main() {
     mpu6050_reset();
     mpu6050_read_raw(acceleration, gyro);
 
+    // Async I/O: completion interrupts on core 0, two channels for the IMU
+    pt_io_init() ;
+    pt_io_token_init(&imu_token, 2) ;
+
     ////////////////////////////////////////////////////////////////////////
     ///////////////////////// PWM CONFIGURATION ////////////////////////////
     ////////////////////////////////////////////////////////////////////////
@@ -310,6 +354,7 @@ int main() {
     gpio_init(14) ;
     gpio_set_dir(14, GPIO_OUT) ;
     gpio_put(14, 0) ;
+    pt_add_thread(protothread_imu) ;
     pt_add_thread(protothread_serial) ;
     pt_schedule_start ;
 
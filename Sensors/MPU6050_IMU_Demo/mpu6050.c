@@ -69,4 +69,22 @@ void mpu6050_read_raw(fix15 accel[3], fix15 gyro[3]) {
         gyro[i] = multfix15(gyro[i], 500<<16) ; // deg/sec
     }
 }
-/////////////////////////////////////////////////////////////////
\ No newline at end of file
+/////////////////////////////////////////////////////////////////
+
+void mpu6050_convert_raw(uint8_t buffer[MPU6050_DATA_BYTES], fix15 accel[3], fix15 gyro[3]) {
+    // Scale a burst read that started at MPU6050_DATA_REG (e.g. one done
+    // with DMA): accel in bytes 0-5, temperature in 6-7, gyro in 8-13
+    int16_t temp_accel, temp_gyro ;
+
+    for (int i = 0; i < 3; i++) {
+        temp_accel = (buffer[i<<1] << 8 | buffer[(i<<1) + 1]);
+        accel[i] = temp_accel ;
+        accel[i] <<= 2 ; // convert to g's (fixed point)
+    }
+
+    for (int i = 0; i < 3; i++) {
+        temp_gyro = (buffer[(i<<1) + 8] << 8 | buffer[(i<<1) + 9]);
+        gyro[i] = temp_gyro ;
+        gyro[i] = multfix15(gyro[i], 500<<16) ; // deg/sec
+    }
+}
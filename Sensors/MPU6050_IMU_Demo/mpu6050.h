@@ -10,6 +10,10 @@
 #define SCL_PIN  9
 #define I2C_BAUD_RATE 400000
 
+// Burst read of accel (6), temperature (2) and gyro (6) registers
+#define MPU6050_DATA_REG 0x3B
+#define MPU6050_DATA_BYTES 14
+
 // Fixed point data type
 typedef signed int fix15 ;
 #define multfix15(a,b) ((fix15)(((( signed long long)(a))*(( signed long long)(b)))>>16)) 
@@ -29,4 +33,5 @@ typedef signed int fix15 ;
 
 // VGA primitives - usable in main
 void mpu6050_reset(void) ;
-void mpu6050_read_raw(fix15 accel[3], fix15 gyro[3]) ;
\ No newline at end of file
+void mpu6050_read_raw(fix15 accel[3], fix15 gyro[3]) ;
+void mpu6050_convert_raw(uint8_t buffer[MPU6050_DATA_BYTES], fix15 accel[3], fix15 gyro[3]) ;
\ No newline at end of file
@@ -0,0 +1,325 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Protothread-aware asynchronous I/O for I2C, SPI and the ADC
+ *
+ * The SDK calls i2c_read_timeout_us, spi_write16_blocking,
+ * dma_channel_wait_for_finish_blocking, etc. spin the CPU until the
+ * transfer is over, which stalls every other thread on that core (and,
+ * from an ISR, everything else). The functions here only set up DMA
+ * channels and return. Each transfer is tracked by a completion token:
+ *
+ *   PT_IO_IDLE  --start-->  PT_IO_BUSY  --DMA IRQ-->  PT_IO_DONE
+ *                                       --abort/timeout--> PT_IO_ERROR
+ *
+ * A thread waits for the token with PT_AWAIT(pt, &token), which yields
+ * until the transfer completes. Completion is signalled from the shared
+ * DMA_IRQ_1 handler below, so a transfer started in an ISR can be
+ * finished by a thread (see imu_demo.c).
+ *
+ * USAGE
+ *   static struct pt_io_token imu_token ;
+ *   pt_io_token_init(&imu_token, 2) ;          // claims 2 DMA channels
+ *   ...
+ *   pt_i2c_read_reg_async(i2c0, 0x68, 0x3B, buffer, 14, &imu_token) ;
+ *   PT_AWAIT(pt, &imu_token) ;
+ *   if (imu_token.state == PT_IO_DONE) { ... use buffer ... }
+ *   pt_io_release(&imu_token) ;
+ *
+ * Channel requirements per token:
+ *   I2C register read, I2C write, SPI full-duplex transfer:  2 channels
+ *   SPI write, ADC capture:                                 1 channel
+ *
+ * DMA_IRQ_1 is shared (irq_add_shared_handler), so other drivers can
+ * use it too. pt_io_init() must be called on the core that should take
+ * the completion interrupts.
+ */
+
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/i2c.h"
+#include "hardware/spi.h"
+#include "hardware/adc.h"
+#include "hardware/sync.h"
+
+//                          CONFIGURATION PARAMETERS
+//
+// Longest I2C read (in bytes) that one token can issue
+#ifndef PT_IO_I2C_MAX
+#define PT_IO_I2C_MAX           32
+#endif
+// I2C transfers that have not finished after this long are aborted
+#ifndef PT_IO_I2C_TIMEOUT_US
+#define PT_IO_I2C_TIMEOUT_US    2000
+#endif
+
+// Token states
+#define PT_IO_IDLE              0
+#define PT_IO_BUSY              1
+#define PT_IO_DONE              2
+#define PT_IO_ERROR             3
+
+// Token flags
+#define PT_IO_FLAG_ADC          0x01    // stop the ADC on completion
+#define PT_IO_FLAG_I2C_WRITE    0x02    // wait for the bus to go idle
+
+// I2C DATA_CMD command bits
+#define PT_IO_I2C_READ          0x100
+#define PT_IO_I2C_STOP          0x200
+#define PT_IO_I2C_RESTART       0x400
+
+
+//                               TOKEN STRUCTURE
+//
+struct pt_io_token {
+    volatile uint8_t state ;
+    uint8_t flags ;
+    // completion channel, and its partner (or -1)
+    int8_t chan ;
+    int8_t aux_chan ;
+    // I2C transfers are watched for aborts and timeouts
+    i2c_inst_t * i2c ;
+    uint64_t deadline ;
+    // I2C command words, must live as long as the transfer
+    uint32_t i2c_cmd[PT_IO_I2C_MAX + 1] ;
+} ;
+
+
+//                                   GLOBALS
+//
+// Token that owns each DMA channel's completion interrupt
+static struct pt_io_token * volatile pt_io_owner[NUM_DMA_CHANNELS] ;
+// Channels whose completion is reported through a token
+static volatile uint32_t pt_io_mask = 0 ;
+// Number of transfers that ended in an I2C abort or timeout
+volatile uint32_t pt_io_errors = 0 ;
+
+
+//                           COMPLETION INTERRUPT
+//
+static void pt_io_dma_handler() {
+    uint32_t status = dma_hw->ints1 & pt_io_mask ;
+    // clear only our channels, other shared handlers see the rest
+    dma_hw->ints1 = status ;
+    while (status) {
+        int chan = __builtin_ctz(status) ;
+        status &= status - 1 ;
+        struct pt_io_token * tok = pt_io_owner[chan] ;
+        if (tok == NULL || tok->state != PT_IO_BUSY) continue ;
+        if (tok->flags & PT_IO_FLAG_ADC) {
+            adc_run(false) ;
+        }
+        tok->state = PT_IO_DONE ;
+    }
+}
+
+// Hook the shared DMA_IRQ_1 handler on the calling core
+void pt_io_init() {
+    irq_add_shared_handler(DMA_IRQ_1, pt_io_dma_handler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY) ;
+    irq_set_enabled(DMA_IRQ_1, true) ;
+}
+
+// Claim the DMA channels a token needs (1 or 2)
+void pt_io_token_init(struct pt_io_token * tok, int channels) {
+    tok->state = PT_IO_IDLE ;
+    tok->flags = 0 ;
+    tok->i2c = NULL ;
+    tok->chan = dma_claim_unused_channel(true) ;
+    tok->aux_chan = (channels > 1) ? dma_claim_unused_channel(true) : -1 ;
+    pt_io_owner[tok->chan] = tok ;
+}
+
+
+//                              INTERNAL HELPERS
+//
+// Route the completion channel's interrupt to DMA_IRQ_1 and mark busy
+static inline void pt_io_arm(struct pt_io_token * tok, uint8_t flags) {
+    tok->flags = flags ;
+    tok->state = PT_IO_BUSY ;
+    pt_io_mask |= 1u << tok->chan ;
+    dma_hw->ints1 = 1u << tok->chan ;
+    hw_set_bits(&dma_hw->inte1, 1u << tok->chan) ;
+}
+
+// Stop both channels without raising a spurious completion
+static void pt_io_abort(struct pt_io_token * tok) {
+    uint32_t mask = 1u << tok->chan ;
+    hw_clear_bits(&dma_hw->inte1, mask) ;
+    dma_channel_abort(tok->chan) ;
+    if (tok->aux_chan >= 0) dma_channel_abort(tok->aux_chan) ;
+    dma_hw->ints1 = mask ;
+    hw_set_bits(&dma_hw->inte1, mask) ;
+}
+
+// Point an I2C block at a new target address
+static inline void pt_io_i2c_target(i2c_inst_t * i2c, uint8_t addr) {
+    i2c_get_hw(i2c)->enable = 0 ;
+    i2c_get_hw(i2c)->tar = addr ;
+    i2c_get_hw(i2c)->enable = 1 ;
+    // DREQ signalling for both directions
+    i2c_get_hw(i2c)->dma_cr = I2C_IC_DMA_CR_TDMAE_BITS | I2C_IC_DMA_CR_RDMAE_BITS ;
+}
+
+// Channel from memory to a peripheral register (or the reverse)
+static void pt_io_configure(int chan, enum dma_channel_transfer_size size, uint dreq,
+                            volatile void * write_addr, const volatile void * read_addr,
+                            bool read_incr, bool write_incr, uint count) {
+    dma_channel_config c = dma_channel_get_default_config(chan) ;
+    channel_config_set_transfer_data_size(&c, size) ;
+    channel_config_set_read_increment(&c, read_incr) ;
+    channel_config_set_write_increment(&c, write_incr) ;
+    channel_config_set_dreq(&c, dreq) ;
+    dma_channel_configure(chan, &c, write_addr, read_addr, count, false) ;
+}
+
+
+//                              TRANSFER STARTERS
+//
+// All starters are safe to call from an ISR. They return false (and
+// start nothing) if the token is still busy.
+
+// Write reg, then read len bytes from an I2C device (repeated start)
+bool pt_i2c_read_reg_async(i2c_inst_t * i2c, uint8_t addr, uint8_t reg,
+                           uint8_t * dst, uint len, struct pt_io_token * tok) {
+    if (tok->state == PT_IO_BUSY || len == 0 || len > PT_IO_I2C_MAX) return false ;
+    // register address, then one read command per byte, STOP on the last
+    tok->i2c_cmd[0] = reg ;
+    for (uint i = 0; i < len; i++) {
+        tok->i2c_cmd[i+1] = PT_IO_I2C_READ ;
+    }
+    tok->i2c_cmd[1] |= PT_IO_I2C_RESTART ;
+    tok->i2c_cmd[len] |= PT_IO_I2C_STOP ;
+    tok->i2c = i2c ;
+    tok->deadline = time_us_64() + PT_IO_I2C_TIMEOUT_US ;
+    pt_io_i2c_target(i2c, addr) ;
+    // receive channel finishes the transfer
+    pt_io_configure(tok->chan, DMA_SIZE_8, i2c_get_dreq(i2c, false),
+                    dst, &i2c_get_hw(i2c)->data_cmd, false, true, len) ;
+    pt_io_configure(tok->aux_chan, DMA_SIZE_32, i2c_get_dreq(i2c, true),
+                    &i2c_get_hw(i2c)->data_cmd, tok->i2c_cmd, true, false, len + 1) ;
+    pt_io_arm(tok, 0) ;
+    dma_start_channel_mask((1u << tok->chan) | (1u << tok->aux_chan)) ;
+    return true ;
+}
+
+// Write len bytes to an I2C device (e.g. register, value)
+bool pt_i2c_write_async(i2c_inst_t * i2c, uint8_t addr, const uint8_t * src,
+                        uint len, struct pt_io_token * tok) {
+    if (tok->state == PT_IO_BUSY || len == 0 || len > PT_IO_I2C_MAX + 1) return false ;
+    for (uint i = 0; i < len; i++) {
+        tok->i2c_cmd[i] = src[i] ;
+    }
+    tok->i2c_cmd[len-1] |= PT_IO_I2C_STOP ;
+    tok->i2c = i2c ;
+    tok->deadline = time_us_64() + PT_IO_I2C_TIMEOUT_US ;
+    pt_io_i2c_target(i2c, addr) ;
+    pt_io_configure(tok->chan, DMA_SIZE_32, i2c_get_dreq(i2c, true),
+                    &i2c_get_hw(i2c)->data_cmd, tok->i2c_cmd, true, false, len) ;
+    // DMA finishes when the last byte is queued, the token completes
+    // once the bus goes idle (checked in pt_io_complete)
+    pt_io_arm(tok, PT_IO_FLAG_I2C_WRITE) ;
+    dma_channel_start(tok->chan) ;
+    return true ;
+}
+
+// Write len 16-bit words to SPI (e.g. DAC). Completes when the last
+// word is in the TX FIFO, up to 8 words may still be shifting out.
+bool pt_spi_write16_async(spi_inst_t * spi, const uint16_t * src, uint len,
+                          struct pt_io_token * tok) {
+    if (tok->state == PT_IO_BUSY) return false ;
+    tok->i2c = NULL ;
+    pt_io_configure(tok->chan, DMA_SIZE_16, spi_get_dreq(spi, true),
+                    &spi_get_hw(spi)->dr, src, true, false, len) ;
+    pt_io_arm(tok, 0) ;
+    dma_channel_start(tok->chan) ;
+    return true ;
+}
+
+// Full-duplex 8-bit SPI transfer. Completes when the last byte is
+// received, so the bus is idle when the token is done.
+bool pt_spi_transfer_async(spi_inst_t * spi, const uint8_t * src, uint8_t * dst,
+                           uint len, struct pt_io_token * tok) {
+    if (tok->state == PT_IO_BUSY) return false ;
+    tok->i2c = NULL ;
+    pt_io_configure(tok->chan, DMA_SIZE_8, spi_get_dreq(spi, false),
+                    dst, &spi_get_hw(spi)->dr, false, true, len) ;
+    pt_io_configure(tok->aux_chan, DMA_SIZE_8, spi_get_dreq(spi, true),
+                    &spi_get_hw(spi)->dr, src, true, false, len) ;
+    pt_io_arm(tok, 0) ;
+    dma_start_channel_mask((1u << tok->chan) | (1u << tok->aux_chan)) ;
+    return true ;
+}
+
+// Capture count ADC samples. The ADC must already be set up with
+// adc_fifo_setup(true, true, 1, false, byte_shift) and a clock divider;
+// byte_shift selects 8-bit (dst is uint8_t) or 16-bit samples.
+bool pt_adc_capture_async(void * dst, uint count, bool byte_shift,
+                          struct pt_io_token * tok) {
+    if (tok->state == PT_IO_BUSY) return false ;
+    tok->i2c = NULL ;
+    adc_run(false) ;
+    adc_fifo_drain() ;
+    pt_io_configure(tok->chan, byte_shift ? DMA_SIZE_8 : DMA_SIZE_16, DREQ_ADC,
+                    dst, &adc_hw->fifo, false, true, count) ;
+    pt_io_arm(tok, PT_IO_FLAG_ADC) ;
+    dma_channel_start(tok->chan) ;
+    adc_run(true) ;
+    return true ;
+}
+
+
+//                              COMPLETION CHECKS
+//
+// True once the transfer is over (DONE or ERROR). An IDLE token is not
+// complete, so a thread can await a transfer an ISR has yet to start.
+// Also detects I2C NACKs and timeouts, which never finish the DMA.
+static bool pt_io_complete(struct pt_io_token * tok) {
+    if (tok->state == PT_IO_BUSY) {
+        if (tok->i2c == NULL) return false ;
+        i2c_hw_t * hw = i2c_get_hw(tok->i2c) ;
+        bool aborted = hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS ;
+        if (!aborted && time_us_64() < tok->deadline) return false ;
+        // NACK (no device) or stuck bus: kill the transfer
+        uint32_t irq_status = save_and_disable_interrupts() ;
+        if (tok->state == PT_IO_BUSY) {
+            pt_io_abort(tok) ;
+            (void) hw->clr_tx_abrt ;
+            tok->state = PT_IO_ERROR ;
+            pt_io_errors++ ;
+        }
+        restore_interrupts(irq_status) ;
+        return true ;
+    }
+    // writes are over when the bus is, not when the DMA is
+    if (tok->state == PT_IO_DONE && (tok->flags & PT_IO_FLAG_I2C_WRITE)) {
+        i2c_hw_t * hw = i2c_get_hw(tok->i2c) ;
+        if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+            (void) hw->clr_tx_abrt ;
+            tok->state = PT_IO_ERROR ;
+            pt_io_errors++ ;
+            return true ;
+        }
+        if (!(hw->status & I2C_IC_STATUS_TFE_BITS) ||
+            (hw->status & I2C_IC_STATUS_MST_ACTIVITY_BITS)) {
+            return false ;
+        }
+    }
+    return tok->state != PT_IO_IDLE ;
+}
+
+// Hand the token (and its buffer) back, so an ISR may start the next
+// transfer on it
+static inline void pt_io_release(struct pt_io_token * tok) {
+    tok->state = PT_IO_IDLE ;
+}
+
+
+//                              PROTOTHREAD MACROS
+//
+// Yield until the token's transfer is DONE (or ERROR)
+#define PT_AWAIT(pt, tok) PT_YIELD_UNTIL(pt, pt_io_complete(tok))
+
+// Start a transfer, yielding first if the token is still busy
+#define PT_IO_START(pt, start_call) PT_YIELD_UNTIL(pt, (start_call))
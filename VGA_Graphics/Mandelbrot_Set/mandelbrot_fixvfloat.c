@@ -7,6 +7,10 @@
  * Core 1 draws the bottom half of the set using floating point.
  * Core 0 draws the top half of the set using fixed point.
  * This illustrates the speed improvement of fixed point over floating point.
+ *
+ * With PARALLEL_MANDELBROT set, both cores instead render the whole set
+ * in fixed point. Rows are handed out in chunks by parallel_for.h, so
+ * the core that draws the cheap rows simply draws more of them.
  * 
  * https://vanhunteradams.com/FixedPoint/FixedPoint.html
  * https://vanhunteradams.com/Pico/VGA/VGA.html
@@ -34,6 +38,7 @@
 #include "hardware/pio.h"
 #include "hardware/dma.h"
 #include "hardware/clocks.h"
+#include "parallel_for.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////// Stuff for Mandelbrot ///////////////////////////////////////////////////////////////
@@ -52,6 +57,60 @@ typedef signed int fix28 ;
 // Maximum number of iterations
 #define max_count 1000
 
+// 1: both cores share the fixed point render (parallel_for.h)
+// 0: core 0 fixed point, core 1 floating point
+#define PARALLEL_MANDELBROT 0
+
+#if PARALLEL_MANDELBROT
+// Rows per chunk
+#define ROWS_PER_CHUNK 4
+
+// Coordinates of each column and row
+fix28 x_fix[640] ;
+fix28 y_fix[480] ;
+
+// Render rows [begin, end). Runs on either core, a row at a time,
+// so the two cores never write the same framebuffer byte.
+void mandelbrot_rows(int begin, int end, void * arg) {
+    fix28 Zre, Zim, Cre, Cim ;
+    fix28 Zre_sq, Zim_sq ;
+    int i, j, count ;
+
+    for (j=begin; j<end; j++) {
+
+        for (i=0; i<640; i++) {
+
+            Zre = Zre_sq = Zim = Zim_sq = 0 ;
+
+            Cre = x_fix[i] ;
+            Cim = y_fix[j] ;
+
+            count = 0 ;
+
+            // Mandelbrot iteration
+            while (count++ < max_count) {
+                Zim = (multfix28(Zre, Zim)<<1) + Cim ;
+                Zre = Zre_sq - Zim_sq + Cre ;
+                Zre_sq = multfix28(Zre, Zre) ;
+                Zim_sq = multfix28(Zim, Zim) ;
+
+                if ((Zre_sq + Zim_sq) >= FOURfix28) break ;
+            }
+
+            // Draw the pixel
+            if (count >= max_count) drawPixel(i, j, BLACK) ;
+            else if (count >= (max_count>>1)) drawPixel(i, j, WHITE) ;
+            else if (count >= (max_count>>2)) drawPixel(i, j, CYAN) ;
+            else if (count >= (max_count>>3)) drawPixel(i, j, BLUE) ;
+            else if (count >= (max_count>>4)) drawPixel(i, j, RED) ;
+            else if (count >= (max_count>>5)) drawPixel(i, j, YELLOW) ;
+            else if (count >= (max_count>>6)) drawPixel(i, j, MAGENTA) ;
+            else drawPixel(i, j, RED) ;
+        }
+    }
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Core 1 entry point
 void core1_entry() {
@@ -135,6 +194,34 @@ int main() {
     // Initialize VGA
     initVGA() ;
 
+#if PARALLEL_MANDELBROT
+    // Core 1 helps with every parallel_for issued by core 0
+    parallel_init() ;
+    multicore_launch_core1(parallel_worker_loop) ;
+
+    uint32_t parallel_begin ;
+    float parallel_time ;
+    while (true) {
+
+        // x values
+        for (int i=0; i<640; i++) {
+            x_fix[i] = float2fix28(-2.0f + 3.0f * (float)i/640.0f) ;
+        }
+
+        // y values
+        for (int j=0; j<480; j++) {
+            y_fix[j] = float2fix28( 1.0f - 2.0f * (float)j/480.0f) ;
+        }
+
+        parallel_begin = time_us_32() ;
+        parallel_for(0, 480, ROWS_PER_CHUNK, mandelbrot_rows, NULL) ;
+        parallel_time = (float)(time_us_32() - parallel_begin)*(1./1000000.) ;
+
+        printf("\nTotal time, both cores: %3.6f seconds \n", parallel_time) ;
+        printf("Chunks: core 0 %d, core 1 %d\n",
+            (int)parallel_chunks[0], (int)parallel_chunks[1]) ;
+    }
+#else
     // Launch core 1
     multicore_launch_core1(core1_entry) ;
 
@@ -218,4 +305,5 @@ int main() {
         printf("\nTotal time core 1: %3.6f seconds \n", total_time_core_1) ;
         // printf("Total iterations: %d", total_count) ;
     }
+#endif
 }
@@ -0,0 +1,160 @@
+/**
+ * V. Hunter Adams (vha3@cornell.edu)
+ *
+ * Dual-core parallel-for (fork/join) for the RP2040/RP2350
+ *
+ * Splits a loop over [first, last) into chunks of `chunk` iterations
+ * and lets BOTH cores pull chunks from a shared index until the range is
+ * exhausted. A core that draws cheap chunks simply takes more of them,
+ * so unbalanced loops (Mandelbrot rows, particles near each other, FFT
+ * bins with different work) still finish together. The caller returns
+ * (or its protothread resumes) once every chunk has completed.
+ *
+ * The chunk function is called as fn(begin, end, arg) for a sub-range,
+ * on either core, possibly concurrently with itself: it must only touch
+ * data belonging to its own sub-range (e.g. whole framebuffer rows, not
+ * neighbouring pixels, since two pixels share a byte).
+ *
+ * The shared index is claimed with a hardware spinlock. The M0+ has no
+ * atomic read-modify-write, the spinlock is the RP2040's single-cycle
+ * atomic primitive. It is held for a handful of instructions per chunk,
+ * never while a chunk runs.
+ *
+ * USAGE (plain loops)
+ *   parallel_init() ;                          // before launching core 1
+ *   multicore_launch_core1(parallel_worker_loop) ;
+ *   parallel_for(0, 480, 4, draw_rows, NULL) ; // from core 0
+ *
+ * USAGE (protothreads, include pt_cornell_rp2040_v1_4.h first)
+ *   core 1:   pt_add_thread(protothread_parallel_worker) ;
+ *   core 0:   PT_PARALLEL_FOR(pt, 0, NUM_BOIDS, 8, update_boids, NULL) ;
+ *   The calling thread takes chunks too, then YIELDS (rather than spins)
+ *   until core 1 finishes the chunks it is holding.
+ *
+ * One parallel-for runs at a time. A second caller waits (yields) until
+ * the first one has joined.
+ */
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+// Chunk function: process iterations [begin, end)
+typedef void (*parallel_chunk_fn)(int begin, int end, void * arg) ;
+
+// The job both cores are working on
+struct parallel_job {
+    parallel_chunk_fn fn ;
+    void * arg ;
+    int next ;              // first unclaimed iteration
+    int last ;              // one past the final iteration
+    int chunk ;             // iterations per claim
+    int remaining ;         // iterations not yet completed
+} ;
+
+static struct parallel_job parallel_job ;
+// True while a job is in flight
+static volatile bool parallel_busy = false ;
+static spin_lock_t * parallel_lock ;
+// Chunks executed by each core in the last job (load-balance check)
+volatile uint32_t parallel_chunks[2] ;
+
+// Claim the spinlock (call once, before starting core 1)
+void parallel_init() {
+    parallel_lock = spin_lock_instance(spin_lock_claim_unused(true)) ;
+}
+
+// Publish a job. Returns false if another job is still in flight.
+bool parallel_fork(int first, int last, int chunk, parallel_chunk_fn fn, void * arg) {
+    uint32_t irq_status = spin_lock_blocking(parallel_lock) ;
+    if (parallel_busy) {
+        spin_unlock(parallel_lock, irq_status) ;
+        return false ;
+    }
+    parallel_job.fn = fn ;
+    parallel_job.arg = arg ;
+    parallel_job.next = first ;
+    parallel_job.last = last ;
+    parallel_job.chunk = (chunk > 0) ? chunk : 1 ;
+    parallel_job.remaining = (last > first) ? (last - first) : 0 ;
+    parallel_chunks[0] = parallel_chunks[1] = 0 ;
+    parallel_busy = (parallel_job.remaining > 0) ;
+    spin_unlock(parallel_lock, irq_status) ;
+    return true ;
+}
+
+// Claim and run one chunk of the current job on the calling core.
+// Returns false if there was nothing left to claim.
+bool parallel_run_chunk() {
+    int begin, end ;
+    parallel_chunk_fn fn ;
+    void * arg ;
+    uint32_t irq_status = spin_lock_blocking(parallel_lock) ;
+    if (!parallel_busy || parallel_job.next >= parallel_job.last) {
+        spin_unlock(parallel_lock, irq_status) ;
+        return false ;
+    }
+    begin = parallel_job.next ;
+    end = begin + parallel_job.chunk ;
+    if (end > parallel_job.last) end = parallel_job.last ;
+    parallel_job.next = end ;
+    fn = parallel_job.fn ;
+    arg = parallel_job.arg ;
+    spin_unlock(parallel_lock, irq_status) ;
+
+    // the actual work, with no lock held
+    fn(begin, end, arg) ;
+
+    // the job ends (and may be replaced) once remaining hits zero
+    irq_status = spin_lock_blocking(parallel_lock) ;
+    parallel_chunks[get_core_num()]++ ;
+    parallel_job.remaining -= (end - begin) ;
+    if (parallel_job.remaining == 0) parallel_busy = false ;
+    spin_unlock(parallel_lock, irq_status) ;
+    return true ;
+}
+
+// Unclaimed work exists (worker wake-up condition)
+static inline bool parallel_work_available() {
+    return parallel_busy && (parallel_job.next < parallel_job.last) ;
+}
+
+// Every chunk of the last job has completed
+static inline bool parallel_joined() {
+    return !parallel_busy ;
+}
+
+// Blocking parallel-for, for code that does not use protothreads
+void parallel_for(int first, int last, int chunk, parallel_chunk_fn fn, void * arg) {
+    while (!parallel_fork(first, last, chunk, fn, arg)) ;
+    while (parallel_run_chunk()) ;
+    // the other core may still be finishing its final chunk
+    while (!parallel_joined()) tight_loop_contents() ;
+}
+
+// Core 1 entry point for code that does not use protothreads
+void parallel_worker_loop() {
+    while (true) {
+        if (!parallel_run_chunk()) tight_loop_contents() ;
+    }
+}
+
+#ifdef __PT_H__
+// Worker thread: add it to the scheduler of the core that should help
+static PT_THREAD (protothread_parallel_worker(struct pt *pt))
+{
+    PT_BEGIN(pt) ;
+    while(1) {
+        PT_YIELD_UNTIL(pt, parallel_work_available()) ;
+        // drain the job, then let the other threads on this core run
+        while (parallel_run_chunk()) ;
+    }
+    PT_END(pt) ;
+}
+
+// Fork, help, and yield until joined
+#define PT_PARALLEL_FOR(pt, first, last, chunk, fn, arg) do { \
+    PT_YIELD_UNTIL(pt, parallel_fork((first), (last), (chunk), (fn), (arg))) ; \
+    while (parallel_run_chunk()) ; \
+    PT_YIELD_UNTIL(pt, parallel_joined()) ; \
+} while(0)
+#endif